@@ -4,15 +4,29 @@
 */
 
 #include "buffer.hpp"
+#include "memstats.hpp"
 #include <assert.h>
+#include <algorithm>
 #include <cstring>
 #include <sys/uio.h>
 #include <unistd.h>
 
+Buffer::Buffer(int bufferSize) : buffer(bufferSize), initSize(bufferSize), readPos(0), writePos(0)
+{
+    MemStats::Add(MemStats::BUFFERS, buffer.capacity());
+}
+
+Buffer::~Buffer()
+{
+    MemStats::Add(MemStats::BUFFERS, -static_cast<int64_t>(buffer.capacity()));
+}
+
 void Buffer::MakeSpace(std::size_t len)
 {
     if(WritableBytes() + PreinsertableBytes() < len){
+        std::size_t before = buffer.capacity();
         buffer.resize(writePos + len + 1);
+        MemStats::Add(MemStats::BUFFERS, static_cast<int64_t>(buffer.capacity()) - static_cast<int64_t>(before));
     } else {
         auto readableBytes = ReadableBytes();
         std::copy(buffer.begin() + readPos, buffer.begin() + writePos, buffer.begin());
@@ -36,6 +50,11 @@ std::size_t Buffer::PreinsertableBytes() const
     return readPos;
 }
 
+std::size_t Buffer::Capacity() const
+{
+    return buffer.capacity();
+}
+
 const char* Buffer::ReadPosition() const
 {
     return buffer.data() + readPos;
@@ -71,7 +90,7 @@ void Buffer::HasWritten(std::size_t len)
 
 void Buffer::Retrieve(std::size_t len)
 {
-    assert(ReadableBytes() <= len);
+    assert(len <= ReadableBytes());
     readPos += len;
 }
 
@@ -83,18 +102,30 @@ void Buffer::RetrieveUntil(const char* end)
 
 void Buffer::RetrieveAll()
 {
-    memset(buffer.data(), 0, buffer.size());
     readPos = 0;
     writePos = 0;
 }
 
 std::string Buffer::RetrieveAllToStr()
 {
-    std::string str(ReadPosition(), WritableBytes());
+    std::string str(ReadPosition(), ReadableBytes());
     RetrieveAll();
     return str;
 }
 
+bool Buffer::Shrink(std::size_t limit)
+{
+    std::size_t readable = ReadableBytes();
+    if(buffer.capacity() <= std::max(limit, initSize) || readable > initSize) return false;
+    std::vector<char> smaller(initSize);
+    std::copy(buffer.begin() + readPos, buffer.begin() + writePos, smaller.begin());
+    MemStats::Add(MemStats::BUFFERS, static_cast<int64_t>(smaller.capacity()) - static_cast<int64_t>(buffer.capacity()));
+    buffer.swap(smaller);
+    readPos = 0;
+    writePos = readable;
+    return true;
+}
+
 void Buffer::Append(const char* str, size_t len)
 {
     assert(str);
@@ -125,7 +156,7 @@ ssize_t Buffer::ReadFromFd(int fd, int* errno_)
     auto writableBytes = WritableBytes();
 
     // prepare a temp buffer for data that can't be read into inner buffer directly.
-    iov[0].iov_base = buffer.data();
+    iov[0].iov_base = WritePosition();
     iov[0].iov_len = writableBytes;
     iov[1].iov_base = buffer_;
     iov[1].iov_len = sizeof(buffer_);
@@ -12,7 +12,8 @@
 
 class Buffer {
 private:
-    std::vector<char> buffer;
+    std::vector<char> buffer; // capacity is counted in MemStats::BUFFERS
+    std::size_t initSize; // Shrink goes back to this
     std::atomic<std::size_t> readPos; // point to read position(all read before)
     std::atomic<std::size_t> writePos; // point to write position(all written before)
 
@@ -24,21 +25,26 @@ private:
     void MakeSpace(std::size_t len);
 
 public:
-    Buffer(int bufferSize = 1024) : buffer(bufferSize), readPos(0), writePos(0) {};
-    ~Buffer() = default;
+    Buffer(int bufferSize = 1024);
+    ~Buffer();
 
     std::size_t WritableBytes() const;
     std::size_t ReadableBytes() const;
     std::size_t PreinsertableBytes() const;
+    std::size_t Capacity() const;
 
     const char* ReadPosition() const; // position for read pointer
     const char* WritePositionConst() const; // position for write pointer
 
     void Retrieve(std::size_t len); // get readable data
     void RetrieveUntil(const char* end);
-    void RetrieveAll();
+    void RetrieveAll(); // O(1), the old bytes stay behind unread
     std::string RetrieveAllToStr();
 
+    // grown over limit bytes, go back to the size it was made with once what is readable fits in that.
+    // one big request or response doesn't keep its memory for the life of the conn then
+    bool Shrink(std::size_t limit);
+
     void Append(const char* str, size_t len); // write new data
     void Append(const std::string& str);
     void Append(const void* data, size_t len);
@@ -0,0 +1,33 @@
+/*
+ * @author: Zimo Li
+ * @date: 2026-10-19
+*/
+
+#include "memstats.hpp"
+using namespace std;
+
+MemStats::Counter MemStats::counters_[KINDS];
+atomic<bool> MemStats::pressure_(false);
+
+int64_t MemStats::Get(Kind kind)
+{
+    return counters_[kind].bytes.load(memory_order_relaxed);
+}
+
+int64_t MemStats::Total()
+{
+    int64_t total = 0;
+    for(int i = 0; i < KINDS; i++) total += Get(static_cast<Kind>(i));
+    return total;
+}
+
+const char* MemStats::Name(Kind kind)
+{
+    static const char* NAMES[KINDS] = {"buffers", "image cache"};
+    return NAMES[kind];
+}
+
+void MemStats::SetPressure(bool on)
+{
+    pressure_.store(on, memory_order_relaxed);
+}
@@ -0,0 +1,37 @@
+/*
+ * @author: Zimo Li
+ * @date: 2026-10-19
+*/
+
+#ifndef MEMSTATS_HPP
+#define MEMSTATS_HPP
+
+#include <atomic>
+#include <cstdint>
+
+// bytes held by the parts of the server that grow with load, counted where they take and give back
+// memory. WebServer compares the total against its budget and sets pressure, then caches shed entries
+// and conns cut their buffers back as soon as they go idle
+class MemStats {
+public:
+    enum Kind { BUFFERS, IMAGE_CACHE, KINDS };
+
+private:
+    struct alignas(64) Counter {
+        std::atomic<int64_t> bytes{0};
+    };
+
+    static Counter counters_[KINDS];
+    static std::atomic<bool> pressure_;
+
+public:
+    static void Add(Kind kind, int64_t bytes) { counters_[kind].bytes.fetch_add(bytes, std::memory_order_relaxed); }
+    static int64_t Get(Kind kind);
+    static int64_t Total();
+    static const char* Name(Kind kind);
+
+    static bool UnderPressure() { return pressure_.load(std::memory_order_relaxed); }
+    static void SetPressure(bool on);
+};
+
+#endif // MEMSTATS_HPP
@@ -0,0 +1,171 @@
+/*
+ * @author: Zimo Li
+ * @date: 2026-10-19
+*/
+
+#include "scheduler.hpp"
+#include <cassert>
+#include <cerrno>
+#include <climits>
+#include <memory>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include "../log/log.hpp"
+using namespace std;
+
+thread_local CoScheduler* CoScheduler::current_ = nullptr;
+const int CoScheduler::SLEEP_ID_MIN = INT_MAX / 2;
+
+CoScheduler::CoScheduler() : epoller_(256), wakeFd_(-1), stopping_(false), nextSleepId_(INT_MAX)
+{
+}
+
+CoScheduler::~CoScheduler()
+{
+    Stop();
+    if(wakeFd_ >= 0) close(wakeFd_);
+}
+
+bool CoScheduler::Start()
+{
+    if(thread_.joinable()) return true;
+    wakeFd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(wakeFd_ < 0 || !epoller_.AddFd(wakeFd_, EPOLLIN)) {
+        LOG_ERROR("coroutine scheduler can't set up wakeup fd, errno %d", errno);
+        return false;
+    }
+    stopping_ = false;
+    thread_ = thread(&CoScheduler::Loop, this);
+    return true;
+}
+
+void CoScheduler::Stop()
+{
+    if(!thread_.joinable()) return;
+    assert(current_ != this); // would join itself
+    stopping_ = true;
+    Post(std::bind(&CoScheduler::Cancel, this));
+    thread_.join();
+}
+
+void CoScheduler::Post(function<void()> fn)
+{
+    {
+        lock_guard<mutex> locker(mtx_);
+        posted_.push_back(std::move(fn));
+    }
+    uint64_t one = 1;
+    ssize_t ret = write(wakeFd_, &one, sizeof(one));
+    (void)ret; // counter can only overflow after 2^64 posts, a failed write means it is already set
+}
+
+void CoScheduler::Spawn(Task<void> task)
+{
+    // std::function needs a copyable target, the task itself is move-only
+    auto holder = make_shared<Task<void>>(std::move(task));
+    Post([holder]() { Detach(std::move(*holder)); });
+}
+
+CoScheduler::FdAwaiter CoScheduler::WaitFd(int fd, uint32_t events, int timeoutMS)
+{
+    return FdAwaiter(this, fd, events, timeoutMS);
+}
+
+CoScheduler::SleepAwaiter CoScheduler::SleepFor(int ms)
+{
+    return SleepAwaiter(this, ms);
+}
+
+CoScheduler* CoScheduler::Current()
+{
+    return current_;
+}
+
+void CoScheduler::Loop()
+{
+    current_ = this;
+    while(true) {
+        RunPosted();
+        if(stopping_ && fdWaiters_.empty() && sleepers_.empty()) {
+            lock_guard<mutex> locker(mtx_);
+            if(posted_.empty()) break;
+            continue;
+        }
+        int timeMS = timer_.GetNextTick(); // resumes expired sleepers and timed out waits
+        int eventCnt = epoller_.Wait(timeMS);
+        for(int i = 0; i < eventCnt; i++) {
+            int fd = epoller_.GetEventFd(i);
+            if(fd == wakeFd_) {
+                uint64_t count;
+                ssize_t ret = read(wakeFd_, &count, sizeof(count));
+                (void)ret;
+            } else {
+                Wake(fd, true);
+            }
+        }
+    }
+    current_ = nullptr;
+}
+
+void CoScheduler::RunPosted()
+{
+    vector<function<void()>> posted;
+    {
+        lock_guard<mutex> locker(mtx_);
+        posted.swap(posted_);
+    }
+    for(auto& fn : posted) fn();
+}
+
+bool CoScheduler::Watch(int fd, uint32_t events, int timeoutMS, coroutine_handle<> handle, bool* ready)
+{
+    assert(current_ == this);
+    *ready = false;
+    if(fdWaiters_.count(fd) > 0 || !epoller_.AddFd(fd, events)) {
+        LOG_WARN("coroutine can't wait on fd[%d], errno %d", fd, errno);
+        return false; // resume at once, caller sees a failed wait
+    }
+    fdWaiters_[fd] = { handle, ready };
+    if(timeoutMS >= 0) timer_.Add(fd, timeoutMS, [this, fd]() { Wake(fd, false); });
+    return true;
+}
+
+void CoScheduler::Wake(int fd, bool ready)
+{
+    auto it = fdWaiters_.find(fd);
+    if(it == fdWaiters_.end()) return;
+    Waiter waiter = it->second;
+    fdWaiters_.erase(it);
+    epoller_.DelFd(fd);
+    timer_.Remove(fd); // a no-op when the timer itself fired
+    *waiter.ready = ready;
+    waiter.handle.resume();
+}
+
+void CoScheduler::AddSleeper(int ms, coroutine_handle<> handle, bool* ready)
+{
+    assert(current_ == this);
+    int id = nextSleepId_;
+    nextSleepId_ = nextSleepId_ == SLEEP_ID_MIN ? INT_MAX : nextSleepId_ - 1;
+    *ready = false;
+    sleepers_[id] = { handle, ready };
+    timer_.Add(id, ms, [this, id]() {
+        Waiter waiter = sleepers_[id];
+        sleepers_.erase(id);
+        *waiter.ready = true;
+        waiter.handle.resume();
+    });
+}
+
+void CoScheduler::Cancel()
+{
+    // resumed coroutines find stopping_ set, so they don't wait again and run to their end
+    while(!fdWaiters_.empty()) Wake(fdWaiters_.begin()->first, false);
+    while(!sleepers_.empty()) {
+        auto it = sleepers_.begin();
+        Waiter waiter = it->second;
+        timer_.Remove(it->first);
+        sleepers_.erase(it);
+        waiter.handle.resume();
+    }
+}
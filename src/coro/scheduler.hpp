@@ -0,0 +1,101 @@
+/*
+ * @author: Zimo Li
+ * @date: 2026-10-19
+*/
+
+#ifndef SCHEDULER_HPP
+#define SCHEDULER_HPP
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <coroutine>
+#include "task.hpp"
+#include "../server/epoller.hpp"
+#include "../timer/heaptimer.hpp"
+
+// one thread with its own epoll and timer heap that drives coroutines. a coroutine waiting on
+// a socket or a timer costs its frame and a map entry, not a thread
+class CoScheduler {
+private:
+    struct Waiter {
+        std::coroutine_handle<> handle;
+        bool* ready; // false on timeout or cancel
+    };
+
+    Epoller epoller_;
+    HeapTimer timer_;
+    int wakeFd_; // eventfd, Post from other threads
+    std::thread thread_;
+    std::atomic<bool> stopping_;
+
+    std::mutex mtx_;
+    std::vector<std::function<void()>> posted_;
+
+    std::unordered_map<int, Waiter> fdWaiters_; // fd -> coroutine waiting on it, one per fd
+    std::unordered_map<int, Waiter> sleepers_; // timer id -> coroutine
+    int nextSleepId_; // counts down from INT_MAX, far above any fd so the two never clash in timer_
+    static const int SLEEP_ID_MIN;
+
+    static thread_local CoScheduler* current_;
+
+    void Loop();
+    void RunPosted();
+    bool Watch(int fd, uint32_t events, int timeoutMS, std::coroutine_handle<> handle, bool* ready);
+    void Wake(int fd, bool ready);
+    void AddSleeper(int ms, std::coroutine_handle<> handle, bool* ready);
+    void Cancel(); // resume every waiter with false, called on the loop thread
+
+public:
+    class FdAwaiter {
+    private:
+        CoScheduler* sched_;
+        int fd_;
+        uint32_t events_;
+        int timeoutMS_;
+        bool ready_;
+
+    public:
+        FdAwaiter(CoScheduler* sched, int fd, uint32_t events, int timeoutMS) :
+            sched_(sched), fd_(fd), events_(events), timeoutMS_(timeoutMS), ready_(false) {};
+        bool await_ready() const { return sched_->stopping_; }
+        bool await_suspend(std::coroutine_handle<> handle)
+        {
+            return sched_->Watch(fd_, events_, timeoutMS_, handle, &ready_);
+        }
+        bool await_resume() const { return ready_; }
+    };
+
+    class SleepAwaiter {
+    private:
+        CoScheduler* sched_;
+        int ms_;
+        bool ready_;
+
+    public:
+        SleepAwaiter(CoScheduler* sched, int ms) : sched_(sched), ms_(ms), ready_(false) {};
+        bool await_ready() const { return ms_ <= 0 || sched_->stopping_; }
+        void await_suspend(std::coroutine_handle<> handle) { sched_->AddSleeper(ms_, handle, &ready_); }
+        bool await_resume() const { return ready_ || ms_ <= 0; } // false if cut short by Stop
+    };
+
+    CoScheduler();
+    ~CoScheduler();
+
+    bool Start(); // false if the loop thread could not be set up
+    void Stop(); // waiters resume with false so their coroutines can unwind, then the thread is joined
+
+    void Post(std::function<void()> fn); // run on the loop thread, from any thread
+    void Spawn(Task<void> task); // start a detached coroutine on the loop thread, from any thread
+
+    // on the loop thread only. true once fd has one of events, false on timeout (-1 never) or Stop
+    FdAwaiter WaitFd(int fd, uint32_t events, int timeoutMS = -1);
+    SleepAwaiter SleepFor(int ms);
+
+    static CoScheduler* Current(); // scheduler whose loop runs this thread, nullptr elsewhere
+};
+
+#endif // SCHEDULER_HPP
@@ -0,0 +1,115 @@
+/*
+ * @author: Zimo Li
+ * @date: 2026-10-19
+*/
+
+#ifndef TASK_HPP
+#define TASK_HPP
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+
+// lazy coroutine, starts when awaited and resumes its awaiter when done (symmetric transfer,
+// so long chains of co_await don't grow the stack). exceptions are not used in this code base
+template<class T = void>
+class Task;
+
+namespace detail {
+
+struct PromiseBase {
+    std::coroutine_handle<> continuation; // awaiter to resume at the end, none for detached
+
+    struct FinalAwaiter {
+        bool await_ready() const noexcept { return false; }
+        template<class P>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<P> self) noexcept
+        {
+            auto next = self.promise().continuation;
+            return next ? next : std::noop_coroutine();
+        }
+        void await_resume() const noexcept {}
+    };
+
+    std::suspend_always initial_suspend() const noexcept { return {}; }
+    FinalAwaiter final_suspend() const noexcept { return {}; }
+    void unhandled_exception() const noexcept { std::terminate(); }
+};
+
+} // namespace detail
+
+template<class T>
+class Task {
+public:
+    struct promise_type : detail::PromiseBase {
+        std::optional<T> value;
+
+        Task get_return_object() { return Task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+        void return_value(T result) { value.emplace(std::move(result)); }
+    };
+
+private:
+    std::coroutine_handle<promise_type> handle_;
+
+    explicit Task(std::coroutine_handle<promise_type> handle) : handle_(handle) {};
+
+public:
+    Task(Task&& other) noexcept : handle_(std::exchange(other.handle_, nullptr)) {};
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+    ~Task() { if(handle_) handle_.destroy(); };
+
+    bool await_ready() const noexcept { return false; }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiter) noexcept
+    {
+        handle_.promise().continuation = awaiter;
+        return handle_;
+    }
+    T await_resume() { return std::move(*handle_.promise().value); }
+};
+
+template<>
+class Task<void> {
+public:
+    struct promise_type : detail::PromiseBase {
+        Task get_return_object() { return Task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+        void return_void() const noexcept {}
+    };
+
+private:
+    std::coroutine_handle<promise_type> handle_;
+
+    explicit Task(std::coroutine_handle<promise_type> handle) : handle_(handle) {};
+
+public:
+    Task(Task&& other) noexcept : handle_(std::exchange(other.handle_, nullptr)) {};
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+    ~Task() { if(handle_) handle_.destroy(); };
+
+    bool await_ready() const noexcept { return false; }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiter) noexcept
+    {
+        handle_.promise().continuation = awaiter;
+        return handle_;
+    }
+    void await_resume() const noexcept {}
+};
+
+// run task to completion with nobody awaiting it, its frame frees itself at the end
+inline void Detach(Task<void> task)
+{
+    struct Detached {
+        struct promise_type {
+            Detached get_return_object() const noexcept { return {}; }
+            std::suspend_never initial_suspend() const noexcept { return {}; }
+            std::suspend_never final_suspend() const noexcept { return {}; }
+            void return_void() const noexcept {}
+            void unhandled_exception() const noexcept { std::terminate(); }
+        };
+    };
+    [](Task<void> inner) -> Detached { co_await std::move(inner); }(std::move(task));
+}
+
+#endif // TASK_HPP
@@ -0,0 +1,282 @@
+/*
+ * @author: Zimo Li
+ * @date: 2026-10-19
+*/
+
+#include "assetbundle.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <unordered_set>
+#include <sys/mman.h>
+#include <sys/stat.h>
+using namespace std;
+
+namespace {
+
+const uint32_t MAX_SEED = 1 << 24; // bucket seeds are tried up to this, far above what is ever needed
+const size_t DATA_ALIGN = 64;
+
+size_t Align(size_t n, size_t to)
+{
+    return (n + to - 1) / to * to;
+}
+
+string Etag(const string& data, const char* suffix)
+{
+    uint64_t hash = 14695981039346656037ull;
+    for(unsigned char c : data) {
+        hash ^= c;
+        hash *= 1099511628211ull;
+    }
+    char buf[32];
+    snprintf(buf, sizeof(buf), "\"%016llx%s\"", (unsigned long long)hash, suffix);
+    return buf;
+}
+
+}
+
+AssetBundle::AssetBundle() : base_(nullptr), size_(0), header_(nullptr), disp_(nullptr), entries_(nullptr)
+{
+}
+
+AssetBundle::~AssetBundle()
+{
+    Close();
+}
+
+bool AssetBundle::Open(const string& file, bool populate, bool hugePages)
+{
+    Close();
+    int fd = open(file.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0) return false;
+    struct stat st;
+    if(fstat(fd, &st) < 0 || st.st_size < static_cast<off_t>(sizeof(BundleHeader))) {
+        close(fd);
+        return false;
+    }
+    void* ret = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED | (populate ? MAP_POPULATE : 0), fd, 0);
+    close(fd);
+    if(ret == MAP_FAILED) return false;
+    base_ = static_cast<char*>(ret);
+    size_ = st.st_size;
+    if(hugePages) madvise(base_, size_, MADV_HUGEPAGE);
+
+    header_ = reinterpret_cast<const BundleHeader*>(base_);
+    size_t indexEnd = sizeof(BundleHeader) + header_->buckets * sizeof(int32_t) +
+                      header_->count * sizeof(BundleEntry);
+    if(header_->magic != BUNDLE_MAGIC || header_->version != BUNDLE_VERSION || header_->buckets == 0 ||
+       indexEnd > size_) {
+        Close();
+        return false;
+    }
+    disp_ = reinterpret_cast<const int32_t*>(base_ + sizeof(BundleHeader));
+    entries_ = reinterpret_cast<const BundleEntry*>(disp_ + header_->buckets);
+    if(!Check()) {
+        Close();
+        return false;
+    }
+    return true;
+}
+
+bool AssetBundle::Check() const
+{
+    auto inside = [this](uint64_t off, uint64_t len) { return off <= size_ && len <= size_ - off; };
+    for(uint32_t i = 0; i < header_->count; i++) {
+        const BundleEntry& e = entries_[i];
+        if(!inside(e.path, e.pathLen) || !inside(e.type, e.typeLen) || !inside(e.etag, e.etagLen) ||
+           !inside(e.gzipEtag, e.gzipEtagLen) || !inside(e.data, e.dataLen) || !inside(e.gzip, e.gzipLen)) {
+            return false;
+        }
+    }
+    for(uint32_t i = 0; i < header_->buckets; i++) {
+        if(disp_[i] < 0 && static_cast<uint32_t>(-(disp_[i] + 1)) >= header_->count) return false;
+    }
+    return true;
+}
+
+void AssetBundle::Close()
+{
+    if(base_) munmap(base_, size_);
+    base_ = nullptr;
+    size_ = 0;
+    header_ = nullptr;
+    disp_ = nullptr;
+    entries_ = nullptr;
+}
+
+bool AssetBundle::IsOpen() const
+{
+    return base_ != nullptr;
+}
+
+size_t AssetBundle::Count() const
+{
+    return header_ ? header_->count : 0;
+}
+
+size_t AssetBundle::Size() const
+{
+    return size_;
+}
+
+bool AssetBundle::Find(string_view path, Asset& asset) const
+{
+    if(!header_ || header_->count == 0) return false;
+    int32_t d = disp_[Hash(path, 0) % header_->buckets];
+    uint32_t slot = d < 0 ? -(d + 1) : Hash(path, d) % header_->count;
+    const BundleEntry& e = entries_[slot];
+    // a path that is not in the bundle still lands on some slot
+    if(path != string_view(base_ + e.path, e.pathLen)) return false;
+    Get(slot, asset);
+    return true;
+}
+
+void AssetBundle::Get(size_t slot, Asset& asset) const
+{
+    const BundleEntry& e = entries_[slot];
+    asset.path = string_view(base_ + e.path, e.pathLen);
+    asset.type = string_view(base_ + e.type, e.typeLen);
+    asset.etag = string_view(base_ + e.etag, e.etagLen);
+    asset.gzipEtag = string_view(base_ + e.gzipEtag, e.gzipEtagLen);
+    asset.data = base_ + e.data;
+    asset.dataLen = e.dataLen;
+    asset.gzip = e.gzipLen > 0 ? base_ + e.gzip : nullptr;
+    asset.gzipLen = e.gzipLen;
+}
+
+bool AssetBundle::Write(const string& file, const vector<Input>& inputs)
+{
+    uint32_t count = inputs.size();
+    uint32_t buckets = count / 2 + 1;
+    unordered_set<string> seen;
+    for(auto& in : inputs) {
+        // a duplicate would never get a slot of its own
+        if(!seen.insert(in.path).second || in.path.size() > UINT16_MAX || in.type.size() > UINT8_MAX) return false;
+    }
+
+    // biggest buckets first, each one tries seeds until all its keys land on free slots,
+    // single key buckets take a free slot directly
+    vector<vector<uint32_t>> members(buckets);
+    for(uint32_t i = 0; i < count; i++) members[Hash(inputs[i].path, 0) % buckets].push_back(i);
+    vector<uint32_t> order(buckets);
+    for(uint32_t i = 0; i < buckets; i++) order[i] = i;
+    sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return members[a].size() > members[b].size(); });
+
+    vector<int32_t> disp(buckets, 0);
+    vector<int64_t> slotInput(count, -1);
+    uint32_t nextFree = 0;
+    for(uint32_t b : order) {
+        auto& keys = members[b];
+        if(keys.size() == 1) {
+            while(slotInput[nextFree] >= 0) nextFree++;
+            slotInput[nextFree] = keys[0];
+            disp[b] = -static_cast<int32_t>(nextFree) - 1;
+            continue;
+        }
+        if(keys.empty()) continue;
+        vector<uint32_t> slots(keys.size());
+        uint32_t seed = 1;
+        for(; seed < MAX_SEED; seed++) {
+            bool ok = true;
+            for(size_t k = 0; k < keys.size() && ok; k++) {
+                slots[k] = Hash(inputs[keys[k]].path, seed) % count;
+                ok = slotInput[slots[k]] < 0 && find(slots.begin(), slots.begin() + k, slots[k]) == slots.begin() + k;
+            }
+            if(ok) break;
+        }
+        if(seed == MAX_SEED) return false;
+        for(size_t k = 0; k < keys.size(); k++) slotInput[slots[k]] = keys[k];
+        disp[b] = seed;
+    }
+
+    // strings right behind the index, then the file data
+    vector<BundleEntry> entries(count);
+    string strings;
+    size_t stringsAt = sizeof(BundleHeader) + buckets * sizeof(int32_t) + count * sizeof(BundleEntry);
+    auto addString = [&](const string& s) {
+        uint64_t off = stringsAt + strings.size();
+        strings += s;
+        return off;
+    };
+    vector<string> etags(count), gzipEtags(count);
+    for(uint32_t slot = 0; slot < count; slot++) {
+        const Input& in = inputs[slotInput[slot]];
+        BundleEntry& e = entries[slot];
+        memset(&e, 0, sizeof(e));
+        etags[slot] = Etag(in.data, "");
+        gzipEtags[slot] = in.gzip.empty() ? "" : Etag(in.data, "-gz");
+        e.path = addString(in.path);
+        e.pathLen = in.path.size();
+        e.type = addString(in.type);
+        e.typeLen = in.type.size();
+        e.etag = addString(etags[slot]);
+        e.etagLen = etags[slot].size();
+        e.gzipEtag = addString(gzipEtags[slot]);
+        e.gzipEtagLen = gzipEtags[slot].size();
+    }
+    // each piece starts on a cache line, an empty one takes no room and has offset 0
+    size_t dataAt = stringsAt + strings.size();
+    auto place = [&](const string& part) {
+        if(part.empty()) return size_t(0);
+        size_t off = Align(dataAt, DATA_ALIGN);
+        dataAt = off + part.size();
+        return off;
+    };
+    for(uint32_t slot = 0; slot < count; slot++) {
+        const Input& in = inputs[slotInput[slot]];
+        entries[slot].data = place(in.data);
+        entries[slot].dataLen = in.data.size();
+        entries[slot].gzip = place(in.gzip);
+        entries[slot].gzipLen = in.gzip.size();
+    }
+
+    // written aside and renamed, a running server keeps its mapping of the old file
+    string tmp = file + ".tmp";
+    FILE* fp = fopen(tmp.c_str(), "wb");
+    if(!fp) return false;
+    BundleHeader header = {};
+    header.magic = BUNDLE_MAGIC;
+    header.version = BUNDLE_VERSION;
+    header.count = count;
+    header.buckets = buckets;
+    bool ok = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+              fwrite(disp.data(), sizeof(int32_t), buckets, fp) == buckets &&
+              fwrite(entries.data(), sizeof(BundleEntry), count, fp) == count &&
+              fwrite(strings.data(), 1, strings.size(), fp) == strings.size();
+    static const char zeros[DATA_ALIGN] = {0};
+    long pos = stringsAt + strings.size();
+    for(uint32_t slot = 0; slot < count && ok; slot++) {
+        const Input& in = inputs[slotInput[slot]];
+        for(const string* part : {&in.data, &in.gzip}) {
+            if(part->empty()) continue;
+            size_t pad = Align(pos, DATA_ALIGN) - pos;
+            ok = ok && fwrite(zeros, 1, pad, fp) == pad && fwrite(part->data(), 1, part->size(), fp) == part->size();
+            pos += pad + part->size();
+        }
+    }
+    ok = fclose(fp) == 0 && ok;
+    if(!ok || rename(tmp.c_str(), file.c_str()) < 0) {
+        remove(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+uint32_t AssetBundle::Hash(string_view key, uint32_t seed)
+{
+    // FNV-1a from a seeded state, then a murmur3 finalizer so seeds give independent slots
+    uint32_t hash = 2166136261u ^ (seed * 0x9e3779b9u);
+    for(unsigned char c : key) {
+        hash ^= c;
+        hash *= 16777619u;
+    }
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6bu;
+    hash ^= hash >> 13;
+    hash *= 0xc2b2ae35u;
+    hash ^= hash >> 16;
+    return hash;
+}
@@ -0,0 +1,100 @@
+/*
+ * @author: Zimo Li
+ * @date: 2026-10-19
+*/
+
+#ifndef ASSETBUNDLE_HPP
+#define ASSETBUNDLE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// file layout, little endian: BundleHeader, int32 displacement per bucket, one BundleEntry per
+// asset in hash slot order, then strings and file data. every offset is from the start of the file
+struct BundleHeader {
+    uint32_t magic; // BUNDLE_MAGIC
+    uint16_t version;
+    uint16_t reserved;
+    uint32_t count; // assets, also the number of slots
+    uint32_t buckets;
+};
+
+struct BundleEntry {
+    uint64_t path;
+    uint64_t type; // mime type, precomputed
+    uint64_t etag; // quoted, of the plain data
+    uint64_t gzipEtag; // quoted, of the gzip variant
+    uint64_t data;
+    uint64_t dataLen;
+    uint64_t gzip; // precompressed variant, gzipLen is 0 if there is none
+    uint64_t gzipLen;
+    uint16_t pathLen;
+    uint8_t typeLen;
+    uint8_t etagLen;
+    uint8_t gzipEtagLen;
+    uint8_t reserved[3];
+};
+
+static_assert(sizeof(BundleHeader) == 16 && sizeof(BundleEntry) == 72, "on disk layout");
+
+const uint32_t BUNDLE_MAGIC = 0x4c425357; // "WSBL"
+const uint16_t BUNDLE_VERSION = 1;
+
+// static files packed into one file (tools/bundle_pack) and mapped once, so serving one is a hash
+// lookup without any syscall. the index is a minimal perfect hash (hash and displace): the key
+// picks a bucket, the bucket's displacement picks the slot
+class AssetBundle {
+public:
+    struct Asset {
+        std::string_view path;
+        std::string_view type;
+        std::string_view etag;
+        std::string_view gzipEtag;
+        const char* data;
+        std::size_t dataLen;
+        const char* gzip; // nullptr if not worth compressing
+        std::size_t gzipLen;
+    };
+
+    struct Input {
+        std::string path; // as requested, "/index.html"
+        std::string type;
+        std::string data;
+        std::string gzip; // empty if there is no variant
+    };
+
+private:
+    char* base_; // the whole mapped file
+    std::size_t size_;
+    const BundleHeader* header_;
+    const int32_t* disp_;
+    const BundleEntry* entries_;
+
+    bool Check() const; // every entry points inside the file
+
+public:
+    AssetBundle();
+    ~AssetBundle();
+    AssetBundle(const AssetBundle&) = delete;
+    AssetBundle& operator=(const AssetBundle&) = delete;
+
+    // map file read only. populate faults every page in now instead of on first requests,
+    // hugePages asks for transparent huge pages (best effort, the fs may not support it)
+    bool Open(const std::string& file, bool populate = false, bool hugePages = false);
+    void Close();
+    bool IsOpen() const;
+    std::size_t Count() const;
+    std::size_t Size() const; // bytes mapped
+
+    bool Find(std::string_view path, Asset& asset) const;
+    void Get(std::size_t slot, Asset& asset) const; // slot < Count(), for listing
+
+    // build the index and write a bundle, false on io error
+    static bool Write(const std::string& file, const std::vector<Input>& inputs);
+    static uint32_t Hash(std::string_view key, uint32_t seed);
+};
+
+#endif // ASSETBUNDLE_HPP
@@ -0,0 +1,390 @@
+/*
+ * @author: Zimo Li
+ * @date: 2026-10-19
+*/
+
+#include "hpack.hpp"
+#include <algorithm>
+#include <cassert>
+using namespace std;
+
+const HpackTable::Field HpackTable::STATIC_TABLE[HpackTable::STATIC_SIZE] = {
+    { ":authority", "" },
+    { ":method", "GET" },
+    { ":method", "POST" },
+    { ":path", "/" },
+    { ":path", "/index.html" },
+    { ":scheme", "http" },
+    { ":scheme", "https" },
+    { ":status", "200" },
+    { ":status", "204" },
+    { ":status", "206" },
+    { ":status", "304" },
+    { ":status", "400" },
+    { ":status", "404" },
+    { ":status", "500" },
+    { "accept-charset", "" },
+    { "accept-encoding", "gzip, deflate" },
+    { "accept-language", "" },
+    { "accept-ranges", "" },
+    { "accept", "" },
+    { "access-control-allow-origin", "" },
+    { "age", "" },
+    { "allow", "" },
+    { "authorization", "" },
+    { "cache-control", "" },
+    { "content-disposition", "" },
+    { "content-encoding", "" },
+    { "content-language", "" },
+    { "content-length", "" },
+    { "content-location", "" },
+    { "content-range", "" },
+    { "content-type", "" },
+    { "cookie", "" },
+    { "date", "" },
+    { "etag", "" },
+    { "expect", "" },
+    { "expires", "" },
+    { "from", "" },
+    { "host", "" },
+    { "if-match", "" },
+    { "if-modified-since", "" },
+    { "if-none-match", "" },
+    { "if-range", "" },
+    { "if-unmodified-since", "" },
+    { "last-modified", "" },
+    { "link", "" },
+    { "location", "" },
+    { "max-forwards", "" },
+    { "proxy-authenticate", "" },
+    { "proxy-authorization", "" },
+    { "range", "" },
+    { "referer", "" },
+    { "refresh", "" },
+    { "retry-after", "" },
+    { "server", "" },
+    { "set-cookie", "" },
+    { "strict-transport-security", "" },
+    { "transfer-encoding", "" },
+    { "user-agent", "" },
+    { "vary", "" },
+    { "via", "" },
+    { "www-authenticate", "" },
+};
+
+const HpackTable::Field* HpackTable::Get(size_t index) const
+{
+    if(index == 0) return nullptr;
+    if(index <= STATIC_SIZE) return &STATIC_TABLE[index - 1];
+    index -= STATIC_SIZE + 1;
+    if(index < dynamic_.size()) return &dynamic_[index];
+    return nullptr;
+}
+
+void HpackTable::Evict(size_t need)
+{
+    while(!dynamic_.empty() && size_ + need > maxSize_) {
+        size_ -= dynamic_.back().first.size() + dynamic_.back().second.size() + ENTRY_OVERHEAD;
+        dynamic_.pop_back();
+    }
+}
+
+void HpackTable::Add(const string& name, const string& value)
+{
+    size_t entrySize = name.size() + value.size() + ENTRY_OVERHEAD;
+    if(entrySize > maxSize_) {
+        // an entry larger than the table empties it and is not inserted
+        dynamic_.clear();
+        size_ = 0;
+        return;
+    }
+    Evict(entrySize);
+    dynamic_.emplace_front(name, value);
+    size_ += entrySize;
+}
+
+void HpackTable::SetMaxSize(size_t maxSize)
+{
+    maxSize_ = maxSize;
+    Evict(0);
+}
+
+size_t HpackTable::MaxSize() const
+{
+    return maxSize_;
+}
+
+size_t HpackTable::Find(const string& name, const string& value, bool* nameOnly) const
+{
+    size_t nameIndex = 0;
+    for(size_t i = 0; i < STATIC_SIZE; i++) {
+        if(STATIC_TABLE[i].first != name) continue;
+        if(STATIC_TABLE[i].second == value) {
+            *nameOnly = false;
+            return i + 1;
+        }
+        if(nameIndex == 0) nameIndex = i + 1;
+    }
+    for(size_t i = 0; i < dynamic_.size(); i++) {
+        if(dynamic_[i].first != name) continue;
+        if(dynamic_[i].second == value) {
+            *nameOnly = false;
+            return STATIC_SIZE + 1 + i;
+        }
+        if(nameIndex == 0) nameIndex = STATIC_SIZE + 1 + i;
+    }
+    *nameOnly = true;
+    return nameIndex;
+}
+
+bool HpackDecoder::DecodeInt(const uint8_t*& pos, const uint8_t* end, int prefix, uint64_t& value)
+{
+    if(pos >= end) return false;
+    const uint64_t mask = (1u << prefix) - 1;
+    value = *pos++ & mask;
+    if(value < mask) return true;
+
+    int shift = 0;
+    while(true) {
+        if(pos >= end || shift > 56) return false;
+        uint8_t b = *pos++;
+        value += static_cast<uint64_t>(b & 0x7f) << shift;
+        shift += 7;
+        if(!(b & 0x80)) break;
+    }
+    return true;
+}
+
+bool HpackDecoder::DecodeString(const uint8_t*& pos, const uint8_t* end, string& str)
+{
+    if(pos >= end) return false;
+    bool huffman = *pos & 0x80;
+    uint64_t len = 0;
+    if(!DecodeInt(pos, end, 7, len)) return false;
+    if(len > static_cast<uint64_t>(end - pos)) return false;
+
+    str.clear();
+    if(huffman) {
+        if(!HpackHuffman::Decode(pos, len, str)) return false;
+    } else {
+        str.assign(reinterpret_cast<const char*>(pos), len);
+    }
+    pos += len;
+    return true;
+}
+
+bool HpackDecoder::Decode(const uint8_t* data, size_t len, vector<HpackTable::Field>& headers)
+{
+    const uint8_t* pos = data;
+    const uint8_t* end = data + len;
+    uint64_t index = 0;
+
+    while(pos < end) {
+        uint8_t b = *pos;
+        if(b & 0x80) { // indexed field
+            if(!DecodeInt(pos, end, 7, index)) return false;
+            const HpackTable::Field* field = table_.Get(index);
+            if(!field) return false;
+            headers.push_back(*field);
+        } else if((b & 0xe0) == 0x20) { // dynamic table size update
+            if(!DecodeInt(pos, end, 5, index)) return false;
+            if(index > maxTableSize_) return false;
+            table_.SetMaxSize(index);
+        } else {
+            // literal, with incremental indexing(01), without indexing(0000) or never indexed(0001)
+            bool indexing = (b & 0xc0) == 0x40;
+            if(!DecodeInt(pos, end, indexing ? 6 : 4, index)) return false;
+
+            HpackTable::Field field;
+            if(index) {
+                const HpackTable::Field* named = table_.Get(index);
+                if(!named) return false;
+                field.first = named->first;
+            } else if(!DecodeString(pos, end, field.first)) {
+                return false;
+            }
+            if(!DecodeString(pos, end, field.second)) return false;
+
+            if(indexing) table_.Add(field.first, field.second);
+            headers.push_back(std::move(field));
+        }
+    }
+    return true;
+}
+
+void HpackEncoder::EncodeInt(string& out, uint8_t flags, int prefix, uint64_t value)
+{
+    const uint64_t mask = (1u << prefix) - 1;
+    if(value < mask) {
+        out.push_back(static_cast<char>(flags | value));
+        return;
+    }
+    out.push_back(static_cast<char>(flags | mask));
+    value -= mask;
+    while(value >= 0x80) {
+        out.push_back(static_cast<char>((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+void HpackEncoder::EncodeString(string& out, const string& str)
+{
+    size_t huffmanLen = HpackHuffman::EncodedLength(str);
+    if(huffmanLen < str.size()) {
+        EncodeInt(out, 0x80, 7, huffmanLen);
+        HpackHuffman::Encode(str, out);
+    } else {
+        EncodeInt(out, 0x00, 7, str.size());
+        out += str;
+    }
+}
+
+void HpackEncoder::SetMaxTableSize(size_t maxSize)
+{
+    maxSize = min<size_t>(maxSize, 4096); // never keep more state than the default for one conn
+    if(maxSize != table_.MaxSize()) {
+        table_.SetMaxSize(maxSize);
+        pendingSizeUpdate_ = true;
+    }
+}
+
+void HpackEncoder::Encode(const vector<HpackTable::Field>& headers, string& out)
+{
+    if(pendingSizeUpdate_) {
+        EncodeInt(out, 0x20, 5, table_.MaxSize());
+        pendingSizeUpdate_ = false;
+    }
+
+    for(auto& field : headers) {
+        bool nameOnly = false;
+        size_t index = table_.Find(field.first, field.second, &nameOnly);
+        if(index && !nameOnly) {
+            EncodeInt(out, 0x80, 7, index);
+            continue;
+        }
+
+        // values that change on every response only pollute the table
+        bool indexing = field.first != "content-length" && field.first != "set-cookie";
+        if(indexing) {
+            EncodeInt(out, 0x40, 6, index);
+        } else {
+            EncodeInt(out, 0x00, 4, index);
+        }
+        if(index == 0) EncodeString(out, field.first);
+        EncodeString(out, field.second);
+        if(indexing) table_.Add(field.first, field.second);
+    }
+}
+
+namespace {
+
+// code length of every symbol, 256 is EOS
+const uint8_t HUFFMAN_LENGTH[257] = {
+    13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+    28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+    6, 10, 10, 12, 13, 6, 8, 11, 10, 10, 8, 11, 8, 6, 6, 6,
+    5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15, 6, 12, 10,
+    13, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6,
+    15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7, 6, 6, 6, 5,
+    6, 7, 6, 5, 5, 6, 7, 7, 7, 7, 7, 15, 11, 14, 13, 28,
+    20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+    24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+    22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+    21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+    26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+    19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+    20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+    26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+    30,
+};
+
+const int HUFFMAN_MAX_LENGTH = 30;
+
+// the code is canonical, so codes of one length are consecutive and ordered by symbol
+struct HuffmanTable {
+    uint32_t code[257];
+    uint32_t firstCode[HUFFMAN_MAX_LENGTH + 1]; // smallest code of each length
+    uint16_t firstIndex[HUFFMAN_MAX_LENGTH + 1]; // position of that code in symbols
+    uint16_t count[HUFFMAN_MAX_LENGTH + 1];
+    uint16_t symbols[257]; // sorted by (length, symbol)
+
+    HuffmanTable() : firstCode(), firstIndex(), count()
+    {
+        int n = 0;
+        uint32_t next = 0;
+        for(int len = 1; len <= HUFFMAN_MAX_LENGTH; len++) {
+            next <<= 1;
+            firstCode[len] = next;
+            firstIndex[len] = n;
+            for(int sym = 0; sym < 257; sym++) {
+                if(HUFFMAN_LENGTH[sym] != len) continue;
+                code[sym] = next++;
+                symbols[n++] = sym;
+                count[len]++;
+            }
+        }
+        assert(n == 257 && next == (1u << HUFFMAN_MAX_LENGTH)); // complete code
+    }
+};
+
+const HuffmanTable& Huffman()
+{
+    static const HuffmanTable table;
+    return table;
+}
+
+} // namespace
+
+bool HpackHuffman::Decode(const uint8_t* data, size_t len, string& out)
+{
+    const HuffmanTable& table = Huffman();
+    uint32_t code = 0;
+    int bits = 0;
+
+    for(size_t i = 0; i < len; i++) {
+        for(int shift = 7; shift >= 0; shift--) {
+            code = (code << 1) | ((data[i] >> shift) & 1);
+            bits++;
+            uint32_t offset = code - table.firstCode[bits];
+            if(offset < table.count[bits]) {
+                uint16_t sym = table.symbols[table.firstIndex[bits] + offset];
+                if(sym == 256) return false; // EOS inside a string is an error
+                out.push_back(static_cast<char>(sym));
+                code = 0;
+                bits = 0;
+            } else if(bits >= HUFFMAN_MAX_LENGTH) {
+                return false;
+            }
+        }
+    }
+    // padding must be shorter than a byte and be the most significant bits of EOS
+    return bits < 8 && code == (1u << bits) - 1;
+}
+
+void HpackHuffman::Encode(const string& str, string& out)
+{
+    const HuffmanTable& table = Huffman();
+    uint64_t acc = 0;
+    int bits = 0;
+    for(unsigned char ch : str) {
+        acc = (acc << HUFFMAN_LENGTH[ch]) | table.code[ch];
+        bits += HUFFMAN_LENGTH[ch];
+        while(bits >= 8) {
+            bits -= 8;
+            out.push_back(static_cast<char>(acc >> bits));
+        }
+    }
+    if(bits > 0) {
+        // pad with the prefix of EOS (all ones)
+        out.push_back(static_cast<char>((acc << (8 - bits)) | (0xff >> bits)));
+    }
+}
+
+size_t HpackHuffman::EncodedLength(const string& str)
+{
+    size_t bits = 0;
+    for(unsigned char ch : str) bits += HUFFMAN_LENGTH[ch];
+    return (bits + 7) / 8;
+}
@@ -0,0 +1,84 @@
+/*
+ * @author: Zimo Li
+ * @date: 2026-10-19
+*/
+
+#ifndef HPACK_HPP
+#define HPACK_HPP
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <cstdint>
+
+// header compression for HTTP/2 (RFC 7541)
+class HpackTable {
+public:
+    typedef std::pair<std::string, std::string> Field;
+
+    static const std::size_t STATIC_SIZE = 61;
+    static const std::size_t ENTRY_OVERHEAD = 32; // counted for every entry besides name and value
+
+private:
+    static const Field STATIC_TABLE[STATIC_SIZE];
+
+    std::deque<Field> dynamic_; // front is the newest entry
+    std::size_t size_; // sum of entry sizes in dynamic table
+    std::size_t maxSize_;
+
+    void Evict(std::size_t need); // drop oldest entries until need bytes fit
+
+public:
+    HpackTable(std::size_t maxSize = 4096) : size_(0), maxSize_(maxSize) {};
+    ~HpackTable() = default;
+
+    const Field* Get(std::size_t index) const; // 1-based index over static then dynamic table
+    void Add(const std::string& name, const std::string& value);
+    void SetMaxSize(std::size_t maxSize);
+    std::size_t MaxSize() const;
+
+    // return index of exact match, or of a name-only match with *nameOnly set, 0 if none
+    std::size_t Find(const std::string& name, const std::string& value, bool* nameOnly) const;
+};
+
+class HpackDecoder {
+private:
+    HpackTable table_;
+    std::size_t maxTableSize_; // upper bound announced by our SETTINGS_HEADER_TABLE_SIZE
+
+    static bool DecodeInt(const uint8_t*& pos, const uint8_t* end, int prefix, uint64_t& value);
+    static bool DecodeString(const uint8_t*& pos, const uint8_t* end, std::string& str);
+
+public:
+    HpackDecoder(std::size_t maxTableSize = 4096) : table_(maxTableSize), maxTableSize_(maxTableSize) {};
+    ~HpackDecoder() = default;
+
+    // decode a complete header block, false means COMPRESSION_ERROR
+    bool Decode(const uint8_t* data, std::size_t len, std::vector<HpackTable::Field>& headers);
+};
+
+class HpackEncoder {
+private:
+    HpackTable table_;
+    bool pendingSizeUpdate_; // peer changed SETTINGS_HEADER_TABLE_SIZE, must be signalled first
+
+    static void EncodeInt(std::string& out, uint8_t flags, int prefix, uint64_t value);
+    static void EncodeString(std::string& out, const std::string& str);
+
+public:
+    HpackEncoder() : pendingSizeUpdate_(false) {};
+    ~HpackEncoder() = default;
+
+    void SetMaxTableSize(std::size_t maxSize);
+    void Encode(const std::vector<HpackTable::Field>& headers, std::string& out);
+};
+
+// canonical huffman code of RFC 7541 appendix B
+class HpackHuffman {
+public:
+    static bool Decode(const uint8_t* data, std::size_t len, std::string& out);
+    static void Encode(const std::string& str, std::string& out);
+    static std::size_t EncodedLength(const std::string& str);
+};
+
+#endif // HPACK_HPP
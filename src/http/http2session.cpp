@@ -0,0 +1,586 @@
+/*
+ * @author: Zimo Li
+ * @date: 2026-10-19
+*/
+
+#include "http2session.hpp"
+#include <algorithm>
+#include <cstring>
+#include "httpconn.hpp"
+#include "../log/log.hpp"
+using namespace std;
+
+const char Http2Session::PREFACE[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+const std::size_t Http2Session::PREFACE_LEN;
+
+namespace {
+
+uint32_t ReadU32(const uint8_t* p)
+{
+    return (static_cast<uint32_t>(p[0]) << 24) | (static_cast<uint32_t>(p[1]) << 16) |
+           (static_cast<uint32_t>(p[2]) << 8) | p[3];
+}
+
+void PutU32(char* p, uint32_t v)
+{
+    p[0] = static_cast<char>(v >> 24);
+    p[1] = static_cast<char>(v >> 16);
+    p[2] = static_cast<char>(v >> 8);
+    p[3] = static_cast<char>(v);
+}
+
+// HTTP2-Settings header is base64url without padding
+bool Base64UrlDecode(const string& in, string& out)
+{
+    uint32_t acc = 0;
+    int bits = 0;
+    for(char ch : in) {
+        int v;
+        if(ch >= 'A' && ch <= 'Z') v = ch - 'A';
+        else if(ch >= 'a' && ch <= 'z') v = ch - 'a' + 26;
+        else if(ch >= '0' && ch <= '9') v = ch - '0' + 52;
+        else if(ch == '-' || ch == '+') v = 62;
+        else if(ch == '_' || ch == '/') v = 63;
+        else if(ch == '=') break;
+        else return false;
+        acc = (acc << 6) | v;
+        bits += 6;
+        if(bits >= 8) {
+            bits -= 8;
+            out.push_back(static_cast<char>(acc >> bits));
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+bool Http2Session::Stream::DataEnd() const
+{
+    return remain == 0 && pending.ReadableBytes() == 0 && !response.IsStreaming();
+}
+
+bool Http2Session::IsPreface(const Buffer& buffer)
+{
+    size_t len = min(buffer.ReadableBytes(), PREFACE_LEN);
+    return len > 0 && memcmp(buffer.ReadPosition(), PREFACE, len) == 0;
+}
+
+Http2Session::Http2Session(const string& srcDir, const sockaddr_in& addr) : srcDir_(srcDir), addr_(addr),
+    prefaceReceived_(false),
+    goawaySent_(false), goawayReceived_(false), closeNow_(false), lastStreamId_(0), connSendWindow_(DEFAULT_WINDOW),
+    peerInitialWindow_(DEFAULT_WINDOW), peerMaxFrame_(LOCAL_MAX_FRAME), headerStream_(0),
+    headerEndStream_(false), headerRefused_(false)
+{
+}
+
+void Http2Session::WriteFrame(Buffer& out, uint8_t type, uint8_t flags, uint32_t streamId,
+                              const char* payload, size_t len)
+{
+    char head[FRAME_HEADER_LEN];
+    head[0] = static_cast<char>(len >> 16);
+    head[1] = static_cast<char>(len >> 8);
+    head[2] = static_cast<char>(len);
+    head[3] = static_cast<char>(type);
+    head[4] = static_cast<char>(flags);
+    PutU32(head + 5, streamId & MAX_WINDOW);
+    out.Append(head, FRAME_HEADER_LEN);
+    if(len > 0) out.Append(payload, len);
+}
+
+void Http2Session::WriteSettings(Buffer& out)
+{
+    char payload[6];
+    payload[0] = 0;
+    payload[1] = MAX_CONCURRENT_STREAMS;
+    PutU32(payload + 2, LOCAL_MAX_STREAMS);
+    WriteFrame(out, SETTINGS, 0, 0, payload, sizeof(payload));
+}
+
+void Http2Session::WriteWindowUpdate(Buffer& out, uint32_t streamId, uint32_t increment)
+{
+    char payload[4];
+    PutU32(payload, increment);
+    WriteFrame(out, WINDOW_UPDATE, 0, streamId, payload, sizeof(payload));
+}
+
+void Http2Session::ResetStream(Buffer& out, uint32_t streamId, ERROR_CODE code)
+{
+    char payload[4];
+    PutU32(payload, code);
+    WriteFrame(out, RST_STREAM, 0, streamId, payload, sizeof(payload));
+    streams_.erase(streamId);
+}
+
+void Http2Session::GoAway(Buffer& out, ERROR_CODE code)
+{
+    if(closeNow_ || (goawaySent_ && code == NO_ERROR)) return;
+    char payload[8];
+    PutU32(payload, lastStreamId_);
+    PutU32(payload + 4, code);
+    WriteFrame(out, GOAWAY, 0, 0, payload, sizeof(payload));
+    goawaySent_ = true;
+    closeNow_ = code != NO_ERROR; // graceful goaway lets open streams finish
+    LOG_DEBUG("h2 goaway, last stream %u, error %d", lastStreamId_, code);
+}
+
+void Http2Session::Start(Buffer& out)
+{
+    WriteSettings(out);
+}
+
+bool Http2Session::Upgrade(HttpRequest& request, Buffer& out)
+{
+    string settings;
+    if(!Base64UrlDecode(request.GetHeader("HTTP2-Settings"), settings) ||
+       !ApplySettings(reinterpret_cast<const uint8_t*>(settings.data()), settings.size())) {
+        return false;
+    }
+
+    out.Append("HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nUpgrade: h2c\r\n\r\n");
+    Start(out);
+
+    // the upgrade request is stream 1, already half closed by client
+    lastStreamId_ = 1;
+    unique_ptr<Stream> stream(new Stream(1, peerInitialWindow_));
+    stream->remoteClosed = true;
+    Stream& ref = *stream;
+    streams_[1] = std::move(stream);
+    Respond(out, ref, request, true); // HttpConn admitted the upgrade request
+    return true;
+}
+
+bool Http2Session::ApplySettings(const uint8_t* payload, size_t len)
+{
+    if(len % 6 != 0) return false;
+    for(size_t i = 0; i < len; i += 6) {
+        uint16_t id = (payload[i] << 8) | payload[i + 1];
+        uint32_t value = ReadU32(payload + i + 2);
+        switch(id) {
+        case HEADER_TABLE_SIZE:
+            encoder_.SetMaxTableSize(value);
+            break;
+        case ENABLE_PUSH:
+            if(value > 1) return false;
+            break;
+        case INITIAL_WINDOW_SIZE: {
+            if(value > MAX_WINDOW) return false;
+            // change applies to every open stream as a delta
+            int64_t delta = static_cast<int64_t>(value) - peerInitialWindow_;
+            for(auto& item : streams_) item.second->sendWindow += delta;
+            peerInitialWindow_ = value;
+            break;
+        }
+        case MAX_FRAME_SIZE:
+            if(value < LOCAL_MAX_FRAME || value > 0xffffff) return false;
+            peerMaxFrame_ = value;
+            break;
+        default: break; // unknown or advisory settings are ignored
+        }
+    }
+    return true;
+}
+
+void Http2Session::OnRead(Buffer& in, Buffer& out)
+{
+    if(!prefaceReceived_) {
+        if(in.ReadableBytes() < PREFACE_LEN) return;
+        if(memcmp(in.ReadPosition(), PREFACE, PREFACE_LEN) != 0) {
+            GoAway(out, PROTOCOL_ERROR);
+            return;
+        }
+        in.Retrieve(PREFACE_LEN);
+        prefaceReceived_ = true;
+    }
+
+    while(!closeNow_ && in.ReadableBytes() >= FRAME_HEADER_LEN) {
+        const uint8_t* head = reinterpret_cast<const uint8_t*>(in.ReadPosition());
+        size_t len = (head[0] << 16) | (head[1] << 8) | head[2];
+        uint8_t type = head[3];
+        uint8_t flags = head[4];
+        uint32_t streamId = ReadU32(head + 5) & MAX_WINDOW;
+
+        if(len > LOCAL_MAX_FRAME) {
+            GoAway(out, FRAME_SIZE_ERROR);
+            break;
+        }
+        if(in.ReadableBytes() < FRAME_HEADER_LEN + len) break; // wait for the rest of frame
+
+        if(!HandleFrame(out, type, flags, streamId, head + FRAME_HEADER_LEN, len)) {
+            GoAway(out, PROTOCOL_ERROR);
+        }
+        in.Retrieve(FRAME_HEADER_LEN + len);
+    }
+}
+
+bool Http2Session::HandleFrame(Buffer& out, uint8_t type, uint8_t flags, uint32_t streamId,
+                               const uint8_t* payload, size_t len)
+{
+    // a header block must not be interleaved with any other frame
+    if(headerStream_ != 0 && (type != CONTINUATION || streamId != headerStream_)) return false;
+
+    switch(type) {
+    case DATA:
+        return OnData(out, flags, streamId, payload, len);
+    case HEADERS:
+        return OnHeaders(out, flags, streamId, payload, len);
+    case CONTINUATION:
+        if(headerStream_ == 0) return false;
+        headerBlock_.append(reinterpret_cast<const char*>(payload), len);
+        if(headerBlock_.size() > MAX_HEADER_BLOCK) {
+            GoAway(out, ENHANCE_YOUR_CALM);
+            return true;
+        }
+        if(flags & END_HEADERS) return OnHeaderBlockEnd(out);
+        return true;
+    case PRIORITY: {
+        if(streamId == 0) return false;
+        if(len != 5) {
+            ResetStream(out, streamId, FRAME_SIZE_ERROR);
+            return true;
+        }
+        auto it = streams_.find(streamId);
+        if(it != streams_.end()) {
+            it->second->dependency = ReadU32(payload) & MAX_WINDOW;
+            it->second->weight = payload[4] + 1;
+        }
+        return true;
+    }
+    case RST_STREAM:
+        if(streamId == 0 || len != 4) return false;
+        streams_.erase(streamId);
+        return true;
+    case SETTINGS:
+        if(streamId != 0) return false;
+        if(flags & ACK) return len == 0;
+        if(!ApplySettings(payload, len)) return false;
+        WriteFrame(out, SETTINGS, ACK, 0, nullptr, 0);
+        return true;
+    case PING:
+        if(streamId != 0 || len != 8) return false;
+        if(!(flags & ACK)) {
+            WriteFrame(out, PING, ACK, 0, reinterpret_cast<const char*>(payload), len);
+        }
+        return true;
+    case GOAWAY:
+        goawayReceived_ = true;
+        return true;
+    case WINDOW_UPDATE:
+        return OnWindowUpdate(out, streamId, payload, len);
+    case PUSH_PROMISE:
+        return false; // clients must not push
+    default:
+        return true; // unknown frame types are ignored
+    }
+}
+
+bool Http2Session::OnData(Buffer& out, uint8_t flags, uint32_t streamId, const uint8_t* payload, size_t len)
+{
+    if(streamId == 0) return false;
+
+    // every DATA byte counts against flow control, padding included, so credit it back at once
+    const uint32_t frameLen = len;
+    if(frameLen > 0) WriteWindowUpdate(out, 0, frameLen);
+
+    size_t padLen = 0;
+    if(flags & PADDED) {
+        if(len < 1) return false;
+        padLen = payload[0];
+        payload++;
+        len--;
+        if(padLen > len) return false;
+    }
+
+    auto it = streams_.find(streamId);
+    if(it == streams_.end() || it->second->remoteClosed) {
+        if(streamId > lastStreamId_) return false; // DATA on an idle stream
+        ResetStream(out, streamId, STREAM_CLOSED);
+        return true;
+    }
+
+    Stream& stream = *it->second;
+    if(stream.body.size() + len - padLen > MAX_BODY) {
+        ResetStream(out, streamId, CANCEL);
+        return true;
+    }
+    stream.body.append(reinterpret_cast<const char*>(payload), len - padLen);
+    if(flags & END_STREAM) {
+        stream.remoteClosed = true;
+        Dispatch(out, stream);
+    } else if(frameLen > 0) {
+        WriteWindowUpdate(out, streamId, frameLen);
+    }
+    return true;
+}
+
+bool Http2Session::OnHeaders(Buffer& out, uint8_t flags, uint32_t streamId, const uint8_t* payload, size_t len)
+{
+    if(streamId == 0 || streamId % 2 == 0) return false; // client streams are odd
+
+    size_t padLen = 0;
+    if(flags & PADDED) {
+        if(len < 1) return false;
+        padLen = payload[0];
+        payload++;
+        len--;
+    }
+
+    uint32_t dependency = 0;
+    uint16_t weight = 16;
+    if(flags & PRIORITY_FLAG) {
+        if(len < 5) return false;
+        dependency = ReadU32(payload) & MAX_WINDOW;
+        weight = payload[4] + 1;
+        payload += 5;
+        len -= 5;
+    }
+    if(padLen > len) return false;
+    len -= padLen;
+
+    auto it = streams_.find(streamId);
+    if(it != streams_.end()) {
+        // trailers, only allowed to end the request
+        if(it->second->remoteClosed || !(flags & END_STREAM)) return false;
+    } else {
+        if(streamId <= lastStreamId_) return false; // stream ids must increase
+        lastStreamId_ = streamId;
+        headerRefused_ = goawaySent_ || goawayReceived_ || streams_.size() >= LOCAL_MAX_STREAMS;
+        if(!headerRefused_) {
+            unique_ptr<Stream> stream(new Stream(streamId, peerInitialWindow_));
+            stream->dependency = dependency;
+            stream->weight = weight;
+            streams_[streamId] = std::move(stream);
+        }
+    }
+
+    headerBlock_.assign(reinterpret_cast<const char*>(payload), len);
+    headerStream_ = streamId;
+    headerEndStream_ = flags & END_STREAM;
+    if(flags & END_HEADERS) return OnHeaderBlockEnd(out);
+    return true;
+}
+
+bool Http2Session::OnHeaderBlockEnd(Buffer& out)
+{
+    uint32_t streamId = headerStream_;
+    headerStream_ = 0;
+
+    vector<HpackTable::Field> headers;
+    if(!decoder_.Decode(reinterpret_cast<const uint8_t*>(headerBlock_.data()), headerBlock_.size(), headers)) {
+        GoAway(out, COMPRESSION_ERROR);
+        return true;
+    }
+    headerBlock_.clear();
+
+    if(headerRefused_) {
+        headerRefused_ = false;
+        ResetStream(out, streamId, REFUSED_STREAM);
+        return true;
+    }
+
+    auto it = streams_.find(streamId);
+    if(it == streams_.end()) return true; // reset while block was in flight
+    Stream& stream = *it->second;
+    stream.headers.insert(stream.headers.end(), headers.begin(), headers.end());
+    if(headerEndStream_) {
+        stream.remoteClosed = true;
+        Dispatch(out, stream);
+    }
+    return true;
+}
+
+bool Http2Session::OnWindowUpdate(Buffer& out, uint32_t streamId, const uint8_t* payload, size_t len)
+{
+    if(len != 4) return false;
+    uint32_t increment = ReadU32(payload) & MAX_WINDOW;
+
+    if(streamId == 0) {
+        if(increment == 0) return false;
+        connSendWindow_ += increment;
+        if(connSendWindow_ > MAX_WINDOW) {
+            GoAway(out, FLOW_CONTROL_ERROR);
+        }
+        return true;
+    }
+
+    auto it = streams_.find(streamId);
+    if(it == streams_.end()) return true; // closed streams may still get updates
+    if(increment == 0) {
+        ResetStream(out, streamId, PROTOCOL_ERROR);
+        return true;
+    }
+    it->second->sendWindow += increment;
+    if(it->second->sendWindow > MAX_WINDOW) {
+        ResetStream(out, streamId, FLOW_CONTROL_ERROR);
+    }
+    return true;
+}
+
+void Http2Session::Dispatch(Buffer& out, Stream& stream)
+{
+    string method, path;
+    vector<pair<string, string>> fields;
+    for(auto& field : stream.headers) {
+        if(field.first == ":method") method = field.second;
+        else if(field.first == ":path") path = field.second;
+        else if(field.first[0] != ':') fields.push_back(field);
+    }
+    if(method.empty() || path.empty() || path[0] != '/') {
+        ResetStream(out, stream.id, PROTOCOL_ERROR);
+        return;
+    }
+
+    HttpRequest request;
+    request.ParseFields(method, path, fields, stream.body);
+    stream.headers.clear();
+    stream.body.clear();
+    Respond(out, stream, request, false);
+}
+
+void Http2Session::Respond(Buffer& out, Stream& stream, HttpRequest& request, bool admitted)
+{
+    if(!admitted && !HttpConn::Admit(addr_)) {
+        // over the limit, the stream gets the short answer and the conn stays
+        static const string BODY = "429 : Too Many Requests\n";
+        stream.pending.Append(BODY);
+        WriteHeaders(out, stream.id, {{":status", "429"}, {"content-type", "text/plain"}, {"retry-after", "1"},
+                                      {"content-length", to_string(BODY.size())}}, false);
+        stream.responding = true;
+        return;
+    }
+    // upstream conns, logins, image encodes and coroutine routes answer later from other threads, a
+    // stream is answered in place here. the client sends those again over HTTP/1.1
+    ImageVariants::Spec spec;
+    if(HttpConn::ProxyRoute(request.target()) || HttpConn::Route(request, spec) != HttpConn::ROUTE_FILE) {
+        ResetStream(out, stream.id, HTTP_1_1_REQUIRED);
+        return;
+    }
+    HttpResponse& response = stream.response;
+    response.init(srcDir_, request.path(), false, 200);
+    auto route = HttpConn::streamRoutes.find(request.path());
+    if(route != HttpConn::streamRoutes.end()) {
+        response.SetBodyProducer(route->second(request));
+    }
+    response.MakeBody();
+
+    vector<HpackTable::Field> headers;
+    headers.emplace_back(":status", to_string(response.code()));
+    headers.emplace_back("content-type", response.GetFileType());
+    if(!response.IsStreaming()) {
+        stream.data = response.file();
+        stream.remain = stream.data ? response.FileLength() : 0;
+        headers.emplace_back("content-length", to_string(stream.remain));
+    }
+
+    bool endStream = stream.DataEnd();
+    WriteHeaders(out, stream.id, headers, endStream);
+    if(endStream) {
+        streams_.erase(stream.id);
+    } else {
+        stream.responding = true;
+    }
+}
+
+void Http2Session::WriteHeaders(Buffer& out, uint32_t streamId, const vector<HpackTable::Field>& headers,
+                                bool endStream)
+{
+    string block;
+    encoder_.Encode(headers, block);
+
+    // split into HEADERS + CONTINUATION when block is larger than peer frame size
+    size_t offset = 0;
+    bool first = true;
+    do {
+        size_t len = min<size_t>(block.size() - offset, peerMaxFrame_);
+        bool last = offset + len == block.size();
+        uint8_t flags = last ? END_HEADERS : 0;
+        if(first && endStream) flags |= END_STREAM;
+        WriteFrame(out, first ? HEADERS : CONTINUATION, flags, streamId, block.data() + offset, len);
+        offset += len;
+        first = false;
+    } while(offset < block.size());
+}
+
+void Http2Session::Flush(Buffer& out, size_t maxBytes)
+{
+    size_t budget = maxBytes;
+    vector<Stream*> ready;
+    while(budget > 0) {
+        ready.clear();
+        uint32_t totalWeight = 0;
+        for(auto& item : streams_) {
+            Stream* stream = item.second.get();
+            if(!stream->responding) continue;
+            // a stream that only owes END_STREAM needs no window
+            if(stream->DataEnd() || (stream->sendWindow > 0 && connSendWindow_ > 0)) {
+                ready.push_back(stream);
+                totalWeight += stream->weight;
+            }
+        }
+        if(ready.empty()) break;
+
+        // every round, a stream gets a share of budget proportional to its weight
+        size_t roundBudget = budget;
+        bool progress = false;
+        for(Stream* stream : ready) {
+            size_t quota = max<size_t>(1, roundBudget * stream->weight / totalWeight);
+            int64_t window = max<int64_t>(0, min(stream->sendWindow, connSendWindow_));
+            size_t len = min<size_t>({ quota, peerMaxFrame_, budget, static_cast<size_t>(window) });
+
+            bool fromFile = stream->remain > 0;
+            // an empty piece is asked again, a round where nobody sends anything would end the write
+            // and leave the stream waiting for the next read
+            while(!fromFile && stream->pending.ReadableBytes() < len && stream->response.IsStreaming()) {
+                stream->response.Produce(stream->pending, len - stream->pending.ReadableBytes());
+                if(stream->pending.ReadableBytes() > 0) break;
+            }
+
+            const char* data = nullptr;
+            if(fromFile) {
+                len = min(len, stream->remain);
+                data = stream->data;
+                stream->data += len;
+                stream->remain -= len;
+            } else {
+                len = min(len, stream->pending.ReadableBytes());
+                data = stream->pending.ReadPosition();
+            }
+
+            size_t pendingLeft = stream->pending.ReadableBytes() - (fromFile ? 0 : len);
+            bool end = stream->remain == 0 && pendingLeft == 0 && !stream->response.IsStreaming();
+            if(len == 0 && !end) continue; // producer had nothing this round
+
+            WriteFrame(out, DATA, end ? END_STREAM : 0, stream->id, data, len);
+            if(!fromFile) stream->pending.Retrieve(len);
+            progress = true;
+
+            stream->sendWindow -= len;
+            connSendWindow_ -= len;
+            budget -= min(budget, len + FRAME_HEADER_LEN);
+            if(end) streams_.erase(stream->id);
+            if(budget == 0) break;
+        }
+        if(!progress) break;
+    }
+}
+
+bool Http2Session::HasSendable() const
+{
+    for(auto& item : streams_) {
+        const Stream& stream = *item.second;
+        if(!stream.responding) continue;
+        if(stream.DataEnd()) return true;
+        if(stream.sendWindow > 0 && connSendWindow_ > 0) return true;
+    }
+    return false;
+}
+
+bool Http2Session::IsClosing() const
+{
+    return closeNow_ || ((goawaySent_ || goawayReceived_) && streams_.empty());
+}
+
+void Http2Session::Shutdown(Buffer& out)
+{
+    GoAway(out, NO_ERROR);
+}
@@ -0,0 +1,158 @@
+/*
+ * @author: Zimo Li
+ * @date: 2026-10-19
+*/
+
+#ifndef HTTP2SESSION_HPP
+#define HTTP2SESSION_HPP
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <netinet/in.h>
+#include "../buffer/buffer.hpp"
+#include "hpack.hpp"
+#include "httprequest.hpp"
+#include "httpresponse.hpp"
+
+// cleartext HTTP/2 (h2c) on top of one HttpConn, every stream is served by its own HttpResponse
+class Http2Session {
+private:
+    enum FRAME_TYPE {
+        DATA = 0x0,
+        HEADERS = 0x1,
+        PRIORITY = 0x2,
+        RST_STREAM = 0x3,
+        SETTINGS = 0x4,
+        PUSH_PROMISE = 0x5,
+        PING = 0x6,
+        GOAWAY = 0x7,
+        WINDOW_UPDATE = 0x8,
+        CONTINUATION = 0x9,
+    };
+
+    enum FRAME_FLAG {
+        END_STREAM = 0x1,
+        ACK = 0x1,
+        END_HEADERS = 0x4,
+        PADDED = 0x8,
+        PRIORITY_FLAG = 0x20,
+    };
+
+    enum ERROR_CODE {
+        NO_ERROR = 0x0,
+        PROTOCOL_ERROR = 0x1,
+        INTERNAL_ERROR = 0x2,
+        FLOW_CONTROL_ERROR = 0x3,
+        STREAM_CLOSED = 0x5,
+        FRAME_SIZE_ERROR = 0x6,
+        REFUSED_STREAM = 0x7,
+        CANCEL = 0x8,
+        COMPRESSION_ERROR = 0x9,
+        ENHANCE_YOUR_CALM = 0xb,
+        HTTP_1_1_REQUIRED = 0xd,
+    };
+
+    enum SETTING_ID {
+        HEADER_TABLE_SIZE = 0x1,
+        ENABLE_PUSH = 0x2,
+        MAX_CONCURRENT_STREAMS = 0x3,
+        INITIAL_WINDOW_SIZE = 0x4,
+        MAX_FRAME_SIZE = 0x5,
+        MAX_HEADER_LIST_SIZE = 0x6,
+    };
+
+    static const std::size_t FRAME_HEADER_LEN = 9;
+    static const uint32_t DEFAULT_WINDOW = 65535;
+    static const uint32_t MAX_WINDOW = 0x7fffffff;
+    static const uint32_t LOCAL_MAX_FRAME = 16384; // we never announce a larger SETTINGS_MAX_FRAME_SIZE
+    static const uint32_t LOCAL_MAX_STREAMS = 100;
+    static const std::size_t MAX_HEADER_BLOCK = 64 * 1024;
+    static const std::size_t MAX_BODY = 1024 * 1024;
+
+    struct Stream {
+        uint32_t id;
+        bool remoteClosed; // END_STREAM received, request is complete
+        bool responding; // HEADERS sent, DATA pending
+        int64_t sendWindow;
+        uint32_t dependency; // kept for PRIORITY frames, scheduling only uses weight
+        uint16_t weight; // 1-256
+
+        std::vector<HpackTable::Field> headers;
+        std::string body;
+
+        HttpResponse response;
+        const char* data; // unsent part of mapped file
+        std::size_t remain;
+        Buffer pending; // generated data not framed yet
+
+        Stream(uint32_t streamId, int64_t window) : id(streamId), remoteClosed(false), responding(false),
+            sendWindow(window), dependency(0), weight(16), data(nullptr), remain(0) {};
+
+        bool DataEnd() const; // nothing left to send after what is already known
+    };
+
+    std::string srcDir_;
+    sockaddr_in addr_; // of the client, for admission
+    HpackDecoder decoder_;
+    HpackEncoder encoder_;
+    std::map<uint32_t, std::unique_ptr<Stream>> streams_;
+
+    bool prefaceReceived_;
+    bool goawaySent_;
+    bool goawayReceived_;
+    bool closeNow_; // goaway with error sent, stop reading frames
+    uint32_t lastStreamId_; // highest stream id opened by client
+
+    int64_t connSendWindow_;
+    uint32_t peerInitialWindow_;
+    uint32_t peerMaxFrame_;
+
+    std::string headerBlock_; // HEADERS + CONTINUATION fragments of one block
+    uint32_t headerStream_; // stream whose block is being collected, 0 if none
+    bool headerEndStream_;
+    bool headerRefused_; // block has to be decoded for HPACK state, but stream is refused
+
+    void WriteFrame(Buffer& out, uint8_t type, uint8_t flags, uint32_t streamId,
+                    const char* payload, std::size_t len);
+    void WriteSettings(Buffer& out);
+    void WriteWindowUpdate(Buffer& out, uint32_t streamId, uint32_t increment);
+    void ResetStream(Buffer& out, uint32_t streamId, ERROR_CODE code);
+    void GoAway(Buffer& out, ERROR_CODE code);
+
+    bool ApplySettings(const uint8_t* payload, std::size_t len); // false on invalid value
+    bool HandleFrame(Buffer& out, uint8_t type, uint8_t flags, uint32_t streamId,
+                     const uint8_t* payload, std::size_t len); // false on connection error
+    bool OnData(Buffer& out, uint8_t flags, uint32_t streamId, const uint8_t* payload, std::size_t len);
+    bool OnHeaders(Buffer& out, uint8_t flags, uint32_t streamId, const uint8_t* payload, std::size_t len);
+    bool OnHeaderBlockEnd(Buffer& out);
+    bool OnWindowUpdate(Buffer& out, uint32_t streamId, const uint8_t* payload, std::size_t len);
+
+    void Dispatch(Buffer& out, Stream& stream); // build request from fields and respond
+    // admission and routes of HttpConn, admitted when the conn has already let the request in
+    void Respond(Buffer& out, Stream& stream, HttpRequest& request, bool admitted);
+    void WriteHeaders(Buffer& out, uint32_t streamId, const std::vector<HpackTable::Field>& headers,
+                      bool endStream);
+
+public:
+    static const char PREFACE[]; // client connection preface
+    static const std::size_t PREFACE_LEN = 24;
+    static bool IsPreface(const Buffer& buffer); // prior knowledge detection on a fresh conn
+
+    Http2Session(const std::string& srcDir, const sockaddr_in& addr);
+    ~Http2Session() = default;
+
+    void Start(Buffer& out); // server connection preface
+    bool Upgrade(HttpRequest& request, Buffer& out); // answer h2c Upgrade, request becomes stream 1
+
+    void OnRead(Buffer& in, Buffer& out); // consume complete frames of in, write replies into out
+    void Flush(Buffer& out, std::size_t maxBytes); // DATA frames of ready streams by weight and windows
+
+    bool HasSendable() const; // Flush would write something now
+    bool IsClosing() const; // conn should be closed once out is written
+    void Shutdown(Buffer& out); // graceful goaway, streams already opened are still served
+};
+
+#endif // HTTP2SESSION_HPP
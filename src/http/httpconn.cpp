@@ -0,0 +1,638 @@
+/*
+ * @author: Zimo Li
+ * @date: 2024-5-26
+*/
+
+#include "httpconn.hpp"
+#include <cassert>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include <netinet/tcp.h>
+#include "../log/log.hpp"
+#include "../buffer/memstats.hpp"
+using namespace std;
+
+bool HttpConn::isET;
+bool HttpConn::cork = false;
+const char* HttpConn::srcDir;
+std::atomic<int> HttpConn::userCount;
+std::atomic<bool> HttpConn::isDraining(false);
+std::unordered_map<std::string, HttpConn::StreamHandler> HttpConn::streamRoutes;
+std::map<std::string, Upstream*> HttpConn::proxyRoutes;
+std::unordered_map<std::string, WebSocket::Handler> HttpConn::wsRoutes;
+std::unordered_map<std::string, HttpConn::CoHandler> HttpConn::coRoutes;
+HttpConn::RequestFilter HttpConn::requestFilter;
+SessionStore* HttpConn::sessions = nullptr;
+HttpConn::LoginCheck HttpConn::loginCheck;
+std::unordered_set<std::string> HttpConn::sessionPaths;
+ImageVariants* HttpConn::images = nullptr;
+TlsContext* HttpConn::tlsContext = nullptr;
+
+HttpConn::HttpConn() : fd_(-1), addr_({0}), connCounted_(false), isClosed_(true), rejected_(false), coPending_(false), urgent_(false), heavy_(false), corked_(false), handshakeWritten_(false), login_(false), image_(false), iovCount_(0),
+                       status_(0), responseBytes_(0)
+{
+}
+
+HttpConn::~HttpConn()
+{
+    close();
+}
+
+void HttpConn::init(int sockFd, const sockaddr_in& addr, bool connCounted)
+{
+    assert(sockFd > 0);
+    userCount++;
+    addr_ = addr;
+    connCounted_ = connCounted;
+    fd_ = sockFd;
+    writeBuffer_.RetrieveAll();
+    readBuffer_.RetrieveAll();
+    request_.Init(); // the last conn on this fd may have left a request half read
+    h2_.reset();
+    ws_.reset();
+    tls_.reset();
+    if(tlsContext) tls_.reset(new TlsConn(tlsContext->Get(), sockFd));
+    rejected_ = false;
+    coPending_ = false;
+    urgent_ = heavy_ = false;
+    corked_ = false;
+    handshakeWritten_ = false;
+    login_ = false;
+    image_ = false;
+    cookie_.clear();
+    trace_.Reset(sockFd);
+    status_ = 0;
+    responseBytes_ = 0;
+    isClosed_ = false;
+    LOG_INFO("Client[%d](%s:%d) in, userCount:%d", fd_, GetIP(), GetPort(), (int)userCount);
+}
+
+bool HttpConn::close()
+{
+    response_.UnmapFIle();
+    if(isClosed_.exchange(true) == false) {
+        if(proxy_) proxy_->Abort();
+        if(ws_) ws_->Close();
+        if(tls_) tls_->Shutdown();
+        userCount--;
+        ::close(fd_);
+        // the conn object stays in users_ until its fd number comes again, maybe never
+        readBuffer_.RetrieveAll();
+        writeBuffer_.RetrieveAll();
+        readBuffer_.Shrink(0);
+        writeBuffer_.Shrink(0);
+        LOG_INFO("Client[%d](%s:%d) quit, UserCount:%d", fd_, GetIP(), GetPort(), (int)userCount);
+        return true;
+    }
+    return false;
+}
+
+int HttpConn::GetFd() const
+{
+    return fd_;
+}
+
+sockaddr_in HttpConn::GetAddr() const
+{
+    return addr_;
+}
+
+bool HttpConn::IsConnCounted() const
+{
+    return connCounted_;
+}
+
+const char* HttpConn::GetIP() const
+{
+    return inet_ntoa(addr_.sin_addr);
+}
+
+int HttpConn::GetPort() const
+{
+    return addr_.sin_port;
+}
+
+ssize_t HttpConn::read(int* errno_)
+{
+    if(tls_) return ReadTls(errno_);
+    ssize_t len = -1;
+    do {
+        len = readBuffer_.ReadFromFd(fd_, errno_);
+        if(len <= 0) break;
+    } while(isET);
+    return len;
+}
+
+ssize_t HttpConn::write(int* errno_)
+{
+    if(ws_) return ws_->Write(fd_, tls_.get(), errno_);
+    // a tail shorter than a segment waits for the next write instead of leaving on its own,
+    // a response that fits one writev is not worth the two setsockopt
+    if(cork && !corked_ && ((iovCount_ == 2 && iov_[1].iov_len > 0) || response_.IsStreaming() ||
+                            (h2_ && h2_->HasSendable()))) {
+        SetCork(true);
+    }
+    handshakeWritten_ = false;
+    ssize_t len = -1;
+    do {
+        len = tls_ ? WriteTls() : writev(fd_, iov_, iovCount_);
+        if(len <= 0) {
+            *errno_ = errno;
+            break;
+        }
+
+        if(static_cast<size_t>(len) > iov_[0].iov_len) {
+            iov_[1].iov_base = static_cast<uint8_t*>(iov_[1].iov_base) + (len - iov_[0].iov_len);
+            iov_[1].iov_len -= (len - iov_[0].iov_len);
+            if(iov_[0].iov_len) {
+                writeBuffer_.RetrieveAll();
+                iov_[0].iov_len = 0;
+            }
+        } else {
+            iov_[0].iov_base = static_cast<uint8_t*>(iov_[0].iov_base) + len;
+            iov_[0].iov_len -= len;
+            writeBuffer_.Retrieve(len);
+        }
+
+        // socket took everything, so it is writable enough for the next chunk
+        if(iov_[0].iov_len + iov_[1].iov_len == 0) {
+            if(h2_ && h2_->HasSendable()) {
+                FillHttp2Frames();
+            } else if(response_.IsStreaming()) {
+                FillStreamChunk();
+            }
+        }
+        if(ToWriteBytes() == 0) break; // transfer finished
+    } while(isET || ToWriteBytes() > 10240);
+    if(corked_ && ToWriteBytes() == 0) SetCork(false); // pushes the last partial segment now
+    return len;
+}
+
+void HttpConn::SetCork(bool on)
+{
+    int val = on ? 1 : 0;
+    setsockopt(fd_, IPPROTO_TCP, TCP_CORK, &val, sizeof(val));
+    corked_ = on;
+}
+
+ssize_t HttpConn::ReadTls(int* errno_)
+{
+    if(!tls_->IsEstablished() && tls_->Handshake() <= 0) {
+        *errno_ = errno;
+        return -1;
+    }
+
+    // records already decrypted stay inside SSL, so always read until it would block
+    char buff[16 * 1024]; // one full record
+    ssize_t total = 0;
+    while(true) {
+        ssize_t len = tls_->Read(buff, sizeof(buff));
+        if(len <= 0) {
+            *errno_ = errno;
+            if(len < 0 && errno == EAGAIN && total > 0) return total;
+            return len;
+        }
+        readBuffer_.Append(buff, len);
+        total += len;
+    }
+}
+
+ssize_t HttpConn::WriteTls()
+{
+    if(!tls_->IsEstablished()) {
+        ssize_t ret = tls_->Handshake();
+        if(ret <= 0) return ret;
+        handshakeWritten_ = true; // stuck on output at the end, the conn must not look finished now
+        return 0;
+    }
+    if(iov_[0].iov_len > 0) return tls_->Write(iov_[0].iov_base, iov_[0].iov_len);
+    if(iovCount_ < 2 || iov_[1].iov_len == 0) return 0;
+
+    // kernel encrypts, so file pages go to socket without being copied to user space
+    if(tls_->KtlsSend() && response_.file() && iov_[1].iov_base >= response_.file() &&
+       response_.FileFd() >= 0) {
+        off_t offset = static_cast<char*>(iov_[1].iov_base) - response_.file();
+        return tls_->SendFile(response_.FileFd(), offset, iov_[1].iov_len);
+    }
+    return tls_->Write(iov_[1].iov_base, iov_[1].iov_len);
+}
+
+void HttpConn::FillStreamChunk()
+{
+    writeBuffer_.RetrieveAll();
+    // an empty piece is not the end, an empty iov would make the response look finished before 0\r\n\r\n
+    while(response_.IsStreaming() && writeBuffer_.ReadableBytes() == 0) {
+        response_.ProduceChunk(writeBuffer_);
+    }
+    iov_[0].iov_base = const_cast<char*>(writeBuffer_.ReadPosition());
+    iov_[0].iov_len = writeBuffer_.ReadableBytes();
+    iov_[1].iov_len = 0;
+    iovCount_ = 1;
+}
+
+void HttpConn::FillHttp2Frames()
+{
+    writeBuffer_.RetrieveAll();
+    h2_->Flush(writeBuffer_, H2_FLUSH_BYTES);
+    iov_[0].iov_base = const_cast<char*>(writeBuffer_.ReadPosition());
+    iov_[0].iov_len = writeBuffer_.ReadableBytes();
+    iov_[1].iov_len = 0;
+    iovCount_ = 1;
+}
+
+bool HttpConn::ProcessHttp2()
+{
+    h2_->OnRead(readBuffer_, writeBuffer_);
+    if(isDraining) h2_->Shutdown(writeBuffer_);
+    h2_->Flush(writeBuffer_, H2_FLUSH_BYTES);
+    iov_[0].iov_base = const_cast<char*>(writeBuffer_.ReadPosition());
+    iov_[0].iov_len = writeBuffer_.ReadableBytes();
+    iov_[1].iov_len = 0;
+    iovCount_ = 1;
+    return ToWriteBytes() > 0;
+}
+
+void HttpConn::TrimBuffers()
+{
+    size_t limit = MemStats::UnderPressure() ? 0 : IDLE_BUFFER_BYTES;
+    readBuffer_.Shrink(limit); // a partial request is kept
+    if(writeBuffer_.ReadableBytes() == 0) writeBuffer_.Shrink(limit); // iov_ may point into it otherwise
+}
+
+bool HttpConn::process()
+{
+    // handshake goes on with next event, wait for writable if it is stuck on output
+    if(tls_ && !tls_->IsEstablished()) {
+        iov_[0].iov_len = iov_[1].iov_len = 0;
+        return tls_->WantWrite();
+    }
+    if(h2_) return ProcessHttp2();
+    if(ws_) {
+        ws_->OnRead(readBuffer_);
+        return ws_->HasPending();
+    }
+
+    if(request_.IsComplete()) request_.Init(); // a partial one goes on where the last read left it
+    if(readBuffer_.ReadableBytes() <= 0) {
+        return false;
+    } else if(!request_.IsPartial() && Http2Session::IsPreface(readBuffer_)) {
+        // prior knowledge h2c, once the whole preface is there
+        if(readBuffer_.ReadableBytes() < Http2Session::PREFACE_LEN) return false;
+        h2_.reset(new Http2Session(srcDir, addr_));
+        h2_->Start(writeBuffer_);
+        return ProcessHttp2();
+    }
+    trace_.Begin(RequestTrace::PARSE);
+    bool parsed = request_.parse(readBuffer_);
+    trace_.End(RequestTrace::PARSE);
+    if(parsed && !request_.IsComplete()) return false; // wait for the rest of it
+    if(parsed) {
+        LOG_DEBUG("%s", request_.path().c_str());
+        urgent_ = Config::Current().urgentPaths.count(request_.path()) == 1;
+        heavy_ = request_.body().size() >= HEAVY_BYTES;
+        if(!Admit(addr_)) {
+            // over the limit, short fixed answer and the conn is dropped after it
+            RespondOnly(HttpResponse::Prerendered(429));
+            return true;
+        }
+        if(StartProxy()) {
+            trace_.Reset(fd_);
+            return true;
+        }
+        if(WebSocket::IsUpgrade(request_) && wsRoutes.count(request_.path()) == 1) {
+            trace_.Reset(fd_);
+            iov_[0].iov_len = iov_[1].iov_len = 0;
+            iovCount_ = 1;
+            ws_ = std::make_shared<WebSocket>(fd_, wsRoutes.find(request_.path())->second);
+            ws_->Open(request_);
+            ws_->OnRead(readBuffer_); // frames sent right behind the upgrade request
+            return true;
+        }
+        if(request_.IsH2cUpgrade() && !tls_) {
+            h2_.reset(new Http2Session(srcDir, addr_));
+            if(h2_->Upgrade(request_, writeBuffer_)) return ProcessHttp2();
+            h2_.reset(); // bad HTTP2-Settings, stay on HTTP/1.1
+        }
+        ROUTE route = Route(request_, imageSpec_);
+        if(route != ROUTE_FILE) {
+            // a login is checked, an image variant encoded on the image pool or taken from its cache, a
+            // coroutine route run. ServeAsync makes the answer once that is done, nothing to write until then
+            login_ = route == ROUTE_LOGIN;
+            image_ = route == ROUTE_IMAGE;
+            coPending_ = true;
+            iov_[0].iov_len = iov_[1].iov_len = 0;
+            iovCount_ = 1;
+            return true;
+        }
+        InitResponse();
+        auto stream = streamRoutes.find(request_.path());
+        if(stream != streamRoutes.end()) {
+            response_.SetBodyProducer(stream->second(request_));
+            // chunked coding is HTTP/1.1, older clients read till the conn closes
+            response_.SetChunked(request_.version() == "1.1");
+        }
+    } else {
+        rejected_ = true; // where the next request starts is unknown now
+        response_.init(srcDir, request_.path(), false, 400);
+    }
+    MakeResponse();
+    return true;
+}
+
+void HttpConn::InitResponse()
+{
+    response_.init(srcDir, request_.path(), IsKeepAlive(), 200);
+    // only used when files come from a bundle
+    response_.SetAcceptGzip(HttpResponse::AcceptsGzip(request_.Header(HttpHeaders::ACCEPT_ENCODING)));
+    response_.SetIfNoneMatch(request_.Header(HttpHeaders::IF_NONE_MATCH));
+    if(!cookie_.empty()) {
+        response_.SetCookie(cookie_);
+        cookie_.clear();
+    }
+}
+
+bool HttpConn::Admit(const sockaddr_in& addr)
+{
+    return !requestFilter || requestFilter(addr);
+}
+
+Upstream* HttpConn::ProxyRoute(const string& target)
+{
+    Upstream* upstream = nullptr;
+    for(auto& route : proxyRoutes) {
+        // map is ordered, so a longer prefix of the same target comes later
+        if(target.compare(0, route.first.size(), route.first) == 0) upstream = route.second;
+    }
+    return upstream;
+}
+
+HttpConn::ROUTE HttpConn::Route(HttpRequest& request, ImageVariants::Spec& spec)
+{
+    if(sessions && CheckSession(request)) return ROUTE_LOGIN;
+    if(images && images->Parse(request.path(), spec)) return ROUTE_IMAGE;
+    if(coRoutes.count(request.path()) == 1) return ROUTE_CO;
+    return ROUTE_FILE;
+}
+
+bool HttpConn::CheckSession(HttpRequest& request)
+{
+    static const string LOGIN = "/login.html", WELCOME = "/welcome.html";
+    string user;
+    bool valid = sessions->Find(SessionStore::FromCookie(request.Header(HttpHeaders::COOKIE)), user);
+    if(request.path() == LOGIN) {
+        if(request.method() == "POST") return loginCheck != nullptr;
+        if(valid) request.path() = WELCOME; // logged in already, no need to ask again
+    } else if(!valid && sessionPaths.count(request.path()) == 1) {
+        request.path() = LOGIN;
+    }
+    return false;
+}
+
+Task<void> HttpConn::Login()
+{
+    string user = request_.GetPost("username");
+    bool ok = !user.empty() && co_await loginCheck(user, request_.GetPost("password"));
+    string id = ok ? sessions->Create(user) : "";
+    if(id.empty()) {
+        request_.path() = "/error.html";
+        co_return;
+    }
+    cookie_ = string(SessionStore::COOKIE_NAME) + "=" + id + "; Path=/; HttpOnly; SameSite=Lax; Max-Age=" +
+              to_string(sessions->Ttl()) + (tls_ ? "; Secure" : "");
+    request_.path() = "/welcome.html";
+}
+
+void HttpConn::MakeResponse()
+{
+    response_.MakeResponse(writeBuffer_);
+    // response header
+    iov_[0].iov_base = const_cast<char*>(writeBuffer_.ReadPosition());
+    iov_[0].iov_len = writeBuffer_.ReadableBytes();
+    iovCount_ = 1;
+
+    // file
+    if(response_.FileLength() > 0 && response_.file()) {
+        iov_[1].iov_base = response_.file();
+        iov_[1].iov_len = response_.FileLength();
+        iovCount_ = 2;
+    } else {
+        iov_[1].iov_len = 0;
+    }
+    LOG_DEBUG("filesize:%d, %d to %d", response_.FileLength(), iovCount_, ToWriteBytes());
+    status_ = response_.code();
+    responseBytes_ = ToWriteBytes();
+    if(static_cast<size_t>(ToWriteBytes()) >= HEAVY_BYTES) heavy_ = true;
+}
+
+RequestTrace& HttpConn::Trace()
+{
+    return trace_;
+}
+
+void HttpConn::FinishTrace()
+{
+    if(h2_) {
+        trace_.Reset(fd_); // streams are not single requests, their writes are batched
+        return;
+    }
+    uint64_t ticks = trace_.Finish(request_.method(), request_.path());
+    if(ticks > 0 && AccessLog::Instance().IsOpen()) {
+        AccessLog::Instance().Add(addr_.sin_addr.s_addr, request_.method(), request_.path(), status_,
+                                  responseBytes_, RequestTrace::ToUs(ticks));
+    }
+}
+
+bool HttpConn::IsUrgent() const
+{
+    return urgent_;
+}
+
+bool HttpConn::IsHeavy() const
+{
+    // an upload still coming in counts before it is parsed
+    return heavy_ || IsProxying() || readBuffer_.ReadableBytes() >= HEAVY_BYTES;
+}
+
+bool HttpConn::IsCoPending() const
+{
+    return coPending_;
+}
+
+Task<ssize_t> HttpConn::ServeAsync(int* errno_, int timeoutMS)
+{
+    assert(coPending_);
+    ImageVariants::Image image;
+    if(login_) {
+        login_ = false;
+        co_await Login();
+    } else if(image_) {
+        image_ = false;
+        image = co_await images->Get(imageSpec_); // nullptr serves the source as it is
+    } else {
+        auto route = coRoutes.find(request_.path());
+        if(route != coRoutes.end()) co_await route->second(request_);
+    }
+    InitResponse();
+    if(image) response_.SetBody(std::move(image));
+    MakeResponse();
+    ssize_t len = co_await WriteAsync(errno_, timeoutMS);
+    coPending_ = false;
+    co_return len;
+}
+
+Task<ssize_t> HttpConn::ReadAsync(int* errno_, int timeoutMS)
+{
+    CoScheduler* sched = CoScheduler::Current();
+    assert(sched);
+    while(true) {
+        // in ET mode read() ends on EAGAIN even after it got data, so look at the buffer instead
+        size_t before = readBuffer_.ReadableBytes();
+        *errno_ = 0;
+        ssize_t len = read(errno_);
+        if(readBuffer_.ReadableBytes() > before) co_return readBuffer_.ReadableBytes() - before;
+        if(len == 0 || (len < 0 && *errno_ != EAGAIN)) co_return len;
+        if(!co_await sched->WaitFd(fd_, EPOLLIN | EPOLLRDHUP, timeoutMS)) {
+            *errno_ = ETIMEDOUT;
+            co_return -1;
+        }
+    }
+}
+
+Task<ssize_t> HttpConn::WriteAsync(int* errno_, int timeoutMS)
+{
+    CoScheduler* sched = CoScheduler::Current();
+    assert(sched);
+    ssize_t total = 0;
+    while(ToWriteBytes() > 0) {
+        *errno_ = 0;
+        ssize_t len = write(errno_);
+        if(len > 0) total += len;
+        if(len < 0 && *errno_ != EAGAIN) co_return -1;
+        if(ToWriteBytes() == 0) break;
+        if(len > 0 && !isET) continue; // LT write() stops early on its own, socket may take more
+        if(!co_await sched->WaitFd(fd_, EPOLLOUT, timeoutMS)) {
+            *errno_ = ETIMEDOUT;
+            co_return -1;
+        }
+    }
+    co_return total;
+}
+
+void HttpConn::RespondOnly(const string& response)
+{
+    rejected_ = true;
+    status_ = atoi(response.c_str() + 9); // after "HTTP/1.1 "
+    responseBytes_ = response.size();
+    writeBuffer_.Append(response);
+    iov_[0].iov_base = const_cast<char*>(writeBuffer_.ReadPosition());
+    iov_[0].iov_len = writeBuffer_.ReadableBytes();
+    iov_[1].iov_len = 0;
+    iovCount_ = 1;
+}
+
+bool HttpConn::StartProxy()
+{
+    const string& target = request_.target();
+    Upstream* upstream = ProxyRoute(target);
+    if(!upstream) return false;
+
+    // request line and fields again, minus those that only describe the client conn
+    static const HttpHeaders::ID HOP_BY_HOP[] = {
+        HttpHeaders::CONNECTION, HttpHeaders::KEEP_ALIVE, HttpHeaders::PROXY_CONNECTION, HttpHeaders::TE,
+        HttpHeaders::TRAILER, HttpHeaders::TRANSFER_ENCODING, HttpHeaders::UPGRADE, HttpHeaders::HTTP2_SETTINGS,
+        HttpHeaders::EXPECT, HttpHeaders::CONTENT_LENGTH, HttpHeaders::X_FORWARDED_FOR,
+    };
+    string forward = request_.method() + " " + target + " HTTP/1.1\r\n";
+    const HttpHeaders& headers = request_.headers();
+    for(size_t i = 0; i < headers.Size(); i++) {
+        HttpHeaders::ID id = headers.Id(i);
+        bool hop = false;
+        for(HttpHeaders::ID name : HOP_BY_HOP) {
+            if(id == name) {
+                hop = true;
+                break;
+            }
+        }
+        if(hop) continue;
+        forward.append(headers.Name(i)).append(": ").append(headers.Value(i)).append("\r\n");
+    }
+    string_view forwardedFor = headers.Get(HttpHeaders::X_FORWARDED_FOR);
+    forward.append("X-Forwarded-For: ").append(forwardedFor);
+    if(!forwardedFor.empty()) forward += ", ";
+    forward += GetIP() + string("\r\n");
+    forward += string("X-Forwarded-Proto: ") + (tls_ ? "https" : "http") + "\r\n";
+    forward += "Connection: keep-alive\r\n";
+    const string& body = request_.body();
+    if(!body.empty() || request_.method() == "POST" || request_.method() == "PUT") {
+        forward += "Content-Length: " + to_string(body.size()) + "\r\n";
+    }
+    forward += "\r\n" + body;
+
+    iov_[0].iov_len = iov_[1].iov_len = 0;
+    iovCount_ = 1;
+    if(!proxy_) proxy_.reset(new ProxyConn);
+    // body is spliced straight into socket unless TLS records have to be built in user space
+    int spliceFd = (!tls_ || tls_->KtlsSend()) ? fd_ : -1;
+    auto writer = [this](const char* data, size_t len) -> ssize_t {
+        return tls_ ? tls_->Write(data, len) : ::write(fd_, data, len);
+    };
+    if(!proxy_->Start(upstream, std::move(forward), request_.method() == "HEAD", IsKeepAlive(), writer, spliceFd)) {
+        LOG_WARN("Client[%d] no upstream for %s", fd_, target.c_str());
+        RespondOnly(HttpResponse::Prerendered(502));
+    }
+    return true;
+}
+
+bool HttpConn::IsProxying() const
+{
+    return proxy_ && proxy_->IsActive();
+}
+
+ProxyConn* HttpConn::Proxy()
+{
+    return proxy_.get();
+}
+
+bool HttpConn::FinishProxy()
+{
+    bool keepAlive = proxy_->ClientKeepAlive() && !isDraining;
+    proxy_->Finish();
+    return keepAlive;
+}
+
+void HttpConn::ProxyFailed()
+{
+    bool sent = proxy_->SentToClient();
+    proxy_->Finish();
+    if(sent) {
+        rejected_ = true; // response is cut, only closing tells client
+        return;
+    }
+    RespondOnly(HttpResponse::Prerendered(502));
+}
+
+WebSocket* HttpConn::GetWebSocket() const
+{
+    return ws_.get();
+}
+
+int HttpConn::ToWriteBytes() const
+{
+    return iov_[0].iov_len + iov_[1].iov_len;
+}
+
+bool HttpConn::HandshakeWritten() const
+{
+    return handshakeWritten_;
+}
+
+bool HttpConn::IsKeepAlive() const
+{
+    if(ws_) return !ws_->IsFinished();
+    if(tls_ && !tls_->IsEstablished()) return true; // handshake in progress
+
+    if(h2_) return !h2_->IsClosing();
+    return request_.IsKeepAlive() && !isDraining && !rejected_;
+}
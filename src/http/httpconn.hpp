@@ -8,16 +8,43 @@
 
 #include <arpa/inet.h>
 #include <sys/uio.h>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
 #include "../buffer/buffer.hpp"
 #include "httprequest.hpp"
 #include "httpresponse.hpp"
+#include "http2session.hpp"
+#include "tlsconn.hpp"
+#include "proxyconn.hpp"
+#include "websocket.hpp"
+#include "../coro/scheduler.hpp"
+#include "../log/reqtrace.hpp"
+#include "../log/accesslog.hpp"
+#include "sessionstore.hpp"
+#include "imagevariants.hpp"
+#include "../server/config.hpp"
 
 class HttpConn {
 private:
     int fd_;
     sockaddr_in addr_;
+    bool connCounted_; // RateLimiter counted this conn for its IP, give it back on close
 
-    bool isClosed_;
+    std::atomic<bool> isClosed_; // timer and workers may both close a conn
+    bool rejected_; // request was refused or could not be proxied, close after answer
+    std::atomic<bool> coPending_; // request is served by a coroutine, conn belongs to its scheduler meanwhile
+    bool urgent_; // last request was on an urgent path
+    bool heavy_; // last request or its response was big
+    bool corked_; // TCP_CORK is on until the response is out
+    bool handshakeWritten_; // last write finished the TLS handshake, the request is still to be read
+    bool login_; // pending request is a login, credentials are checked on the CoScheduler
+    std::string cookie_; // Set-Cookie for the next response
+    bool image_; // pending request wants an image variant, made on the ImageVariants pool
+    ImageVariants::Spec imageSpec_;
 
     int iovCount_;
     iovec iov_[2]; // iov[0] equals to write buffer, iov[1] equals temp space
@@ -27,24 +54,108 @@ private:
 
     HttpRequest request_;
     HttpResponse response_;
+    RequestTrace trace_; // phases of the request in flight, proxied and websocket ones are not traced
+    int status_; // of the response in flight, for the access log
+    std::size_t responseBytes_;
+    std::unique_ptr<Http2Session> h2_; // set once conn switched to HTTP/2
+    std::unique_ptr<TlsConn> tls_; // set when server terminates TLS
+    std::unique_ptr<ProxyConn> proxy_; // created by first request on a proxied route
+    std::shared_ptr<WebSocket> ws_; // set once conn switched to WebSocket, channels hold weak refs
+
+    void FillStreamChunk(); // pull next chunk into write buffer once it has been drained
+    void FillHttp2Frames(); // same as above, for DATA frames of h2 streams
+    bool ProcessHttp2();
+    ssize_t ReadTls(int* errno_);
+    ssize_t WriteTls(); // one step of write through TLS, errno set like writev
+    void SetCork(bool on);
+    bool StartProxy(); // false if request is not on a proxied route
+    void RespondOnly(const std::string& response); // fixed answer, conn closed after it
+    void InitResponse(); // 200 for the request path, with its cache and encoding headers
+    static bool CheckSession(HttpRequest& request); // route by session cookie, true if the request is a login to check
+    Task<void> Login();
+    void MakeResponse(); // response for request_ into write buffer and iov
 
 public:
+    // create the body producer for a dynamic route
+    typedef std::function<HttpResponse::BodyProducer(const HttpRequest& request)> StreamHandler;
+    // runs on a CoScheduler before the response is made, may wait on sockets and rewrite the path
+    typedef std::function<Task<void>(HttpRequest& request)> CoHandler;
+    // admission check for every HTTP/1.x request, false answers 429
+    typedef std::function<bool(const sockaddr_in& addr)> RequestFilter;
+    // credentials of a login form, runs on a CoScheduler (SqlConnPool::VerifyUserAsync by default)
+    typedef std::function<Task<bool>(const std::string& user, const std::string& password)> LoginCheck;
+
+    static bool isET;
+    static bool cork; // responses taking more than one write leave in full segments
+    static const char* srcDir;
+    static std::atomic<int> userCount;
+    static std::atomic<bool> isDraining; // server is going away, answer current request then close
+    static std::unordered_map<std::string, StreamHandler> streamRoutes; // path -> generated content
+    static std::map<std::string, Upstream*> proxyRoutes; // path prefix -> backends, longest prefix wins
+    static std::unordered_map<std::string, WebSocket::Handler> wsRoutes; // path -> WebSocket endpoint
+    static std::unordered_map<std::string, CoHandler> coRoutes; // path -> coroutine handler
+    static RequestFilter requestFilter;
+    static SessionStore* sessions; // nullptr means no sessions
+    static LoginCheck loginCheck;
+    static std::unordered_set<std::string> sessionPaths; // need a session, the login page is served without one
+    static ImageVariants* images; // nullptr serves images as they are
+    static TlsContext* tlsContext; // nullptr means plaintext
+    // what answers a request once it is admitted and not proxied, the same for h2 streams. may rewrite
+    // the path: login page for a path that needs a session, query of an image variant taken off
+    enum ROUTE { ROUTE_FILE, ROUTE_LOGIN, ROUTE_IMAGE, ROUTE_CO };
+    static bool Admit(const sockaddr_in& addr); // requestFilter, false answers 429
+    static Upstream* ProxyRoute(const std::string& target); // nullptr if target isn't proxied
+    static ROUTE Route(HttpRequest& request, ImageVariants::Spec& spec);
+    static const std::size_t H2_FLUSH_BYTES = 64 * 1024; // DATA frames put into write buffer at once
+    static const std::size_t HEAVY_BYTES = 256 * 1024; // request body or response this big makes a conn heavy
+    static const std::size_t IDLE_BUFFER_BYTES = 64 * 1024; // idle conns cut buffers grown past this back
+
+
     HttpConn();
     ~HttpConn(); // close http conn
 
-    void init(int sockFd, const sockaddr_in& addr); // new user comes, init everything
+    void init(int sockFd, const sockaddr_in& addr, bool connCounted = false); // new user comes, init everything
 
     ssize_t read(int* errno_); // if ET(Ե) mode, read until there is no data, otherwise read only once.
     ssize_t write(int* errno_); // same as above, but if ET or has more than 10240 bytes to write
 
     bool process(); // parse request and yield response and fill iov[0](write buff), iov[1](file)
 
+    int ToWriteBytes() const; // bytes left in iov, streamed chunks are produced lazily
+    // between requests: buffers grown over IDLE_BUFFER_BYTES, or over their first size under memory
+    // pressure, give the memory back
+    void TrimBuffers();
+    bool IsKeepAlive() const;
+    bool HandshakeWritten() const; // nothing was answered by the last write, read the request next
+
+    bool IsProxying() const; // response comes from upstream, events go to Proxy()
+    ProxyConn* Proxy();
+    bool FinishProxy(); // release upstream conn, true if client conn is kept
+    void ProxyFailed(); // 502 if nothing was forwarded yet
+
+    WebSocket* GetWebSocket() const; // nullptr while conn speaks HTTP
+
+    // class hint for the next task of this conn, taken from its last request
+    bool IsUrgent() const;
+    bool IsHeavy() const;
+
+    RequestTrace& Trace();
+    void FinishTrace(); // response is written: slow log with phases, access log record
+
+    // on the CoScheduler of this thread. ReadAsync returns once new bytes are buffered, WriteAsync once
+    // everything queued is out, both -1 with errno_ ETIMEDOUT if the socket stays idle for timeoutMS
+    bool IsCoPending() const;
+    Task<ssize_t> ServeAsync(int* errno_, int timeoutMS); // run handler of the pending request and write its response
+    Task<ssize_t> ReadAsync(int* errno_, int timeoutMS = -1);
+    Task<ssize_t> WriteAsync(int* errno_, int timeoutMS = -1);
+
     int GetFd() const;
     int GetPort() const;
     const char* GetIP() const; // get string format IP
     sockaddr_in GetAddr() const;
+    bool IsConnCounted() const;
 
-    void close();
+    bool close(); // false if conn was already closed
 };
 
 #endif // HTTPCONN_HPP
\ No newline at end of file
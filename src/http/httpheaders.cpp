@@ -0,0 +1,157 @@
+/*
+ * @author: Zimo Li
+ * @date: 2026-10-19
+*/
+
+#include "httpheaders.hpp"
+#include <array>
+#include <cassert>
+#include <cstring>
+using namespace std;
+
+const char* const HttpHeaders::KNOWN_NAMES[KNOWN_COUNT] = {
+    "Host", "Connection", "Keep-Alive", "Proxy-Connection", "Content-Length", "Content-Type",
+    "Transfer-Encoding", "TE", "Trailer", "Expect", "Upgrade", "HTTP2-Settings",
+    "Sec-WebSocket-Key", "Sec-WebSocket-Version", "Origin", "Accept", "Accept-Encoding",
+    "Accept-Language", "User-Agent", "Referer", "Cookie", "Authorization", "Cache-Control",
+    "If-Modified-Since", "If-None-Match", "Range", "X-Forwarded-For",
+};
+
+static inline char Lower(char ch)
+{
+    return (ch >= 'A' && ch <= 'Z') ? ch + ('a' - 'A') : ch;
+}
+
+HttpHeaders::HttpHeaders()
+{
+    memset(slots_, 0, sizeof(slots_));
+}
+
+bool HttpHeaders::EqualsNoCase(string_view a, string_view b)
+{
+    if(a.size() != b.size()) return false;
+    for(size_t i = 0; i < a.size(); i++) {
+        if(Lower(a[i]) != Lower(b[i])) return false;
+    }
+    return true;
+}
+
+bool HttpHeaders::HasToken(string_view value, string_view token)
+{
+    size_t pos = 0;
+    while(pos <= value.size()) {
+        size_t end = value.find(',', pos);
+        if(end == string_view::npos) end = value.size();
+        size_t first = pos, last = end;
+        while(first < last && (value[first] == ' ' || value[first] == '\t')) first++;
+        while(last > first && (value[last - 1] == ' ' || value[last - 1] == '\t')) last--;
+        if(EqualsNoCase(value.substr(first, last - first), token)) return true;
+        pos = end + 1;
+    }
+    return false;
+}
+
+HttpHeaders::ID HttpHeaders::Lookup(string_view name)
+{
+    // candidates are grouped by length, rarely more than two share one
+    static const size_t MAX_LEN = 32;
+    static const array<vector<ID>, MAX_LEN> byLength = []() {
+        array<vector<ID>, MAX_LEN> res;
+        for(int id = 0; id < KNOWN_COUNT; id++) {
+            size_t len = strlen(KNOWN_NAMES[id]);
+            assert(len < MAX_LEN);
+            res[len].push_back(static_cast<ID>(id));
+        }
+        return res;
+    }();
+    if(name.size() >= MAX_LEN) return UNKNOWN;
+    for(ID id : byLength[name.size()]) {
+        if(Lower(KNOWN_NAMES[id][0]) == Lower(name[0]) && EqualsNoCase(KNOWN_NAMES[id], name)) return id;
+    }
+    return UNKNOWN;
+}
+
+void HttpHeaders::Clear()
+{
+    arena_.clear();
+    fields_.clear();
+    memset(slots_, 0, sizeof(slots_));
+}
+
+void HttpHeaders::Add(string_view name, string_view value)
+{
+    ID id = Lookup(name);
+    if(id != UNKNOWN && slots_[id] != 0) {
+        // value has to stay contiguous, so the joined one is written again at the end
+        Field& field = fields_[slots_[id] - 1];
+        if(value.empty()) return; // empty list members carry nothing
+        size_t start = arena_.size();
+        if(field.valueLen == 0) {
+            arena_.append(value.data(), value.size());
+            field.value = start;
+            field.valueLen = value.size();
+            return;
+        }
+        arena_.append(arena_, field.value, field.valueLen);
+        arena_.append(", ", 2);
+        arena_.append(value.data(), value.size());
+        field.value = start;
+        field.valueLen = arena_.size() - start;
+        return;
+    }
+
+    if(fields_.size() >= UINT16_MAX) return; // slots could not address it
+    Field field;
+    field.id = id;
+    field.name = arena_.size();
+    field.nameLen = name.size();
+    arena_.append(name.data(), name.size());
+    field.value = arena_.size();
+    field.valueLen = value.size();
+    arena_.append(value.data(), value.size());
+    fields_.push_back(field);
+    if(id != UNKNOWN) slots_[id] = fields_.size();
+}
+
+bool HttpHeaders::Has(ID id) const
+{
+    assert(id < KNOWN_COUNT);
+    return slots_[id] != 0;
+}
+
+string_view HttpHeaders::Get(ID id) const
+{
+    assert(id < KNOWN_COUNT);
+    if(slots_[id] == 0) return string_view();
+    return Value(slots_[id] - 1);
+}
+
+string_view HttpHeaders::Get(string_view name) const
+{
+    ID id = Lookup(name);
+    if(id != UNKNOWN) return Get(id);
+    for(size_t i = 0; i < fields_.size(); i++) {
+        if(fields_[i].id == UNKNOWN && EqualsNoCase(Name(i), name)) return Value(i);
+    }
+    return string_view();
+}
+
+size_t HttpHeaders::Size() const
+{
+    return fields_.size();
+}
+
+string_view HttpHeaders::Name(size_t i) const
+{
+    return string_view(arena_.data() + fields_[i].name, fields_[i].nameLen);
+}
+
+string_view HttpHeaders::Value(size_t i) const
+{
+    return string_view(arena_.data() + fields_[i].value, fields_[i].valueLen);
+}
+
+HttpHeaders::ID HttpHeaders::Id(size_t i) const
+{
+    return fields_[i].id;
+}
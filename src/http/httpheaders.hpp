@@ -0,0 +1,89 @@
+/*
+ * @author: Zimo Li
+ * @date: 2026-10-19
+*/
+
+#ifndef HTTPHEADERS_HPP
+#define HTTPHEADERS_HPP
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+
+// request header fields in one flat arena. names match case-insensitively and well-known
+// names get a fixed id with its own slot, so the usual lookups are a single array access
+class HttpHeaders {
+public:
+    enum ID : uint8_t {
+        HOST,
+        CONNECTION,
+        KEEP_ALIVE,
+        PROXY_CONNECTION,
+        CONTENT_LENGTH,
+        CONTENT_TYPE,
+        TRANSFER_ENCODING,
+        TE,
+        TRAILER,
+        EXPECT,
+        UPGRADE,
+        HTTP2_SETTINGS,
+        SEC_WEBSOCKET_KEY,
+        SEC_WEBSOCKET_VERSION,
+        ORIGIN,
+        ACCEPT,
+        ACCEPT_ENCODING,
+        ACCEPT_LANGUAGE,
+        USER_AGENT,
+        REFERER,
+        COOKIE,
+        AUTHORIZATION,
+        CACHE_CONTROL,
+        IF_MODIFIED_SINCE,
+        IF_NONE_MATCH,
+        RANGE,
+        X_FORWARDED_FOR,
+        KNOWN_COUNT,
+        UNKNOWN = KNOWN_COUNT,
+    };
+
+private:
+    static const char* const KNOWN_NAMES[KNOWN_COUNT];
+
+    // offsets instead of views, arena may move while it grows
+    struct Field {
+        uint32_t name;
+        uint32_t nameLen;
+        uint32_t value;
+        uint32_t valueLen;
+        ID id;
+    };
+
+    std::string arena_;
+    std::vector<Field> fields_;
+    uint16_t slots_[KNOWN_COUNT]; // index + 1 of first field with that id, 0 if absent
+
+public:
+    HttpHeaders();
+    ~HttpHeaders() = default;
+
+    static ID Lookup(std::string_view name); // UNKNOWN for names without an id
+    static bool EqualsNoCase(std::string_view a, std::string_view b);
+    static bool HasToken(std::string_view value, std::string_view token); // comma separated list, no case
+
+    void Clear(); // capacity is kept for the next request on the conn
+    // a repeated well-known field is joined with ", ", unknown ones are kept apart and Get finds the first
+    void Add(std::string_view name, std::string_view value);
+
+    bool Has(ID id) const;
+    std::string_view Get(ID id) const;
+    std::string_view Get(std::string_view name) const;
+
+    // fields in arrival order, views are valid until next Add or Clear
+    std::size_t Size() const;
+    std::string_view Name(std::size_t i) const;
+    std::string_view Value(std::size_t i) const;
+    ID Id(std::size_t i) const;
+};
+
+#endif // HTTPHEADERS_HPP
@@ -4,50 +4,86 @@
 */
 
 #include "httprequest.hpp"
-#include <regex>
+#include <algorithm>
 #include "../log/log.hpp"
+#include "../server/config.hpp"
 #include <cassert>
 using namespace std;
 
-const unordered_set<string> HttpRequest::DEFAULT_HTML{
-            "/index", "/register", "/login",
-             "/welcome", "/video", "/picture", };
-
 const unordered_map<string, int> HttpRequest::DEFAULT_HTML_TAG {
             {"/register.html", 0}, {"/login.html", 1},  };
 
-HttpRequest::HttpRequest() : state(REQUEST_LINE), method_(""),
+const size_t HttpRequest::MAX_HEAD;
+const size_t HttpRequest::MAX_BODY;
+
+HttpRequest::HttpRequest() : state(REQUEST_LINE), headBytes_(0), contentLength_(0), method_(""),
                              path_(""), version_(""), body_("")
 {
-    header.clear();
     body_.clear();
 }
 
-bool HttpRequest::parse(Buffer& buffer)
+HttpRequest::HttpRequest(const HttpRequest& other)
+{
+    *this = other;
+}
+
+HttpRequest& HttpRequest::operator=(const HttpRequest& other)
 {
-    if(buffer.ReadableBytes() <= 0) return false;
+    if(this == &other) return *this;
+    state = other.state;
+    headBytes_ = other.headBytes_;
+    contentLength_ = other.contentLength_;
+    method_ = other.method_;
+    path_ = other.path_;
+    version_ = other.version_;
+    body_ = other.body_;
+    target_ = other.target_;
+    headers_ = other.headers_;
+    post.clear();
+    ParsePost();
+    return *this;
+}
+
+void HttpRequest::Init()
+{
+    state = REQUEST_LINE;
+    headBytes_ = contentLength_ = 0;
+    method_ = path_ = version_ = body_ = target_ = "";
+    headers_.Clear();
+    post.clear();
+}
 
+bool HttpRequest::parse(Buffer& buffer)
+{
     const char CRLF[] = "\r\n";
-    while(buffer.ReadableBytes() > 0 && state != FINISH) {
+    while(state != FINISH) {
+        if(state == BODY) {
+            if(buffer.ReadableBytes() < contentLength_) return true; // rest of the body comes later
+            body_.assign(buffer.ReadPosition(), contentLength_);
+            buffer.Retrieve(contentLength_);
+            ParseBody();
+            break;
+        }
+
+        // only whole lines are taken, a cut one is looked at again once more has been read
         const char* lineEnd = search(buffer.ReadPosition(), buffer.WritePositionConst(), CRLF, CRLF + 2);
-        string line(buffer.ReadPosition(), lineEnd);
+        size_t lineLen = lineEnd - buffer.ReadPosition();
+        if(headBytes_ + lineLen + 2 > MAX_HEAD) {
+            LOG_ERROR("Request header over %zu bytes", MAX_HEAD);
+            return false;
+        }
+        if(lineEnd == buffer.WritePositionConst()) return true;
+        string_view line(buffer.ReadPosition(), lineLen);
 
-        switch(state) {
-        case REQUEST_LINE:
+        if(state == REQUEST_LINE && line.empty()) {
+            // CRLF some clients send after a body, not a request
+        } else if(state == REQUEST_LINE) {
             if(!ParseRequestLine(line)) return false;
             ParsePath();
-            break;
-        case HEADER:
-            ParseHeader(line);
-            if(buffer.ReadableBytes() < 2) state = FINISH;
-            break;
-        case BODY:
-            ParseBody(line);
-            break;
-        default: break;
+        } else if(!ParseHeader(line)) {
+            return false;
         }
-
-        if(lineEnd == buffer.WritePositionConst()) break;
+        headBytes_ += lineLen + 2;
         buffer.RetrieveUntil(lineEnd + 2);
     }
 
@@ -55,6 +91,31 @@ bool HttpRequest::parse(Buffer& buffer)
     return true;
 }
 
+bool HttpRequest::IsComplete() const
+{
+    return state == FINISH;
+}
+
+bool HttpRequest::IsPartial() const
+{
+    return state != REQUEST_LINE && state != FINISH;
+}
+
+void HttpRequest::ParseFields(const string& method, const string& path,
+                              const vector<pair<string, string>>& headers, const string& body)
+{
+    Init();
+    method_ = method;
+    path_ = target_ = path;
+    version_ = "2.0";
+    for(auto& field : headers) headers_.Add(field.first, field.second);
+    ParsePath();
+    body_ = body;
+    ParsePost();
+    state = FINISH;
+    LOG_DEBUG("[%s], [%s], [%s]", method_.c_str(), path_.c_str(), version_.c_str());
+}
+
 string HttpRequest::path() const
 {
     return path_;
@@ -75,37 +136,77 @@ string HttpRequest::version() const
     return version_;
 }
 
+const string& HttpRequest::target() const
+{
+    return target_;
+}
+
+const string& HttpRequest::body() const
+{
+    return body_;
+}
+
+const HttpHeaders& HttpRequest::headers() const
+{
+    return headers_;
+}
+
 string HttpRequest::GetPost(const string& key) const
 {
     assert(key != "");
-    if(post.count(key) == 1) return post.find(key)->second;
-    return "";
+    return string(PostView(key));
 }
 
 string HttpRequest::GetPost(const char* key) const
 {
     assert(key != nullptr);
-    if(post.count(key) == 1) return post.find(key)->second;
-    return "";
+    return string(PostView(key));
+}
+
+string_view HttpRequest::PostView(string_view key) const
+{
+    for(auto& field : post) {
+        if(field.first == key) return field.second;
+    }
+    return string_view();
+}
+
+string HttpRequest::GetHeader(const string& key) const
+{
+    return string(headers_.Get(key));
+}
+
+string_view HttpRequest::Header(HttpHeaders::ID id) const
+{
+    return headers_.Get(id);
+}
+
+bool HttpRequest::IsH2cUpgrade() const
+{
+    // a request with body would have to be read before switching, so only those without are upgraded
+    return HttpHeaders::EqualsNoCase(headers_.Get(HttpHeaders::UPGRADE), "h2c") &&
+           headers_.Has(HttpHeaders::HTTP2_SETTINGS) && version_ == "1.1" && body_.empty();
 }
 
 bool HttpRequest::IsKeepAlive() const
 {
-    if(header.count("Connection") == 1) {
-        return header.find("Connection")->second == "keep-alive" &&
+    if(headers_.Has(HttpHeaders::CONNECTION)) {
+        return HttpHeaders::HasToken(headers_.Get(HttpHeaders::CONNECTION), "keep-alive") &&
                version_ == "1.1";
     }
     return false;
 }
 
-bool HttpRequest::ParseRequestLine(const string& line)
+bool HttpRequest::ParseRequestLine(string_view line)
 {
-    regex pattern("^([^ ]*) ([^ ]*) HTTP/([^ ]*)$");
-    smatch match;
-    if(regex_match(line, match, pattern)) {
-        method_ = match[1];
-        path_ = match[2];
-        version_ = match[3];
+    // method SP target SP HTTP/version, neither part may hold another space
+    size_t first = line.find(' ');
+    size_t second = first == string_view::npos ? first : line.find(' ', first + 1);
+    if(second != string_view::npos && line.find(' ', second + 1) == string_view::npos &&
+       line.compare(second + 1, 5, "HTTP/") == 0) {
+        method_ = string(line.substr(0, first));
+        path_ = target_ = string(line.substr(first + 1, second - first - 1));
+        version_ = string(line.substr(second + 6));
         state = HEADER; // switch state
         return true;
     }
@@ -114,43 +215,86 @@ bool HttpRequest::ParseRequestLine(const string& line)
     return false;
 }
 
-void HttpRequest::ParseHeader(const std::string& line)
+bool HttpRequest::ParseHeader(string_view line)
 {
-    regex pattern("^([^:]*): ?(.*)$");
-    smatch match;
-    if(regex_match(line, match, pattern)) {
-        header[match[1]] = match[2];
-    } else {
-        state = BODY; // now is empty line
+    if(line.empty()) {
+        // a body is as long as Content-Length says, there is none without it. chunked uploads are
+        // refused, guessing where they end would desync the conn
+        if(headers_.Has(HttpHeaders::TRANSFER_ENCODING)) {
+            LOG_ERROR("Transfer-Encoding in request");
+            return false;
+        }
+        string_view length = headers_.Get(HttpHeaders::CONTENT_LENGTH);
+        if(headers_.Has(HttpHeaders::CONTENT_LENGTH) && length.empty()) return false;
+        contentLength_ = 0;
+        for(char ch : length) {
+            if(ch < '0' || ch > '9' || contentLength_ > MAX_BODY / 10) {
+                LOG_ERROR("Content-Length Error");
+                return false;
+            }
+            contentLength_ = contentLength_ * 10 + (ch - '0');
+        }
+        if(contentLength_ > MAX_BODY) {
+            LOG_ERROR("Content-Length Error");
+            return false;
+        }
+        state = contentLength_ > 0 ? BODY : FINISH;
+        return true;
+    }
+
+    size_t colon = line.find(':');
+    if(colon == string_view::npos || colon == 0) {
+        LOG_ERROR("Header Error");
+        return false;
     }
+    string_view value = line.substr(colon + 1);
+    while(!value.empty() && (value.front() == ' ' || value.front() == '\t')) value.remove_prefix(1);
+    while(!value.empty() && (value.back() == ' ' || value.back() == '\t')) value.remove_suffix(1);
+    headers_.Add(line.substr(0, colon), value);
+    return true;
 }
 
-void HttpRequest::ParseBody(const std::string& line)
+void HttpRequest::ParseBody()
 {
-    body_ = line;
     ParsePost();
     state = FINISH;
-    LOG_DEBUG("Body:%s, len:%d", line.c_str(), line.size());
+    LOG_DEBUG("Body:%s, len:%d", body_.c_str(), body_.size());
 }
 
 void HttpRequest::ParsePath()
 {
+    // path names a file under srcDir and is matched against routes as a string, so there is one
+    // spelling of it: "." and empty segments go, ".." drops the segment before and never climbs over
+    // the root. the query is left alone
+    size_t end = min(path_.find('?'), path_.size());
+    string canonical;
+    size_t pos = 0;
+    while(pos < end) {
+        size_t next = min(path_.find('/', pos), end);
+        string_view segment(path_.data() + pos, next - pos);
+        if(segment == "..") {
+            canonical.resize(canonical.empty() ? 0 : canonical.rfind('/'));
+        } else if(!segment.empty() && segment != ".") {
+            canonical.append("/").append(segment);
+        }
+        pos = next + 1;
+    }
+    if(canonical.empty() || (end > 0 && path_[end - 1] == '/')) canonical += '/';
+    path_ = canonical + path_.substr(end);
+
     if(path_ == "/") {
         path_ = "/index.html";
-    } else {
-        for(auto &item : DEFAULT_HTML) {
-            if(item == path_) {
-                path_ += ".html";
-                break;
-            }
-        }
+    } else if(Config::Current().pages.count(path_) == 1) {
+        path_ += ".html";
     }
 }
 
 void HttpRequest::ParsePost()
 {
-    if(method_ == "POST" &&
-       header["Content-Type"] == "application/x-www-form-urlencoded") {
+    // media type may carry parameters such as charset
+    static const string_view FORM = "application/x-www-form-urlencoded";
+    string_view type = headers_.Get(HttpHeaders::CONTENT_TYPE);
+    if(method_ == "POST" && HttpHeaders::EqualsNoCase(type.substr(0, type.find(';')), FORM)) {
         ParseEncodedURL();
 
     }
@@ -158,51 +302,9 @@ void HttpRequest::ParsePost()
 
 void HttpRequest::ParseEncodedURL()
 {
-    if(body_.size() == 0) return;
-
-    string key, value;
-    int num = 0;
-    int n = body_.size();
-    int i = 0, j = 0;
-
-    for(; i < n; i++) {
-        char ch = body_[i];
-
-        switch (ch) {
-        case '=': // the latter is key and former is value
-            key = body_.substr(j, i - j);
-            j = i + 1;
-            break;
-        case '+': // old standard see '+' as whitespace
-            body_[i] = ' ';
-            break;
-        case '%': // URL encoding
-            assert(i + 2 < n);
-            num = ConvertHexToDec(body_[i + 1]) * 16 + ConvertHexToDec(body_[i + 2]);
-            body_[i + 1] = static_cast<char>(num / 10) + '0';
-            body_[i + 2] = static_cast<char>(num % 10) + '0';
-            i += 2;
-            break;
-        case '&': // end of the key-value pair
-            value = body_.substr(j, i - j);
-            j = i + 1;
-            post[key] = value;
-            LOG_DEBUG("%s = %s", key.c_str(), value.c_str());
-            break;
-        default: break;
-        }
+    UrlCodec::ParseForm(body_, post, postArena_);
+    for(auto& field : post) {
+        LOG_DEBUG("%.*s = %.*s", (int)field.first.size(), field.first.data(),
+                  (int)field.second.size(), field.second.data());
     }
-
-    assert(j <= i);
-    if(post.count(key) == 0 && j < i) {
-        value = body_.substr(j, i - j);
-        post[key] = value;
-    }
-}
-
-int HttpRequest::ConvertHexToDec(char ch)
-{
-    if(ch >= 'A' && ch <= 'F') return static_cast<int>(ch - 'A') + 10;
-    if(ch >= 'a' && ch <= 'f') return static_cast<int>(ch - 'a') + 10;
-    return static_cast<int>(ch);
 }
@@ -7,9 +7,13 @@
 #define HTTPREQUEST_HPP
 
 #include <string>
+#include <string_view>
+#include <vector>
 #include <unordered_map>
 #include <unordered_set>
 #include "../buffer/buffer.hpp"
+#include "urlcodec.hpp"
+#include "httpheaders.hpp"
 
 class HttpRequest {
 private:
@@ -32,37 +36,59 @@ private:
         CLOSED_CONNECTION,
     };
 
+    static const std::size_t MAX_HEAD = 64 * 1024; // request line and header fields
+    static const std::size_t MAX_BODY = 16 * 1024 * 1024;
+
     PARSE_STATE state;
+    std::size_t headBytes_; // of the request line and fields taken so far
+    std::size_t contentLength_; // body bytes to wait for once the header is done
     std::string method_, path_, version_, body_;
-    std::unordered_map<std::string, std::string> header;
-    std::unordered_map<std::string, std::string> post;
+    std::string target_; // request target as sent, before path rewriting
+    HttpHeaders headers_; // values are copied once per request, read buffer is compacted under them
+    std::vector<UrlCodec::Field> post; // views into body_ or postArena_, few fields so a flat scan is enough
+    std::string postArena_; // decoded keys and values
 
-    static const std::unordered_set<std::string> DEFAULT_HTML;
     static const std::unordered_map<std::string, int> DEFAULT_HTML_TAG;
 
-    bool ParseRequestLine(const std::string& line);
-    void ParseHeader(const std::string& line);
-    void ParseBody(const std::string& line);
+    bool ParseRequestLine(std::string_view line);
+    bool ParseHeader(std::string_view line); // the empty line ends the header and sizes the body
+    void ParseBody();
     void ParsePath();
     void ParsePost();
     void ParseEncodedURL();
 
-    int ConvertHexToDec(char ch); // convert URL encoding to normal data
-
 public:
     HttpRequest();
     ~HttpRequest() = default;
+    HttpRequest(const HttpRequest& other); // post views are rebuilt for the copied body
+    HttpRequest& operator=(const HttpRequest& other);
+
+    void Init(); // reset state for next request on a keep-alive conn
 
+    // takes what has arrived of the request out of buffer, false on a bad request. a request cut
+    // between reads goes on with the next call until IsComplete, bytes behind it stay in buffer
     bool parse(Buffer& buffer);
+    bool IsComplete() const;
+    bool IsPartial() const; // some of a request was taken, the rest hasn't arrived
+    // build from fields already split by a binary framing(h2 HEADERS/DATA), routed the same way as parse()
+    void ParseFields(const std::string& method, const std::string& path,
+                     const std::vector<std::pair<std::string, std::string>>& headers, const std::string& body);
 
     std::string path() const;
     std::string& path();
     std::string method() const;
     std::string version() const;
+    const std::string& target() const; // original path and query, for forwarding
+    const std::string& body() const;
+    const HttpHeaders& headers() const;
     std::string GetPost(const std::string& key) const;
     std::string GetPost(const char* key) const;
+    std::string_view PostView(std::string_view key) const; // valid until next request on the conn
+    std::string GetHeader(const std::string& key) const; // name matches without case
+    std::string_view Header(HttpHeaders::ID id) const;
 
     bool IsKeepAlive() const;
+    bool IsH2cUpgrade() const; // client asks to switch to cleartext HTTP/2
 };
 
 #endif //HTTPREQUEST_HPP
\ No newline at end of file
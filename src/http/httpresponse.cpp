@@ -4,4 +4,423 @@
 */
 
 #include "httpresponse.hpp"
+#include <cassert>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "../log/log.hpp"
+using namespace std;
 
+const AssetBundle* HttpResponse::bundle = nullptr;
+string HttpResponse::altSvc;
+
+const unordered_map<string, string> HttpResponse::SUFFIX_TYPE = {
+    { ".html",  "text/html" },
+    { ".xml",   "text/xml" },
+    { ".xhtml", "application/xhtml+xml" },
+    { ".txt",   "text/plain" },
+    { ".rtf",   "application/rtf" },
+    { ".pdf",   "application/pdf" },
+    { ".word",  "application/nsword" },
+    { ".png",   "image/png" },
+    { ".gif",   "image/gif" },
+    { ".jpg",   "image/jpeg" },
+    { ".jpeg",  "image/jpeg" },
+    { ".au",    "audio/basic" },
+    { ".mpeg",  "video/mpeg" },
+    { ".mpg",   "video/mpeg" },
+    { ".avi",   "video/x-msvideo" },
+    { ".gz",    "application/x-gzip" },
+    { ".tar",   "application/x-tar" },
+    { ".css",   "text/css" },
+    { ".js",    "text/javascript" },
+};
+
+const unordered_map<int, string> HttpResponse::CODE_STATUS = {
+    { 200, "OK" },
+    { 304, "Not Modified" },
+    { 400, "Bad Request" },
+    { 403, "Forbidden" },
+    { 404, "Not Found" },
+    { 429, "Too Many Requests" },
+    { 502, "Bad Gateway" },
+    { 503, "Service Unavailable" },
+};
+
+const unordered_map<int, string> HttpResponse::CODE_PATH = {
+    { 400, "/400.html" },
+    { 403, "/403.html" },
+    { 404, "/404.html" },
+};
+
+HttpResponse::HttpResponse() : code_(-1), isKeepAlive_(false), path_(""), srcDir_(""),
+                               mmFile_(nullptr), mmFileState_({0}), fileFd_(-1), fromBundle_(false),
+                               acceptGzip_(false), gzipped_(false),
+                               producer_(nullptr), chunked_(true), streamEnd_(true), chunkBuffer_(CHUNK_SIZE)
+{
+}
+
+HttpResponse::~HttpResponse()
+{
+    UnmapFIle();
+}
+
+void HttpResponse::init(const string& srcDir, string& path, bool isKeepAlive, int code)
+{
+    assert(srcDir != "");
+    UnmapFIle();
+
+    code_ = code;
+    isKeepAlive_ = isKeepAlive;
+    path_ = path;
+    srcDir_ = srcDir;
+    mmFile_ = nullptr;
+    mmFileState_ = {0};
+    type_ = etag_ = string_view();
+    acceptGzip_ = gzipped_ = false;
+    ifNoneMatch_.clear();
+    cookie_.clear();
+    producer_ = nullptr;
+    chunked_ = true;
+    streamEnd_ = true;
+}
+
+void HttpResponse::SetAcceptGzip(bool accept)
+{
+    acceptGzip_ = accept;
+}
+
+void HttpResponse::SetIfNoneMatch(string_view etags)
+{
+    ifNoneMatch_.assign(etags.data(), etags.size());
+}
+
+void HttpResponse::SetCookie(const string& cookie)
+{
+    cookie_ = cookie;
+}
+
+void HttpResponse::SetBody(shared_ptr<const string> body)
+{
+    body_ = std::move(body);
+}
+
+bool HttpResponse::AcceptsGzip(string_view acceptEncoding)
+{
+    size_t pos = 0;
+    while(pos < acceptEncoding.size()) {
+        size_t end = acceptEncoding.find(',', pos);
+        if(end == string_view::npos) end = acceptEncoding.size();
+        string_view item = acceptEncoding.substr(pos, end - pos);
+        pos = end + 1;
+        size_t semi = item.find(';');
+        string_view coding = item.substr(0, semi);
+        while(!coding.empty() && (coding.front() == ' ' || coding.front() == '\t')) coding.remove_prefix(1);
+        while(!coding.empty() && (coding.back() == ' ' || coding.back() == '\t')) coding.remove_suffix(1);
+        if(coding != "gzip" && coding != "*") continue;
+        // "gzip;q=0" and "gzip;q=0.000" refuse it
+        if(semi == string_view::npos) return true;
+        string_view params = item.substr(semi + 1);
+        size_t q = params.find("q=");
+        if(q == string_view::npos) return true;
+        for(size_t i = q + 2; i < params.size() && params[i] != ' '; i++) {
+            if(params[i] >= '1' && params[i] <= '9') return true;
+        }
+    }
+    return false;
+}
+
+const string& HttpResponse::Prerendered(int code)
+{
+    // rendered once, shedding load must not cost a file access
+    static const unordered_map<int, string> rendered = []() {
+        unordered_map<int, string> res;
+        for(int c : {429, 502, 503}) {
+            const string& status = CODE_STATUS.find(c)->second;
+            string body = to_string(c) + " : " + status + "\n";
+            res[c] = "HTTP/1.1 " + to_string(c) + " " + status + "\r\n"
+                     "Connection: close\r\nRetry-After: 1\r\nContent-type: text/plain\r\n"
+                     "Content-length: " + to_string(body.size()) + "\r\n\r\n" + body;
+        }
+        return res;
+    }();
+    auto it = rendered.find(code);
+    assert(it != rendered.end());
+    return it->second;
+}
+
+void HttpResponse::MakeResponse(Buffer& buffer)
+{
+    CheckFile();
+    ChangeToErrorHtml();
+    AddStateLine(buffer);
+    AddHeader(buffer);
+    AddContent(buffer);
+}
+
+void HttpResponse::MakeBody()
+{
+    CheckFile();
+    ChangeToErrorHtml();
+    if(CODE_STATUS.count(code_) == 0) code_ = 400;
+    if(producer_) {
+        streamEnd_ = false;
+    } else {
+        MapFile();
+    }
+}
+
+void HttpResponse::CheckFile()
+{
+    if(producer_) {
+        // generated content has no file behind it
+        if(code_ == -1) code_ = 200;
+    } else if(body_) {
+        if(code_ == -1) code_ = 200;
+        mmFile_ = const_cast<char*>(body_->data());
+        mmFileState_ = {0};
+        mmFileState_.st_size = body_->size();
+    } else if(bundle) {
+        // no filesystem access at all, a miss is a 404
+        if(!FindAsset()) {
+            code_ = 404;
+        } else if(code_ == -1 || code_ == 200) {
+            code_ = 200;
+            if(!ifNoneMatch_.empty() && (ifNoneMatch_ == "*" || ifNoneMatch_.find(etag_) != string::npos)) {
+                code_ = 304;
+                mmFile_ = nullptr;
+                mmFileState_.st_size = 0;
+            }
+        }
+    } else if(stat((srcDir_ + path_).data(), &mmFileState_) < 0 || S_ISDIR(mmFileState_.st_mode)) {
+        code_ = 404;
+    } else if(!(mmFileState_.st_mode & S_IROTH)) {
+        code_ = 403;
+    } else if(code_ == -1) {
+        code_ = 200;
+    }
+}
+
+char* HttpResponse::file()
+{
+    return mmFile_;
+}
+
+size_t HttpResponse::FileLength() const
+{
+    return mmFileState_.st_size;
+}
+
+int HttpResponse::FileFd()
+{
+    if(fromBundle_ || body_) return -1; // written from memory
+    if(fileFd_ < 0 && mmFile_) fileFd_ = open((srcDir_ + path_).data(), O_RDONLY | O_CLOEXEC);
+    return fileFd_;
+}
+
+void HttpResponse::ChangeToErrorHtml()
+{
+    if(CODE_PATH.count(code_) == 1) {
+        producer_ = nullptr; // error page is always a file
+        if(body_) {
+            body_.reset();
+            mmFile_ = nullptr;
+        }
+        path_ = CODE_PATH.find(code_)->second;
+        if(bundle) {
+            acceptGzip_ = false;
+            mmFile_ = nullptr;
+            mmFileState_ = {0};
+            fromBundle_ = false;
+            FindAsset();
+        } else {
+            stat((srcDir_ + path_).data(), &mmFileState_);
+        }
+    }
+}
+
+void HttpResponse::AddStateLine(Buffer& buffer)
+{
+    string status;
+    if(CODE_STATUS.count(code_) == 1) {
+        status = CODE_STATUS.find(code_)->second;
+    } else {
+        code_ = 400;
+        status = CODE_STATUS.find(400)->second;
+    }
+    buffer.Append("HTTP/1.1 " + to_string(code_) + " " + status + "\r\n");
+}
+
+void HttpResponse::AddHeader(Buffer& buffer)
+{
+    buffer.Append("Connection: ");
+    if(isKeepAlive_) {
+        buffer.Append("keep-alive\r\n");
+        buffer.Append("keep-alive: max=6, timeout=120\r\n");
+    } else {
+        buffer.Append("close\r\n");
+    }
+    buffer.Append("Content-type: " + GetFileType() + "\r\n");
+    if(fromBundle_ && (code_ == 200 || code_ == 304)) {
+        buffer.Append("ETag: " + string(etag_) + "\r\nVary: Accept-Encoding\r\n");
+        if(gzipped_) buffer.Append("Content-Encoding: gzip\r\n");
+    }
+    if(!cookie_.empty()) buffer.Append("Set-Cookie: " + cookie_ + "\r\n");
+    if(!altSvc.empty()) buffer.Append("Alt-Svc: " + altSvc + "\r\n");
+}
+
+void HttpResponse::AddContent(Buffer& buffer)
+{
+    if(producer_) {
+        // length is unknown, body is pulled chunk by chunk when socket is writable
+        streamEnd_ = false;
+        buffer.Append(chunked_ ? "Transfer-Encoding: chunked\r\n\r\n" : "\r\n");
+        return;
+    }
+    if(code_ == 304) {
+        buffer.Append("\r\n");
+        return;
+    }
+
+    if(!MapFile()) {
+        ErrorContent(buffer, "File NotFound!");
+        return;
+    }
+    buffer.Append("Content-length: " + to_string(mmFileState_.st_size) + "\r\n\r\n");
+}
+
+bool HttpResponse::MapFile()
+{
+    if(body_) return true;
+    if(bundle) return fromBundle_ && mmFile_;
+    int srcFd = open((srcDir_ + path_).data(), O_RDONLY);
+    if(srcFd < 0) return false;
+
+    // map file into memory to speed up file access
+    LOG_DEBUG("file path %s", (srcDir_ + path_).data());
+    void* mmRet = mmap(0, mmFileState_.st_size, PROT_READ, MAP_PRIVATE, srcFd, 0);
+    close(srcFd);
+    if(mmRet == MAP_FAILED) return false;
+    mmFile_ = static_cast<char*>(mmRet);
+    return true;
+}
+
+bool HttpResponse::FindAsset()
+{
+    AssetBundle::Asset asset;
+    if(!bundle->Find(path_, asset)) return false;
+    gzipped_ = acceptGzip_ && asset.gzip;
+    mmFile_ = const_cast<char*>(gzipped_ ? asset.gzip : asset.data);
+    mmFileState_ = {0};
+    mmFileState_.st_size = gzipped_ ? asset.gzipLen : asset.dataLen;
+    type_ = asset.type;
+    etag_ = gzipped_ ? asset.gzipEtag : asset.etag;
+    fromBundle_ = true;
+    return true;
+}
+
+void HttpResponse::UnmapFIle()
+{
+    if(mmFile_ && !fromBundle_ && !body_) munmap(mmFile_, mmFileState_.st_size);
+    mmFile_ = nullptr;
+    fromBundle_ = false;
+    body_.reset();
+    if(fileFd_ >= 0) {
+        close(fileFd_);
+        fileFd_ = -1;
+    }
+}
+
+string HttpResponse::GetFileType() const
+{
+    if(fromBundle_) return string(type_);
+    return MimeType(path_);
+}
+
+string HttpResponse::MimeType(const string& path)
+{
+    string::size_type idx = path.find_last_of('.');
+    if(idx == string::npos) return "text/plain";
+
+    string suffix = path.substr(idx);
+    if(SUFFIX_TYPE.count(suffix) == 1) return SUFFIX_TYPE.find(suffix)->second;
+    return "text/plain";
+}
+
+void HttpResponse::ErrorContent(Buffer& buffer, string message)
+{
+    string body;
+    string status;
+    body += "<html><title>Error</title>";
+    body += "<body bgcolor=\"ffffff\">";
+    if(CODE_STATUS.count(code_) == 1) {
+        status = CODE_STATUS.find(code_)->second;
+    } else {
+        status = "Bad Request";
+    }
+    body += to_string(code_) + " : " + status + "\n";
+    body += "<p>" + message + "</p>";
+    body += "<hr><em>TinyWebServer</em></body></html>";
+
+    buffer.Append("Content-length: " + to_string(body.size()) + "\r\n\r\n");
+    buffer.Append(body);
+}
+
+int HttpResponse::code() const
+{
+    return code_;
+}
+
+void HttpResponse::SetBodyProducer(BodyProducer producer)
+{
+    producer_ = std::move(producer);
+}
+
+void HttpResponse::SetChunked(bool chunked)
+{
+    chunked_ = chunked;
+    if(!chunked_) isKeepAlive_ = false;
+}
+
+bool HttpResponse::IsStreaming() const
+{
+    return producer_ && !streamEnd_;
+}
+
+size_t HttpResponse::ProduceChunk(Buffer& buffer)
+{
+    if(!IsStreaming()) return 0;
+
+    chunkBuffer_.RetrieveAll();
+    bool more = Produce(chunkBuffer_, CHUNK_SIZE);
+    size_t len = chunkBuffer_.ReadableBytes();
+    assert(len <= CHUNK_SIZE);
+
+    size_t before = buffer.ReadableBytes();
+    if(!chunked_) {
+        buffer.Append(chunkBuffer_);
+    } else if(len > 0) {
+        // chunk = size in hex, CRLF, payload, CRLF
+        char head[20] = {0};
+        int n = snprintf(head, sizeof(head), "%zx\r\n", len);
+        buffer.Append(head, n);
+        buffer.Append(chunkBuffer_);
+        buffer.Append("\r\n", 2);
+    }
+    if(!more && chunked_) {
+        buffer.Append("0\r\n\r\n", 5); // last chunk without trailer
+    }
+    return buffer.ReadableBytes() - before;
+}
+
+bool HttpResponse::Produce(Buffer& buffer, size_t maxLen)
+{
+    if(!IsStreaming()) return false;
+    if(!producer_(buffer, maxLen)) {
+        streamEnd_ = true;
+        producer_ = nullptr;
+        return false;
+    }
+    return true;
+}
@@ -7,11 +7,25 @@
 #define HTTPRESPONSE_HPP
 
 #include <string>
+#include <string_view>
+#include <functional>
+#include <memory>
 #include <sys/stat.h>
 #include <unordered_map>
 #include "../buffer/buffer.hpp"
+#include "assetbundle.hpp"
 
 class HttpResponse {
+public:
+    // generated content source, append at most maxLen bytes into buffer, return false after the last piece.
+    // runs on whichever worker writes the conn, an empty piece is asked again at once so it must not wait
+    typedef std::function<bool(Buffer& buffer, std::size_t maxLen)> BodyProducer;
+
+    static const std::size_t CHUNK_SIZE = 16 * 1024; // max payload of one chunk
+
+    static const AssetBundle* bundle; // files are served from here instead of srcDir when set
+    static std::string altSvc; // Alt-Svc value sent with every HTTP/1.x response, empty for none
+
 private:
     int code_; // status code
     bool isKeepAlive_;
@@ -21,19 +35,35 @@ private:
 
     char* mmFile_; // file itself
     struct stat mmFileState_; // file state
+    int fileFd_; // only opened for sendfile, closed with the mapping
+
+    bool fromBundle_; // mmFile_ points into bundle, nothing to unmap
+    std::string_view type_; // precomputed by the bundle
+    std::string_view etag_;
+    bool acceptGzip_;
+    bool gzipped_; // serving the precompressed variant
+    std::string ifNoneMatch_;
+    std::string cookie_; // Set-Cookie value, sent with any status
+    std::shared_ptr<const std::string> body_; // generated in memory (image variants), served instead of the file
+
+    BodyProducer producer_; // if set, body is streamed with Transfer-Encoding: chunked
+    bool chunked_; // false for HTTP/1.0 clients, then the stream goes unframed and the close ends it
+    bool streamEnd_; // last chunk has been produced
+    Buffer chunkBuffer_; // temp space for one chunk payload
 
     static const std::unordered_map<std::string, std::string> SUFFIX_TYPE;
     static const std::unordered_map<int, std::string> CODE_STATUS;
     static const std::unordered_map<int, std::string> CODE_PATH;
 
+    void CheckFile(); // decide status code by file state
     void ChangeToErrorHtml(); // if state is error, change file to error page
+    bool MapFile(); // mmap file of path_, false if it can't be opened
+    bool FindAsset(); // look path_ up in bundle, set file and length
 
     void AddStateLine(Buffer& buffer); // add state line
     void AddHeader(Buffer& buffer); // add header(Connection: keep-alive: Content-type:)
     void AddContent(Buffer& buffer); // just add file length to header, but why?
 
-    std::string GetFileType() const; // get file's type through suffix
-
 public:
     HttpResponse(); // normally init values = 0
     ~HttpResponse();
@@ -43,11 +73,30 @@ public:
 
     char* file(); // get file
     size_t FileLength() const; // get file length
+    int FileFd(); // fd of the mapped file for sendfile, opened on first call, -1 on error
     void ErrorContent(Buffer& buffer, std::string message); // create a error html page and add into buffer
     int code() const; // get status code
+    std::string GetFileType() const; // get file's type through suffix
+    static std::string MimeType(const std::string& path);
+    static bool AcceptsGzip(std::string_view acceptEncoding); // gzip or * listed without q=0
+
+    // request side of the bundle features, call after init: gzip variant, 304 on a matching ETag
+    void SetAcceptGzip(bool accept);
+    void SetIfNoneMatch(std::string_view etags);
+    void SetCookie(const std::string& cookie); // call after init
+    void SetBody(std::shared_ptr<const std::string> body); // call after init, typed by the path suffix
+
+    static const std::string& Prerendered(int code); // whole close response for 429/502/503, no file behind it
 
     void MakeResponse(Buffer& buffer);
+    void MakeBody(); // same as MakeResponse without HTTP/1.x header, for frames that carry header themselves
     void UnmapFIle(); // unmap file
+
+    void SetBodyProducer(BodyProducer producer); // stream generated body instead of file, call before MakeResponse
+    void SetChunked(bool chunked); // call after init, false drops keep-alive too
+    bool IsStreaming() const; // there are still chunks to produce
+    std::size_t ProduceChunk(Buffer& buffer); // append next encoded chunk into buffer, return bytes appended
+    bool Produce(Buffer& buffer, std::size_t maxLen); // append raw generated data, return false after the last piece
 };
 
 #endif //HTTPRESPONSE_HPP
\ No newline at end of file
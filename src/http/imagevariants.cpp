@@ -0,0 +1,481 @@
+/*
+ * @author: Zimo Li
+ * @date: 2026-10-19
+*/
+
+#include "imagevariants.hpp"
+#include <algorithm>
+#include <cassert>
+#include <csetjmp>
+#include <cstdio>
+#include <cstdlib>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <jpeglib.h>
+#include "../log/log.hpp"
+#include "../buffer/memstats.hpp"
+using namespace std;
+
+const int ImageVariants::WIDTHS[] = { 160, 320, 480, 640, 960, 1280, 1920 };
+const int ImageVariants::WIDTH_STEPS = sizeof(WIDTHS) / sizeof(WIDTHS[0]);
+const int ImageVariants::DEFAULT_QUALITY;
+const int ImageVariants::MAX_PIXELS;
+
+namespace {
+
+const char CACHE_SUFFIX[] = ".jpg";
+const size_t NAME_LEN = 16; // hex digits of the key hash
+
+// libjpeg reports errors by calling error_exit, which must not return
+struct JpegError {
+    jpeg_error_mgr mgr;
+    jmp_buf jump;
+};
+
+void OnJpegError(j_common_ptr cinfo)
+{
+    longjmp(reinterpret_cast<JpegError*>(cinfo->err)->jump, 1);
+}
+
+void OnJpegMessage(j_common_ptr)
+{
+    // corrupt data warnings, the image is still usable
+}
+
+void InitError(JpegError& err)
+{
+    jpeg_std_error(&err.mgr);
+    err.mgr.error_exit = OnJpegError;
+    err.mgr.output_message = OnJpegMessage;
+}
+
+string CacheName(const string& key)
+{
+    // FNV-1a
+    uint64_t h = 1469598103934665603ULL;
+    for(unsigned char c : key) {
+        h ^= c;
+        h *= 1099511628211ULL;
+    }
+    static const char HEX[] = "0123456789abcdef";
+    string name(NAME_LEN, '0');
+    for(size_t i = 0; i < NAME_LEN; i++) name[i] = HEX[(h >> (60 - i * 4)) & 0xf];
+    return name + CACHE_SUFFIX;
+}
+
+bool ReadFile(const string& path, string& data)
+{
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0) return false;
+    struct stat st;
+    bool ok = fstat(fd, &st) == 0;
+    if(ok) {
+        data.resize(st.st_size);
+        size_t done = 0;
+        while(done < data.size()) {
+            ssize_t len = read(fd, &data[done], data.size() - done);
+            if(len <= 0) break;
+            done += len;
+        }
+        ok = done == data.size();
+    }
+    close(fd);
+    return ok;
+}
+
+// box filter, every source pixel lands in exactly one output pixel
+void ScaleDown(const vector<unsigned char>& src, int sw, int sh, int comps,
+               vector<unsigned char>& dst, int dw, int dh)
+{
+    dst.resize(static_cast<size_t>(dw) * dh * comps);
+    vector<uint32_t> sum(static_cast<size_t>(dw) * comps);
+    for(int y = 0; y < dh; y++) {
+        int y0 = static_cast<int>(static_cast<int64_t>(y) * sh / dh);
+        int y1 = max(y0 + 1, static_cast<int>(static_cast<int64_t>(y + 1) * sh / dh));
+        fill(sum.begin(), sum.end(), 0);
+        for(int sy = y0; sy < y1; sy++) {
+            const unsigned char* row = &src[static_cast<size_t>(sy) * sw * comps];
+            for(int x = 0; x < dw; x++) {
+                int x0 = static_cast<int>(static_cast<int64_t>(x) * sw / dw);
+                int x1 = max(x0 + 1, static_cast<int>(static_cast<int64_t>(x + 1) * sw / dw));
+                for(int sx = x0; sx < x1; sx++) {
+                    for(int c = 0; c < comps; c++) sum[x * comps + c] += row[sx * comps + c];
+                }
+            }
+        }
+        unsigned char* out = &dst[static_cast<size_t>(y) * dw * comps];
+        for(int x = 0; x < dw; x++) {
+            int x0 = static_cast<int>(static_cast<int64_t>(x) * sw / dw);
+            int x1 = max(x0 + 1, static_cast<int>(static_cast<int64_t>(x + 1) * sw / dw));
+            uint32_t area = static_cast<uint32_t>((x1 - x0) * (y1 - y0));
+            for(int c = 0; c < comps; c++) out[x * comps + c] = (sum[x * comps + c] + area / 2) / area;
+        }
+    }
+}
+
+}
+
+ImageVariants::ImageVariants(const string& srcDir, const string& prefix, const string& cacheDir,
+                             size_t memBytes, size_t diskBytes, int threads) :
+    srcDir_(srcDir), prefix_(prefix), cacheDir_(cacheDir), memBytes_(0), memLimit_(memBytes),
+    diskBytes_(0), diskLimit_(diskBytes), stats_({0, 0, 0, 0, 0}), pool_(max(threads, 1))
+{
+    if(!cacheDir_.empty()) {
+        if(cacheDir_.back() != '/') cacheDir_ += '/';
+        mkdir(cacheDir_.c_str(), 0755);
+        ScanCache();
+    }
+}
+
+ImageVariants::~ImageVariants()
+{
+    pool_.Shutdown(chrono::milliseconds(10000));
+    MemStats::Add(MemStats::IMAGE_CACHE, -static_cast<int64_t>(memBytes_));
+}
+
+void ImageVariants::ScanCache()
+{
+    DIR* dir = opendir(cacheDir_.c_str());
+    if(!dir) return;
+    vector<pair<time_t, pair<string, size_t>>> found;
+    while(dirent* ent = readdir(dir)) {
+        string name = ent->d_name;
+        string path = cacheDir_ + name;
+        struct stat st;
+        if(stat(path.c_str(), &st) < 0 || !S_ISREG(st.st_mode)) continue;
+        if(name.size() != NAME_LEN + sizeof(CACHE_SUFFIX) - 1 ||
+           name.compare(NAME_LEN, string::npos, CACHE_SUFFIX) != 0) {
+            // cut off by a crash
+            if(name.size() > 4 && name.compare(name.size() - 4, 4, ".tmp") == 0) unlink(path.c_str());
+            continue;
+        }
+        found.push_back({st.st_mtime, {name, static_cast<size_t>(st.st_size)}});
+    }
+    closedir(dir);
+    // newest first, the order it would have had in the LRU
+    sort(found.begin(), found.end(), [](auto& a, auto& b) { return a.first > b.first; });
+    for(auto& f : found) {
+        diskLru_.push_back(f.second.first);
+        disk_[f.second.first] = {f.second.second, prev(diskLru_.end())};
+        diskBytes_ += f.second.second;
+    }
+    while(diskBytes_ > diskLimit_ && !diskLru_.empty()) {
+        auto it = disk_.find(diskLru_.back());
+        diskBytes_ -= it->second.size;
+        unlink((cacheDir_ + it->first).c_str());
+        disk_.erase(it);
+        diskLru_.pop_back();
+    }
+    if(!disk_.empty()) LOG_INFO("%zu image variants (%zu bytes) in %s", disk_.size(), diskBytes_, cacheDir_.c_str());
+}
+
+bool ImageVariants::Parse(string& path, Spec& spec) const
+{
+    size_t mark = path.find('?');
+    if(mark == string::npos || path.compare(0, prefix_.size(), prefix_) != 0) return false;
+    string_view query(path);
+    query.remove_prefix(mark + 1);
+    int width = 0, quality = 0;
+    while(!query.empty()) {
+        size_t end = query.find('&');
+        string_view item = query.substr(0, end);
+        query = end == string_view::npos ? string_view() : query.substr(end + 1);
+        if(item.size() < 3 || item[1] != '=') continue;
+        int value = atoi(string(item.substr(2)).c_str());
+        if(item[0] == 'w') width = value;
+        else if(item[0] == 'q') quality = value;
+    }
+    path.resize(mark); // cache busting queries and the like are ignored, the file is served as it is
+    string_view ext(path);
+    size_t dot = ext.rfind('.');
+    ext = dot == string_view::npos ? string_view() : ext.substr(dot);
+    if((width <= 0 && quality <= 0) || (ext != ".jpg" && ext != ".jpeg")) return false;
+
+    spec.path = path;
+    spec.width = 0;
+    if(width > 0) {
+        spec.width = WIDTHS[WIDTH_STEPS - 1];
+        for(int i = 0; i < WIDTH_STEPS; i++) {
+            if(WIDTHS[i] >= width) {
+                spec.width = WIDTHS[i];
+                break;
+            }
+        }
+    }
+    // tens from 30 to 90, above that files grow fast for no visible gain
+    spec.quality = quality > 0 ? min(max((quality + 5) / 10 * 10, 30), 90) : DEFAULT_QUALITY;
+    return true;
+}
+
+ImageVariants::Awaiter ImageVariants::Get(const Spec& spec)
+{
+    // the source's identity is part of the key, a replaced file gets new variants
+    struct stat st;
+    if(stat((srcDir_ + spec.path).c_str(), &st) < 0 || !S_ISREG(st.st_mode)) {
+        lock_guard<mutex> locker(mtx_);
+        stats_.failed++;
+        return Awaiter(this, "", spec);
+    }
+    string key = spec.path + '|' + to_string(spec.width) + '|' + to_string(spec.quality) + '|' +
+                 to_string(st.st_mtim.tv_sec) + '.' + to_string(st.st_mtim.tv_nsec) + '|' + to_string(st.st_size);
+    return Awaiter(this, std::move(key), spec);
+}
+
+bool ImageVariants::Wait(const string& key, const Spec& spec, coroutine_handle<> handle, Image* result)
+{
+    CoScheduler* sched = CoScheduler::Current();
+    assert(sched);
+    lock_guard<mutex> locker(mtx_);
+    auto hit = mem_.find(key);
+    if(hit != mem_.end()) {
+        memLru_.splice(memLru_.begin(), memLru_, hit->second.pos);
+        *result = hit->second.image;
+        stats_.memHits++;
+        return false; // no need to suspend
+    }
+    auto job = jobs_.find(key);
+    if(job != jobs_.end()) {
+        job->second.push_back({sched, handle, result});
+        stats_.coalesced++;
+        return true;
+    }
+    jobs_[key].push_back({sched, handle, result});
+    pool_.addTask([this, key, spec] { Encode(key, spec); });
+    return true;
+}
+
+void ImageVariants::Encode(string key, Spec spec)
+{
+    string name = CacheName(key);
+    Image image = ReadCached(name);
+    bool encoded = false;
+    if(!image) {
+        string source, out;
+        if(ReadFile(srcDir_ + spec.path, source) && Resize(source, spec.width, spec.quality, out)) {
+            WriteCached(name, out);
+            image = make_shared<const string>(std::move(out));
+            encoded = true;
+        } else {
+            LOG_WARN("no variant of %s", spec.path.c_str());
+        }
+    }
+
+    vector<Waiter> waiters;
+    {
+        lock_guard<mutex> locker(mtx_);
+        if(image) {
+            Remember(key, image);
+            if(encoded) stats_.encodes++;
+            else stats_.diskHits++;
+        } else {
+            stats_.failed++;
+        }
+        auto job = jobs_.find(key);
+        waiters.swap(job->second);
+        jobs_.erase(job);
+    }
+    for(Waiter& w : waiters) {
+        *w.result = image;
+        coroutine_handle<> handle = w.handle;
+        w.sched->Post([handle] { handle.resume(); });
+    }
+}
+
+ImageVariants::Image ImageVariants::ReadCached(const string& name)
+{
+    if(cacheDir_.empty()) return nullptr;
+    {
+        lock_guard<mutex> locker(mtx_);
+        auto it = disk_.find(name);
+        if(it == disk_.end()) return nullptr;
+        diskLru_.splice(diskLru_.begin(), diskLru_, it->second.pos);
+    }
+    string data;
+    if(!ReadFile(cacheDir_ + name, data)) return nullptr; // evicted meanwhile, encode again
+    return make_shared<const string>(std::move(data));
+}
+
+void ImageVariants::WriteCached(const string& name, const string& data)
+{
+    if(cacheDir_.empty() || data.size() > diskLimit_) return;
+    string path = cacheDir_ + name, tmp = path + ".tmp";
+    FILE* fp = fopen(tmp.c_str(), "wb");
+    if(!fp) return;
+    bool ok = fwrite(data.data(), 1, data.size(), fp) == data.size();
+    ok = fclose(fp) == 0 && ok;
+    if(!ok || rename(tmp.c_str(), path.c_str()) < 0) {
+        unlink(tmp.c_str());
+        return;
+    }
+    vector<string> evicted;
+    {
+        lock_guard<mutex> locker(mtx_);
+        auto it = disk_.find(name);
+        if(it != disk_.end()) {
+            diskBytes_ -= it->second.size;
+            diskLru_.erase(it->second.pos);
+            disk_.erase(it);
+        }
+        diskLru_.push_front(name);
+        disk_[name] = {data.size(), diskLru_.begin()};
+        diskBytes_ += data.size();
+        while(diskBytes_ > diskLimit_) {
+            auto old = disk_.find(diskLru_.back());
+            diskBytes_ -= old->second.size;
+            evicted.push_back(old->first);
+            disk_.erase(old);
+            diskLru_.pop_back();
+        }
+    }
+    for(auto& e : evicted) unlink((cacheDir_ + e).c_str());
+}
+
+void ImageVariants::Remember(const string& key, const Image& image)
+{
+    if(image->size() > memLimit_ || mem_.count(key) == 1) return;
+    memLru_.push_front(key);
+    mem_[key] = {image, memLru_.begin()};
+    memBytes_ += image->size();
+    MemStats::Add(MemStats::IMAGE_CACHE, image->size());
+    EvictMem(memLimit_);
+}
+
+size_t ImageVariants::EvictMem(size_t limit)
+{
+    size_t freed = 0;
+    while(memBytes_ > limit) {
+        auto old = mem_.find(memLru_.back());
+        freed += old->second.image->size();
+        memBytes_ -= old->second.image->size();
+        mem_.erase(old);
+        memLru_.pop_back();
+    }
+    MemStats::Add(MemStats::IMAGE_CACHE, -static_cast<int64_t>(freed));
+    return freed;
+}
+
+size_t ImageVariants::Trim(size_t memBytes)
+{
+    lock_guard<mutex> locker(mtx_);
+    return EvictMem(memBytes);
+}
+
+ImageVariants::Stats ImageVariants::GetStats()
+{
+    lock_guard<mutex> locker(mtx_);
+    return stats_;
+}
+
+size_t ImageVariants::MemBytes()
+{
+    lock_guard<mutex> locker(mtx_);
+    return memBytes_;
+}
+
+size_t ImageVariants::DiskBytes()
+{
+    lock_guard<mutex> locker(mtx_);
+    return diskBytes_;
+}
+
+bool ImageVariants::Dimensions(const string& jpeg, int& width, int& height)
+{
+    jpeg_decompress_struct cinfo;
+    JpegError err;
+    cinfo.err = &err.mgr;
+    InitError(err);
+    jpeg_create_decompress(&cinfo);
+    if(setjmp(err.jump)) {
+        jpeg_destroy_decompress(&cinfo);
+        return false;
+    }
+    jpeg_mem_src(&cinfo, reinterpret_cast<const unsigned char*>(jpeg.data()), jpeg.size());
+    jpeg_read_header(&cinfo, TRUE);
+    width = cinfo.image_width;
+    height = cinfo.image_height;
+    jpeg_destroy_decompress(&cinfo);
+    return true;
+}
+
+bool ImageVariants::Resize(const string& jpeg, int width, int quality, string& out)
+{
+    // no locals with destructors are created between setjmp and the calls that may longjmp
+    vector<unsigned char> pixels, scaled;
+    unsigned char* encoded = nullptr;
+    unsigned long encodedLen = 0;
+    jpeg_decompress_struct dinfo;
+    jpeg_compress_struct cinfo;
+    JpegError derr, cerr;
+    dinfo.err = &derr.mgr;
+    InitError(derr);
+    jpeg_create_decompress(&dinfo);
+    if(setjmp(derr.jump)) {
+        jpeg_destroy_decompress(&dinfo);
+        return false;
+    }
+    jpeg_mem_src(&dinfo, reinterpret_cast<const unsigned char*>(jpeg.data()), jpeg.size());
+    jpeg_read_header(&dinfo, TRUE);
+    if(dinfo.image_width == 0 || static_cast<uint64_t>(dinfo.image_width) * dinfo.image_height > MAX_PIXELS ||
+       (dinfo.jpeg_color_space != JCS_GRAYSCALE && dinfo.jpeg_color_space != JCS_YCbCr &&
+        dinfo.jpeg_color_space != JCS_RGB)) {
+        jpeg_destroy_decompress(&dinfo);
+        return false;
+    }
+    int target = width > 0 ? min(width, static_cast<int>(dinfo.image_width)) : dinfo.image_width;
+    // the DCT scales by 1/2, 1/4 or 1/8 almost for free while decoding, the box filter does the rest
+    dinfo.scale_num = 1;
+    dinfo.scale_denom = 1;
+    while(dinfo.scale_denom < 8 && (dinfo.image_width + dinfo.scale_denom * 2 - 1) / (dinfo.scale_denom * 2) >= static_cast<unsigned>(target)) {
+        dinfo.scale_denom *= 2;
+    }
+    dinfo.out_color_space = dinfo.jpeg_color_space == JCS_GRAYSCALE ? JCS_GRAYSCALE : JCS_RGB;
+    jpeg_start_decompress(&dinfo);
+    int sw = dinfo.output_width, sh = dinfo.output_height, comps = dinfo.output_components;
+    pixels.resize(static_cast<size_t>(sw) * sh * comps);
+    while(dinfo.output_scanline < dinfo.output_height) {
+        JSAMPROW row = &pixels[static_cast<size_t>(dinfo.output_scanline) * sw * comps];
+        jpeg_read_scanlines(&dinfo, &row, 1);
+    }
+    jpeg_finish_decompress(&dinfo);
+    jpeg_destroy_decompress(&dinfo);
+
+    int dw = min(target, sw);
+    int dh = max(1, static_cast<int>((static_cast<int64_t>(sh) * dw + sw / 2) / sw));
+    const vector<unsigned char>* src = &pixels;
+    if(dw != sw) {
+        ScaleDown(pixels, sw, sh, comps, scaled, dw, dh);
+        src = &scaled;
+    } else {
+        dh = sh;
+    }
+
+    cinfo.err = &cerr.mgr;
+    InitError(cerr);
+    jpeg_create_compress(&cinfo);
+    if(setjmp(cerr.jump)) {
+        jpeg_destroy_compress(&cinfo);
+        free(encoded);
+        return false;
+    }
+    jpeg_mem_dest(&cinfo, &encoded, &encodedLen);
+    cinfo.image_width = dw;
+    cinfo.image_height = dh;
+    cinfo.input_components = comps;
+    cinfo.in_color_space = comps == 1 ? JCS_GRAYSCALE : JCS_RGB;
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, quality, TRUE);
+    cinfo.optimize_coding = TRUE;
+    jpeg_simple_progression(&cinfo); // a few percent smaller, and shows early on slow links
+    jpeg_start_compress(&cinfo, TRUE);
+    while(cinfo.next_scanline < cinfo.image_height) {
+        JSAMPROW row = const_cast<unsigned char*>(&(*src)[static_cast<size_t>(cinfo.next_scanline) * dw * comps]);
+        jpeg_write_scanlines(&cinfo, &row, 1);
+    }
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+    out.assign(reinterpret_cast<char*>(encoded), encodedLen);
+    free(encoded);
+    return true;
+}
@@ -0,0 +1,129 @@
+/*
+ * @author: Zimo Li
+ * @date: 2026-10-19
+*/
+
+#ifndef IMAGEVARIANTS_HPP
+#define IMAGEVARIANTS_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <coroutine>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "../pool/threadpool.hpp"
+#include "../coro/scheduler.hpp"
+
+// smaller copies of the JPEGs under a path prefix, asked for as "/images/a.jpg?w=320&q=60". widths and
+// qualities snap to a few steps, so clients can't fill the cache with one-off sizes. encoding runs on a
+// pool of its own, and a variant wanted by many requests at once is encoded once and handed to all of
+// them. results are kept in a memory LRU and in a directory LRU that survives a restart
+class ImageVariants {
+public:
+    typedef std::shared_ptr<const std::string> Image; // held by responses while they are written
+
+    struct Spec {
+        std::string path; // source, query stripped
+        int width; // 0 keeps the source width
+        int quality;
+    };
+
+    struct Stats {
+        uint64_t memHits;
+        uint64_t diskHits;
+        uint64_t encodes;
+        uint64_t coalesced; // requests that waited on an encode someone else started
+        uint64_t failed; // source missing or not a JPEG we can decode
+    };
+
+    static const int WIDTHS[]; // a width asks for the next step up, the last one caps it
+    static const int WIDTH_STEPS;
+    static const int DEFAULT_QUALITY = 75;
+    static const int MAX_PIXELS = 50 * 1000 * 1000; // bigger sources are not decoded
+
+private:
+    struct Waiter {
+        CoScheduler* sched;
+        std::coroutine_handle<> handle;
+        Image* result;
+    };
+
+    struct MemEntry {
+        Image image;
+        std::list<std::string>::iterator pos;
+    };
+
+    struct DiskEntry {
+        std::size_t size;
+        std::list<std::string>::iterator pos;
+    };
+
+    std::string srcDir_;
+    std::string prefix_;
+    std::string cacheDir_; // empty keeps variants in memory only
+
+    std::mutex mtx_;
+    std::unordered_map<std::string, std::vector<Waiter>> jobs_; // key being encoded -> requests waiting
+    std::unordered_map<std::string, MemEntry> mem_;
+    std::list<std::string> memLru_; // most recent first
+    std::size_t memBytes_, memLimit_;
+    std::unordered_map<std::string, DiskEntry> disk_; // file name -> entry
+    std::list<std::string> diskLru_;
+    std::size_t diskBytes_, diskLimit_;
+    Stats stats_;
+
+    ThreadPool pool_; // last member, its tasks use everything above
+
+    void ScanCache(); // index what an earlier run left in cacheDir
+    bool Wait(const std::string& key, const Spec& spec, std::coroutine_handle<> handle, Image* result);
+    void Encode(std::string key, Spec spec); // on pool_, then hands the result to every waiter
+    Image ReadCached(const std::string& name);
+    void WriteCached(const std::string& name, const std::string& data);
+    void Remember(const std::string& key, const Image& image); // memory LRU, under mtx_
+    std::size_t EvictMem(std::size_t limit); // least recent first until memBytes_ <= limit, under mtx_
+
+public:
+    class Awaiter {
+    private:
+        ImageVariants* owner_;
+        std::string key_;
+        Spec spec_;
+        Image result_;
+
+    public:
+        Awaiter(ImageVariants* owner, std::string key, const Spec& spec) :
+            owner_(owner), key_(std::move(key)), spec_(spec) {};
+        bool await_ready() const { return key_.empty(); }
+        bool await_suspend(std::coroutine_handle<> handle) { return owner_->Wait(key_, spec_, handle, &result_); }
+        Image await_resume() { return std::move(result_); }
+    };
+
+    ImageVariants(const std::string& srcDir, const std::string& prefix, const std::string& cacheDir,
+                  std::size_t memBytes, std::size_t diskBytes, int threads);
+    ~ImageVariants(); // waits for encodes in flight
+    ImageVariants(const ImageVariants&) = delete;
+    ImageVariants& operator=(const ImageVariants&) = delete;
+
+    // strips the query off paths under prefix, true if it asks for a variant (w= or q=)
+    bool Parse(std::string& path, Spec& spec) const;
+
+    // on a CoScheduler loop. nullptr if the source can't be made into a variant, serve it as it is then
+    Awaiter Get(const Spec& spec);
+
+    Stats GetStats();
+    std::size_t MemBytes();
+    std::size_t DiskBytes();
+    // drop variants from memory, least recent first, until memBytes are left (under memory pressure).
+    // returns the bytes dropped, responses still writing one keep it until they are done
+    std::size_t Trim(std::size_t memBytes);
+
+    // decode, scale down to width (never up) and encode at quality, false if jpeg is not a usable JPEG
+    static bool Resize(const std::string& jpeg, int width, int quality, std::string& out);
+    static bool Dimensions(const std::string& jpeg, int& width, int& height);
+};
+
+#endif // IMAGEVARIANTS_HPP
@@ -0,0 +1,438 @@
+/*
+ * @author: Zimo Li
+ * @date: 2026-10-19
+*/
+
+#include "proxyconn.hpp"
+#include <cassert>
+#include <cctype>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <strings.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "../log/log.hpp"
+using namespace std;
+
+const size_t ProxyConn::MAX_HEAD;
+const size_t ProxyConn::IO_SIZE;
+const int ProxyConn::MAX_RETRY;
+
+ProxyConn::ProxyConn() : state_(IDLE), upstream_(nullptr), backend_(0), fd_(-1), registeredFd_(-1),
+                         staleFd_(-1), reused_(false), retries_(0), sent_(0), headOnly_(false),
+                         clientKeepAlive_(false), upstreamReusable_(false), sentToClient_(false),
+                         spliceFd_(-1), pipe_{-1, -1}, pipeBytes_(0), outPos_(0), body_(NO_BODY),
+                         remaining_(0), chunkState_(CHUNK_SIZE), chunkLeft_(0), chunkDone_(false)
+{
+}
+
+ProxyConn::~ProxyConn()
+{
+    Abort();
+    ClosePipe();
+}
+
+bool ProxyConn::Start(Upstream* upstream, string request, bool headOnly, bool clientKeepAlive,
+                      Writer writer, int spliceFd)
+{
+    assert(upstream && state_ == IDLE);
+    upstream_ = upstream;
+    request_ = std::move(request);
+    sent_ = 0;
+    headOnly_ = headOnly;
+    clientKeepAlive_ = clientKeepAlive;
+    upstreamReusable_ = false;
+    sentToClient_ = false;
+    retries_ = 0;
+
+    writer_ = std::move(writer);
+    spliceFd_ = spliceFd;
+    if(spliceFd_ >= 0 && !OpenPipe()) spliceFd_ = -1;
+
+    head_.clear();
+    out_.clear();
+    outPos_ = 0;
+    body_ = NO_BODY;
+    remaining_ = 0;
+    chunkState_ = CHUNK_SIZE;
+    chunkLeft_ = 0;
+    chunkDone_ = false;
+
+    return Connect();
+}
+
+bool ProxyConn::Connect()
+{
+    // a retry must not land on another pooled conn that may be just as stale
+    fd_ = upstream_->Acquire(backend_, reused_, retries_ > 0);
+    if(fd_ < 0) {
+        state_ = IDLE;
+        return false;
+    }
+    state_ = reused_ ? SENDING : CONNECTING;
+    return true;
+}
+
+ProxyConn::STEP ProxyConn::Advance()
+{
+    char buff[16 * 1024];
+    while(true) {
+        switch(state_) {
+        case CONNECTING: {
+            pollfd pfd = {fd_, POLLOUT, 0};
+            if(poll(&pfd, 1, 0) == 0) return UPSTREAM_WRITE;
+            int err = 0;
+            socklen_t len = sizeof(err);
+            if(getsockopt(fd_, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err != 0) {
+                upstream_->MarkFailed(backend_);
+                return Fail();
+            }
+            state_ = SENDING;
+            break;
+        }
+        case SENDING: {
+            ssize_t len = send(fd_, request_.data() + sent_, request_.size() - sent_, MSG_NOSIGNAL);
+            if(len < 0) {
+                if(errno == EAGAIN) return UPSTREAM_WRITE;
+                return Fail();
+            }
+            sent_ += len;
+            if(sent_ == request_.size()) state_ = READING_HEAD;
+            break;
+        }
+        case READING_HEAD: {
+            size_t end = head_.find("\r\n\r\n");
+            if(end != string::npos) {
+                if(!ParseHead(end + 4)) {
+                    LOG_WARN("upstream bad response head");
+                    retries_ = MAX_RETRY;
+                    return Fail();
+                }
+                break;
+            }
+            if(head_.size() > MAX_HEAD) {
+                retries_ = MAX_RETRY;
+                return Fail();
+            }
+            ssize_t len = recv(fd_, buff, sizeof(buff), 0);
+            if(len < 0 && errno == EAGAIN) return UPSTREAM_READ;
+            if(len <= 0) return Fail();
+            head_.append(buff, len);
+            break;
+        }
+        case WRITING_HEAD:
+        case COPYING: {
+            if(outPos_ < out_.size()) {
+                ssize_t len = writer_(out_.data() + outPos_, out_.size() - outPos_);
+                if(len <= 0) {
+                    if(len < 0 && errno == EAGAIN) return CLIENT_WRITE;
+                    return Fail();
+                }
+                sentToClient_ = true;
+                outPos_ += len;
+                break;
+            }
+            out_.clear();
+            outPos_ = 0;
+            if(BodyDone()) {
+                state_ = FINISHED;
+            } else if(state_ == WRITING_HEAD) {
+                state_ = (spliceFd_ >= 0 && body_ != CHUNKED) ? SPLICING : COPYING;
+            } else {
+                ssize_t len = recv(fd_, buff, sizeof(buff), 0);
+                if(len < 0 && errno == EAGAIN) return UPSTREAM_READ;
+                if(len == 0 && body_ == UNTIL_CLOSE) {
+                    state_ = FINISHED;
+                    break;
+                }
+                if(len <= 0) return Fail();
+                AppendBody(buff, len);
+            }
+            break;
+        }
+        case SPLICING: {
+            // drain pipe before reading more, so EAGAIN below always means upstream is empty
+            if(pipeBytes_ > 0) {
+                ssize_t len = splice(pipe_[0], nullptr, spliceFd_, nullptr, pipeBytes_,
+                                     SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+                if(len <= 0) {
+                    if(len < 0 && errno == EAGAIN) return CLIENT_WRITE;
+                    return Fail();
+                }
+                sentToClient_ = true;
+                pipeBytes_ -= len;
+                break;
+            }
+            if(body_ == LENGTH && remaining_ == 0) {
+                state_ = FINISHED;
+                break;
+            }
+            size_t want = body_ == LENGTH ? min(remaining_, IO_SIZE) : IO_SIZE;
+            ssize_t len = splice(fd_, nullptr, pipe_[1], nullptr, want, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if(len < 0 && errno == EAGAIN) return UPSTREAM_READ;
+            if(len == 0 && body_ == UNTIL_CLOSE) {
+                state_ = FINISHED;
+                break;
+            }
+            if(len <= 0) return Fail();
+            pipeBytes_ += len;
+            if(body_ == LENGTH) remaining_ -= len;
+            break;
+        }
+        case FINISHED:
+            return DONE;
+        default:
+            assert(false);
+            return FAILED;
+        }
+    }
+}
+
+ProxyConn::STEP ProxyConn::Fail()
+{
+    // nothing of the response was seen, so sending the request again is safe
+    bool retry = (state_ == CONNECTING || (reused_ && (state_ == SENDING || state_ == READING_HEAD) &&
+                  head_.empty())) && retries_ < MAX_RETRY;
+    ReleaseConn(false);
+    if(retry) {
+        retries_++;
+        sent_ = 0;
+        LOG_DEBUG("upstream retry %d", retries_);
+        if(Connect()) return Advance();
+    }
+    upstreamReusable_ = false;
+    state_ = FINISHED;
+    return FAILED;
+}
+
+bool ProxyConn::ParseHead(size_t headLen)
+{
+    size_t lineEnd = head_.find("\r\n");
+    if(lineEnd < 12 || head_.compare(0, 5, "HTTP/") != 0) return false;
+    bool http11 = head_.compare(5, 3, "1.1") == 0;
+    int code = atoi(head_.c_str() + 9);
+    if(code < 100 || code > 599 || code == 101) return false;
+    if(code < 200) {
+        // interim response, client never asked for it since Expect is not forwarded
+        head_.erase(0, headLen);
+        return true;
+    }
+
+    bool chunked = false, hasLength = false, upstreamClose = !http11;
+    size_t length = 0;
+    out_.assign(head_, 0, lineEnd + 2);
+    size_t pos = lineEnd + 2;
+    while(pos < headLen - 2) {
+        size_t eol = head_.find("\r\n", pos);
+        size_t colon = head_.find(':', pos);
+        if(colon == string::npos || colon > eol) return false;
+        string name = head_.substr(pos, colon - pos);
+        size_t valuePos = head_.find_first_not_of(" \t", colon + 1);
+        string value = valuePos < eol ? head_.substr(valuePos, eol - valuePos) : "";
+
+        // hop-by-hop fields describe the upstream conn, client gets its own Connection below
+        if(strcasecmp(name.c_str(), "Connection") == 0) {
+            if(strcasestr(value.c_str(), "close")) {
+                upstreamClose = true;
+            } else if(strcasestr(value.c_str(), "keep-alive")) {
+                upstreamClose = false;
+            }
+        } else if(strcasecmp(name.c_str(), "Keep-Alive") != 0 &&
+                  strcasecmp(name.c_str(), "Proxy-Connection") != 0) {
+            if(strcasecmp(name.c_str(), "Transfer-Encoding") == 0) {
+                chunked = strcasestr(value.c_str(), "chunked") != nullptr;
+            } else if(strcasecmp(name.c_str(), "Content-Length") == 0) {
+                hasLength = true;
+                length = strtoull(value.c_str(), nullptr, 10);
+            }
+            out_.append(head_, pos, eol + 2 - pos);
+        }
+        pos = eol + 2;
+    }
+
+    if(headOnly_ || code == 204 || code == 304) {
+        body_ = NO_BODY;
+    } else if(chunked) {
+        body_ = CHUNKED;
+    } else if(hasLength) {
+        body_ = LENGTH;
+        remaining_ = length;
+    } else {
+        body_ = UNTIL_CLOSE;
+    }
+    clientKeepAlive_ = clientKeepAlive_ && body_ != UNTIL_CLOSE;
+    upstreamReusable_ = !upstreamClose && body_ != UNTIL_CLOSE;
+    out_ += clientKeepAlive_ ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n";
+    outPos_ = 0;
+
+    // body bytes that came with the head
+    if(body_ == NO_BODY) {
+        if(head_.size() > headLen) upstreamReusable_ = false;
+    } else {
+        AppendBody(head_.data() + headLen, head_.size() - headLen);
+    }
+    head_.clear();
+    state_ = WRITING_HEAD;
+    return true;
+}
+
+void ProxyConn::AppendBody(const char* data, size_t len)
+{
+    if(body_ == LENGTH) {
+        if(len > remaining_) {
+            len = remaining_;
+            upstreamReusable_ = false; // garbage after body
+        }
+        remaining_ -= len;
+    } else if(body_ == CHUNKED) {
+        size_t used = FeedChunked(data, len);
+        if(used < len) upstreamReusable_ = false;
+        len = used;
+    }
+    out_.append(data, len);
+}
+
+size_t ProxyConn::FeedChunked(const char* data, size_t len)
+{
+    // chunks are forwarded as they are, only their boundaries are tracked to find end of message
+    size_t i = 0;
+    while(i < len && !chunkDone_) {
+        char ch = data[i];
+        switch(chunkState_) {
+        case CHUNK_SIZE:
+            if(isxdigit(static_cast<unsigned char>(ch)) && chunkLeft_ < (SIZE_MAX >> 4)) {
+                chunkLeft_ = chunkLeft_ * 16 + (isdigit(static_cast<unsigned char>(ch)) ? ch - '0' : (ch | 0x20) - 'a' + 10);
+                i++;
+            } else {
+                chunkState_ = CHUNK_EXT;
+            }
+            break;
+        case CHUNK_EXT:
+            i++;
+            if(ch == '\n') chunkState_ = chunkLeft_ ? CHUNK_DATA : CHUNK_TRAILER_START;
+            break;
+        case CHUNK_DATA: {
+            size_t n = min(len - i, chunkLeft_);
+            i += n;
+            chunkLeft_ -= n;
+            if(chunkLeft_ == 0) chunkState_ = CHUNK_DATA_END;
+            break;
+        }
+        case CHUNK_DATA_END:
+            i++;
+            if(ch == '\n') chunkState_ = CHUNK_SIZE;
+            break;
+        case CHUNK_TRAILER_START:
+            i++;
+            if(ch == '\n') {
+                chunkDone_ = true;
+            } else if(ch != '\r') {
+                chunkState_ = CHUNK_TRAILER;
+            }
+            break;
+        case CHUNK_TRAILER:
+            i++;
+            if(ch == '\n') chunkState_ = CHUNK_TRAILER_START;
+            break;
+        }
+    }
+    return i;
+}
+
+bool ProxyConn::BodyDone() const
+{
+    switch(body_) {
+    case NO_BODY: return true;
+    case LENGTH: return remaining_ == 0;
+    case CHUNKED: return chunkDone_;
+    default: return false; // ends with upstream EOF
+    }
+}
+
+bool ProxyConn::OpenPipe()
+{
+    if(pipe_[0] >= 0) return true;
+    if(pipe2(pipe_, O_NONBLOCK | O_CLOEXEC) < 0) {
+        pipe_[0] = pipe_[1] = -1;
+        return false;
+    }
+    pipeBytes_ = 0;
+    return true;
+}
+
+void ProxyConn::ClosePipe()
+{
+    if(pipe_[0] >= 0) {
+        ::close(pipe_[0]);
+        ::close(pipe_[1]);
+        pipe_[0] = pipe_[1] = -1;
+    }
+    pipeBytes_ = 0;
+}
+
+void ProxyConn::ReleaseConn(bool reusable)
+{
+    if(fd_ < 0) return;
+    if(registeredFd_ >= 0) staleFd_ = registeredFd_;
+    registeredFd_ = -1;
+    upstream_->Release(backend_, fd_, reusable);
+    fd_ = -1;
+}
+
+void ProxyConn::Finish()
+{
+    ReleaseConn(state_ == FINISHED && upstreamReusable_);
+    if(pipeBytes_ > 0) ClosePipe(); // leftover of a broken transfer
+    writer_ = nullptr;
+    state_ = IDLE;
+}
+
+void ProxyConn::Abort()
+{
+    upstreamReusable_ = false;
+    ReleaseConn(false);
+    if(pipeBytes_ > 0) ClosePipe();
+    writer_ = nullptr;
+    state_ = IDLE;
+}
+
+bool ProxyConn::IsActive() const
+{
+    return state_ != IDLE;
+}
+
+bool ProxyConn::SentToClient() const
+{
+    return sentToClient_;
+}
+
+bool ProxyConn::ClientKeepAlive() const
+{
+    return clientKeepAlive_;
+}
+
+int ProxyConn::UpstreamFd() const
+{
+    return fd_;
+}
+
+int ProxyConn::RegisteredFd() const
+{
+    return registeredFd_;
+}
+
+void ProxyConn::SetRegisteredFd(int fd)
+{
+    registeredFd_ = fd;
+}
+
+int ProxyConn::TakeStaleFd()
+{
+    int fd = staleFd_;
+    staleFd_ = -1;
+    return fd;
+}
@@ -0,0 +1,125 @@
+/*
+ * @author: Zimo Li
+ * @date: 2026-10-19
+*/
+
+#ifndef PROXYCONN_HPP
+#define PROXYCONN_HPP
+
+#include <string>
+#include <functional>
+#include <sys/types.h>
+#include "upstream.hpp"
+
+// one request forwarded to an upstream backend, driven by epoll events of both sockets
+class ProxyConn {
+public:
+    enum STEP {
+        UPSTREAM_WRITE, // wait until upstream socket is writable
+        UPSTREAM_READ,
+        CLIENT_WRITE,
+        DONE, // response forwarded completely
+        FAILED, // see SentToClient() to decide between 502 and closing
+    };
+
+    // write to client, returns like write(2)
+    typedef std::function<ssize_t(const char* data, std::size_t len)> Writer;
+
+private:
+    enum STATE {
+        IDLE,
+        CONNECTING,
+        SENDING,
+        READING_HEAD,
+        WRITING_HEAD,
+        SPLICING, // body moves socket -> pipe -> socket inside kernel
+        COPYING, // chunked body or client that cannot take splice
+        FINISHED,
+    };
+
+    enum BODY {
+        NO_BODY,
+        LENGTH,
+        CHUNKED,
+        UNTIL_CLOSE,
+    };
+
+    enum CHUNK_STATE {
+        CHUNK_SIZE,
+        CHUNK_EXT, // rest of size line
+        CHUNK_DATA,
+        CHUNK_DATA_END, // CRLF after data
+        CHUNK_TRAILER_START,
+        CHUNK_TRAILER,
+    };
+
+    static const std::size_t MAX_HEAD = 64 * 1024;
+    static const std::size_t IO_SIZE = 64 * 1024;
+    static const int MAX_RETRY = 2; // stale pooled conn or refused connect before anything was sent
+
+    STATE state_;
+    Upstream* upstream_;
+    std::size_t backend_;
+    int fd_;
+    int registeredFd_; // fd known by epoll, -1 after fd changed
+    int staleFd_; // replaced fd whose owner entry has to be dropped
+    bool reused_;
+    int retries_;
+
+    std::string request_;
+    std::size_t sent_;
+    bool headOnly_; // HEAD request, response never has a body
+    bool clientKeepAlive_;
+    bool upstreamReusable_;
+    bool sentToClient_;
+
+    Writer writer_;
+    int spliceFd_; // client socket splice may write to, -1 to copy
+    int pipe_[2];
+    std::size_t pipeBytes_;
+
+    std::string head_; // response head being read
+    std::string out_; // bytes for client not written yet
+    std::size_t outPos_;
+    BODY body_;
+    std::size_t remaining_; // LENGTH body bytes still to read from upstream
+
+    CHUNK_STATE chunkState_;
+    std::size_t chunkLeft_;
+    bool chunkDone_;
+
+    bool Connect(); // acquire a conn from upstream, false if none
+    STEP Fail(); // retry on a fresh conn if nothing happened yet
+    bool ParseHead(std::size_t headLen); // build head for client into out_
+    void AppendBody(const char* data, std::size_t len); // body bytes read with copy
+    std::size_t FeedChunked(const char* data, std::size_t len); // bytes up to end of message
+    bool BodyDone() const;
+    bool OpenPipe();
+    void ClosePipe();
+    void ReleaseConn(bool reusable);
+
+public:
+    ProxyConn();
+    ~ProxyConn();
+
+    ProxyConn(const ProxyConn&) = delete;
+    ProxyConn& operator=(const ProxyConn&) = delete;
+
+    bool Start(Upstream* upstream, std::string request, bool headOnly, bool clientKeepAlive,
+               Writer writer, int spliceFd); // false if no backend can be reached
+    STEP Advance(); // move data until something would block
+
+    void Finish(); // after DONE or FAILED, upstream conn goes back to pool if it is clean
+    void Abort(); // client went away, upstream conn is closed
+
+    bool IsActive() const;
+    bool SentToClient() const;
+    bool ClientKeepAlive() const; // valid after DONE
+
+    int UpstreamFd() const;
+    int RegisteredFd() const;
+    void SetRegisteredFd(int fd);
+    int TakeStaleFd(); // -1 if none
+};
+
+#endif // PROXYCONN_HPP
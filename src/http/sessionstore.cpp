@@ -0,0 +1,204 @@
+/*
+ * @author: Zimo Li
+ * @date: 2026-10-19
+*/
+
+#include "sessionstore.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/random.h>
+#include <sys/stat.h>
+using namespace std;
+
+const char* const SessionStore::COOKIE_NAME = "sid";
+const size_t SessionStore::SHARDS;
+
+namespace {
+
+const size_t ID_BYTES = 16; // 128 random bits
+const size_t MAX_USER = 255; // longer names are not snapshotted
+const size_t MAX_LINE = ID_BYTES * 2 + MAX_USER + 32;
+
+bool ValidId(string_view id)
+{
+    if(id.size() != ID_BYTES * 2) return false;
+    for(char c : id) {
+        if(!((c >= '0' && c <= '9') || (c >= 'a' && c <= 'f'))) return false;
+    }
+    return true;
+}
+
+}
+
+SessionStore::SessionStore(int ttlSec) : ttl_(ttlSec > 0 ? ttlSec : 1), changes_(0)
+{
+}
+
+SessionStore::Shard& SessionStore::ShardOf(string_view id)
+{
+    return shards_[hash<string_view>()(id) & (SHARDS - 1)];
+}
+
+string SessionStore::Create(const string& user)
+{
+    unsigned char raw[ID_BYTES];
+    if(getrandom(raw, sizeof(raw), 0) != static_cast<ssize_t>(sizeof(raw))) return "";
+    static const char HEX[] = "0123456789abcdef";
+    string id(ID_BYTES * 2, '0');
+    for(size_t i = 0; i < ID_BYTES; i++) {
+        id[i * 2] = HEX[raw[i] >> 4];
+        id[i * 2 + 1] = HEX[raw[i] & 0xf];
+    }
+    Shard& shard = ShardOf(id);
+    {
+        lock_guard<mutex> locker(shard.mtx);
+        shard.entries[id] = {user, Clock::now() + ttl_};
+    }
+    changes_++;
+    return id;
+}
+
+bool SessionStore::Find(string_view id, string& user)
+{
+    if(!ValidId(id)) return false;
+    Shard& shard = ShardOf(id);
+    auto now = Clock::now();
+    lock_guard<mutex> locker(shard.mtx);
+    auto it = shard.entries.find(string(id));
+    if(it == shard.entries.end()) return false;
+    if(it->second.expires <= now) {
+        shard.entries.erase(it);
+        return false;
+    }
+    it->second.expires = now + ttl_;
+    user = it->second.user;
+    return true;
+}
+
+void SessionStore::Erase(string_view id)
+{
+    Shard& shard = ShardOf(id);
+    lock_guard<mutex> locker(shard.mtx);
+    if(shard.entries.erase(string(id)) > 0) changes_++;
+}
+
+size_t SessionStore::Sweep()
+{
+    size_t removed = 0;
+    auto now = Clock::now();
+    for(Shard& shard : shards_) {
+        lock_guard<mutex> locker(shard.mtx);
+        for(auto it = shard.entries.begin(); it != shard.entries.end(); ) {
+            if(it->second.expires <= now) {
+                it = shard.entries.erase(it);
+                removed++;
+            } else {
+                ++it;
+            }
+        }
+    }
+    return removed;
+}
+
+size_t SessionStore::Size()
+{
+    size_t total = 0;
+    for(Shard& shard : shards_) {
+        lock_guard<mutex> locker(shard.mtx);
+        total += shard.entries.size();
+    }
+    return total;
+}
+
+uint64_t SessionStore::Changes() const
+{
+    return changes_;
+}
+
+int SessionStore::Ttl() const
+{
+    return static_cast<int>(ttl_.count());
+}
+
+bool SessionStore::Save(const string& file)
+{
+    lock_guard<mutex> saveLocker(saveMtx_);
+    string tmp = file + ".tmp";
+    // ids are as good as a password, only the server's user may read them
+    int fd = open(tmp.c_str(), O_CREAT | O_TRUNC | O_WRONLY | O_CLOEXEC, 0600);
+    if(fd < 0) return false;
+    FILE* fp = fchmod(fd, 0600) == 0 ? fdopen(fd, "w") : nullptr; // a leftover tmp keeps its old mode
+    if(!fp) {
+        close(fd);
+        remove(tmp.c_str());
+        return false;
+    }
+    bool ok = true;
+    string lines;
+    for(Shard& shard : shards_) {
+        lines.clear();
+        {
+            // a shard is locked while its lines are formatted, not while they are written
+            lock_guard<mutex> locker(shard.mtx);
+            for(auto& e : shard.entries) {
+                if(e.second.user.size() > MAX_USER || e.second.user.find('\n') != string::npos) continue;
+                lines += e.first + ' ' + e.second.user + ' ' +
+                         to_string(Clock::to_time_t(e.second.expires)) + '\n';
+            }
+        }
+        ok = ok && fwrite(lines.data(), 1, lines.size(), fp) == lines.size();
+    }
+    ok = fclose(fp) == 0 && ok;
+    if(!ok || rename(tmp.c_str(), file.c_str()) < 0) {
+        remove(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+size_t SessionStore::Load(const string& file)
+{
+    FILE* fp = fopen(file.c_str(), "r");
+    if(!fp) return 0;
+    size_t loaded = 0;
+    auto now = Clock::now();
+    char line[MAX_LINE];
+    while(fgets(line, sizeof(line), fp)) {
+        // user names come from a form and may hold spaces, so the id is the first field and expiry the last
+        string_view rest(line);
+        if(!rest.empty() && rest.back() == '\n') rest.remove_suffix(1);
+        size_t first = rest.find(' '), last = rest.rfind(' ');
+        if(first == string_view::npos || first == last) continue;
+        string_view id = rest.substr(0, first);
+        string user(rest.substr(first + 1, last - first - 1));
+        auto expires = Clock::from_time_t(strtoll(line + last + 1, nullptr, 10));
+        if(!ValidId(id) || expires <= now) continue;
+        Shard& shard = ShardOf(id);
+        lock_guard<mutex> locker(shard.mtx);
+        shard.entries[string(id)] = {user, expires};
+        loaded++;
+    }
+    fclose(fp);
+    return loaded;
+}
+
+string_view SessionStore::FromCookie(string_view cookie)
+{
+    // "a=1; sid=...; b=2"
+    size_t pos = 0;
+    size_t nameLen = char_traits<char>::length(COOKIE_NAME);
+    while(pos < cookie.size()) {
+        size_t end = cookie.find(';', pos);
+        if(end == string_view::npos) end = cookie.size();
+        string_view pair = cookie.substr(pos, end - pos);
+        while(!pair.empty() && pair.front() == ' ') pair.remove_prefix(1);
+        if(pair.size() > nameLen && pair.compare(0, nameLen, COOKIE_NAME) == 0 && pair[nameLen] == '=') {
+            return pair.substr(nameLen + 1);
+        }
+        pos = end + 1;
+    }
+    return string_view();
+}
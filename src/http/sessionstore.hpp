@@ -0,0 +1,64 @@
+/*
+ * @author: Zimo Li
+ * @date: 2026-10-19
+*/
+
+#ifndef SESSIONSTORE_HPP
+#define SESSIONSTORE_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+// logged in users by session id. ids are spread over shards with a lock each, so workers checking
+// cookies rarely meet on a lock. entries expire lazily on lookup, Sweep drops the ones never asked for
+class SessionStore {
+public:
+    static const char* const COOKIE_NAME;
+    static const std::size_t SHARDS = 16; // power of two
+
+private:
+    typedef std::chrono::system_clock Clock; // wall clock, expiry survives a restart through a snapshot
+
+    struct Entry {
+        std::string user;
+        Clock::time_point expires;
+    };
+
+    struct alignas(64) Shard {
+        std::mutex mtx;
+        std::unordered_map<std::string, Entry> entries;
+    };
+
+    Shard shards_[SHARDS];
+    std::chrono::seconds ttl_; // idle time before a session ends, each hit renews it
+    std::atomic<uint64_t> changes_; // creates and erases, a snapshot is only worth writing after one
+    std::mutex saveMtx_;
+
+    Shard& ShardOf(std::string_view id);
+
+public:
+    explicit SessionStore(int ttlSec = 1800);
+    SessionStore(const SessionStore&) = delete;
+    SessionStore& operator=(const SessionStore&) = delete;
+
+    std::string Create(const std::string& user); // new session id, empty if no randomness is available
+    bool Find(std::string_view id, std::string& user); // false for unknown or expired ids
+    void Erase(std::string_view id);
+    std::size_t Sweep(); // drop expired sessions, return how many
+    std::size_t Size();
+    uint64_t Changes() const;
+    int Ttl() const;
+
+    // snapshot as text lines "id user expires", written aside and renamed. Load keeps what has not expired
+    bool Save(const std::string& file);
+    std::size_t Load(const std::string& file);
+
+    static std::string_view FromCookie(std::string_view cookie); // our session id in a Cookie header, or empty
+};
+
+#endif // SESSIONSTORE_HPP
@@ -0,0 +1,182 @@
+/*
+ * @author: Zimo Li
+ * @date: 2026-10-19
+*/
+
+#include "tlsconn.hpp"
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <openssl/err.h>
+#include "../log/log.hpp"
+using namespace std;
+
+TlsContext::~TlsContext()
+{
+    if(ctx_) SSL_CTX_free(ctx_);
+}
+
+int TlsContext::SelectAlpn(SSL* ssl, const unsigned char** out, unsigned char* outlen,
+                           const unsigned char* in, unsigned int inlen, void* arg)
+{
+    // prefer h2, then http/1.1, no match lets the handshake go on without ALPN
+    static const unsigned char protos[] = "\x02h2\x08http/1.1";
+    unsigned char* selected = nullptr;
+    if(SSL_select_next_proto(&selected, outlen, protos, sizeof(protos) - 1, in, inlen) != OPENSSL_NPN_NEGOTIATED) {
+        return SSL_TLSEXT_ERR_NOACK;
+    }
+    *out = selected;
+    return SSL_TLSEXT_ERR_OK;
+}
+
+bool TlsContext::Init(const string& certFile, const string& keyFile, const string& ticketKeyFile)
+{
+    if(ctx_) SSL_CTX_free(ctx_);
+    ctx_ = SSL_CTX_new(TLS_server_method());
+    if(!ctx_) return false;
+
+    SSL_CTX_set_min_proto_version(ctx_, TLS1_2_VERSION);
+    // kernel TLS is used when the kernel supports it, otherwise this is a no-op
+    SSL_CTX_set_options(ctx_, SSL_OP_ENABLE_KTLS | SSL_OP_NO_RENEGOTIATION | SSL_OP_CIPHER_SERVER_PREFERENCE);
+    // write buffer of a conn moves when it grows, retry with the rest is fine
+    SSL_CTX_set_mode(ctx_, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER |
+                           SSL_MODE_RELEASE_BUFFERS);
+
+    if(SSL_CTX_use_certificate_chain_file(ctx_, certFile.c_str()) != 1 ||
+       SSL_CTX_use_PrivateKey_file(ctx_, keyFile.c_str(), SSL_FILETYPE_PEM) != 1 ||
+       SSL_CTX_check_private_key(ctx_) != 1) {
+        LOG_ERROR("TLS cert %s / key %s error: %s", certFile.c_str(), keyFile.c_str(),
+                  ERR_error_string(ERR_get_error(), nullptr));
+        SSL_CTX_free(ctx_);
+        ctx_ = nullptr;
+        return false;
+    }
+
+    // session id cache for TLS 1.2 clients without ticket support
+    static const unsigned char sidCtx[] = "webserver";
+    SSL_CTX_set_session_id_context(ctx_, sidCtx, sizeof(sidCtx) - 1);
+    SSL_CTX_set_session_cache_mode(ctx_, SSL_SESS_CACHE_SERVER);
+    SSL_CTX_sess_set_cache_size(ctx_, SESSION_CACHE_SIZE);
+    SSL_CTX_set_timeout(ctx_, SESSION_TIMEOUT);
+
+    if(!ticketKeyFile.empty()) {
+        unsigned char keys[80]; // name 16, hmac 32, aes 32
+        FILE* fp = fopen(ticketKeyFile.c_str(), "rb");
+        size_t n = fp ? fread(keys, 1, sizeof(keys), fp) : 0;
+        if(fp) fclose(fp);
+        if(n != sizeof(keys) || SSL_CTX_set_tlsext_ticket_keys(ctx_, keys, sizeof(keys)) != 1) {
+            LOG_WARN("TLS ticket key file %s unusable, tickets are per process", ticketKeyFile.c_str());
+        }
+        OPENSSL_cleanse(keys, sizeof(keys));
+    }
+
+    SSL_CTX_set_alpn_select_cb(ctx_, SelectAlpn, nullptr);
+    return true;
+}
+
+SSL_CTX* TlsContext::Get() const
+{
+    return ctx_;
+}
+
+TlsConn::TlsConn(SSL_CTX* ctx, int fd) : ssl_(SSL_new(ctx)), established_(false), wantWrite_(false)
+{
+    if(ssl_) {
+        SSL_set_fd(ssl_, fd);
+        SSL_set_accept_state(ssl_);
+    }
+}
+
+TlsConn::~TlsConn()
+{
+    if(ssl_) SSL_free(ssl_);
+}
+
+ssize_t TlsConn::Fail(int ret)
+{
+    int err = SSL_get_error(ssl_, ret);
+    wantWrite_ = (err == SSL_ERROR_WANT_WRITE);
+    if(err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) {
+        errno = EAGAIN;
+        return -1;
+    }
+    if(err == SSL_ERROR_ZERO_RETURN) return 0; // close_notify from peer
+    if(err != SSL_ERROR_SYSCALL || errno == 0) errno = EPROTO;
+    LOG_DEBUG("TLS error %d: %s", err, ERR_error_string(ERR_get_error(), nullptr));
+    ERR_clear_error(); // error queue is per thread, don't leave it to the next conn
+    return -1;
+}
+
+ssize_t TlsConn::Handshake()
+{
+    if(!ssl_) {
+        errno = ENOMEM;
+        return -1;
+    }
+    if(established_) return 1;
+    int ret = SSL_do_handshake(ssl_);
+    if(ret != 1) return Fail(ret);
+
+    established_ = true;
+    wantWrite_ = false;
+    LOG_DEBUG("TLS %s %s, resumed %d, ktls send %d", SSL_get_version(ssl_), SSL_get_cipher_name(ssl_),
+              SSL_session_reused(ssl_), KtlsSend());
+    return 1;
+}
+
+bool TlsConn::IsEstablished() const
+{
+    return established_;
+}
+
+bool TlsConn::WantWrite() const
+{
+    return wantWrite_;
+}
+
+ssize_t TlsConn::Read(void* buf, size_t len)
+{
+    size_t n = 0;
+    int ret = SSL_read_ex(ssl_, buf, len, &n);
+    if(ret != 1) return Fail(ret);
+    wantWrite_ = false;
+    return static_cast<ssize_t>(n);
+}
+
+ssize_t TlsConn::Write(const void* buf, size_t len)
+{
+    size_t n = 0;
+    int ret = SSL_write_ex(ssl_, buf, len, &n);
+    if(ret != 1) return Fail(ret);
+    wantWrite_ = false;
+    return static_cast<ssize_t>(n);
+}
+
+ssize_t TlsConn::SendFile(int fileFd, off_t offset, size_t len)
+{
+    ossl_ssize_t n = SSL_sendfile(ssl_, fileFd, offset, len, 0);
+    if(n < 0) return Fail(static_cast<int>(n));
+    wantWrite_ = false;
+    return n;
+}
+
+bool TlsConn::KtlsSend() const
+{
+    return ssl_ && BIO_get_ktls_send(SSL_get_wbio(ssl_));
+}
+
+string TlsConn::Alpn() const
+{
+    const unsigned char* data = nullptr;
+    unsigned int len = 0;
+    SSL_get0_alpn_selected(ssl_, &data, &len);
+    return data ? string(reinterpret_cast<const char*>(data), len) : string();
+}
+
+void TlsConn::Shutdown()
+{
+    if(ssl_ && established_) {
+        SSL_shutdown(ssl_);
+        ERR_clear_error();
+    }
+}
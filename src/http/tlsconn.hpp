@@ -0,0 +1,67 @@
+/*
+ * @author: Zimo Li
+ * @date: 2026-10-19
+*/
+
+#ifndef TLSCONN_HPP
+#define TLSCONN_HPP
+
+#include <string>
+#include <sys/types.h>
+#include <openssl/ssl.h>
+
+// server side SSL_CTX shared by every conn. session cache and ticket keys live in the ctx,
+// so a session can be resumed on whichever worker picks up the next conn
+class TlsContext {
+private:
+    static const long SESSION_CACHE_SIZE = 20480;
+    static const long SESSION_TIMEOUT = 3600; // seconds
+
+    SSL_CTX* ctx_;
+
+    static int SelectAlpn(SSL* ssl, const unsigned char** out, unsigned char* outlen,
+                          const unsigned char* in, unsigned int inlen, void* arg);
+
+public:
+    TlsContext() : ctx_(nullptr) {};
+    ~TlsContext();
+
+    TlsContext(const TlsContext&) = delete;
+    TlsContext& operator=(const TlsContext&) = delete;
+
+    // ticketKeyFile holds 80 random bytes, sharing it keeps tickets valid across processes and restarts
+    bool Init(const std::string& certFile, const std::string& keyFile, const std::string& ticketKeyFile = "");
+    SSL_CTX* Get() const;
+};
+
+// one non-blocking TLS conn on top of a socket. Read/Write/SendFile behave like read/write/sendfile,
+// wanting more io from the socket shows up as -1 with errno EAGAIN
+class TlsConn {
+private:
+    SSL* ssl_;
+    bool established_;
+    bool wantWrite_; // last call is blocked on socket being writable
+
+    ssize_t Fail(int ret); // map SSL error of ret to errno
+
+public:
+    TlsConn(SSL_CTX* ctx, int fd);
+    ~TlsConn();
+
+    TlsConn(const TlsConn&) = delete;
+    TlsConn& operator=(const TlsConn&) = delete;
+
+    ssize_t Handshake(); // 1 when established, otherwise like Read
+    bool IsEstablished() const;
+    bool WantWrite() const;
+
+    ssize_t Read(void* buf, size_t len);
+    ssize_t Write(const void* buf, size_t len);
+    ssize_t SendFile(int fileFd, off_t offset, size_t len); // zero copy, only with kernel TLS
+
+    bool KtlsSend() const; // records are encrypted by kernel
+    std::string Alpn() const;
+    void Shutdown(); // send close_notify, best effort
+};
+
+#endif // TLSCONN_HPP
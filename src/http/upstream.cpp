@@ -0,0 +1,132 @@
+/*
+ * @author: Zimo Li
+ * @date: 2026-10-19
+*/
+
+#include "upstream.hpp"
+#include <cassert>
+#include <cerrno>
+#include <climits>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include "../log/log.hpp"
+using namespace std;
+
+const int Upstream::FAIL_TIMEOUT_MS;
+
+Upstream::Upstream(BALANCE balance, size_t maxIdle) : balance_(balance), maxIdle_(maxIdle), next_(0)
+{
+}
+
+Upstream::~Upstream()
+{
+    for(auto& backend : backends_) {
+        for(int fd : backend.idle) close(fd);
+    }
+}
+
+bool Upstream::AddBackend(const string& ip, int port)
+{
+    Backend backend;
+    backend.addr = {0};
+    backend.addr.sin_family = AF_INET;
+    backend.addr.sin_port = htons(port);
+    if(port <= 0 || port > 65535 || inet_pton(AF_INET, ip.c_str(), &backend.addr.sin_addr) != 1) {
+        LOG_ERROR("upstream %s:%d invalid", ip.c_str(), port);
+        return false;
+    }
+    backend.active = 0;
+    backends_.push_back(backend);
+    return true;
+}
+
+size_t Upstream::Size() const
+{
+    return backends_.size();
+}
+
+size_t Upstream::Pick()
+{
+    auto now = chrono::steady_clock::now();
+    size_t n = backends_.size();
+    size_t best = n;
+    for(size_t k = 0; k < n; k++) {
+        size_t i = (next_ + k) % n;
+        if(backends_[i].failUntil > now) continue;
+        if(balance_ == ROUND_ROBIN) {
+            best = i;
+            break;
+        }
+        if(best == n || backends_[i].active < backends_[best].active) best = i;
+    }
+    if(best == n) best = next_ % n; // all failed lately, try anyway
+    next_ = best + 1;
+    return best;
+}
+
+bool Upstream::IsAlive(int fd)
+{
+    // backend closing an idle conn shows up as EOF, a stray byte means it is unusable too
+    char ch;
+    ssize_t ret = recv(fd, &ch, 1, MSG_PEEK | MSG_DONTWAIT);
+    return ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+int Upstream::Acquire(size_t& backend, bool& reused, bool fresh)
+{
+    std::lock_guard<std::mutex> locker(mtx_);
+    if(backends_.empty()) return -1;
+
+    for(size_t attempt = 0; attempt < backends_.size(); attempt++) {
+        size_t i = Pick();
+        Backend& item = backends_[i];
+        while(!fresh && !item.idle.empty()) {
+            int fd = item.idle.back();
+            item.idle.pop_back();
+            if(IsAlive(fd)) {
+                item.active++;
+                backend = i;
+                reused = true;
+                return fd;
+            }
+            close(fd);
+        }
+
+        int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if(fd < 0) return -1;
+        int optval = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &optval, sizeof(optval));
+        if(connect(fd, reinterpret_cast<sockaddr*>(&item.addr), sizeof(item.addr)) == 0 || errno == EINPROGRESS) {
+            item.active++;
+            backend = i;
+            reused = false;
+            return fd;
+        }
+        LOG_WARN("upstream connect %s:%d error: %d", inet_ntoa(item.addr.sin_addr), ntohs(item.addr.sin_port), errno);
+        close(fd);
+        item.failUntil = chrono::steady_clock::now() + chrono::milliseconds(FAIL_TIMEOUT_MS);
+    }
+    return -1;
+}
+
+void Upstream::Release(size_t backend, int fd, bool reusable)
+{
+    assert(backend < backends_.size() && fd >= 0);
+    std::lock_guard<std::mutex> locker(mtx_);
+    Backend& item = backends_[backend];
+    item.active--;
+    if(reusable && item.idle.size() < maxIdle_) {
+        item.idle.push_back(fd);
+    } else {
+        close(fd);
+    }
+}
+
+void Upstream::MarkFailed(size_t backend)
+{
+    assert(backend < backends_.size());
+    std::lock_guard<std::mutex> locker(mtx_);
+    backends_[backend].failUntil = chrono::steady_clock::now() + chrono::milliseconds(FAIL_TIMEOUT_MS);
+}
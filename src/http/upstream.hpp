@@ -0,0 +1,58 @@
+/*
+ * @author: Zimo Li
+ * @date: 2026-10-19
+*/
+
+#ifndef UPSTREAM_HPP
+#define UPSTREAM_HPP
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <chrono>
+#include <netinet/in.h>
+
+// a group of backend servers with keep-alive conn pools, shared by every worker
+class Upstream {
+public:
+    enum BALANCE {
+        ROUND_ROBIN,
+        LEAST_CONN,
+    };
+
+private:
+    static const int FAIL_TIMEOUT_MS = 2000; // backend is skipped this long after a failed connect
+
+    struct Backend {
+        sockaddr_in addr;
+        int active; // conns handed out
+        std::vector<int> idle; // keep-alive conns ready for reuse
+        std::chrono::steady_clock::time_point failUntil;
+    };
+
+    BALANCE balance_;
+    std::size_t maxIdle_; // per backend
+    std::size_t next_; // round robin position
+    std::vector<Backend> backends_;
+    std::mutex mtx_;
+
+    std::size_t Pick(); // index of backend for next conn, called with mtx_ held
+    static bool IsAlive(int fd); // idle conn was not closed by backend meanwhile
+
+public:
+    explicit Upstream(BALANCE balance = ROUND_ROBIN, std::size_t maxIdle = 32);
+    ~Upstream();
+
+    Upstream(const Upstream&) = delete;
+    Upstream& operator=(const Upstream&) = delete;
+
+    bool AddBackend(const std::string& ip, int port); // not thread safe, call before serving
+    std::size_t Size() const;
+
+    // non-blocking socket to a backend, connecting if not reused. -1 if no backend could be reached
+    int Acquire(std::size_t& backend, bool& reused, bool fresh = false);
+    void Release(std::size_t backend, int fd, bool reusable); // back to pool or closed
+    void MarkFailed(std::size_t backend);
+};
+
+#endif // UPSTREAM_HPP
@@ -0,0 +1,168 @@
+/*
+ * @author: Zimo Li
+ * @date: 2026-10-19
+*/
+
+#include "urlcodec.hpp"
+#include <cassert>
+#include <cstring>
+#include <algorithm>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define URLCODEC_X86
+#endif
+using namespace std;
+
+const size_t UrlCodec::BLOCK;
+
+static inline bool IsSpecial(char ch)
+{
+    return ch == '&' || ch == '=' || ch == '%' || ch == '+';
+}
+
+uint64_t UrlCodec::SpecialMaskScalar(const char* data, size_t len)
+{
+    assert(len <= BLOCK);
+    uint64_t mask = 0;
+    for(size_t i = 0; i < len; i++) {
+        if(IsSpecial(data[i])) mask |= uint64_t(1) << i;
+    }
+    return mask;
+}
+
+#ifdef URLCODEC_X86
+// SSE2 is part of x86-64, four compares are as fast as pcmpistri for a set this small
+static uint64_t SpecialMaskSse2(const char* data)
+{
+    const __m128i amp = _mm_set1_epi8('&'), eq = _mm_set1_epi8('=');
+    const __m128i pct = _mm_set1_epi8('%'), plus = _mm_set1_epi8('+');
+    uint64_t mask = 0;
+    for(int i = 0; i < 4; i++) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i * 16));
+        __m128i hit = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, amp), _mm_cmpeq_epi8(v, eq)),
+                                   _mm_or_si128(_mm_cmpeq_epi8(v, pct), _mm_cmpeq_epi8(v, plus)));
+        mask |= static_cast<uint64_t>(static_cast<uint16_t>(_mm_movemask_epi8(hit))) << (i * 16);
+    }
+    return mask;
+}
+
+// leaf function, so upper halves are cleared on return and following SSE code does not stall
+__attribute__((target("avx2")))
+static uint64_t SpecialMaskAvx2(const char* data)
+{
+    const __m256i amp = _mm256_set1_epi8('&'), eq = _mm256_set1_epi8('=');
+    const __m256i pct = _mm256_set1_epi8('%'), plus = _mm256_set1_epi8('+');
+    uint64_t mask = 0;
+    for(int i = 0; i < 2; i++) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i * 32));
+        __m256i hit = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, amp), _mm256_cmpeq_epi8(v, eq)),
+                                      _mm256_or_si256(_mm256_cmpeq_epi8(v, pct), _mm256_cmpeq_epi8(v, plus)));
+        mask |= static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_epi8(hit))) << (i * 32);
+    }
+    return mask;
+}
+#endif
+
+uint64_t UrlCodec::SpecialMask(const char* data, size_t len)
+{
+    assert(len <= BLOCK);
+#ifdef URLCODEC_X86
+    // cpu is checked once, the binary itself only assumes SSE2
+    static uint64_t (*const impl)(const char*) =
+        __builtin_cpu_supports("avx2") ? SpecialMaskAvx2 : SpecialMaskSse2;
+    if(len == BLOCK) return impl(data);
+    char block[BLOCK] = {0}; // short tail is padded, zero is no delimiter
+    memcpy(block, data, len);
+    return impl(block);
+#else
+    return SpecialMaskScalar(data, len);
+#endif
+}
+
+int UrlCodec::HexValue(char ch)
+{
+    if(ch >= '0' && ch <= '9') return ch - '0';
+    if(ch >= 'A' && ch <= 'F') return ch - 'A' + 10;
+    if(ch >= 'a' && ch <= 'f') return ch - 'a' + 10;
+    return -1;
+}
+
+void UrlCodec::Decode(string_view in, string& out)
+{
+    // hex digits are never delimiters, so an escape never hides a later hit
+    size_t pos = 0; // start of bytes not copied yet
+    for(size_t base = 0; base < in.size(); base += BLOCK) {
+        uint64_t mask = SpecialMask(in.data() + base, min(BLOCK, in.size() - base));
+        while(mask) {
+            size_t i = base + __builtin_ctzll(mask);
+            mask &= mask - 1;
+            if(i < pos) continue;
+            out.append(in.data() + pos, i - pos);
+
+            int high, low;
+            if(in[i] == '+') {
+                out.push_back(' ');
+                pos = i + 1;
+            } else if(in[i] == '%' && i + 2 < in.size() && (high = HexValue(in[i + 1])) >= 0 &&
+                      (low = HexValue(in[i + 2])) >= 0) {
+                out.push_back(static_cast<char>(high * 16 + low));
+                pos = i + 3;
+            } else {
+                out.push_back(in[i]); // '=' inside a value or a broken escape
+                pos = i + 1;
+            }
+        }
+    }
+    out.append(in.data() + pos, in.size() - pos);
+}
+
+string_view UrlCodec::Piece(string_view raw, bool escaped, string& arena)
+{
+    if(!escaped) return raw;
+    size_t start = arena.size();
+    Decode(raw, arena);
+    return string_view(arena.data() + start, arena.size() - start);
+}
+
+void UrlCodec::ParseForm(string_view body, vector<Field>& fields, string& arena)
+{
+    fields.clear();
+    arena.clear();
+    arena.reserve(body.size()); // decoded text is never longer than raw, so arena never moves
+
+    size_t start = 0; // current key or value
+    bool inValue = false;
+    bool escaped = false;
+    string_view key;
+    auto closePair = [&](size_t end) {
+        string_view piece = Piece(body.substr(start, end - start), escaped, arena);
+        if(inValue) {
+            fields.emplace_back(key, piece);
+        } else if(!piece.empty()) {
+            fields.emplace_back(piece, string_view()); // key without '='
+        }
+        inValue = false;
+        escaped = false;
+        start = end + 1;
+    };
+
+    for(size_t base = 0; base < body.size(); base += BLOCK) {
+        uint64_t mask = SpecialMask(body.data() + base, min(BLOCK, body.size() - base));
+        while(mask) {
+            size_t i = base + __builtin_ctzll(mask);
+            mask &= mask - 1;
+            char ch = body[i];
+            if(ch == '&') {
+                closePair(i);
+            } else if(ch == '=' && !inValue) {
+                key = Piece(body.substr(start, i - start), escaped, arena);
+                inValue = true;
+                escaped = false;
+                start = i + 1;
+            } else if(ch != '=') {
+                escaped = true; // '%' or '+', '=' inside a value is just data
+            }
+        }
+    }
+    closePair(body.size());
+}
@@ -0,0 +1,38 @@
+/*
+ * @author: Zimo Li
+ * @date: 2026-10-19
+*/
+
+#ifndef URLCODEC_HPP
+#define URLCODEC_HPP
+
+#include <string>
+#include <string_view>
+#include <cstdint>
+#include <vector>
+
+// application/x-www-form-urlencoded decoding. delimiters of 64 bytes are found at once as a bit
+// mask, so dense escapes cost no more calls than plain text
+class UrlCodec {
+public:
+    typedef std::pair<std::string_view, std::string_view> Field;
+
+    static const std::size_t BLOCK = 64;
+
+    // bit i set if data[i] is '&', '=', '%' or '+', for len <= BLOCK
+    static uint64_t SpecialMask(const char* data, std::size_t len);
+    static uint64_t SpecialMaskScalar(const char* data, std::size_t len);
+
+    // append decoded in to out, '+' is a space and a malformed escape is kept as it is
+    static void Decode(std::string_view in, std::string& out);
+
+    // split body into key/value views. pieces without escapes point into body, decoded ones into
+    // arena, which is reserved up front so that the views stay valid
+    static void ParseForm(std::string_view body, std::vector<Field>& fields, std::string& arena);
+
+private:
+    static int HexValue(char ch); // -1 if ch is no hex digit
+    static std::string_view Piece(std::string_view raw, bool escaped, std::string& arena);
+};
+
+#endif // URLCODEC_HPP
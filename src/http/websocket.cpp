@@ -0,0 +1,370 @@
+/*
+ * @author: Zimo Li
+ * @date: 2026-10-19
+*/
+
+#include "websocket.hpp"
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <sys/uio.h>
+#include <openssl/evp.h>
+#include <openssl/sha.h>
+#include "../log/log.hpp"
+using namespace std;
+
+const char WebSocket::GUID[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+const size_t WebSocket::MAX_MESSAGE;
+const size_t WebSocket::MAX_QUEUED;
+const int WebSocket::MAX_IOV;
+std::function<void(int fd, bool write)> WebSocket::arm;
+
+WebSocket::WebSocket(int fd, const Handler& handler) : fd_(fd), handler_(handler), messageOp_(CONTINUATION),
+                                                       closeReceived_(false), offset_(0), queued_(0), busy_(true),
+                                                       writeArmed_(false), closeSent_(false), awaitingPong_(false),
+                                                       overflow_(false), closed_(false)
+{
+    // created by the worker that handles the upgrade, so the conn starts as owned
+}
+
+bool WebSocket::IsUpgrade(const HttpRequest& request)
+{
+    return request.method() == "GET" && request.version() == "1.1" &&
+           HttpHeaders::EqualsNoCase(request.Header(HttpHeaders::UPGRADE), "websocket") &&
+           HttpHeaders::HasToken(request.Header(HttpHeaders::CONNECTION), "upgrade") &&
+           request.Header(HttpHeaders::SEC_WEBSOCKET_VERSION) == "13" &&
+           !request.Header(HttpHeaders::SEC_WEBSOCKET_KEY).empty();
+}
+
+string WebSocket::AcceptKey(const string& key)
+{
+    string input = key + GUID;
+    unsigned char digest[SHA_DIGEST_LENGTH];
+    SHA1(reinterpret_cast<const unsigned char*>(input.data()), input.size(), digest);
+    char encoded[4 * ((SHA_DIGEST_LENGTH + 2) / 3) + 1];
+    int len = EVP_EncodeBlock(reinterpret_cast<unsigned char*>(encoded), digest, SHA_DIGEST_LENGTH);
+    return string(encoded, len);
+}
+
+WebSocket::Frame WebSocket::MakeFrame(OPCODE op, const char* data, size_t len)
+{
+    // server frames are never masked
+    auto frame = make_shared<string>();
+    frame->reserve(len + 10);
+    frame->push_back(static_cast<char>(0x80 | op));
+    if(len < 126) {
+        frame->push_back(static_cast<char>(len));
+    } else if(len <= 0xffff) {
+        frame->push_back(126);
+        frame->push_back(static_cast<char>(len >> 8));
+        frame->push_back(static_cast<char>(len));
+    } else {
+        frame->push_back(127);
+        for(int i = 7; i >= 0; i--) frame->push_back(static_cast<char>(static_cast<uint64_t>(len) >> (i * 8)));
+    }
+    frame->append(data, len);
+    return frame;
+}
+
+void WebSocket::Open(const HttpRequest& request)
+{
+    string response = "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+                      "Sec-WebSocket-Accept: " + AcceptKey(string(request.Header(HttpHeaders::SEC_WEBSOCKET_KEY))) + "\r\n\r\n";
+    {
+        std::lock_guard<std::mutex> locker(mtx_);
+        Queue(make_shared<const string>(std::move(response)), true);
+    }
+    LOG_DEBUG("websocket[%d] open %s", fd_, request.path().c_str());
+    if(handler_.onOpen) handler_.onOpen(shared_from_this());
+}
+
+void WebSocket::Unmask(uint8_t* data, size_t len, const uint8_t* key)
+{
+    // 8 bytes per step, the key repeats every 4 so it lines up again after each step
+    uint32_t key32;
+    memcpy(&key32, key, 4);
+    uint64_t key64 = (static_cast<uint64_t>(key32) << 32) | key32;
+    size_t i = 0;
+    for(; i + 8 <= len; i += 8) {
+        uint64_t chunk;
+        memcpy(&chunk, data + i, 8);
+        chunk ^= key64;
+        memcpy(data + i, &chunk, 8);
+    }
+    for(; i < len; i++) data[i] ^= key[i & 3];
+}
+
+void WebSocket::OnRead(Buffer& in)
+{
+    while(!closeReceived_ && in.ReadableBytes() >= 2) {
+        uint8_t* pos = reinterpret_cast<uint8_t*>(const_cast<char*>(in.ReadPosition()));
+        size_t avail = in.ReadableBytes();
+        bool fin = pos[0] & 0x80;
+        OPCODE op = static_cast<OPCODE>(pos[0] & 0x0f);
+        uint64_t len = pos[1] & 0x7f;
+        size_t head = 2;
+        if(len == 126) {
+            if(avail < 4) return;
+            len = (pos[2] << 8) | pos[3];
+            head = 4;
+        } else if(len == 127) {
+            if(avail < 10) return;
+            len = 0;
+            for(int i = 0; i < 8; i++) len = (len << 8) | pos[2 + i];
+            head = 10;
+        }
+
+        // clients must mask, no extension was negotiated so RSV bits stay clear
+        bool control = op & 0x8;
+        if((pos[0] & 0x70) || !(pos[1] & 0x80) || (control && (!fin || len > 125)) ||
+           (op > BINARY && op < CLOSE) || op > PONG) {
+            Fail(PROTOCOL_ERROR);
+            return;
+        }
+        if(len > MAX_MESSAGE || (!control && message_.size() + len > MAX_MESSAGE)) {
+            Fail(TOO_BIG);
+            return;
+        }
+        if(avail < head + 4 + len) return; // rest of frame not here yet
+
+        char* payload = reinterpret_cast<char*>(pos + head + 4);
+        Unmask(reinterpret_cast<uint8_t*>(payload), len, pos + head);
+        {
+            std::lock_guard<std::mutex> locker(mtx_);
+            awaitingPong_ = false; // any frame shows the peer is alive
+        }
+
+        switch(op) {
+        case PING: {
+            std::lock_guard<std::mutex> locker(mtx_);
+            Queue(MakeFrame(PONG, payload, len), true);
+            break;
+        }
+        case PONG:
+            break;
+        case CLOSE: {
+            closeReceived_ = true;
+            std::lock_guard<std::mutex> locker(mtx_);
+            if(!closeSent_) {
+                // echo status code, reason is not needed
+                Queue(MakeFrame(CLOSE, payload, len >= 2 ? 2 : 0), true);
+                closeSent_ = true;
+            }
+            break;
+        }
+        case TEXT:
+        case BINARY:
+            if(messageOp_ != CONTINUATION) {
+                Fail(PROTOCOL_ERROR); // new message inside a fragmented one
+                return;
+            }
+            if(fin) {
+                Deliver(op, string(payload, len));
+            } else {
+                messageOp_ = op;
+                message_.assign(payload, len);
+            }
+            break;
+        case CONTINUATION:
+            if(messageOp_ == CONTINUATION) {
+                Fail(PROTOCOL_ERROR);
+                return;
+            }
+            message_.append(payload, len);
+            if(fin) {
+                OPCODE messageOp = messageOp_;
+                messageOp_ = CONTINUATION;
+                Deliver(messageOp, message_);
+                message_.clear();
+            }
+            break;
+        default: break;
+        }
+        in.Retrieve(head + 4 + len);
+    }
+    if(closeReceived_) in.RetrieveAll(); // nothing may follow a close frame
+}
+
+void WebSocket::Deliver(OPCODE op, const string& message)
+{
+    if(handler_.onMessage) handler_.onMessage(shared_from_this(), op, message);
+}
+
+void WebSocket::Fail(CLOSE_CODE code)
+{
+    LOG_WARN("websocket[%d] closing with %d", fd_, code);
+    closeReceived_ = true; // stop parsing
+    char payload[2] = {static_cast<char>(code >> 8), static_cast<char>(code & 0xff)};
+    std::lock_guard<std::mutex> locker(mtx_);
+    if(!closeSent_) {
+        Queue(MakeFrame(CLOSE, payload, 2), true);
+        closeSent_ = true;
+    }
+}
+
+bool WebSocket::Queue(const Frame& frame, bool control)
+{
+    if(closed_ || (closeSent_ && !control)) return false;
+    if(!control && queued_ + frame->size() > MAX_QUEUED) {
+        // slow reader, the worker drops the conn instead of buffering without bound
+        overflow_ = true;
+    } else {
+        outbox_.push_back(frame);
+        queued_ += frame->size();
+    }
+    if(!busy_ && !writeArmed_) {
+        writeArmed_ = true;
+        if(arm) arm(fd_, true);
+    }
+    return !overflow_;
+}
+
+bool WebSocket::Send(const Frame& frame)
+{
+    std::lock_guard<std::mutex> locker(mtx_);
+    return Queue(frame, false);
+}
+
+bool WebSocket::Send(OPCODE op, const string& message)
+{
+    return Send(MakeFrame(op, message.data(), message.size()));
+}
+
+bool WebSocket::Ping()
+{
+    static const Frame PING_FRAME = MakeFrame(PING, "", 0);
+    std::lock_guard<std::mutex> locker(mtx_);
+    if(awaitingPong_ || closeSent_) return false;
+    awaitingPong_ = true;
+    return Queue(PING_FRAME, true);
+}
+
+bool WebSocket::GoAway()
+{
+    char payload[2] = {static_cast<char>(GOING_AWAY >> 8), static_cast<char>(GOING_AWAY & 0xff)};
+    std::lock_guard<std::mutex> locker(mtx_);
+    if(closeSent_) return false;
+    closeSent_ = true;
+    return Queue(MakeFrame(CLOSE, payload, 2), true);
+}
+
+ssize_t WebSocket::Write(int fd, TlsConn* tls, int* errno_)
+{
+    ssize_t total = 0;
+    while(true) {
+        // frames are immutable and only popped here, so their data stays valid outside the lock
+        iovec iov[MAX_IOV];
+        int count = 0;
+        {
+            std::lock_guard<std::mutex> locker(mtx_);
+            for(auto it = outbox_.begin(); it != outbox_.end() && count < MAX_IOV; ++it, ++count) {
+                size_t skip = count == 0 ? offset_ : 0;
+                iov[count].iov_base = const_cast<char*>((*it)->data()) + skip;
+                iov[count].iov_len = (*it)->size() - skip;
+            }
+        }
+        if(count == 0) return total;
+
+        ssize_t len = tls ? tls->Write(iov[0].iov_base, iov[0].iov_len) : writev(fd, iov, count);
+        if(len <= 0) {
+            *errno_ = len < 0 ? errno : EPIPE;
+            return -1;
+        }
+        total += len;
+
+        std::lock_guard<std::mutex> locker(mtx_);
+        size_t left = len;
+        while(left > 0) {
+            size_t rest = outbox_.front()->size() - offset_;
+            if(left < rest) {
+                offset_ += left;
+                break;
+            }
+            left -= rest;
+            queued_ -= outbox_.front()->size();
+            outbox_.pop_front();
+            offset_ = 0;
+        }
+    }
+}
+
+bool WebSocket::BeginTask()
+{
+    std::lock_guard<std::mutex> locker(mtx_);
+    if(busy_ || closed_) return false;
+    busy_ = true;
+    writeArmed_ = false;
+    return true;
+}
+
+void WebSocket::EndTask()
+{
+    std::lock_guard<std::mutex> locker(mtx_);
+    busy_ = false;
+    if(closed_) return;
+    writeArmed_ = !outbox_.empty() || overflow_;
+    if(arm) arm(fd_, writeArmed_);
+}
+
+bool WebSocket::HasPending()
+{
+    std::lock_guard<std::mutex> locker(mtx_);
+    return !outbox_.empty();
+}
+
+bool WebSocket::IsFinished()
+{
+    std::lock_guard<std::mutex> locker(mtx_);
+    return overflow_ || closed_ || (closeSent_ && closeReceived_ && outbox_.empty());
+}
+
+void WebSocket::Close()
+{
+    std::lock_guard<std::mutex> locker(mtx_);
+    closed_ = true;
+    outbox_.clear();
+    queued_ = 0;
+    offset_ = 0;
+}
+
+void WsChannel::Subscribe(const shared_ptr<WebSocket>& ws)
+{
+    std::lock_guard<std::mutex> locker(mtx_);
+    subscribers_.push_back(ws);
+}
+
+void WsChannel::Unsubscribe(const shared_ptr<WebSocket>& ws)
+{
+    std::lock_guard<std::mutex> locker(mtx_);
+    for(size_t i = 0; i < subscribers_.size(); i++) {
+        if(subscribers_[i].lock() == ws) {
+            subscribers_[i] = std::move(subscribers_.back());
+            subscribers_.pop_back();
+            return;
+        }
+    }
+}
+
+size_t WsChannel::Publish(WebSocket::OPCODE op, const string& message)
+{
+    WebSocket::Frame frame = WebSocket::MakeFrame(op, message.data(), message.size());
+    std::lock_guard<std::mutex> locker(mtx_);
+    size_t i = 0;
+    while(i < subscribers_.size()) {
+        shared_ptr<WebSocket> ws = subscribers_[i].lock();
+        if(ws && ws->Send(frame)) {
+            i++;
+        } else {
+            // gone or closing, unsubscribed here instead of on close
+            subscribers_[i] = std::move(subscribers_.back());
+            subscribers_.pop_back();
+        }
+    }
+    return subscribers_.size();
+}
+
+size_t WsChannel::Size()
+{
+    std::lock_guard<std::mutex> locker(mtx_);
+    return subscribers_.size();
+}
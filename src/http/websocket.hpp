@@ -0,0 +1,124 @@
+/*
+ * @author: Zimo Li
+ * @date: 2026-10-19
+*/
+
+#ifndef WEBSOCKET_HPP
+#define WEBSOCKET_HPP
+
+#include <deque>
+#include <mutex>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <functional>
+#include <sys/types.h>
+#include "../buffer/buffer.hpp"
+#include "httprequest.hpp"
+#include "tlsconn.hpp"
+
+// RFC 6455 conn after upgrade. frames are parsed in the read buffer, outgoing frames are
+// shared pointers so a broadcast is serialized once for every receiver
+class WebSocket : public std::enable_shared_from_this<WebSocket> {
+public:
+    enum OPCODE {
+        CONTINUATION = 0x0,
+        TEXT = 0x1,
+        BINARY = 0x2,
+        CLOSE = 0x8,
+        PING = 0x9,
+        PONG = 0xa,
+    };
+
+    enum CLOSE_CODE {
+        NORMAL = 1000,
+        GOING_AWAY = 1001,
+        PROTOCOL_ERROR = 1002,
+        TOO_BIG = 1009,
+    };
+
+    typedef std::shared_ptr<const std::string> Frame;
+
+    struct Handler {
+        std::function<void(const std::shared_ptr<WebSocket>& ws)> onOpen;
+        std::function<void(const std::shared_ptr<WebSocket>& ws, OPCODE op, const std::string& message)> onMessage;
+    };
+
+    // re-arm fd in epoll for read, and for write if frames are queued
+    static std::function<void(int fd, bool write)> arm;
+
+private:
+    static const char GUID[];
+    static const std::size_t MAX_MESSAGE = 1024 * 1024;
+    static const std::size_t MAX_QUEUED = 4 * 1024 * 1024; // a reader this far behind is dropped
+    static const int MAX_IOV = 64;
+
+    int fd_;
+    Handler handler_;
+
+    // reader state, only touched by the worker that owns the conn
+    std::string message_; // fragments of a message so far
+    OPCODE messageOp_; // CONTINUATION if no fragmented message is open
+    bool closeReceived_;
+
+    std::mutex mtx_;
+    std::deque<Frame> outbox_;
+    std::size_t offset_; // written part of outbox_.front()
+    std::size_t queued_; // bytes in outbox_
+    bool busy_; // a worker runs for this conn and arms it when done
+    bool writeArmed_;
+    bool closeSent_;
+    bool awaitingPong_;
+    bool overflow_;
+    bool closed_; // conn is gone, fd must not be touched
+
+    bool Queue(const Frame& frame, bool control); // called with mtx_ held
+    void Fail(CLOSE_CODE code); // close frame, conn ends after it is written
+    void Deliver(OPCODE op, const std::string& message);
+    static void Unmask(uint8_t* data, std::size_t len, const uint8_t* key);
+
+public:
+    WebSocket(int fd, const Handler& handler);
+    ~WebSocket() = default;
+
+    WebSocket(const WebSocket&) = delete;
+    WebSocket& operator=(const WebSocket&) = delete;
+
+    static bool IsUpgrade(const HttpRequest& request);
+    static std::string AcceptKey(const std::string& key); // Sec-WebSocket-Accept for a client key
+    static Frame MakeFrame(OPCODE op, const char* data, std::size_t len);
+
+    void Open(const HttpRequest& request); // queue 101 response and call onOpen
+    void OnRead(Buffer& in); // consume complete frames, payloads are unmasked in place
+    ssize_t Write(int fd, TlsConn* tls, int* errno_); // queued frames until socket is full
+
+    bool Send(const Frame& frame); // any thread, false once the conn is closing
+    bool Send(OPCODE op, const std::string& message);
+    bool Ping(); // timer probe, false if the last ping got no answer
+    bool GoAway(); // server shutdown, false if a close frame was already sent
+
+    bool BeginTask(); // main thread before dispatch, false if a worker already owns the conn
+    void EndTask(); // worker is done, arm fd again
+    bool HasPending();
+    bool IsFinished(); // close handshake done or reader dropped, conn should be closed
+    void Close(); // HttpConn is closing, stop arming the fd
+};
+
+// subscribers of one topic, published messages are framed once and shared by all of them
+class WsChannel {
+private:
+    std::mutex mtx_;
+    std::vector<std::weak_ptr<WebSocket>> subscribers_;
+
+public:
+    WsChannel() = default;
+    ~WsChannel() = default;
+
+    void Subscribe(const std::shared_ptr<WebSocket>& ws);
+    void Unsubscribe(const std::shared_ptr<WebSocket>& ws);
+    std::size_t Publish(WebSocket::OPCODE op, const std::string& message); // number of receivers
+    std::size_t Size();
+};
+
+#endif // WEBSOCKET_HPP
@@ -0,0 +1,216 @@
+/*
+ * @author: Zimo Li
+ * @date: 2026-10-19
+*/
+
+#include "accesslog.hpp"
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include "log.hpp"
+using namespace std;
+
+AccessLog AccessLog::instance;
+
+const size_t AccessLog::BLOCK_BYTES;
+const int AccessLog::FLUSH_MS;
+const size_t AccessLog::MAX_PATH_LEN;
+const int AccessLog::QUEUE_BLOCKS;
+
+AccessLog::AccessLog() : isOpen_(false), sampleRate_(1), dropped_(0), fp_(nullptr)
+{
+}
+
+AccessLog::~AccessLog()
+{
+    Close();
+}
+
+AccessLog& AccessLog::Instance()
+{
+    return instance;
+}
+
+bool AccessLog::Open(const string& path, uint32_t sampleRate)
+{
+    Close();
+    fp_ = fopen(path.c_str(), "ab");
+    if(!fp_) return false;
+    sampleRate_ = sampleRate > 0 ? sampleRate : 1;
+    blocks_.reset(new BlockDeque<vector<char>>(QUEUE_BLOCKS));
+    writer_ = thread(&AccessLog::WriteLoop, this);
+    isOpen_ = true;
+    return true;
+}
+
+void AccessLog::Close()
+{
+    if(!isOpen_.exchange(false)) return;
+    FlushIdle(true);
+    blocks_->push_back(vector<char>()); // stop mark behind the last block
+    writer_.join();
+    fclose(fp_); // blocks_ stays, an Add that raced with Close may still push into it
+    fp_ = nullptr;
+}
+
+bool AccessLog::IsOpen() const
+{
+    return isOpen_;
+}
+
+uint64_t AccessLog::Dropped() const
+{
+    return dropped_;
+}
+
+AccessLog::Local* AccessLog::GetLocal()
+{
+    thread_local shared_ptr<Local> local;
+    if(!local) {
+        local = make_shared<Local>();
+        local->records = 0;
+        local->seen = 0;
+        lock_guard<mutex> locker(mtx_);
+        locals_.push_back(local);
+    }
+    return local.get();
+}
+
+void AccessLog::Add(uint32_t ip, const string& method, const string& path, int status,
+                    size_t bytes, double latencyUs)
+{
+    if(!isOpen_) return;
+    Local* local = GetLocal();
+    uint32_t sample = sampleRate_.load(memory_order_relaxed);
+    if(status < 500 && local->seen++ % sample != 0) return;
+
+    AccessRecord record = {};
+    record.timeUs = chrono::duration_cast<chrono::microseconds>(
+                        chrono::system_clock::now().time_since_epoch()).count();
+    record.ip = ip;
+    record.pathId = PathId(path);
+    record.bytes = static_cast<uint32_t>(min<size_t>(bytes, UINT32_MAX));
+    record.latencyUs = static_cast<uint32_t>(min<double>(latencyUs, UINT32_MAX));
+    record.status = static_cast<uint16_t>(status);
+    record.method = MethodCode(method);
+    record.type = AccessRecord::REQUEST;
+    record.sample = status < 500 ? sample : 1;
+
+    vector<char> full;
+    {
+        lock_guard<mutex> locker(local->mtx);
+        if(local->data.empty()) {
+            local->data.reserve(BLOCK_BYTES + sizeof(AccessRecord) + MAX_PATH_LEN + 8);
+            local->data.resize(sizeof(AccessBlockHeader));
+            local->first = chrono::steady_clock::now();
+        }
+        if(local->paths.insert(record.pathId).second) {
+            size_t len = min(path.size(), MAX_PATH_LEN);
+            AccessRecord entry = {};
+            entry.pathId = record.pathId;
+            entry.bytes = static_cast<uint32_t>(len);
+            entry.type = AccessRecord::PATH;
+            const char* raw = reinterpret_cast<const char*>(&entry);
+            local->data.insert(local->data.end(), raw, raw + sizeof(entry));
+            local->data.insert(local->data.end(), path.data(), path.data() + len);
+            local->data.resize(local->data.size() + (8 - len % 8) % 8, 0);
+        }
+        const char* raw = reinterpret_cast<const char*>(&record);
+        local->data.insert(local->data.end(), raw, raw + sizeof(record));
+        local->records++;
+        if(local->data.size() >= BLOCK_BYTES) full = Seal(*local);
+    }
+    if(!full.empty()) {
+        uint32_t records = reinterpret_cast<AccessBlockHeader*>(full.data())->records;
+        // a slow disk costs records, never request latency
+        if(!blocks_->try_push(std::move(full), Overflow::DROP_NEWEST)) dropped_ += records;
+    }
+}
+
+vector<char> AccessLog::Seal(Local& local)
+{
+    AccessBlockHeader header = {};
+    header.magic = ACCESS_MAGIC;
+    header.version = ACCESS_VERSION;
+    header.bytes = static_cast<uint32_t>(local.data.size() - sizeof(header));
+    header.records = local.records;
+    memcpy(local.data.data(), &header, sizeof(header));
+
+    vector<char> block;
+    block.swap(local.data);
+    local.paths.clear();
+    local.records = 0;
+    return block;
+}
+
+void AccessLog::FlushIdle(bool all)
+{
+    vector<vector<char>> idle;
+    {
+        lock_guard<mutex> locker(mtx_);
+        auto now = chrono::steady_clock::now();
+        for(size_t i = 0; i < locals_.size(); i++) {
+            {
+                lock_guard<mutex> localLocker(locals_[i]->mtx);
+                if(!locals_[i]->data.empty() &&
+                   (all || now - locals_[i]->first >= chrono::milliseconds(FLUSH_MS))) {
+                    idle.push_back(Seal(*locals_[i]));
+                }
+            }
+            if(locals_[i].use_count() == 1 && locals_[i]->data.empty()) {
+                // its thread is gone and everything it logged is out
+                locals_[i] = locals_.back();
+                locals_.pop_back();
+                i--;
+            }
+        }
+    }
+    for(auto& block : idle) {
+        if(all) {
+            blocks_->push_back(std::move(block));
+        } else {
+            uint32_t records = reinterpret_cast<AccessBlockHeader*>(block.data())->records;
+            if(!blocks_->try_push(std::move(block), Overflow::DROP_NEWEST)) dropped_ += records;
+        }
+    }
+}
+
+void AccessLog::WriteLoop()
+{
+    // wake up at least every FLUSH_MS to pick up buffers of threads that went quiet
+    auto lastFlush = chrono::steady_clock::now();
+    while(true) {
+        vector<char> block;
+        bool got = blocks_->pop(block, FLUSH_MS / 1000);
+        if(got && block.empty()) break;
+        if(got && fwrite(block.data(), 1, block.size(), fp_) != block.size()) {
+            LOG_ERROR("access log write failed, errno %d", errno);
+        }
+        auto now = chrono::steady_clock::now();
+        if(now - lastFlush >= chrono::milliseconds(FLUSH_MS)) {
+            lastFlush = now;
+            FlushIdle(false);
+            fflush(fp_);
+        }
+    }
+    fflush(fp_);
+}
+
+uint32_t AccessLog::PathId(const string& path)
+{
+    uint32_t hash = 2166136261u;
+    for(size_t i = 0; i < path.size() && i < MAX_PATH_LEN; i++) {
+        hash ^= static_cast<unsigned char>(path[i]);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+uint8_t AccessLog::MethodCode(const string& method)
+{
+    static const char* NAMES[] = {"GET", "POST", "HEAD", "PUT", "DELETE", "OPTIONS", "PATCH"};
+    for(uint8_t i = 0; i < sizeof(NAMES) / sizeof(NAMES[0]); i++) {
+        if(method == NAMES[i]) return i + 1;
+    }
+    return AccessRecord::OTHER;
+}
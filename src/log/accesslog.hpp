@@ -0,0 +1,114 @@
+/*
+ * @author: Zimo Li
+ * @date: 2026-10-19
+*/
+
+#ifndef ACCESSLOG_HPP
+#define ACCESSLOG_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+#include "blockdeque.hpp"
+
+// file layout, little endian: blocks of AccessBlockHeader followed by 32 byte entries. a PATH entry
+// carries the path of pathId right behind it, padded to 8 bytes, and comes before the first REQUEST
+// entry of its block that uses it, so every block can be read on its own (tools/accesslog_dump)
+struct AccessBlockHeader {
+    uint32_t magic; // ACCESS_MAGIC
+    uint16_t version;
+    uint16_t reserved;
+    uint32_t bytes; // entries following this header
+    uint32_t records; // REQUEST entries among them
+};
+
+struct AccessRecord {
+    enum Type : uint8_t { REQUEST = 1, PATH = 2 };
+    enum Method : uint8_t { OTHER = 0, GET, POST, HEAD, PUT, DELETE, OPTIONS, PATCH };
+
+    uint64_t timeUs; // wall clock when the response was done, us since epoch
+    uint32_t ip; // network byte order as in sockaddr_in
+    uint32_t pathId; // FNV-1a of the path
+    uint32_t bytes; // response size, length of the path for PATH
+    uint32_t latencyUs; // first byte of the request to last byte of the response
+    uint16_t status;
+    uint8_t method;
+    uint8_t type;
+    uint32_t sample; // one in this many requests like it was logged
+};
+
+static_assert(sizeof(AccessBlockHeader) == 16 && sizeof(AccessRecord) == 32, "on disk layout");
+
+const uint32_t ACCESS_MAGIC = 0x4c415357; // "WSAL"
+const uint16_t ACCESS_VERSION = 1;
+
+// binary access log. workers append records to a buffer of their own thread, full blocks go to a
+// writer thread that writes them with one fwrite each, idle buffers are flushed once a second
+class AccessLog {
+private:
+    struct Local {
+        std::mutex mtx; // only contended while the writer flushes an idle buffer
+        std::vector<char> data; // block being filled, header included
+        std::unordered_set<uint32_t> paths; // path ids already in this block
+        uint32_t records;
+        uint64_t seen; // requests offered, for sampling, owner thread only
+        std::chrono::steady_clock::time_point first; // first record of the block
+    };
+
+    static AccessLog instance;
+    static const std::size_t BLOCK_BYTES = 64 * 1024;
+    static const int FLUSH_MS = 1000;
+    static const std::size_t MAX_PATH_LEN = 255;
+    static const int QUEUE_BLOCKS = 64;
+
+    std::atomic<bool> isOpen_;
+    std::atomic<uint32_t> sampleRate_;
+    std::atomic<uint64_t> dropped_; // records lost with blocks the writer could not keep up with
+
+    FILE* fp_;
+    std::unique_ptr<BlockDeque<std::vector<char>>> blocks_; // an empty block tells the writer to stop
+    std::thread writer_;
+
+    std::mutex mtx_;
+    std::vector<std::shared_ptr<Local>> locals_; // buffers of every thread that logged
+
+    AccessLog();
+    ~AccessLog();
+
+    Local* GetLocal();
+    std::vector<char> Seal(Local& local); // take the filled block out of local, its mtx held
+    void FlushIdle(bool all); // blocks older than FLUSH_MS, or all of them
+    void WriteLoop();
+
+public:
+    AccessLog(const AccessLog&) = delete;
+    AccessLog& operator=(const AccessLog&) = delete;
+
+    static AccessLog& Instance();
+
+    // append to file, keep one in sampleRate requests (errors always). false if it can't be opened
+    bool Open(const std::string& path, uint32_t sampleRate = 1);
+    void Close(); // write out every buffer and stop the writer
+    bool IsOpen() const;
+    uint64_t Dropped() const;
+
+    void Add(uint32_t ip, const std::string& method, const std::string& path, int status,
+             std::size_t bytes, double latencyUs);
+
+    static uint32_t PathId(const std::string& path);
+    static uint8_t MethodCode(const std::string& method);
+    static const char* MethodName(uint8_t code) // inline, the dump tool links nothing
+    {
+        static const char* NAMES[] = {"-", "GET", "POST", "HEAD", "PUT", "DELETE", "OPTIONS", "PATCH"};
+        return code < sizeof(NAMES) / sizeof(NAMES[0]) ? NAMES[code] : "-";
+    }
+};
+
+#endif // ACCESSLOG_HPP
@@ -7,26 +7,52 @@
 #define BLOCKDEQUE_HPP
 
 #include <deque>
+#include <algorithm>
+#include <vector>
 #include <mutex>
+#include <atomic>
+#include <thread>
 #include <condition_variable>
 #include <cassert>
+#include <cstdint>
 
 #define USE_MACRO_FUNC 1
 
 #define BLOCK_DEQUE_FUNC_DECL(FUNC, CONST, ...) \
     auto FUNC(__VA_ARGS__) -> decltype(deque_.FUNC(__VA_ARGS__)) CONST;
 
-// a deque used in multithread environment
+// what try_push does when the deque is full
+enum class Overflow {
+    BLOCK, // wait for room like push_back
+    DROP_NEWEST, // give up on the item
+    DROP_OLDEST, // make room by dropping the front item
+};
+
+// a deque used in multithread environment. waiting threads spin a little before they park on a
+// condition variable, and a push only signals when somebody is parked, so a busy consumer costs
+// producers no futex call
 template <class T>
 class BlockDeque {
 private:
+    static const int SPIN_ROUNDS = 64;
+
     std::deque<T> deque_;
     std::size_t capacity_;
+    std::atomic<std::size_t> count_; // deque_.size(), readable without the lock while spinning
+    std::size_t dropped_; // by try_push on overflow
 
     mutable std::mutex mtx;
-    bool isClosed;
+    std::atomic<bool> isClosed;
     std::condition_variable condConsumer;
     std::condition_variable condProducer;
+    int parkedConsumers;
+    int parkedProducers;
+
+    void Spin(bool forItem) const; // until an item (or room) shows up, for a while
+    bool WaitRoom(std::unique_lock<std::mutex>& locker); // false if closed meanwhile
+    bool WaitItem(std::unique_lock<std::mutex>& locker, int timeoutMS); // -1 for no timeout
+    void Pushed();
+    void Popped(std::size_t n);
 
 public:
     BlockDeque(int maxCapacity = 1024);
@@ -55,10 +81,16 @@ public:
     T back() const;
 #endif
 
-    void push_front(const T& item);
-    void push_back(const T& item);
+    void push_front(T item);
+    void push_back(T item);
+    // never waits unless policy is BLOCK. false if item was not added, it is left as it was then
+    bool try_push(T&& item, Overflow policy = Overflow::DROP_NEWEST);
+    std::size_t dropped() const;
+
     bool pop(T& item);
-    bool pop(T& item, int timeout);
+    bool pop(T& item, int timeout); // timeout in seconds
+    // wait for at least one item, then move up to maxItems into items under one lock. 0 once closed
+    std::size_t pop_all(std::vector<T>& items, std::size_t maxItems = SIZE_MAX);
 
     void flush();
     void close();
@@ -73,10 +105,10 @@ public:
     }
 
 template<class T>
-BlockDeque<T>::BlockDeque(int maxCapacity) : capacity_(maxCapacity)
+BlockDeque<T>::BlockDeque(int maxCapacity) : capacity_(maxCapacity), count_(0), dropped_(0),
+                                             isClosed(false), parkedConsumers(0), parkedProducers(0)
 {
     assert(maxCapacity > 0);
-    isClosed = false;
 }
 
 template <class T>
@@ -147,41 +179,132 @@ T BlockDeque<T>::back() const
 #endif
 
 template <class T>
-void BlockDeque<T>::push_front(const T& item) {
-    std::unique_lock<std::mutex> locker(mtx);
-    while(deque_.size() >= capacity_) {
-        condProducer.wait(locker);
-        if(isClosed) return;
+void BlockDeque<T>::Spin(bool forItem) const
+{
+    for(int i = 0; i < SPIN_ROUNDS && !isClosed; i++) {
+        std::size_t count = count_.load(std::memory_order_acquire);
+        if(forItem ? count > 0 : count < capacity_) return;
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#else
+        std::this_thread::yield();
+#endif
     }
-    deque_.push_front(item);
-    condConsumer.notify_one();
 }
 
 template <class T>
-void BlockDeque<T>::push_back(const T& item)
+bool BlockDeque<T>::WaitRoom(std::unique_lock<std::mutex>& locker)
 {
-    std::unique_lock<std::mutex> locker(mtx);
-    while(deque_.size() >= capacity_) {
+    if(deque_.size() >= capacity_ && !isClosed) {
+        locker.unlock();
+        Spin(false);
+        locker.lock();
+    }
+    while(deque_.size() >= capacity_ && !isClosed) {
+        parkedProducers++;
         condProducer.wait(locker);
-        if(isClosed) return;
+        parkedProducers--;
     }
-    deque_.push_back(item);
-    condConsumer.notify_one();
+    return !isClosed;
 }
 
 template <class T>
-bool BlockDeque<T>::pop(T& item)
+bool BlockDeque<T>::WaitItem(std::unique_lock<std::mutex>& locker, int timeoutMS)
+{
+    if(deque_.empty() && !isClosed) {
+        locker.unlock();
+        Spin(true);
+        locker.lock();
+    }
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMS);
+    while(deque_.empty() && !isClosed) {
+        parkedConsumers++;
+        bool timeout = false;
+        if(timeoutMS < 0) {
+            condConsumer.wait(locker);
+        } else {
+            timeout = condConsumer.wait_until(locker, deadline) == std::cv_status::timeout;
+        }
+        parkedConsumers--;
+        if(timeout && deque_.empty()) return false;
+    }
+    return !isClosed;
+}
+
+template <class T>
+void BlockDeque<T>::Pushed()
+{
+    count_.store(deque_.size(), std::memory_order_release);
+    if(parkedConsumers > 0) condConsumer.notify_one();
+}
+
+template <class T>
+void BlockDeque<T>::Popped(std::size_t n)
+{
+    count_.store(deque_.size(), std::memory_order_release);
+    if(parkedProducers > 0) {
+        if(n > 1) {
+            condProducer.notify_all();
+        } else {
+            condProducer.notify_one();
+        }
+    }
+}
+
+template <class T>
+void BlockDeque<T>::push_front(T item)
+{
+    std::unique_lock<std::mutex> locker(mtx);
+    if(!WaitRoom(locker)) return;
+    deque_.push_front(std::move(item));
+    Pushed();
+}
+
+template <class T>
+void BlockDeque<T>::push_back(T item)
+{
+    std::unique_lock<std::mutex> locker(mtx);
+    if(!WaitRoom(locker)) return;
+    deque_.push_back(std::move(item));
+    Pushed();
+}
+
+template <class T>
+bool BlockDeque<T>::try_push(T&& item, Overflow policy)
 {
     std::unique_lock<std::mutex> locker(mtx);
-    while(deque_.empty()) {
-        condConsumer.wait(locker);
-        if(isClosed) {
+    if(isClosed) return false;
+    if(deque_.size() >= capacity_) {
+        if(policy == Overflow::BLOCK) {
+            if(!WaitRoom(locker)) return false;
+        } else if(policy == Overflow::DROP_NEWEST) {
+            dropped_++;
             return false;
+        } else {
+            deque_.pop_front();
+            dropped_++;
         }
     }
-    item = deque_.front();
+    deque_.push_back(std::move(item));
+    Pushed();
+    return true;
+}
+
+template <class T>
+std::size_t BlockDeque<T>::dropped() const
+{
+    std::lock_guard<std::mutex> locker(mtx);
+    return dropped_;
+}
+
+template <class T>
+bool BlockDeque<T>::pop(T& item)
+{
+    std::unique_lock<std::mutex> locker(mtx);
+    if(!WaitItem(locker, -1)) return false;
+    item = std::move(deque_.front());
     deque_.pop_front();
-    condProducer.notify_one();
+    Popped(1);
     return true;
 }
 
@@ -189,25 +312,32 @@ template <class T>
 bool BlockDeque<T>::pop(T& item, int timeout)
 {
     std::unique_lock<std::mutex> locker(mtx);
-    while(deque_.empty()) {
-        if(condConsumer.wait_for(locker, 
-            std::chrono::seconds(timeout)) == std::cv_status::timeout) {
-                return false;
-            }
-        if(isClosed) {
-            return false;
-        }
-    }
-    item = deque_.front();
+    if(!WaitItem(locker, timeout * 1000)) return false;
+    item = std::move(deque_.front());
     deque_.pop_front();
-    condProducer.notify_one();
+    Popped(1);
     return true;
 }
 
+template <class T>
+std::size_t BlockDeque<T>::pop_all(std::vector<T>& items, std::size_t maxItems)
+{
+    std::unique_lock<std::mutex> locker(mtx);
+    if(!WaitItem(locker, -1)) return 0;
+    std::size_t n = std::min(maxItems, deque_.size());
+    for(std::size_t i = 0; i < n; i++) {
+        items.push_back(std::move(deque_.front()));
+        deque_.pop_front();
+    }
+    Popped(n);
+    return n;
+}
+
 template <class T>
 void BlockDeque<T>::flush()
 {
-    condConsumer.notify_one();
+    std::lock_guard<std::mutex> locker(mtx);
+    if(parkedConsumers > 0) condConsumer.notify_one();
 }
 
 template <class T>
@@ -215,6 +345,7 @@ void BlockDeque<T>::close() {
     {
         std::lock_guard<std::mutex> locker(mtx);
         deque_.clear();
+        count_ = 0;
         isClosed = true;
     }
     condConsumer.notify_all();
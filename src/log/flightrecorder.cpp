@@ -0,0 +1,212 @@
+/*
+ * @author: Zimo Li
+ * @date: 2026-10-19
+*/
+
+#include "flightrecorder.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <ctime>
+#include <fcntl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+using namespace std;
+
+const int FlightRecorder::SLOTS;
+const int FlightRecorder::MAX_RINGS;
+const int FlightRecorder::ARG_BYTES;
+
+atomic<int> FlightRecorder::level_(INT_MAX);
+atomic<int> FlightRecorder::ringCount_(0);
+atomic<FlightRecorder::Ring*> FlightRecorder::rings_[MAX_RINGS];
+atomic<bool> FlightRecorder::dumping_(false);
+char FlightRecorder::crashFile_[256];
+
+namespace {
+
+const int FATAL_SIGNALS[] = {SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT};
+
+// write(2) in blocks, static so a dump from a signal handler needs no allocation and little stack.
+// only used while dumping_ is held
+char dumpBuf[16 * 1024];
+
+struct DumpWriter {
+    int fd;
+    size_t len;
+    bool ok;
+
+    void Flush()
+    {
+        size_t done = 0;
+        while(ok && done < len) {
+            ssize_t n = write(fd, dumpBuf + done, len - done);
+            if(n < 0 && errno == EINTR) continue;
+            if(n <= 0) ok = false;
+            else done += n;
+        }
+        len = 0;
+    }
+
+    void Put(const void* data, size_t n)
+    {
+        const char* p = static_cast<const char*>(data);
+        while(n > 0) {
+            if(len == sizeof(dumpBuf)) Flush();
+            size_t step = min(n, sizeof(dumpBuf) - len);
+            memcpy(dumpBuf + len, p, step);
+            len += step;
+            p += step;
+            n -= step;
+        }
+    }
+};
+
+uint64_t NowUs()
+{
+    timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+}
+
+bool FlightRecorder::Enable(int level, const char* crashFile)
+{
+    if(!crashFile || strlen(crashFile) >= sizeof(crashFile_)) return false;
+    static bool installed = false; // handlers stay, they check level_
+    strcpy(crashFile_, crashFile);
+    if(!installed) {
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = OnFatal;
+        sa.sa_flags = SA_RESETHAND; // back to the default action once we are in, so the re-raise kills
+        sigemptyset(&sa.sa_mask);
+        for(int signo : FATAL_SIGNALS) {
+            if(sigaction(signo, &sa, nullptr) < 0) return false;
+        }
+        installed = true;
+    }
+    level_.store(level, memory_order_relaxed);
+    return true;
+}
+
+void FlightRecorder::Disable()
+{
+    level_.store(INT_MAX, memory_order_relaxed);
+}
+
+void FlightRecorder::OnFatal(int signo)
+{
+    if(level_.load(memory_order_relaxed) != INT_MAX) Dump(crashFile_, signo);
+    raise(signo); // default action by now, a fault just happens again on return
+}
+
+FlightRecorder::Ring* FlightRecorder::MyRing(int& tid)
+{
+    struct Holder {
+        Ring* ring = nullptr;
+        int tid = 0;
+        bool full = false; // don't search on every call once there are no rings left
+        ~Holder() { if(ring) ring->used.store(false, memory_order_release); }
+    };
+    thread_local Holder holder;
+    if(holder.ring || holder.full) {
+        tid = holder.tid;
+        return holder.ring;
+    }
+    holder.tid = tid = static_cast<int>(syscall(SYS_gettid));
+
+    // take over the ring of an exited thread first, its records get overwritten as this one goes
+    int count = min(ringCount_.load(memory_order_acquire), MAX_RINGS);
+    for(int i = 0; i < count; i++) {
+        Ring* ring = rings_[i].load(memory_order_acquire);
+        bool expected = false;
+        if(ring && ring->used.compare_exchange_strong(expected, true, memory_order_acq_rel)) {
+            return holder.ring = ring;
+        }
+    }
+    int i = ringCount_.fetch_add(1, memory_order_acq_rel);
+    if(i >= MAX_RINGS) {
+        holder.full = true;
+        return nullptr;
+    }
+    Ring* ring = new Ring(); // zeroed, kept until exit since a dump may read it any time
+    ring->used.store(true, memory_order_relaxed);
+    rings_[i].store(ring, memory_order_release);
+    return holder.ring = ring;
+}
+
+FlightRecorder::Slot* FlightRecorder::Begin(int level, const char* format, Ring*& ring)
+{
+    int tid;
+    ring = MyRing(tid);
+    if(!ring) return nullptr;
+    Slot* slot = &ring->slots[ring->next % SLOTS];
+    slot->seq.store(0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release); // a dumper that sees the new fields sees the 0 too
+    slot->timeUs = NowUs();
+    slot->format = format;
+    slot->tid = tid;
+    slot->level = static_cast<uint8_t>(level);
+    slot->args = 0;
+    slot->argBytes = 0;
+    return slot;
+}
+
+void FlightRecorder::Commit(Ring* ring, Slot* slot)
+{
+    slot->seq.store(++ring->next, memory_order_release);
+}
+
+bool FlightRecorder::Dump(const char* file, int signo)
+{
+    bool expected = false;
+    if(!dumping_.compare_exchange_strong(expected, true, memory_order_acquire)) return false;
+    int fd = open(file, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(fd < 0) {
+        dumping_.store(false, memory_order_release);
+        return false;
+    }
+    DumpWriter out{fd, 0, true};
+    FlightHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = FLIGHT_MAGIC;
+    header.version = FLIGHT_VERSION;
+    header.pid = getpid();
+    header.signo = signo;
+    header.timeUs = NowUs();
+    out.Put(&header, sizeof(header));
+
+    uint8_t data[ARG_BYTES];
+    int count = min(ringCount_.load(memory_order_acquire), MAX_RINGS);
+    for(int i = 0; i < count; i++) {
+        Ring* ring = rings_[i].load(memory_order_acquire);
+        if(!ring) continue;
+        for(Slot& slot : ring->slots) {
+            // copy, then keep the copy only if the owner didn't start over the slot meanwhile
+            uint64_t seq = slot.seq.load(memory_order_acquire);
+            if(seq == 0) continue;
+            FlightRecord record;
+            memset(&record, 0, sizeof(record));
+            record.timeUs = slot.timeUs;
+            record.tid = slot.tid;
+            record.level = slot.level;
+            record.args = slot.args;
+            record.argBytes = min<uint16_t>(slot.argBytes, ARG_BYTES);
+            const char* format = slot.format;
+            memcpy(data, slot.data, record.argBytes);
+            atomic_thread_fence(memory_order_acquire);
+            if(slot.seq.load(memory_order_relaxed) != seq || !format) continue;
+            record.formatLen = static_cast<uint16_t>(strnlen(format, UINT16_MAX));
+            out.Put(&record, sizeof(record));
+            out.Put(format, record.formatLen);
+            out.Put(data, record.argBytes);
+        }
+    }
+    out.Flush();
+    bool ok = out.ok;
+    close(fd);
+    dumping_.store(false, memory_order_release);
+    return ok;
+}
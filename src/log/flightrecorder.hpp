@@ -0,0 +1,145 @@
+/*
+ * @author: Zimo Li
+ * @date: 2026-10-19
+*/
+
+#ifndef FLIGHTRECORDER_HPP
+#define FLIGHTRECORDER_HPP
+
+#include <atomic>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+// dump layout, little endian: FlightHeader, then the records of every ring as FlightRecord, the format
+// text (formatLen bytes) and the args (argBytes bytes). an arg is a FlightArg tag and its value: 8 bytes
+// for numbers and pointers, a length byte and the text for strings (tools/flightrec_dump)
+struct FlightHeader {
+    uint32_t magic; // FLIGHT_MAGIC
+    uint16_t version;
+    uint16_t reserved;
+    int32_t pid;
+    int32_t signo; // what caused the dump
+    uint64_t timeUs;
+};
+
+struct FlightRecord {
+    uint64_t timeUs; // wall clock, us since epoch
+    int32_t tid;
+    uint16_t formatLen;
+    uint16_t argBytes;
+    uint8_t level;
+    uint8_t args;
+    uint16_t reserved;
+    uint32_t reserved2;
+};
+
+enum FlightArg : uint8_t { ARG_INT = 1, ARG_UINT, ARG_DOUBLE, ARG_PTR, ARG_STR };
+
+static_assert(sizeof(FlightHeader) == 24 && sizeof(FlightRecord) == 24, "dump layout");
+
+const uint32_t FLIGHT_MAGIC = 0x52464c57; // "WLFR"
+const uint16_t FLIGHT_VERSION = 1;
+
+// LOG_ calls under the level of the log file go into a ring of this thread instead: format pointer
+// and raw args, nothing is formatted. rings are written to a file on a fatal signal (assert failures
+// end in SIGABRT) or when Dump is called, so the debug lines around a problem are there without
+// paying for them on disk all the time
+class FlightRecorder {
+public:
+    static const int SLOTS = 512; // per thread, the oldest record is overwritten
+    static const int MAX_RINGS = 256; // threads that record, later ones don't
+    static const int ARG_BYTES = 96; // args past this are dropped, strings cut to fit
+
+private:
+    struct Slot {
+        std::atomic<uint64_t> seq; // index + 1 once written, 0 while being written
+        uint64_t timeUs;
+        const char* format; // LOG_ formats are literals, they outlive any thread
+        int32_t tid;
+        uint8_t level;
+        uint8_t args;
+        uint16_t argBytes;
+        uint8_t data[ARG_BYTES];
+    };
+
+    struct Ring {
+        std::atomic<bool> used; // a thread holds it, an exited thread leaves its records to the next one
+        uint64_t next; // owner only
+        Slot slots[SLOTS];
+    };
+
+    static std::atomic<int> level_; // INT_MAX when off
+    static std::atomic<int> ringCount_;
+    static std::atomic<Ring*> rings_[MAX_RINGS];
+    static std::atomic<bool> dumping_;
+    static char crashFile_[256]; // copied at Enable, the signal handler can't touch a std::string
+
+    static Ring* MyRing(int& tid); // nullptr once MAX_RINGS threads hold one
+    static Slot* Begin(int level, const char* format, Ring*& ring);
+    static void Commit(Ring* ring, Slot* slot);
+    static void OnFatal(int signo);
+
+    template<class T>
+    static void Put(Slot* slot, const T& value)
+    {
+        typedef std::decay_t<T> U;
+        uint8_t* p = slot->data + slot->argBytes;
+        std::size_t left = ARG_BYTES - slot->argBytes;
+        if constexpr(std::is_same_v<U, char*> || std::is_same_v<U, const char*>) {
+            if(left < 2) return;
+            const char* s = value; // arrays decay here
+            if(!s) s = "(null)";
+            std::size_t len = strnlen(s, left - 2 < 255 ? left - 2 : 255);
+            p[0] = ARG_STR;
+            p[1] = static_cast<uint8_t>(len);
+            memcpy(p + 2, s, len);
+            slot->argBytes += 2 + len;
+        } else {
+            if(left < 9) return;
+            uint64_t bits = 0;
+            if constexpr(std::is_floating_point_v<U>) {
+                double d = value;
+                memcpy(&bits, &d, sizeof(bits));
+                p[0] = ARG_DOUBLE;
+            } else if constexpr(std::is_pointer_v<U>) {
+                bits = reinterpret_cast<uintptr_t>(value);
+                p[0] = ARG_PTR;
+            } else if constexpr(std::is_signed_v<U> || std::is_enum_v<U>) {
+                int64_t v = static_cast<int64_t>(value);
+                memcpy(&bits, &v, sizeof(bits));
+                p[0] = ARG_INT;
+            } else {
+                bits = static_cast<uint64_t>(value);
+                p[0] = ARG_UINT;
+            }
+            memcpy(p + 1, &bits, sizeof(bits));
+            slot->argBytes += 9;
+        }
+        slot->args++;
+    }
+
+public:
+    // record LOG_ calls from level up that the log file doesn't take, dump to crashFile on a fatal signal
+    static bool Enable(int level, const char* crashFile);
+    static void Disable(); // rings keep what they have, handlers stay harmless
+
+    static bool IsOn(int level) { return level >= level_.load(std::memory_order_relaxed); }
+
+    template<class... Args>
+    static void Record(int level, const char* format, const Args&... args)
+    {
+        Ring* ring;
+        Slot* slot = Begin(level, format, ring);
+        if(!slot) return;
+        (Put(slot, args), ...);
+        Commit(ring, slot);
+    }
+
+    // write every ring to file, only async signal safe calls. false if it can't be written or another
+    // dump is running. records being written meanwhile are skipped
+    static bool Dump(const char* file, int signo = 0);
+};
+
+#endif // FLIGHTRECORDER_HPP
@@ -8,10 +8,21 @@
 #include <cassert>
 #include <sys/time.h>
 #include <cstdarg>
+#include "../pool/affinity.hpp"
 
 Log Log::instance;
 
 Log::~Log()
+{
+    close();
+    if(fp) {
+        std::lock_guard<std::mutex> locker(mtx);
+        fclose(fp);
+        fp = nullptr;
+    }
+}
+
+void Log::close()
 {
     if(writeThread && writeThread->joinable()) {
         while(!deque_->empty()) {
@@ -20,12 +31,20 @@ Log::~Log()
         deque_->close();
         writeThread->join();
     }
-    
-    if(fp) {
-        std::lock_guard<std::mutex> locker(mtx);
-        flush();
-        fclose(fp);
-    }
+
+    std::lock_guard<std::mutex> locker(mtx);
+    // lines logged after close are written directly
+    isAsync = false;
+    writeThread.reset();
+    deque_.reset();
+    if(fp) fflush(fp);
+}
+
+bool Log::PinWriter(int cpu)
+{
+    std::lock_guard<std::mutex> locker(mtx);
+    if(!writeThread) return false;
+    return CpuAffinity::Pin(writeThread->native_handle(), cpu);
 }
 
 void Log::AppendLogTitle(int level)
@@ -51,10 +70,18 @@ void Log::AppendLogTitle(int level)
 
 void Log::AsyncWrite()
 {
-    std::string str = "";
-    while(deque_->pop(str)) {
+    // lines are taken in batches, one lock round per batch instead of per line
+    std::vector<std::string> lines;
+    std::size_t reported = 0;
+    while(deque_->pop_all(lines) > 0) {
+        std::size_t dropped = deque_->dropped();
         std::lock_guard<std::mutex> locker(mtx);
-        fputs(str.c_str(), fp);
+        for(auto& line : lines) fputs(line.c_str(), fp);
+        if(dropped > reported) {
+            fprintf(fp, "[warn] : log queue full, %zu lines dropped\n", dropped - reported);
+            reported = dropped;
+        }
+        lines.clear();
     }
 }
 
@@ -72,8 +99,7 @@ void Log::init(int level, const char* path, const char* suffix, int maxDequeSize
     if(maxDequeSize > 0) {
         isAsync = true;
         if(!deque_) {
-            std::unique_ptr<BlockDeque<std::string>> newDeque(new BlockDeque<std::string>);
-            deque_ = std::move(newDeque);
+            deque_ = std::make_shared<BlockDeque<std::string>>(maxDequeSize);
 
             std::unique_ptr<std::thread> newThread(new std::thread([]{
                 Log::Instance().AsyncWrite();
@@ -115,22 +141,31 @@ void Log::init(int level, const char* path, const char* suffix, int maxDequeSize
 
 bool Log::IsOpen() const
 {
-    std::lock_guard<std::mutex> locker(mtx);
-    return isOpen;
+    return isOpen.load(std::memory_order_relaxed);
 }
 
 int Log::GetLevel() const
 {
-    std::lock_guard<std::mutex> locker(mtx);
-    return this->level;
+    return this->level.load(std::memory_order_relaxed);
 }
 
 void Log::SetLevel(int level)
 {
-    std::lock_guard<std::mutex> locker(mtx);
     this->level = level;
 }
 
+void Log::SetMaxLines(int lines)
+{
+    assert(lines > 0);
+    maxLines = lines;
+}
+
+void Log::SetOverflow(Overflow policy)
+{
+    std::lock_guard<std::mutex> locker(mtx);
+    overflow = policy;
+}
+
 void Log::flush()
 {
     if(isAsync) {
@@ -147,8 +182,9 @@ void Log::write(int level, const char* format, ...)
     tm* ptr = localtime(&seconds);
     tm t = *ptr;
 
+    int lines = maxLines;
     if(today != t.tm_mday ||
-     (lineCount && lineCount % MAX_LINES == 0)) {
+     (lineCount && lineCount % lines == 0)) {
         std::unique_lock<std::mutex> locker(mtx);
         locker.unlock();
 
@@ -163,7 +199,7 @@ void Log::write(int level, const char* format, ...)
             lineCount = 0;
         } else {
             snprintf(newFile, LOG_PATH_LEN, "%s/%s-%d%s",
-                    path, name, lineCount / MAX_LINES, suffix);
+                    path, name, lineCount / lines, suffix);
         }
 
         locker.lock();
@@ -173,6 +209,9 @@ void Log::write(int level, const char* format, ...)
         assert(fp != nullptr);
     }
 
+    std::string line;
+    std::shared_ptr<BlockDeque<std::string>> deque;
+    Overflow policy;
     {
         // write log content
         std::lock_guard<std::mutex> locker(mtx);
@@ -192,10 +231,18 @@ void Log::write(int level, const char* format, ...)
         va_end(valist);
         buffer.Append("\n\0", 2);
 
-        if(isAsync && deque_ && !deque_->full()) {
-            deque_->push_back(buffer.RetrieveAllToStr());
-        } else {
+        if(!isAsync || !deque_) {
             fputs(buffer.RetrieveAllToStr().c_str(), fp);
+            return;
         }
+        line = buffer.RetrieveAllToStr();
+        deque = deque_;
+        policy = overflow;
+    }
+    // outside the lock, a BLOCK push waits for the writer thread, which needs mtx to write
+    if(!deque->try_push(std::move(line), policy) && policy == Overflow::BLOCK) {
+        // closed meanwhile
+        std::lock_guard<std::mutex> locker(mtx);
+        fputs(line.c_str(), fp);
     }
 }
@@ -7,8 +7,10 @@
 #define LOG_HPP
 
 #include "../buffer/buffer.hpp"
+#include <atomic>
 #include <memory>
 #include "blockdeque.hpp"
+#include "flightrecorder.hpp"
 #include <thread>
 #include <mutex>
 
@@ -19,25 +21,27 @@ private:
     static const int LOG_PATH_LEN = 256;
     static const int LOG_NAME_LEN = 64;
     static const int MAX_LINE_LEN = 128;
-    static const int MAX_LINES = 50000;
+    static const int MAX_LINES = 50000; // default of SetMaxLines
 
     const char* path;
     const char* suffix;
 
-    bool isOpen;
+    std::atomic<bool> isOpen; // read by every LOG_ call, so is level, neither takes mtx
     int lineCount;
+    std::atomic<int> maxLines;
     int today;
 
     Buffer buffer;
-    int level;
+    std::atomic<int> level;
     bool isAsync; // if log is async, we will have a new thread to process log
+    Overflow overflow; // what a full deque does with a new line
 
     FILE* fp;
-    std::unique_ptr<BlockDeque<std::string>> deque_;
+    std::shared_ptr<BlockDeque<std::string>> deque_; // writers push on their own copy outside mtx
     std::unique_ptr<std::thread> writeThread;
     mutable std::mutex mtx;
 
-    Log() : lineCount(0), today(0), isAsync(false), 
+    Log() : lineCount(0), maxLines(MAX_LINES), today(0), isAsync(false), overflow(Overflow::BLOCK),
             fp(nullptr), deque_(nullptr), writeThread(nullptr) {};
     ~Log();
 
@@ -55,8 +59,13 @@ public:
 
     int GetLevel() const;
     void SetLevel(int level);
+    void SetMaxLines(int lines); // lines per file before it is split, from the next split on
+    // BLOCK (default) never loses a line but a slow disk stalls callers, the drop policies don't
+    void SetOverflow(Overflow policy);
 
     void flush();
+    void close(); // write out queued lines and stop the async thread, safe to call before exit
+    bool PinWriter(int cpu); // keep async writer thread on one cpu, false if log isn't async
 
     void write(int level, const char* format, ...);
 };
@@ -67,6 +76,8 @@ public:
         if(instance.IsOpen() && instance.GetLevel() <= level) {\
             instance.write(level, format, ##__VA_ARGS__); \
             instance.flush(); \
+        } else if(FlightRecorder::IsOn(level)) {\
+            FlightRecorder::Record(level, format, ##__VA_ARGS__); \
         }\
     } while(0);
 
@@ -0,0 +1,100 @@
+/*
+ * @author: Zimo Li
+ * @date: 2026-10-19
+*/
+
+#include "reqtrace.hpp"
+#include <chrono>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#include "log.hpp"
+using namespace std;
+
+atomic<int> RequestTrace::slowMS(0);
+thread_local RequestTrace* RequestTrace::active = nullptr;
+
+namespace {
+
+typedef chrono::steady_clock Clock;
+
+// ticks per us are measured against the steady clock since start, fixed once 100ms have passed
+const uint64_t BASE_TICKS = RequestTrace::Now();
+const Clock::time_point BASE_TIME = Clock::now();
+const double CALIBRATE_US = 100000;
+atomic<double> ticksPerUs(0);
+
+}
+
+RequestTrace::RequestTrace()
+{
+    Reset(-1);
+}
+
+void RequestTrace::Reset(int fd)
+{
+    fd_ = fd;
+    start_ = 0;
+    for(int i = 0; i < PHASE_COUNT; i++) begin_[i] = sum_[i] = 0;
+}
+
+void RequestTrace::Begin(Phase phase)
+{
+    uint64_t now = Now();
+    if(start_ == 0) start_ = now;
+    begin_[phase] = now;
+    TRACE_PROBE2(phase_begin, fd_, phase);
+}
+
+void RequestTrace::End(Phase phase)
+{
+    if(begin_[phase] == 0) return;
+    uint64_t ticks = Now() - begin_[phase];
+    begin_[phase] = 0;
+    sum_[phase] += ticks;
+    TRACE_PROBE3(phase_end, fd_, phase, ticks);
+}
+
+void RequestTrace::Add(Phase phase, uint64_t ticks)
+{
+    sum_[phase] += ticks;
+    TRACE_PROBE3(phase_end, fd_, phase, ticks);
+}
+
+uint64_t RequestTrace::Finish(const string& method, const string& path)
+{
+    if(start_ == 0) return 0;
+    uint64_t total = Now() - start_;
+    TRACE_PROBE2(request_done, fd_, total);
+    int slow = slowMS.load(memory_order_relaxed);
+    if(slow > 0 && ToUs(total) >= slow * 1000.0) {
+        // log lines are short, so a compact legend: queue read parse process(incl. parse, db) db write, in us
+        LOG_WARN("slow %.1fms %s %.32s q%.0f r%.0f p%.0f h%.0f db%.0f w%.0f", ToUs(total) / 1000,
+                 method.c_str(), path.c_str(), ToUs(sum_[QUEUE]), ToUs(sum_[READ]), ToUs(sum_[PARSE]),
+                 ToUs(sum_[PROCESS]), ToUs(sum_[DB]), ToUs(sum_[WRITE]));
+    }
+    Reset(fd_);
+    return total;
+}
+
+uint64_t RequestTrace::Now()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return chrono::duration_cast<chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+#endif
+}
+
+double RequestTrace::ToUs(uint64_t ticks)
+{
+    double rate = ticksPerUs.load(memory_order_relaxed);
+    if(rate == 0) {
+        double elapsed = chrono::duration<double, micro>(Clock::now() - BASE_TIME).count();
+        uint64_t elapsedTicks = Now() - BASE_TICKS;
+        if(elapsed < 1 || elapsedTicks == 0) return 0;
+        rate = elapsedTicks / elapsed;
+        if(elapsed >= CALIBRATE_US) ticksPerUs.store(rate, memory_order_relaxed);
+    }
+    return ticks / rate;
+}
@@ -0,0 +1,61 @@
+/*
+ * @author: Zimo Li
+ * @date: 2026-10-19
+*/
+
+#ifndef REQTRACE_HPP
+#define REQTRACE_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// USDT probes, provider "webserver", compiled in when systemtap's sys/sdt.h is installed:
+//   phase_begin(fd, phase), phase_end(fd, phase, ticks), request_done(fd, total ticks)
+// e.g. bpftrace -e 'usdt:./server:webserver:phase_end /arg1 == 4/ { @db = hist(arg2); }'
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define TRACE_PROBE2(name, a, b) DTRACE_PROBE2(webserver, name, a, b)
+#define TRACE_PROBE3(name, a, b, c) DTRACE_PROBE3(webserver, name, a, b, c)
+#else
+#define TRACE_PROBE2(name, a, b) do {} while(0)
+#define TRACE_PROBE3(name, a, b, c) do {} while(0)
+#endif
+
+// time one request spends in each phase, in TSC ticks. a phase may run several times per
+// request (reads, writes), the sums are kept. a conn is owned by one thread at a time, so no locks
+class RequestTrace {
+public:
+    enum Phase {
+        QUEUE = 0, // task waiting in the thread pool
+        READ,
+        PARSE,
+        PROCESS, // whole of HttpConn::process, parse and db included
+        DB, // waiting for a sql conn
+        WRITE,
+        PHASE_COUNT,
+    };
+
+    static std::atomic<int> slowMS; // requests slower than this are logged with their phases, 0 is off
+    static thread_local RequestTrace* active; // request in process() on this thread, for phases deep down
+
+    RequestTrace();
+
+    void Reset(int fd); // forget the current request, fd is reported by the probes
+    void Begin(Phase phase); // the first Begin after Reset starts the request clock
+    void End(Phase phase); // no-op without a Begin
+    void Add(Phase phase, uint64_t ticks);
+    // response is out, log if slow. ticks from first Begin, 0 if nothing was traced
+    uint64_t Finish(const std::string& method, const std::string& path);
+
+    static uint64_t Now(); // rdtsc on x86, steady clock ns elsewhere
+    static double ToUs(uint64_t ticks);
+
+private:
+    int fd_;
+    uint64_t start_;
+    uint64_t begin_[PHASE_COUNT];
+    uint64_t sum_[PHASE_COUNT];
+};
+
+#endif // REQTRACE_HPP
@@ -0,0 +1,87 @@
+/*
+ * @author: Zimo Li
+ * @date: 2026-10-19
+*/
+
+#include "affinity.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <sched.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/socket.h>
+using namespace std;
+
+bool CpuAffinity::Pin(pthread_t thread, int cpu)
+{
+    if(cpu < 0 || cpu >= CPU_SETSIZE) return false;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(thread, sizeof(set), &set) == 0;
+}
+
+bool CpuAffinity::PinSelf(int cpu)
+{
+    return Pin(pthread_self(), cpu);
+}
+
+vector<int> CpuAffinity::Parse(const string& list)
+{
+    vector<int> cpus;
+    size_t pos = 0;
+    while(pos < list.size()) {
+        size_t end = list.find(',', pos);
+        if(end == string::npos) end = list.size();
+        string part = list.substr(pos, end - pos);
+        pos = end + 1;
+
+        char* rest = nullptr;
+        long first = strtol(part.c_str(), &rest, 10);
+        if(rest == part.c_str() || first < 0) continue;
+        long last = first;
+        if(*rest == '-') {
+            const char* next = rest + 1;
+            last = strtol(next, &rest, 10);
+            if(rest == next || last < first) continue;
+        }
+        if(*rest != '\0' || last >= CPU_SETSIZE) continue;
+        for(long cpu = first; cpu <= last; cpu++) cpus.push_back(static_cast<int>(cpu));
+    }
+    return cpus;
+}
+
+int CpuAffinity::CpuCount()
+{
+    long n = sysconf(_SC_NPROCESSORS_CONF);
+    return n > 0 ? static_cast<int>(n) : 1;
+}
+
+int CpuAffinity::NodeOf(int cpu)
+{
+    // sysfs puts a nodeN link into the directory of every cpu
+    char path[64];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+    DIR* dir = opendir(path);
+    if(!dir) return -1;
+    int node = -1;
+    while(dirent* entry = readdir(dir)) {
+        int n;
+        if(sscanf(entry->d_name, "node%d", &n) == 1) {
+            node = n;
+            break;
+        }
+    }
+    closedir(dir);
+    return node;
+}
+
+int CpuAffinity::IncomingCpu(int sockFd)
+{
+#ifdef SO_INCOMING_CPU
+    int cpu = -1;
+    socklen_t len = sizeof(cpu);
+    if(getsockopt(sockFd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, &len) == 0) return cpu;
+#endif
+    return -1;
+}
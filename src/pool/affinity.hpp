@@ -0,0 +1,24 @@
+/*
+ * @author: Zimo Li
+ * @date: 2026-10-19
+*/
+
+#ifndef AFFINITY_HPP
+#define AFFINITY_HPP
+
+#include <pthread.h>
+#include <string>
+#include <vector>
+
+// cpu pinning helpers shared by thread pool, log and server
+class CpuAffinity {
+public:
+    static bool Pin(pthread_t thread, int cpu);
+    static bool PinSelf(int cpu);
+    static std::vector<int> Parse(const std::string& list); // "0-3,8,10-11", invalid parts are skipped
+    static int CpuCount(); // configured cpus
+    static int NodeOf(int cpu); // NUMA node of cpu, -1 if unknown
+    static int IncomingCpu(int sockFd); // cpu that handled the socket's last packet (RSS/IRQ), -1 if unknown
+};
+
+#endif // AFFINITY_HPP
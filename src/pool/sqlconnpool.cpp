@@ -0,0 +1,249 @@
+/*
+ * @author: Zimo Li
+ * @date: 2026-10-19
+*/
+
+#include "sqlconnpool.hpp"
+#include <cassert>
+#include <sys/epoll.h>
+#include "../log/log.hpp"
+#include "../log/reqtrace.hpp"
+using namespace std;
+
+SqlConnPool SqlConnPool::instance_;
+SqlConnPool::PasswordLookup SqlConnPool::passwordLookup = SqlConnPool::PasswordOf;
+
+SqlConnPool::SqlConnPool() : MAXCONN(0), usedCount(0), availCount(0)
+{
+}
+
+SqlConnPool::~SqlConnPool()
+{
+    ClosePool();
+}
+
+SqlConnPool& SqlConnPool::Instance()
+{
+    return instance_;
+}
+
+void SqlConnPool::init(const char* host, int port, const char* user,
+                       const char* pwd, const char* db, int connSize)
+{
+    assert(connSize > 0);
+    vector<MYSQL*> conns;
+    for(int i = 0; i < connSize; i++) {
+        MYSQL* sql = mysql_init(nullptr);
+        if(!sql) {
+            LOG_ERROR("MySql init error!");
+            assert(sql);
+        }
+#ifdef MYSQL_WAIT_READ
+        mysql_options(sql, MYSQL_OPT_NONBLOCK, 0); // mariadb: allow the _start/_cont calls of QueryAsync
+#endif
+        if(!mysql_real_connect(sql, host, user, pwd, db, port, nullptr, 0)) {
+            LOG_ERROR("MySql connect error: %s", mysql_error(sql));
+        }
+        conns.push_back(sql);
+    }
+    init(conns);
+}
+
+void SqlConnPool::init(const vector<MYSQL*>& conns)
+{
+    assert(!conns.empty());
+    for(MYSQL* sql : conns) connQueue.push(sql);
+    MAXCONN = static_cast<int>(conns.size());
+    availCount = MAXCONN;
+    sem_init(&sem, 0, MAXCONN);
+}
+
+MYSQL* SqlConnPool::GetConn()
+{
+    if(MAXCONN == 0) {
+        LOG_WARN("SqlConnPool is not initialized!");
+        return nullptr;
+    }
+    uint64_t begin = RequestTrace::Now();
+    sem_wait(&sem);
+    if(RequestTrace::active) RequestTrace::active->Add(RequestTrace::DB, RequestTrace::Now() - begin);
+    lock_guard<mutex> locker(mtx);
+    if(connQueue.empty()) return nullptr; // closed meanwhile
+    MYSQL* sql = connQueue.front();
+    connQueue.pop();
+    usedCount++;
+    availCount--;
+    return sql;
+}
+
+SqlConnPool::ConnAwaiter SqlConnPool::GetConnAsync()
+{
+    assert(CoScheduler::Current());
+    return ConnAwaiter(this);
+}
+
+bool SqlConnPool::Enqueue(coroutine_handle<> handle, MYSQL** conn)
+{
+    lock_guard<mutex> locker(mtx);
+    if(MAXCONN == 0) {
+        *conn = nullptr; // never initialized or already closed
+        return false;
+    }
+    if(sem_trywait(&sem) == 0) {
+        *conn = connQueue.front();
+        connQueue.pop();
+        usedCount++;
+        availCount--;
+        return false;
+    }
+    waiters_.push_back({ CoScheduler::Current(), handle, conn });
+    return true;
+}
+
+void SqlConnPool::FreeConn(MYSQL* conn)
+{
+    assert(conn);
+    lock_guard<mutex> locker(mtx);
+    if(MAXCONN == 0) {
+        mysql_close(conn); // returned after ClosePool
+        return;
+    }
+    if(!waiters_.empty()) {
+        // hand it over without touching the semaphore, the coroutine resumes on its own loop thread
+        AsyncWaiter waiter = waiters_.front();
+        waiters_.pop_front();
+        *waiter.conn = conn;
+        coroutine_handle<> handle = waiter.handle;
+        waiter.sched->Post([handle]() { handle.resume(); });
+        return;
+    }
+    connQueue.push(conn);
+    usedCount--;
+    availCount++;
+    sem_post(&sem);
+}
+
+int SqlConnPool::GetAvailConnCount() const
+{
+    lock_guard<mutex> locker(mtx);
+    return availCount;
+}
+
+void SqlConnPool::ClosePool()
+{
+    lock_guard<mutex> locker(mtx);
+    while(!connQueue.empty()) {
+        mysql_close(connQueue.front());
+        connQueue.pop();
+    }
+    availCount = 0;
+    while(!waiters_.empty()) {
+        AsyncWaiter waiter = waiters_.front(); // resumes with nullptr
+        waiters_.pop_front();
+        coroutine_handle<> handle = waiter.handle;
+        waiter.sched->Post([handle]() { handle.resume(); });
+    }
+    if(MAXCONN > 0) {
+        for(int i = 0; i < MAXCONN; i++) sem_post(&sem); // let blocked GetConn return nullptr
+        MAXCONN = 0;
+        mysql_library_end();
+    }
+}
+
+#ifdef MYSQL_WAIT_READ
+// mariadb connector: wait for what the last _start/_cont asked for, return the status for _cont
+static Task<int> WaitSql(CoScheduler* sched, MYSQL* sql, int status)
+{
+    uint32_t events = 0;
+    if(status & MYSQL_WAIT_READ) events |= EPOLLIN;
+    if(status & MYSQL_WAIT_WRITE) events |= EPOLLOUT;
+    if(status & MYSQL_WAIT_EXCEPT) events |= EPOLLPRI;
+    int timeoutMS = (status & MYSQL_WAIT_TIMEOUT) ? static_cast<int>(mysql_get_timeout_value_ms(sql)) : -1;
+    bool ready = co_await sched->WaitFd(mysql_get_socket(sql), events, timeoutMS);
+    // the library retries its nonblocking read or write, so the requested set stands in for the happened one
+    co_return ready ? (status & ~MYSQL_WAIT_TIMEOUT) : MYSQL_WAIT_TIMEOUT;
+}
+
+Task<MYSQL_RES*> SqlConnPool::QueryAsync(MYSQL* sql, string query)
+{
+    CoScheduler* sched = CoScheduler::Current();
+    assert(sql && sched);
+    int err = 0;
+    int status = mysql_real_query_start(&err, sql, query.data(), query.size());
+    while(status) {
+        status = co_await WaitSql(sched, sql, status);
+        status = mysql_real_query_cont(&err, sql, status);
+    }
+    if(err) {
+        LOG_WARN("MySql query failed: %s", mysql_error(sql));
+        co_return nullptr;
+    }
+    MYSQL_RES* res = nullptr;
+    status = mysql_store_result_start(&res, sql);
+    while(status) {
+        status = co_await WaitSql(sched, sql, status);
+        status = mysql_store_result_cont(&res, sql, status);
+    }
+    co_return res;
+}
+
+#elif defined(MYSQL_VERSION_ID) && MYSQL_VERSION_ID >= 80016
+// mysql 8 has no wait status, poll the socket for a reply and retry on a short timer in case it
+// was waiting to send instead
+static const int SQL_POLL_MS = 5;
+
+Task<MYSQL_RES*> SqlConnPool::QueryAsync(MYSQL* sql, string query)
+{
+    CoScheduler* sched = CoScheduler::Current();
+    assert(sql && sched);
+    net_async_status status;
+    while((status = mysql_real_query_nonblocking(sql, query.data(), query.size())) == NET_ASYNC_NOT_READY) {
+        co_await sched->WaitFd(sql->net.fd, EPOLLIN, SQL_POLL_MS);
+    }
+    if(status == NET_ASYNC_ERROR) {
+        LOG_WARN("MySql query failed: %s", mysql_error(sql));
+        co_return nullptr;
+    }
+    MYSQL_RES* res = nullptr;
+    while((status = mysql_store_result_nonblocking(sql, &res)) == NET_ASYNC_NOT_READY) {
+        co_await sched->WaitFd(sql->net.fd, EPOLLIN, SQL_POLL_MS);
+    }
+    co_return status == NET_ASYNC_ERROR ? nullptr : res;
+}
+
+#else
+// client without a nonblocking api, blocks the loop thread for the round trip
+Task<MYSQL_RES*> SqlConnPool::QueryAsync(MYSQL* sql, string query)
+{
+    assert(sql);
+    if(mysql_real_query(sql, query.data(), query.size())) {
+        LOG_WARN("MySql query failed: %s", mysql_error(sql));
+        co_return nullptr;
+    }
+    co_return mysql_store_result(sql);
+}
+#endif
+
+Task<optional<string>> SqlConnPool::PasswordOf(MYSQL* sql, string user)
+{
+    string name(user.size() * 2 + 1, '\0');
+    name.resize(mysql_real_escape_string(sql, &name[0], user.data(), user.size()));
+    MYSQL_RES* res = co_await QueryAsync(sql, "SELECT password FROM user WHERE username='" + name + "' LIMIT 1");
+    optional<string> password;
+    if(res) {
+        MYSQL_ROW row = mysql_fetch_row(res);
+        unsigned long* lengths = row ? mysql_fetch_lengths(res) : nullptr;
+        if(row && row[0]) password.emplace(row[0], lengths[0]);
+        mysql_free_result(res);
+    }
+    co_return password;
+}
+
+Task<bool> SqlConnPool::VerifyUserAsync(string user, string password)
+{
+    MYSQL* sql = co_await Instance().GetConnAsync();
+    if(!sql) co_return false;
+    optional<string> stored = co_await passwordLookup(sql, user);
+    Instance().FreeConn(sql);
+    co_return stored && *stored == password;
+}
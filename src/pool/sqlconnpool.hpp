@@ -8,8 +8,14 @@
 
 #include <mysql/mysql.h>
 #include <queue>
+#include <deque>
+#include <functional>
 #include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
 #include <semaphore.h>
+#include "../coro/scheduler.hpp"
 
 class SqlConnPool {
 private:
@@ -23,21 +29,54 @@ private:
     int usedCount; // conn number that be used
     int availCount; // conn number that is free
 
+    struct AsyncWaiter {
+        CoScheduler* sched;
+        std::coroutine_handle<> handle;
+        MYSQL** conn;
+    };
+    std::deque<AsyncWaiter> waiters_; // coroutines waiting for a conn, a freed conn goes to them first
+
+    bool Enqueue(std::coroutine_handle<> handle, MYSQL** conn); // false if a conn was free and *conn is set
+
     SqlConnPool(); // init conn num for 0
     ~SqlConnPool(); // close pool
 
 public:
+    class ConnAwaiter {
+    private:
+        SqlConnPool* pool_;
+        MYSQL* conn_;
+
+    public:
+        explicit ConnAwaiter(SqlConnPool* pool) : pool_(pool), conn_(nullptr) {};
+        bool await_ready() const { return false; }
+        bool await_suspend(std::coroutine_handle<> handle) { return pool_->Enqueue(handle, &conn_); }
+        MYSQL* await_resume() const { return conn_; } // nullptr if the pool was closed meanwhile
+    };
+
     static SqlConnPool& Instance(); // get instance
 
     void init(const char* host, int post, const char* user,
               const char* pwd, const char* db, int connSize = 10); // add connSize conns into queue
+    void init(const std::vector<MYSQL*>& conns); // conns set up elsewhere, stand-ins in tests
 
     MYSQL* GetConn(); // get a conn from queue, using PV and lock protecting
+    ConnAwaiter GetConnAsync(); // same, but the coroutine waits on its CoScheduler instead of blocking the thread
     void FreeConn(MYSQL* conn); // add a conn into queue
 
     int GetAvailConnCount() const;
 
     void ClosePool();
+
+    // query on a CoScheduler thread, the coroutine waits on the conn's socket between steps.
+    // rows of a SELECT, nullptr for other statements or on error (mysql_errno tells)
+    static Task<MYSQL_RES*> QueryAsync(MYSQL* sql, std::string query);
+    // stored password of user, nullopt if there is none or the query failed
+    typedef std::function<Task<std::optional<std::string>>(MYSQL* sql, const std::string& user)> PasswordLookup;
+    static PasswordLookup passwordLookup; // PasswordOf, tests answer in place of the database
+    static Task<std::optional<std::string>> PasswordOf(MYSQL* sql, std::string user);
+    // login check against table user(username, password), HttpConn::loginCheck unless sessions get another
+    static Task<bool> VerifyUserAsync(std::string user, std::string password);
 };
 
 #endif //SQLCONNPOOL_HPP
\ No newline at end of file
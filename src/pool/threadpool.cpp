@@ -4,29 +4,308 @@
 */
 
 #include <assert.h>
+#include <algorithm>
+#include <system_error>
 #include "threadpool.hpp"
+#include "affinity.hpp"
 
-ThreadPool::ThreadPool(size_t threadNum) : pool(std::make_shared<Pool>())
+const int ThreadPool::GROW_DELAY_US;
+const int ThreadPool::GROW_INTERVAL_US;
+const int ThreadPool::IDLE_EXIT_MS;
+const uint64_t ThreadPool::STRIDE;
+
+ThreadPool::ThreadPool(size_t threadNum, const std::vector<int>& cpus, size_t maxThreads) : pool(std::make_shared<Pool>())
 {
     assert(threadNum > 0);
+    size_t minThreads = threadNum;
+    maxThreads = std::max(maxThreads, minThreads);
     pool->isClose = false;
-    for(size_t i = 0; i < threadNum; i++){
+    pool->workers = minThreads;
+    pool->minWorkers = minThreads;
+    pool->maxWorkers = maxThreads;
+    pool->idle = 0;
+    pool->locals.resize(maxThreads);
+    pool->busy.assign(maxThreads, 0);
+    pool->alive.assign(maxThreads, 0);
+    pool->cpus = cpus;
+    pool->completed = pool->spawned = pool->retired = pool->expired = 0;
+    pool->queueDelayUs = pool->runTimeUs = pool->maxQueueDelayUs = 0;
+    pool->weights[URGENT] = 1; // never compared, urgent tasks go first anyway
+    pool->weights[LIGHT] = 4;
+    pool->weights[HEAVY] = 1;
+    pool->vtime = 0;
+    for(int cls = 0; cls < CLASS_COUNT; cls++) {
+        pool->pass[cls] = 0;
+        pool->counts[cls] = 0;
+        pool->classDelayUs[cls] = 0;
+    }
+
+    if(!cpus.empty()) {
+        // a cpu without its own worker goes to a worker of the same node, round robin
+        int cpuCount = CpuAffinity::CpuCount();
+        pool->cpuWorker.assign(cpuCount, -1);
+        std::vector<int> workerNode(minThreads);
+        for(size_t i = 0; i < minThreads; i++) {
+            int cpu = cpus[i % cpus.size()];
+            workerNode[i] = CpuAffinity::NodeOf(cpu);
+            if(cpu < cpuCount && pool->cpuWorker[cpu] < 0) pool->cpuWorker[cpu] = static_cast<int>(i);
+        }
+        size_t next = 0;
+        for(int cpu = 0; cpu < cpuCount; cpu++) {
+            if(pool->cpuWorker[cpu] >= 0) continue;
+            int node = CpuAffinity::NodeOf(cpu);
+            for(size_t k = 0; k < minThreads && node >= 0; k++) {
+                size_t i = (next + k) % minThreads;
+                if(workerNode[i] != node) continue;
+                pool->cpuWorker[cpu] = static_cast<int>(i);
+                next = i + 1;
+                break;
+            }
+        }
+    }
+
+    for(size_t i = 0; i < minThreads; i++){
+        pool->alive[i] = 1;
         // create a new thread
-        std::thread([pool = this->pool]() {
-            std::unique_lock<std::mutex> locker(pool->mtx); // if unique_lock can't get the lock, it will wait
-            while(true){
-                if(!pool->tasks.empty()){
-                    auto task = std::move(pool->tasks.front());
-                    pool->tasks.pop();
-                    locker.unlock(); // other thread can access task queue
-                    task(); // start excuting the task
-                    locker.lock();
-                } 
-                else if (pool->isClose) break;
-                else pool->cond.wait(locker); // wait() will unlock the mutex
+        std::thread(Pool::Work, pool, i).detach();
+    }
+}
+
+void ThreadPool::Pool::Work(std::shared_ptr<Pool> pool, size_t self)
+{
+    // pin before running anything, tasks stay on this cpu or node. conn buffers are not placed by it:
+    // they are allocated by the event loop thread and reused by whichever worker gets the conn
+    if(!pool->cpus.empty()) CpuAffinity::PinSelf(pool->cpus[self % pool->cpus.size()]);
+    Task task;
+    std::unique_lock<std::mutex> locker(pool->mtx); // if unique_lock can't get the lock, it will wait
+    while(true){
+        if(pool->Pop(self, task)){
+            pool->busy[self] = 1;
+            locker.unlock(); // other thread can access task queue
+            Clock::time_point start = Clock::now();
+            bool late = start > task.deadline;
+            if(late) {
+                if(task.expired) task.expired(); // fast fail, the result would come too late anyway
+            } else {
+                task.run(); // start excuting the task
+            }
+            task.run = nullptr; // release what the task captured outside the lock
+            task.expired = nullptr;
+            Clock::time_point end = Clock::now();
+            locker.lock();
+            pool->busy[self] = 0;
+            if(late) {
+                pool->expired++;
+            } else {
+                pool->Record(task.cls, start - task.queued, end - start);
+            }
+        }
+        else if (pool->isClose) break;
+        else {
+            pool->idle++;
+            bool timeout = false;
+            if(self < pool->minWorkers) {
+                pool->cond.wait(locker); // wait() will unlock the mutex
+            } else {
+                timeout = pool->cond.wait_for(locker, std::chrono::milliseconds(IDLE_EXIT_MS)) == std::cv_status::timeout;
+            }
+            pool->idle--;
+            if(timeout && !pool->HasTask(self) && !pool->isClose) {
+                pool->retired++; // backlog is gone, spare worker not needed any more
+                break;
+            }
+        }
+    }
+    pool->alive[self] = 0;
+    pool->workers--;
+    pool->exited.notify_all();
+}
+
+size_t ThreadPool::Queues::Size() const
+{
+    size_t size = 0;
+    for(auto& queue : byClass) size += queue.size();
+    return size;
+}
+
+void ThreadPool::Pool::Push(Task&& task, int cpu)
+{
+    int cls = task.cls;
+    if(counts[cls] == 0 && pass[cls] < vtime) pass[cls] = vtime; // no credit for the time it was idle
+    counts[cls]++;
+    if(cpu >= 0 && static_cast<size_t>(cpu) < cpuWorker.size() && cpuWorker[cpu] >= 0 && alive[cpuWorker[cpu]]) {
+        locals[cpuWorker[cpu]].byClass[cls].push(std::move(task));
+    } else {
+        tasks.byClass[cls].push(std::move(task));
+    }
+}
+
+bool ThreadPool::Pool::Pop(size_t self, Task& task)
+{
+    std::queue<Task>* queue = nullptr;
+    int picked = -1;
+    for(int cls = 0; cls < CLASS_COUNT; cls++) {
+        std::queue<Task>* found = Find(self, cls);
+        if(!found) continue;
+        if(picked < 0 || pass[cls] < pass[picked]) {
+            picked = cls;
+            queue = found;
+        }
+        if(picked == URGENT) break;
+    }
+    if(!queue) return false;
+    task = std::move(queue->front());
+    queue->pop();
+    counts[picked]--;
+    if(picked != URGENT) {
+        vtime = pass[picked];
+        pass[picked] += STRIDE / weights[picked];
+    }
+    return true;
+}
+
+std::queue<ThreadPool::Task>* ThreadPool::Pool::Find(size_t self, int cls)
+{
+    if(counts[cls] == 0) return nullptr;
+    if(!locals[self].byClass[cls].empty()) return &locals[self].byClass[cls];
+    if(!tasks.byClass[cls].empty()) return &tasks.byClass[cls];
+    // better run it here than leave it waiting behind a busy worker, an idle owner takes its own.
+    // an owner that left after a Resize takes nothing
+    for(size_t i = 1; i < locals.size(); i++) {
+        size_t other = (self + i) % locals.size();
+        if((busy[other] || !alive[other]) && !locals[other].byClass[cls].empty()) return &locals[other].byClass[cls];
+    }
+    return nullptr;
+}
+
+bool ThreadPool::Pool::HasTask(size_t self) const
+{
+    return locals[self].Size() > 0 || tasks.Size() > 0;
+}
+
+int ThreadPool::Pool::GrowSlot(Clock::time_point now)
+{
+    if(isClose || idle > 0 || workers >= maxWorkers) return -1;
+    if(now - lastGrow < std::chrono::microseconds(GROW_INTERVAL_US)) return -1;
+
+    // queues are FIFO, so fronts are the oldest tasks
+    Clock::time_point oldest = now;
+    for(int cls = 0; cls < CLASS_COUNT; cls++) {
+        if(!tasks.byClass[cls].empty() && tasks.byClass[cls].front().queued < oldest) {
+            oldest = tasks.byClass[cls].front().queued;
+        }
+        for(auto& local : locals) {
+            if(!local.byClass[cls].empty() && local.byClass[cls].front().queued < oldest) {
+                oldest = local.byClass[cls].front().queued;
             }
-        }).detach();
+        }
+    }
+    if(now - oldest < std::chrono::microseconds(GROW_DELAY_US)) return -1;
+
+    for(size_t i = minWorkers; i < maxWorkers; i++) {
+        if(alive[i]) continue;
+        alive[i] = 1;
+        workers++;
+        spawned++;
+        lastGrow = now;
+        return static_cast<int>(i);
     }
+    return -1;
+}
+
+void ThreadPool::Pool::Record(TaskClass cls, Clock::duration queueDelay, Clock::duration runTime)
+{
+    // weight 1/8, recent enough to drive sizing, smooth enough to not chase one slow task
+    double delay = std::chrono::duration<double, std::micro>(queueDelay).count();
+    double run = std::chrono::duration<double, std::micro>(runTime).count();
+    if(completed == 0) {
+        queueDelayUs = delay;
+        runTimeUs = run;
+    } else {
+        queueDelayUs += (delay - queueDelayUs) / 8;
+        runTimeUs += (run - runTimeUs) / 8;
+    }
+    classDelayUs[cls] += (delay - classDelayUs[cls]) / 8;
+    if(delay > maxQueueDelayUs) maxQueueDelayUs = delay;
+    completed++;
+}
+
+void ThreadPool::Add(Task&& task, int cpu)
+{
+    int slot;
+    {
+        std::lock_guard<std::mutex> locker(pool->mtx);
+        Clock::time_point now = Clock::now();
+        task.queued = now;
+        pool->Push(std::move(task), cpu);
+        slot = pool->GrowSlot(now);
+    }
+    pool->cond.notify_all();
+    if(slot >= 0) Spawn(slot);
+}
+
+void ThreadPool::Spawn(size_t slot)
+{
+    try {
+        std::thread(Pool::Work, pool, slot).detach();
+    } catch(const std::system_error&) {
+        // out of threads, the pool just stays smaller
+        std::lock_guard<std::mutex> locker(pool->mtx);
+        pool->alive[slot] = 0;
+        pool->workers--;
+        pool->spawned--;
+        pool->exited.notify_all();
+    }
+}
+
+ThreadPool::Stats ThreadPool::GetStats()
+{
+    Stats stats = {};
+    if(!static_cast<bool>(pool)) return stats;
+    std::lock_guard<std::mutex> locker(pool->mtx);
+    stats.workers = pool->workers;
+    stats.idle = pool->idle;
+    stats.queued = pool->tasks.Size();
+    for(auto& local : pool->locals) stats.queued += local.Size();
+    stats.completed = pool->completed;
+    stats.spawned = pool->spawned;
+    stats.retired = pool->retired;
+    stats.queueDelayUs = pool->queueDelayUs;
+    stats.runTimeUs = pool->runTimeUs;
+    stats.maxQueueDelayUs = pool->maxQueueDelayUs;
+    for(int cls = 0; cls < CLASS_COUNT; cls++) stats.classDelayUs[cls] = pool->classDelayUs[cls];
+    stats.expired = pool->expired;
+    pool->maxQueueDelayUs = 0;
+    return stats;
+}
+
+void ThreadPool::SetWeight(TaskClass cls, unsigned weight)
+{
+    assert(cls != URGENT && cls < CLASS_COUNT && weight > 0);
+    std::lock_guard<std::mutex> locker(pool->mtx);
+    pool->weights[cls] = std::min<unsigned>(weight, STRIDE);
+}
+
+void ThreadPool::Resize(size_t threadNum, size_t maxThreads)
+{
+    assert(threadNum > 0);
+    std::vector<size_t> slots;
+    {
+        std::lock_guard<std::mutex> locker(pool->mtx);
+        if(pool->isClose) return;
+        size_t capacity = pool->locals.size(); // slot vectors don't move under running workers
+        pool->minWorkers = std::min(threadNum, capacity);
+        pool->maxWorkers = std::min(std::max(maxThreads, pool->minWorkers), capacity);
+        for(size_t i = 0; i < pool->minWorkers; i++) {
+            if(pool->alive[i]) continue;
+            pool->alive[i] = 1;
+            pool->workers++;
+            pool->spawned++;
+            slots.push_back(i);
+        }
+    }
+    pool->cond.notify_all(); // parked workers above minWorkers go back to waiting with a timeout
+    for(size_t slot : slots) Spawn(slot);
 }
 
 ThreadPool::~ThreadPool()
@@ -39,3 +318,12 @@ ThreadPool::~ThreadPool()
         pool->cond.notify_all();
     }
 }
+
+bool ThreadPool::Shutdown(std::chrono::milliseconds timeout)
+{
+    if(!static_cast<bool>(pool)) return true;
+    std::unique_lock<std::mutex> locker(pool->mtx);
+    pool->isClose = true;
+    pool->cond.notify_all();
+    return pool->exited.wait_for(locker, timeout, [this]() { return pool->workers == 0; });
+}
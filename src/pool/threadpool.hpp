@@ -7,44 +7,164 @@
 #define THREADPOOL_HPP
 
 #include <queue>
+#include <vector>
+#include <memory>
+#include <chrono>
 #include <thread>
 #include <functional>
 #include <mutex>
 #include <condition_variable>
+#include <cstdint>
 
+// at least minThreads workers, spare ones up to maxThreads are started while tasks keep waiting
+// with nobody idle (workers stuck in blocking calls) and leave again after being idle for a while.
+// tasks come in classes: URGENT ones run first, LIGHT and HEAVY share the workers by weight
+// (stride scheduling), so a burst of heavy tasks can't push cheap ones to the back of one long queue
 class ThreadPool {
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    enum TaskClass {
+        URGENT = 0, // health checks and the like, strict priority
+        LIGHT, // default
+        HEAVY, // uploads, big responses, proxying
+        CLASS_COUNT,
+    };
+
+    struct Stats {
+        size_t workers; // running now
+        size_t idle; // parked waiting for a task
+        size_t queued; // added but not started
+        uint64_t completed;
+        uint64_t spawned; // spare workers started
+        uint64_t retired; // spare workers that left idle
+        double queueDelayUs; // moving average of addTask to start of the task
+        double runTimeUs; // moving average of task execution
+        double maxQueueDelayUs; // since last GetStats
+        double classDelayUs[CLASS_COUNT]; // moving average of queue delay per class
+        uint64_t expired; // dropped at their deadline without running
+    };
+
 private:
+    static const int GROW_DELAY_US = 2000; // oldest task waited this long with no idle worker
+    static const int GROW_INTERVAL_US = 20000; // at most one spare worker per interval
+    static const int IDLE_EXIT_MS = 10000; // spare worker idle this long leaves
+    static const uint64_t STRIDE = 1 << 20; // pass advance of a weight 1 class per task
+
+    struct Task {
+        std::function<void()> run;
+        Clock::time_point queued;
+        Clock::time_point deadline; // not run when it starts later than this
+        std::function<void()> expired; // runs instead, may be empty
+        TaskClass cls;
+    };
+
+    struct Queues {
+        std::queue<Task> byClass[CLASS_COUNT];
+
+        size_t Size() const;
+    };
+
     struct Pool{
         bool isClose; // thread pool is closed or not
         std::mutex mtx; // mutex for the thread pool
         std::condition_variable cond; // condition variable for the thread pool
-        std::queue<std::function<void()>> tasks; // task queue
+        std::condition_variable exited; // notified when a worker leaves
+        size_t workers; // running worker threads
+        size_t minWorkers, maxWorkers; // slots below minWorkers never leave
+        size_t idle; // workers waiting on cond
+        Queues tasks; // task queue
+        std::vector<Queues> locals; // per worker queue for tasks with a cpu hint
+        std::vector<int> cpuWorker; // cpu -> worker pinned on it or on its NUMA node, -1 for none
+        std::vector<char> busy; // worker is running a task, its local queue may be stolen
+        std::vector<char> alive; // slot has a running thread
+        std::vector<int> cpus; // worker i is pinned to cpus[i % cpus.size()]
+
+        // class picked next is the queued one with the smallest pass, it then advances by STRIDE / weight.
+        // a class that was empty restarts at vtime (pass of the last pick) instead of its old, lower pass
+        unsigned weights[CLASS_COUNT];
+        uint64_t pass[CLASS_COUNT];
+        size_t counts[CLASS_COUNT]; // queued per class, over all queues
+        uint64_t vtime;
+
+        Clock::time_point lastGrow;
+        uint64_t completed, spawned, retired, expired;
+        double queueDelayUs, runTimeUs, maxQueueDelayUs;
+        double classDelayUs[CLASS_COUNT];
+
+        void Push(Task&& task, int cpu); // -1 for no cpu hint
+        bool Pop(size_t self, Task& task); // pick class, then own queue, shared queue, steal
+        std::queue<Task>* Find(size_t self, int cls);
+        bool HasTask(size_t self) const;
+        int GrowSlot(Clock::time_point now); // slot for a spare worker if backlog calls for one, else -1
+        void Record(TaskClass cls, Clock::duration queueDelay, Clock::duration runTime);
+        static void Work(std::shared_ptr<Pool> pool, size_t self);
     };
 
     std::shared_ptr<Pool> pool;
 
+    void Spawn(size_t slot);
+    void Add(Task&& task, int cpu);
+
 public:
     ThreadPool() = default;
 
-    explicit ThreadPool(size_t threadNum = 8);
+    // worker i is pinned to cpus[i % cpus.size()], no pinning if cpus is empty.
+    // maxThreads above threadNum allows spare workers, they get no cpu hinted tasks of their own
+    explicit ThreadPool(size_t threadNum = 8, const std::vector<int>& cpus = {}, size_t maxThreads = 0);
 
     ThreadPool(ThreadPool&&) = default;
 
     ~ThreadPool();
 
+    // stop taking tasks, wait until queued tasks are done and workers exited, false on timeout
+    bool Shutdown(std::chrono::milliseconds timeout);
+
+    Stats GetStats(); // also restarts the max queue delay window
+
+    void SetWeight(TaskClass cls, unsigned weight); // share of LIGHT and HEAVY, 4 and 1 by default
+
+    // change worker counts while running, within the maxThreads the pool was made with. new workers
+    // start at once, surplus ones leave when they have been idle for a while like spare ones do
+    void Resize(size_t threadNum, size_t maxThreads = 0);
+
     template<class F>
     void addTask(F&& task);
+
+    // run on the worker closest to cpu (socket's incoming cpu), so that its data stays in that core's cache
+    template<class F>
+    void addTask(F&& task, int cpu);
+
+    template<class F>
+    void addTask(F&& task, TaskClass cls, int cpu = -1);
+
+    // expired runs instead of task if no worker got to it before deadline, e.g. the client gave up already
+    template<class F, class E>
+    void addTask(F&& task, TaskClass cls, Clock::time_point deadline, E&& expired, int cpu = -1);
 };
 
 template<class F>
 void ThreadPool::addTask(F&& task)
 {
-    {
-        std::lock_guard<std::mutex> locker(pool->mtx);
-        pool->tasks.emplace(std::forward<F>(task));
-        // pool->tasks.emplace(std::forward(task));
-    }
-    pool->cond.notify_all();
+    Add(Task{std::forward<F>(task), Clock::time_point(), Clock::time_point::max(), nullptr, LIGHT}, -1);
+}
+
+template<class F>
+void ThreadPool::addTask(F&& task, int cpu)
+{
+    Add(Task{std::forward<F>(task), Clock::time_point(), Clock::time_point::max(), nullptr, LIGHT}, cpu);
+}
+
+template<class F>
+void ThreadPool::addTask(F&& task, TaskClass cls, int cpu)
+{
+    Add(Task{std::forward<F>(task), Clock::time_point(), Clock::time_point::max(), nullptr, cls}, cpu);
+}
+
+template<class F, class E>
+void ThreadPool::addTask(F&& task, TaskClass cls, Clock::time_point deadline, E&& expired, int cpu)
+{
+    Add(Task{std::forward<F>(task), Clock::time_point(), deadline, std::forward<E>(expired), cls}, cpu);
 }
 
 #endif //THREADPOOL_HPP
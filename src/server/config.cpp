@@ -0,0 +1,130 @@
+/*
+ * @author: Zimo Li
+ * @date: 2026-10-19
+*/
+
+#include "config.hpp"
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+using namespace std;
+
+atomic<const Config*> Config::current_(nullptr);
+mutex Config::mtx_;
+vector<unique_ptr<const Config>> Config::published_;
+
+namespace {
+
+string_view Trim(string_view s)
+{
+    while(!s.empty() && (s.front() == ' ' || s.front() == '\t' || s.front() == '\r')) s.remove_prefix(1);
+    while(!s.empty() && (s.back() == ' ' || s.back() == '\t' || s.back() == '\r')) s.remove_suffix(1);
+    return s;
+}
+
+bool ToInt(string_view value, int min, int max, int& out)
+{
+    string s(value);
+    char* end = nullptr;
+    errno = 0;
+    long v = strtol(s.c_str(), &end, 10);
+    if(s.empty() || *end != '\0' || errno != 0 || v < min || v > max) return false;
+    out = static_cast<int>(v);
+    return true;
+}
+
+bool ToPaths(string_view value, unordered_set<string>& out)
+{
+    out.clear();
+    istringstream in{string(value)};
+    string path;
+    while(in >> path) {
+        if(path[0] != '/') return false;
+        out.insert(path);
+    }
+    return true;
+}
+
+}
+
+Config::Config() : logLevel(1), logMaxLines(50000), threads(8), timeoutMS(60000), maxConn(65536),
+                   maxConnPerIP(0), slowLogMS(0),
+                   pages({"/index", "/register", "/login", "/welcome", "/video", "/picture"})
+{
+}
+
+bool Config::Parse(const string& text, const Config& base, Config& out, string& error)
+{
+    Config res = base;
+    istringstream in(text);
+    string raw;
+    for(int lineNo = 1; getline(in, raw); lineNo++) {
+        string_view line(raw);
+        line = Trim(line.substr(0, line.find('#')));
+        if(line.empty()) continue;
+        size_t eq = line.find('=');
+        if(eq == string_view::npos) {
+            error = "line " + to_string(lineNo) + ": no '='";
+            return false;
+        }
+        string_view key = Trim(line.substr(0, eq));
+        string_view value = Trim(line.substr(eq + 1));
+        bool ok = false;
+        if(key == "log_level") {
+            ok = ToInt(value, 0, 3, res.logLevel);
+        } else if(key == "log_max_lines") {
+            ok = ToInt(value, 1000, INT_MAX, res.logMaxLines);
+        } else if(key == "threads") {
+            ok = ToInt(value, 1, 1024, res.threads);
+        } else if(key == "timeout_ms") {
+            ok = ToInt(value, 0, INT_MAX, res.timeoutMS);
+        } else if(key == "max_conn") {
+            ok = ToInt(value, 1, INT_MAX, res.maxConn);
+        } else if(key == "max_conn_per_ip") {
+            ok = ToInt(value, 0, INT_MAX, res.maxConnPerIP);
+        } else if(key == "slow_log_ms") {
+            ok = ToInt(value, 0, INT_MAX, res.slowLogMS);
+        } else if(key == "pages") {
+            ok = ToPaths(value, res.pages);
+        } else if(key == "urgent_paths") {
+            ok = ToPaths(value, res.urgentPaths);
+        } else {
+            error = "line " + to_string(lineNo) + ": unknown key " + string(key);
+            return false;
+        }
+        if(!ok) {
+            error = "line " + to_string(lineNo) + ": bad value for " + string(key);
+            return false;
+        }
+    }
+    out = std::move(res);
+    return true;
+}
+
+bool Config::Load(const string& file, const Config& base, Config& out, string& error)
+{
+    ifstream in(file);
+    if(!in) {
+        error = "can't open " + file;
+        return false;
+    }
+    stringstream text;
+    text << in.rdbuf();
+    return Parse(text.str(), base, out, error);
+}
+
+const Config& Config::Current()
+{
+    static const Config defaults;
+    const Config* config = current_.load(memory_order_acquire);
+    return config ? *config : defaults;
+}
+
+void Config::Publish(unique_ptr<const Config> config)
+{
+    lock_guard<mutex> locker(mtx_);
+    current_.store(config.get(), memory_order_release);
+    published_.push_back(std::move(config));
+}
@@ -0,0 +1,47 @@
+/*
+ * @author: Zimo Li
+ * @date: 2026-10-19
+*/
+
+#ifndef CONFIG_HPP
+#define CONFIG_HPP
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+// settings that can change while the server runs, read from a file of "key = value" lines.
+// a snapshot never changes once published, so workers read the current one with a single atomic
+// load and no lock. published snapshots are kept until exit, a request may still look at an old one
+// after a reload (they are small and reloads are rare)
+struct Config {
+    int logLevel;
+    int logMaxLines; // lines per log file before it is split
+    int threads; // workers, up to the pool limit given at startup
+    int timeoutMS; // idle conns, 0 means never
+    int maxConn;
+    int maxConnPerIP; // 0 means no limit
+    int slowLogMS; // 0 is off
+    std::unordered_set<std::string> pages; // "/index" is served as "/index.html"
+    std::unordered_set<std::string> urgentPaths; // tasks of conns asking for these jump the queue
+
+    Config(); // compiled in defaults
+
+    // keys missing from text keep their value in base. '#' starts a comment, list values are separated
+    // by spaces. false with the line and reason in error on an unknown key or a bad value
+    static bool Parse(const std::string& text, const Config& base, Config& out, std::string& error);
+    static bool Load(const std::string& file, const Config& base, Config& out, std::string& error);
+
+    static const Config& Current();
+    static void Publish(std::unique_ptr<const Config> config);
+
+private:
+    static std::atomic<const Config*> current_;
+    static std::mutex mtx_;
+    static std::vector<std::unique_ptr<const Config>> published_;
+};
+
+#endif // CONFIG_HPP
@@ -0,0 +1,97 @@
+/*
+ * @author: Zimo Li
+ * @date: 2026-10-19
+*/
+
+#include "epoller.hpp"
+#include <cassert>
+#include <chrono>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#ifndef EPIOCSPARAMS
+// uapi of linux 6.9, missing from older headers
+struct epoll_params {
+    uint32_t busy_poll_usecs;
+    uint16_t busy_poll_budget;
+    uint8_t prefer_busy_poll;
+    uint8_t __pad;
+};
+#define EPIOCSPARAMS _IOW(0x8A, 0x01, struct epoll_params)
+#endif
+
+static const uint16_t BUSY_POLL_BUDGET = 64; // packets per poll, as NAPI's default weight
+
+Epoller::Epoller(int maxEvent) : epollFd_(epoll_create1(EPOLL_CLOEXEC)), events_(maxEvent), spinUs_(0)
+{
+    assert(epollFd_ >= 0 && events_.size() > 0);
+}
+
+Epoller::~Epoller()
+{
+    close(epollFd_);
+}
+
+bool Epoller::AddFd(int fd, uint32_t events)
+{
+    if(fd < 0) return false;
+    epoll_event ev = {0};
+    ev.data.fd = fd;
+    ev.events = events;
+    return epoll_ctl(epollFd_, EPOLL_CTL_ADD, fd, &ev) == 0;
+}
+
+bool Epoller::ModFd(int fd, uint32_t events)
+{
+    if(fd < 0) return false;
+    epoll_event ev = {0};
+    ev.data.fd = fd;
+    ev.events = events;
+    return epoll_ctl(epollFd_, EPOLL_CTL_MOD, fd, &ev) == 0;
+}
+
+bool Epoller::DelFd(int fd)
+{
+    if(fd < 0) return false;
+    epoll_event ev = {0};
+    return epoll_ctl(epollFd_, EPOLL_CTL_DEL, fd, &ev) == 0;
+}
+
+bool Epoller::SetBusyPoll(int usecs)
+{
+    epoll_params params = {};
+    params.busy_poll_usecs = usecs > 0 ? usecs : 0;
+    params.busy_poll_budget = usecs > 0 ? BUSY_POLL_BUDGET : 0;
+    params.prefer_busy_poll = usecs > 0;
+    if(ioctl(epollFd_, EPIOCSPARAMS, &params) == 0) {
+        spinUs_ = 0;
+        return true;
+    }
+    spinUs_ = usecs > 0 ? usecs : 0;
+    return false;
+}
+
+int Epoller::Wait(int timeoutMS)
+{
+    if(spinUs_ > 0 && timeoutMS != 0) {
+        // the spin is far below timer resolution, so timeoutMS is not shortened by it
+        auto end = std::chrono::steady_clock::now() + std::chrono::microseconds(spinUs_);
+        do {
+            int n = epoll_wait(epollFd_, &events_[0], static_cast<int>(events_.size()), 0);
+            if(n != 0) return n;
+        } while(std::chrono::steady_clock::now() < end);
+    }
+    return epoll_wait(epollFd_, &events_[0], static_cast<int>(events_.size()), timeoutMS);
+}
+
+int Epoller::GetEventFd(std::size_t i) const
+{
+    assert(i < events_.size());
+    return events_[i].data.fd;
+}
+
+uint32_t Epoller::GetEvents(std::size_t i) const
+{
+    assert(i < events_.size());
+    return events_[i].events;
+}
@@ -0,0 +1,36 @@
+/*
+ * @author: Zimo Li
+ * @date: 2026-10-19
+*/
+
+#ifndef EPOLLER_HPP
+#define EPOLLER_HPP
+
+#include <sys/epoll.h>
+#include <vector>
+#include <cstdint>
+
+class Epoller {
+private:
+    int epollFd_;
+    std::vector<struct epoll_event> events_; // ready events of the last Wait
+    int spinUs_; // busy poll by hand where the kernel can't, 0 is off
+
+public:
+    explicit Epoller(int maxEvent = 1024);
+    ~Epoller();
+
+    bool AddFd(int fd, uint32_t events);
+    bool ModFd(int fd, uint32_t events);
+    bool DelFd(int fd);
+
+    // busy poll for up to usecs before sleeping in Wait: the kernel polls the NIC queues itself
+    // (EPIOCSPARAMS, linux 6.9) or, if it can't, Wait spins on zero timeout waits. false for the spin
+    bool SetBusyPoll(int usecs);
+
+    int Wait(int timeoutMS = -1); // return number of ready events
+    int GetEventFd(std::size_t i) const;
+    uint32_t GetEvents(std::size_t i) const;
+};
+
+#endif // EPOLLER_HPP
@@ -0,0 +1,145 @@
+/*
+ * @author: Zimo Li
+ * @date: 2026-10-19
+*/
+
+#include "listenerhandoff.hpp"
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include "../log/log.hpp"
+using namespace std;
+
+const char* const ListenerHandoff::ENV_FD = "WEBSERVER_HANDOFF";
+
+bool ListenerHandoff::WaitReadable(int fd, int timeoutMS)
+{
+    pollfd pfd = {fd, POLLIN, 0};
+    int ret;
+    do {
+        ret = poll(&pfd, 1, timeoutMS);
+    } while(ret < 0 && errno == EINTR);
+    return ret > 0;
+}
+
+bool ListenerHandoff::Pair(int& parentFd, int& childFd)
+{
+    int fds[2];
+    if(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) < 0) {
+        LOG_ERROR("handoff socketpair error: %s", strerror(errno));
+        return false;
+    }
+    parentFd = fds[0];
+    childFd = fds[1];
+    return true;
+}
+
+bool ListenerHandoff::Send(int connFd, const vector<int>& fds)
+{
+    if(fds.empty() || fds.size() > MAX_FDS) return false;
+
+    char tag = 'F'; // at least one byte of data has to carry the ancillary data
+    iovec iov = {&tag, 1};
+    char control[CMSG_SPACE(sizeof(int) * MAX_FDS)];
+    memset(control, 0, sizeof(control));
+
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * fds.size());
+
+    cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fds.size());
+    memcpy(CMSG_DATA(cmsg), fds.data(), sizeof(int) * fds.size());
+
+    ssize_t len;
+    do {
+        len = sendmsg(connFd, &msg, MSG_NOSIGNAL);
+    } while(len < 0 && errno == EINTR);
+    return len == 1;
+}
+
+bool ListenerHandoff::WaitReady(int connFd, int timeoutMS)
+{
+    if(!WaitReadable(connFd, timeoutMS)) return false;
+    char tag = 0;
+    return ::read(connFd, &tag, 1) == 1 && tag == 'R';
+}
+
+int ListenerHandoff::Adopt(const char* value)
+{
+    char* end = nullptr;
+    errno = 0;
+    long fd = value ? strtol(value, &end, 10) : -1;
+    if(!value || end == value || *end != '\0' || errno != 0 || fd <= STDERR_FILENO || fd > INT_MAX) return -1;
+
+    // the env may be stale or set by someone else, only a socket the parent made is taken
+    struct stat st;
+    int domain = 0;
+    ucred cred;
+    socklen_t len = sizeof(domain), credLen = sizeof(cred);
+    if(fstat(fd, &st) < 0 || !S_ISSOCK(st.st_mode) ||
+       getsockopt(fd, SOL_SOCKET, SO_DOMAIN, &domain, &len) < 0 || domain != AF_UNIX ||
+       getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &credLen) < 0 ||
+       cred.pid != getppid() || cred.uid != getuid()) {
+        LOG_ERROR("handoff fd %s is not from the parent process", value);
+        return -1;
+    }
+    fcntl(fd, F_SETFD, FD_CLOEXEC); // not passed on to whatever this process starts
+    return static_cast<int>(fd);
+}
+
+bool ListenerHandoff::Receive(int connFd, vector<int>& fds, int timeoutMS)
+{
+    if(!WaitReadable(connFd, timeoutMS)) return false;
+
+    char tag = 0;
+    iovec iov = {&tag, 1};
+    char control[CMSG_SPACE(sizeof(int) * MAX_FDS)];
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    ssize_t len;
+    do {
+        len = recvmsg(connFd, &msg, MSG_CMSG_CLOEXEC);
+    } while(len < 0 && errno == EINTR);
+    if(len != 1 || tag != 'F') return false;
+
+    fds.clear();
+    for(cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if(cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) continue;
+        size_t n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        const unsigned char* data = CMSG_DATA(cmsg);
+        for(size_t i = 0; i < n; i++) {
+            int fd;
+            memcpy(&fd, data + i * sizeof(int), sizeof(int));
+            fds.push_back(fd);
+        }
+    }
+    if(msg.msg_flags & MSG_CTRUNC) {
+        for(int fd : fds) close(fd);
+        fds.clear();
+        return false;
+    }
+    return !fds.empty();
+}
+
+bool ListenerHandoff::Ready(int connFd)
+{
+    char tag = 'R';
+    return send(connFd, &tag, 1, MSG_NOSIGNAL) == 1;
+}
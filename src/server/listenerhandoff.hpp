@@ -0,0 +1,37 @@
+/*
+ * @author: Zimo Li
+ * @date: 2026-10-19
+*/
+
+#ifndef LISTENERHANDOFF_HPP
+#define LISTENERHANDOFF_HPP
+
+#include <string>
+#include <vector>
+
+// pass listening sockets from a running server to its replacement over a socketpair (SCM_RIGHTS),
+// so the port never stops accepting during a binary upgrade. nothing is bound to a path, only the
+// process that execs the replacement holds the other end.
+// old process: Pair -> fork, exec with the child end open and named in ENV_FD -> Send -> WaitReady,
+//              then stop accepting and drain
+// new process: Adopt -> Receive -> set up event loop -> Ready
+class ListenerHandoff {
+public:
+    static const std::size_t MAX_FDS = 16;
+    static const char* const ENV_FD; // env var with the fd number of the new process's end
+
+    // both ends close on exec, the child clears that on its end between fork and exec
+    static bool Pair(int& parentFd, int& childFd);
+    static bool Send(int connFd, const std::vector<int>& fds);
+    static bool WaitReady(int connFd, int timeoutMS); // replacement is serving
+
+    // fd named by ENV_FD if it's a unix socket made by the parent process, -1 otherwise
+    static int Adopt(const char* value);
+    static bool Receive(int connFd, std::vector<int>& fds, int timeoutMS);
+    static bool Ready(int connFd);
+
+private:
+    static bool WaitReadable(int fd, int timeoutMS);
+};
+
+#endif // LISTENERHANDOFF_HPP
@@ -0,0 +1,140 @@
+/*
+ * @author: Zimo Li
+ * @date: 2026-10-19
+*/
+
+#include "ratelimiter.hpp"
+#include <cassert>
+#include <algorithm>
+using namespace std;
+
+const uint32_t RateLimiter::MAX_BURST;
+const uint64_t RateLimiter::TOKEN_MASK;
+const uint64_t RateLimiter::CONN_MASK;
+
+RateLimiter::RateLimiter(size_t capacity) : shardSize_(1), start_(chrono::steady_clock::now()),
+                                            rate_(0), burst_(0)
+{
+    while(shardSize_ * SHARDS < capacity) shardSize_ <<= 1;
+    // value initialization zeroes the atomics
+    slots_.reset(new Slot[shardSize_ * SHARDS]());
+}
+
+uint64_t RateLimiter::NowMS() const
+{
+    // +1 so that a refill time is never 0
+    return chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start_).count() + 1;
+}
+
+uint32_t RateLimiter::Hash(uint32_t ip)
+{
+    ip ^= ip >> 16;
+    ip *= 0x7feb352d;
+    ip ^= ip >> 15;
+    ip *= 0x846ca68b;
+    ip ^= ip >> 16;
+    return ip;
+}
+
+RateLimiter::Slot* RateLimiter::Find(uint32_t ip, bool claim)
+{
+    if(ip == 0) return nullptr;
+    uint32_t h = Hash(ip);
+    Slot* shard = &slots_[(h % SHARDS) * shardSize_];
+    size_t start = h / SHARDS;
+
+    Slot* empty = nullptr;
+    Slot* idle = nullptr;
+    uint64_t idleOwner = 0;
+    uint64_t now = NowMS();
+    for(size_t i = 0; i < MAX_PROBE; i++) {
+        Slot* slot = &shard[(start + i) & (shardSize_ - 1)];
+        uint64_t owner = slot->owner.load(memory_order_acquire);
+        uint32_t key = owner >> 32;
+        if(key == ip) return slot;
+        if(key == 0) {
+            // keys are never cleared, so nothing further can match
+            empty = slot;
+            break;
+        }
+        uint64_t last = slot->bucket.load(memory_order_relaxed) >> TOKEN_BITS;
+        if(!idle && (owner & CONN_MASK) == 0 && last + IDLE_MS < now) {
+            idle = slot;
+            idleOwner = owner;
+        }
+    }
+    if(!claim) return nullptr;
+
+    uint64_t mine = static_cast<uint64_t>(ip) << 32;
+    if(empty) {
+        uint64_t expected = 0;
+        if(empty->owner.compare_exchange_strong(expected, mine, memory_order_acq_rel)) return empty;
+        if((expected >> 32) == ip) return empty; // same client claimed it just now
+    }
+    // fails if the old client got a conn counted since it was seen idle
+    if(idle && idle->owner.compare_exchange_strong(idleOwner, mine, memory_order_acq_rel)) {
+        idle->bucket.store(0, memory_order_relaxed);
+        return idle;
+    }
+    return nullptr;
+}
+
+void RateLimiter::SetRate(uint32_t perSecond, uint32_t burst)
+{
+    rate_ = perSecond;
+    burst_ = min(max(burst, 1u), MAX_BURST);
+}
+
+bool RateLimiter::Allow(uint32_t ip)
+{
+    uint32_t rate = rate_.load(memory_order_relaxed);
+    if(rate == 0) return true;
+    Slot* slot = Find(ip, true);
+    if(!slot) return true;
+
+    uint64_t full = static_cast<uint64_t>(burst_.load(memory_order_relaxed)) * 1000;
+    uint64_t now = NowMS();
+    uint64_t old = slot->bucket.load(memory_order_relaxed);
+    while(true) {
+        uint64_t tokens = full;
+        if(old != 0) {
+            // rate tokens per second == rate milli tokens per ms
+            uint64_t last = old >> TOKEN_BITS;
+            uint64_t elapsed = now > last ? now - last : 0;
+            tokens = min(full, (old & TOKEN_MASK) + elapsed * rate);
+        }
+        bool ok = tokens >= 1000;
+        if(ok) tokens -= 1000;
+        uint64_t next = (now << TOKEN_BITS) | tokens;
+        if(slot->bucket.compare_exchange_weak(old, next, memory_order_relaxed)) return ok;
+    }
+}
+
+bool RateLimiter::AcquireConn(uint32_t ip, int maxConn, bool& counted)
+{
+    counted = false;
+    if(maxConn <= 0) return true;
+    while(true) {
+        Slot* slot = Find(ip, true);
+        if(!slot) return true;
+
+        uint64_t cur = slot->owner.load(memory_order_relaxed);
+        while((cur >> 32) == ip) {
+            if((cur & CONN_MASK) >= static_cast<uint64_t>(maxConn)) return false;
+            if(slot->owner.compare_exchange_weak(cur, cur + 1, memory_order_relaxed)) {
+                counted = true;
+                return true;
+            }
+        }
+        // taken by another client between Find and the count, look again
+    }
+}
+
+void RateLimiter::ReleaseConn(uint32_t ip)
+{
+    Slot* slot = Find(ip, false);
+    if(!slot) return;
+    uint64_t cur = slot->owner.load(memory_order_relaxed);
+    while((cur >> 32) == ip && (cur & CONN_MASK) > 0 &&
+          !slot->owner.compare_exchange_weak(cur, cur - 1, memory_order_relaxed)) {}
+}
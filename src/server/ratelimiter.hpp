@@ -0,0 +1,57 @@
+/*
+ * @author: Zimo Li
+ * @date: 2026-10-19
+*/
+
+#ifndef RATELIMITER_HPP
+#define RATELIMITER_HPP
+
+#include <atomic>
+#include <memory>
+#include <chrono>
+#include <cstdint>
+
+// per client IPv4 token bucket and conn counter.
+// lock-free open addressing table split into shards, a slot is claimed by CAS on its key and
+// reused once its client has been idle for a while, when a probe window is full the client is let through.
+// key and conn count share one word, so a slot can't change hands while it counts a conn
+class RateLimiter {
+private:
+    struct Slot {
+        std::atomic<uint64_t> owner; // ip in network order << 32 | conns, ip 0 means empty
+        std::atomic<uint64_t> bucket; // last refill ms << TOKEN_BITS | milli tokens, 0 means full
+    };
+
+    static const std::size_t SHARDS = 16;
+    static const std::size_t MAX_PROBE = 16;
+    static const int TOKEN_BITS = 24;
+    static const uint64_t TOKEN_MASK = (1ull << TOKEN_BITS) - 1;
+    static const uint32_t MAX_BURST = 16000; // fits TOKEN_BITS as milli tokens
+    static const uint64_t IDLE_MS = 60 * 1000; // slot may be taken by another client after this
+    static const uint64_t CONN_MASK = 0xffffffffull;
+
+    std::unique_ptr<Slot[]> slots_;
+    std::size_t shardSize_; // power of two
+    std::chrono::steady_clock::time_point start_;
+
+    std::atomic<uint32_t> rate_; // tokens per second, 0 disables rate limiting
+    std::atomic<uint32_t> burst_;
+
+    uint64_t NowMS() const;
+    Slot* Find(uint32_t ip, bool claim); // nullptr if not found or no slot left
+    static uint32_t Hash(uint32_t ip);
+
+public:
+    explicit RateLimiter(std::size_t capacity = 64 * 1024);
+    ~RateLimiter() = default;
+
+    void SetRate(uint32_t perSecond, uint32_t burst);
+    bool Allow(uint32_t ip); // take one token, false if bucket is empty
+
+    // false if client already has maxConn conns. counted is false when the conn got in without
+    // being counted (no limit, or no slot left), such a conn must not be released
+    bool AcquireConn(uint32_t ip, int maxConn, bool& counted);
+    void ReleaseConn(uint32_t ip);
+};
+
+#endif // RATELIMITER_HPP
@@ -0,0 +1,1155 @@
+/*
+ * @author: Zimo Li
+ * @date: 2026-10-19
+*/
+
+#include "webserver.hpp"
+#include <cassert>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <cstdlib>
+#include <fcntl.h>
+#include <malloc.h>
+#include <unistd.h>
+#include <vector>
+#include <netinet/tcp.h>
+#include <sys/wait.h>
+#include <sys/signalfd.h>
+#include "listenerhandoff.hpp"
+#include "../pool/affinity.hpp"
+#include "../pool/sqlconnpool.hpp"
+#include "../log/log.hpp"
+#include "../log/accesslog.hpp"
+#include "../log/flightrecorder.hpp"
+#include "../buffer/memstats.hpp"
+using namespace std;
+
+extern char** environ;
+
+char** WebServer::argv_ = nullptr;
+const int WebServer::MAX_FD;
+const int WebServer::DRAIN_TIMEOUT_MS;
+const int WebServer::DRAIN_IDLE_MS;
+const int WebServer::HANDOFF_TIMEOUT_MS;
+const int WebServer::SHUTDOWN_TIMEOUT_MS;
+const int WebServer::ACCEPT_RETRY_MS;
+
+WebServer::WebServer(int port, int trigMode, int timeoutMS, bool optLinger, int threadNum,
+                     bool openLog, int logLevel, int logQueSize) :
+                     port_(port), openLinger_(optLinger), timeoutMS_(timeoutMS), isClose_(false),
+                     isDraining_(false), listenFd_(-1), signalFd_(-1), handoffFd_(-1), acceptPaused_(false),
+                     timer_(new HeapTimer()), epoller_(new Epoller()), savedChanges_(0), handedOver_(false), threadNum_(threadNum),
+                     threadMax_(threadNum), lightWeight_(4), heavyWeight_(1), cpuAware_(false),
+                     maxConn_(MAX_FD), maxConnPerIP_(0), memBudget_(0)
+{
+    char* cwd = getcwd(nullptr, 0);
+    assert(cwd);
+    srcDir_ = string(cwd) + "/resources";
+    free(cwd);
+    HttpConn::userCount = 0;
+    HttpConn::isDraining = false;
+    HttpConn::srcDir = srcDir_.c_str();
+
+    // signals are blocked before log and pool threads start so that only signalfd sees them
+    if(!InitSignal()) isClose_ = true;
+    if(openLog) Log::Instance().init(logLevel, "./log", ".log", logQueSize);
+    ResetPool();
+
+    InitEventMode(trigMode);
+    // broadcasts from any thread wake the receiving conn up for write
+    WebSocket::arm = [this](int fd, bool write) {
+        epoller_->ModFd(fd, connEvent_ | EPOLLIN | (write ? EPOLLOUT : 0));
+    };
+    if(!isClose_ && !InitSocket()) isClose_ = true;
+
+    if(isClose_) {
+        LOG_ERROR("========== Server init error!==========");
+    } else {
+        LOG_INFO("========== Server init ==========");
+        LOG_INFO("Port:%d, OpenLinger: %s", port_, optLinger ? "true" : "false");
+        LOG_INFO("Listen Mode: %s, OpenConn Mode: %s",
+                 (listenEvent_ & EPOLLET ? "ET" : "LT"),
+                 (connEvent_ & EPOLLET ? "ET" : "LT"));
+        LOG_INFO("LogSys level: %d", logLevel);
+        LOG_INFO("srcDir: %s", HttpConn::srcDir);
+        LOG_INFO("ThreadPool num: %d", threadNum);
+    }
+}
+
+WebServer::~WebServer()
+{
+    if(listenFd_ >= 0) close(listenFd_);
+    if(signalFd_ >= 0) close(signalFd_);
+    if(handoffFd_ >= 0) close(handoffFd_);
+    HttpConn::tlsContext = nullptr;
+    HttpResponse::bundle = nullptr;
+    HttpResponse::altSvc.clear();
+    if(!flightFile_.empty()) FlightRecorder::Disable();
+    MemStats::SetPressure(false);
+    HttpConn::sessions = nullptr;
+    HttpConn::loginCheck = nullptr;
+    HttpConn::sessionPaths.clear();
+    HttpConn::images = nullptr;
+    HttpConn::proxyRoutes.clear();
+    HttpConn::coRoutes.clear();
+    Config::Publish(unique_ptr<const Config>(new Config()));
+    WebSocket::arm = nullptr;
+    isClose_ = true;
+}
+
+void WebServer::SetArgs(char** argv)
+{
+    argv_ = argv;
+}
+
+void WebServer::SetAffinity(const vector<int>& workerCpus, int logCpu)
+{
+    if(!workerCpus.empty()) {
+        workerCpus_ = workerCpus;
+        ResetPool();
+        cpuAware_ = true;
+        LOG_INFO("workers pinned to %d cpus", (int)workerCpus.size());
+    }
+    if(logCpu >= 0 && !Log::Instance().PinWriter(logCpu)) {
+        LOG_WARN("log writer can't be pinned to cpu %d", logCpu);
+    }
+}
+
+void WebServer::SetPoolLimit(int maxThreads)
+{
+    if(maxThreads <= threadMax_) return;
+    threadMax_ = maxThreads;
+    ResetPool();
+    LOG_INFO("ThreadPool grows up to %d workers", threadMax_);
+}
+
+void WebServer::SetScheduling(const vector<string>& urgentPaths, unsigned lightWeight, unsigned heavyWeight)
+{
+    assert(lightWeight > 0 && heavyWeight > 0);
+    unique_ptr<Config> config(new Config(Config::Current()));
+    config->urgentPaths.insert(urgentPaths.begin(), urgentPaths.end());
+    Config::Publish(std::move(config));
+    lightWeight_ = lightWeight;
+    heavyWeight_ = heavyWeight;
+    threadpool_->SetWeight(ThreadPool::LIGHT, lightWeight_);
+    threadpool_->SetWeight(ThreadPool::HEAVY, heavyWeight_);
+    LOG_INFO("%d urgent paths, light:heavy %u:%u", (int)urgentPaths.size(), lightWeight_, heavyWeight_);
+}
+
+void WebServer::SetSlowLog(int ms)
+{
+    RequestTrace::slowMS = ms > 0 ? ms : 0;
+    if(ms > 0) LOG_INFO("slow request log over %d ms", ms);
+}
+
+bool WebServer::SetAccessLog(const string& path, int sampleRate)
+{
+    if(!AccessLog::Instance().Open(path, sampleRate > 0 ? sampleRate : 1)) {
+        LOG_ERROR("can't open access log %s, errno %d", path.c_str(), errno);
+        return false;
+    }
+    LOG_INFO("access log %s, 1 in %d requests", path.c_str(), sampleRate > 0 ? sampleRate : 1);
+    return true;
+}
+
+void WebServer::ResetPool()
+{
+    // nothing has been queued yet, the old pool can just be replaced
+    if(threadpool_) threadpool_->Shutdown(MS(SHUTDOWN_TIMEOUT_MS));
+    threadpool_.reset(new ThreadPool(threadNum_, workerCpus_, threadMax_));
+    threadpool_->SetWeight(ThreadPool::LIGHT, lightWeight_);
+    threadpool_->SetWeight(ThreadPool::HEAVY, heavyWeight_);
+}
+
+bool WebServer::StartCoLoop()
+{
+    if(coLoop_) return true;
+    unique_ptr<CoScheduler> loop(new CoScheduler());
+    if(!loop->Start()) return false;
+    coLoop_ = std::move(loop);
+    return true;
+}
+
+bool WebServer::AddCoRoute(const string& path, HttpConn::CoHandler handler)
+{
+    if(!StartCoLoop()) return false;
+    HttpConn::coRoutes[path] = std::move(handler);
+    LOG_INFO("coroutine route %s", path.c_str());
+    return true;
+}
+
+bool WebServer::EnableSessions(int ttlSec, const vector<string>& sessionPaths, HttpConn::LoginCheck loginCheck,
+                               const string& snapshotFile)
+{
+    if(!StartCoLoop()) return false;
+    sessions_.reset(new SessionStore(ttlSec));
+    sessionFile_ = snapshotFile;
+    if(!sessionFile_.empty()) {
+        size_t loaded = sessions_->Load(sessionFile_);
+        if(loaded > 0) LOG_INFO("%zu sessions restored from %s", loaded, sessionFile_.c_str());
+    }
+    HttpConn::sessions = sessions_.get();
+    HttpConn::loginCheck = loginCheck ? std::move(loginCheck) : HttpConn::LoginCheck(SqlConnPool::VerifyUserAsync);
+    HttpConn::sessionPaths.insert(sessionPaths.begin(), sessionPaths.end());
+    timer_->Add(SESSION_TIMER_ID, SESSION_SWEEP_MS, std::bind(&WebServer::SweepSessions, this));
+    LOG_INFO("sessions on, ttl %ds, %d paths need one", ttlSec, (int)sessionPaths.size());
+    return true;
+}
+
+void WebServer::SweepSessions()
+{
+    // walking every session and writing them out is no work for the loop thread
+    bool save = !sessionFile_.empty() && !handedOver_;
+    threadpool_->addTask([this, save] {
+        size_t removed = sessions_->Sweep();
+        uint64_t changes = sessions_->Changes();
+        if(save && changes != savedChanges_.exchange(changes)) {
+            if(!sessions_->Save(sessionFile_)) LOG_WARN("can't save sessions to %s", sessionFile_.c_str());
+        }
+        if(removed > 0) LOG_DEBUG("%zu sessions expired", removed);
+    }, ThreadPool::HEAVY);
+    timer_->Add(SESSION_TIMER_ID, SESSION_SWEEP_MS, std::bind(&WebServer::SweepSessions, this));
+}
+
+void WebServer::SetMemoryBudget(size_t bytes)
+{
+    memBudget_ = bytes;
+    if(bytes == 0) return;
+    timer_->Add(MEM_TIMER_ID, MEM_CHECK_MS, std::bind(&WebServer::CheckMemory, this));
+    LOG_INFO("memory budget %zu bytes", bytes);
+}
+
+void WebServer::CheckMemory()
+{
+    int64_t total = MemStats::Total();
+    int64_t budget = static_cast<int64_t>(memBudget_);
+    // on over the budget, off once 10% under it, so it doesn't flap at the edge
+    bool pressure = MemStats::UnderPressure() ? total > budget * 9 / 10 : total > budget;
+    if(pressure != MemStats::UnderPressure()) {
+        MemStats::SetPressure(pressure);
+        if(pressure) {
+            LOG_WARN("memory pressure on, %lld of %lld bytes", (long long)total, (long long)budget);
+        } else {
+            LOG_INFO("memory pressure off, %lld of %lld bytes", (long long)total, (long long)budget);
+        }
+    }
+    if(pressure) {
+        // caches give back first, conns trim their buffers as they go idle
+        int64_t excess = total - budget * 9 / 10;
+        threadpool_->addTask([this, excess] {
+            if(images_) {
+                int64_t cached = static_cast<int64_t>(images_->MemBytes());
+                size_t freed = images_->Trim(cached > excess ? cached - excess : 0);
+                if(freed > 0) LOG_DEBUG("memory pressure: %zu bytes of image cache dropped", freed);
+            }
+            malloc_trim(0); // RSS is what the OOM killer goes by, freed heap pages are given back
+        }, ThreadPool::HEAVY);
+    }
+    timer_->Add(MEM_TIMER_ID, MEM_CHECK_MS, std::bind(&WebServer::CheckMemory, this));
+}
+
+bool WebServer::SetTls(const string& certFile, const string& keyFile, const string& ticketKeyFile)
+{
+    unique_ptr<TlsContext> ctx(new TlsContext());
+    if(!ctx->Init(certFile, keyFile, ticketKeyFile)) return false;
+    tls_ = std::move(ctx);
+    HttpConn::tlsContext = tls_.get();
+    LOG_INFO("TLS on, cert %s", certFile.c_str());
+    return true;
+}
+
+bool WebServer::SetBundle(const string& file, bool populate, bool hugePages)
+{
+    unique_ptr<AssetBundle> bundle(new AssetBundle());
+    if(!bundle->Open(file, populate, hugePages)) {
+        LOG_ERROR("can't open bundle %s", file.c_str());
+        return false;
+    }
+    bundle_ = std::move(bundle);
+    HttpResponse::bundle = bundle_.get();
+    LOG_INFO("bundle %s, %zu files in %zu bytes", file.c_str(), bundle_->Count(), bundle_->Size());
+    return true;
+}
+
+Config WebServer::CurrentConfig() const
+{
+    Config config = Config::Current();
+    config.logLevel = Log::Instance().GetLevel();
+    config.threads = threadNum_;
+    config.timeoutMS = timeoutMS_;
+    config.maxConn = maxConn_;
+    config.maxConnPerIP = maxConnPerIP_;
+    config.slowLogMS = RequestTrace::slowMS;
+    return config;
+}
+
+bool WebServer::SetConfigFile(const string& file)
+{
+    configBase_.reset(new Config(CurrentConfig()));
+    Config config;
+    string error;
+    if(!Config::Load(file, *configBase_, config, error)) {
+        LOG_ERROR("config %s: %s", file.c_str(), error.c_str());
+        configBase_.reset();
+        return false;
+    }
+    configFile_ = file;
+    if(config.threads > threadMax_) {
+        // nothing is queued yet, the pool can still be made bigger
+        threadMax_ = config.threads;
+        threadNum_ = config.threads;
+        ResetPool();
+    }
+    ApplyConfig(config);
+    LOG_INFO("config %s loaded", file.c_str());
+    return true;
+}
+
+void WebServer::ReloadConfig()
+{
+    if(configFile_.empty()) {
+        LOG_WARN("SIGHUP without a config file, ignored");
+        return;
+    }
+    Config config;
+    string error;
+    if(!Config::Load(configFile_, *configBase_, config, error)) {
+        LOG_ERROR("config %s: %s, keeping the running one", configFile_.c_str(), error.c_str());
+        return;
+    }
+    ApplyConfig(config);
+    LOG_INFO("config %s reloaded", configFile_.c_str());
+}
+
+void WebServer::ApplyConfig(const Config& config)
+{
+    Config applied = config;
+    if(applied.threads > threadMax_) {
+        LOG_WARN("threads %d over the pool limit %d", applied.threads, threadMax_);
+        applied.threads = threadMax_;
+    }
+    if((applied.maxConnPerIP > 0) != (maxConnPerIP_ > 0)) {
+        // conns open now were counted, or not, by the old setting and release by the new one
+        LOG_WARN("max_conn_per_ip can't be switched on or off while running, keeping %d", maxConnPerIP_.load());
+        applied.maxConnPerIP = maxConnPerIP_;
+    }
+    applied.maxConn = min(applied.maxConn, MAX_FD);
+
+    Log::Instance().SetLevel(applied.logLevel);
+    Log::Instance().SetMaxLines(applied.logMaxLines);
+    if(applied.threads != threadNum_) {
+        threadNum_ = applied.threads;
+        threadpool_->Resize(threadNum_, threadMax_);
+    }
+    timeoutMS_ = applied.timeoutMS; // conns pick it up with their next timer update
+    maxConn_ = applied.maxConn;
+    maxConnPerIP_ = applied.maxConnPerIP;
+    RequestTrace::slowMS = applied.slowLogMS;
+    Config::Publish(unique_ptr<const Config>(new Config(applied)));
+    LOG_INFO("log level %d, %d workers, timeout %dms, slow log %dms", applied.logLevel, applied.threads,
+             applied.timeoutMS, applied.slowLogMS);
+    LOG_INFO("max conn %d (%d per ip), %zu pages, %zu urgent paths", applied.maxConn, applied.maxConnPerIP,
+             applied.pages.size(), applied.urgentPaths.size());
+}
+
+bool WebServer::SetImageVariants(const string& prefix, const string& cacheDir, size_t memBytes,
+                                 size_t diskBytes, int threads)
+{
+    if(!StartCoLoop()) return false;
+    images_.reset(new ImageVariants(srcDir_, prefix, cacheDir, memBytes, diskBytes, threads));
+    HttpConn::images = images_.get();
+    LOG_INFO("image variants under %s, %d encoders, cache %zu bytes in memory, %zu on disk",
+             prefix.c_str(), threads, memBytes, cacheDir.empty() ? 0 : diskBytes);
+    return true;
+}
+
+bool WebServer::SetFlightRecorder(int level, const string& file)
+{
+    if(!FlightRecorder::Enable(level, file.c_str())) {
+        LOG_ERROR("flight recorder: can't use %s", file.c_str());
+        return false;
+    }
+    flightFile_ = file;
+    LOG_INFO("flight recorder from level %d, dumps to %s", level, file.c_str());
+    return true;
+}
+
+void WebServer::SetAltSvc(int h3Port, int maxAgeS)
+{
+    if(h3Port <= 0 || h3Port > 65535) {
+        HttpResponse::altSvc.clear();
+        return;
+    }
+    HttpResponse::altSvc = "h3=\":" + to_string(h3Port) + "\"; ma=" + to_string(maxAgeS > 0 ? maxAgeS : 86400);
+    LOG_INFO("Alt-Svc: %s", HttpResponse::altSvc.c_str());
+}
+
+void WebServer::SetLowLatency(int busyPollUs, int deferAcceptS, int fastOpenQueue, bool cork)
+{
+    if(listenFd_ < 0) return;
+    // accepted sockets inherit socket level options and nagle from the listener, nothing to set per conn
+    int on = 1;
+    setsockopt(listenFd_, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    if(busyPollUs > 0) {
+        if(setsockopt(listenFd_, SOL_SOCKET, SO_BUSY_POLL, &busyPollUs, sizeof(busyPollUs)) < 0) {
+            LOG_WARN("SO_BUSY_POLL %dus: errno %d, above net.core.busy_read it needs CAP_NET_ADMIN", busyPollUs, errno);
+        }
+        if(!epoller_->SetBusyPoll(busyPollUs)) LOG_INFO("no epoll busy poll in kernel, event loop spins %dus", busyPollUs);
+    }
+    if(deferAcceptS > 0 && setsockopt(listenFd_, IPPROTO_TCP, TCP_DEFER_ACCEPT, &deferAcceptS, sizeof(deferAcceptS)) < 0) {
+        LOG_WARN("TCP_DEFER_ACCEPT: errno %d", errno);
+    }
+    // server side TFO also needs bit 2 of net.ipv4.tcp_fastopen
+    if(fastOpenQueue > 0 && setsockopt(listenFd_, IPPROTO_TCP, TCP_FASTOPEN, &fastOpenQueue, sizeof(fastOpenQueue)) < 0) {
+        LOG_WARN("TCP_FASTOPEN: errno %d", errno);
+    }
+    HttpConn::cork = cork;
+    LOG_INFO("low latency: busy poll %dus, defer accept %ds, fast open queue %d, cork %s",
+             busyPollUs, deferAcceptS, fastOpenQueue, cork ? "on" : "off");
+}
+
+void WebServer::SetLimits(int maxConn, int maxConnPerIP, int reqPerSec, int burst)
+{
+    maxConn_ = (maxConn > 0 && maxConn < MAX_FD) ? maxConn : MAX_FD;
+    maxConnPerIP_ = maxConnPerIP > 0 ? maxConnPerIP : 0;
+    limiter_.SetRate(reqPerSec > 0 ? reqPerSec : 0, burst > 0 ? burst : reqPerSec);
+    if(reqPerSec > 0) {
+        HttpConn::requestFilter = [this](const sockaddr_in& addr) {
+            return limiter_.Allow(addr.sin_addr.s_addr);
+        };
+    } else {
+        HttpConn::requestFilter = nullptr;
+    }
+    LOG_INFO("MaxConn: %d, MaxConnPerIP: %d, RatePerIP: %d/s", maxConn_, maxConnPerIP_.load(), reqPerSec);
+}
+
+bool WebServer::AddProxyRoute(const string& prefix, const vector<string>& backends, Upstream::BALANCE balance)
+{
+    if(prefix.empty() || prefix[0] != '/') return false;
+    unique_ptr<Upstream> upstream(new Upstream(balance));
+    for(auto& backend : backends) {
+        size_t colon = backend.rfind(':');
+        if(colon == string::npos) return false;
+        if(!upstream->AddBackend(backend.substr(0, colon), atoi(backend.c_str() + colon + 1))) return false;
+    }
+    if(upstream->Size() == 0) return false;
+    HttpConn::proxyRoutes[prefix] = upstream.get();
+    upstreams_.push_back(std::move(upstream));
+    LOG_INFO("proxy %s to %d backends", prefix.c_str(), (int)backends.size());
+    return true;
+}
+
+void WebServer::InitEventMode(int trigMode)
+{
+    listenEvent_ = EPOLLRDHUP;
+    connEvent_ = EPOLLONESHOT | EPOLLRDHUP;
+    switch(trigMode) {
+    case 0:
+        break;
+    case 1:
+        connEvent_ |= EPOLLET;
+        break;
+    case 2:
+        listenEvent_ |= EPOLLET;
+        break;
+    case 3:
+    default:
+        listenEvent_ |= EPOLLET;
+        connEvent_ |= EPOLLET;
+        break;
+    }
+    HttpConn::isET = (connEvent_ & EPOLLET);
+}
+
+void WebServer::Start()
+{
+    int timeMS = -1; // epoll wait timeout == -1 means blocking
+    if(!isClose_) LOG_INFO("========== Server start ==========");
+    if(!isClose_ && handoffFd_ >= 0) {
+        // old process stops accepting once it hears from us
+        ListenerHandoff::Ready(handoffFd_);
+        close(handoffFd_);
+        handoffFd_ = -1;
+    }
+
+    while(!isClose_) {
+        int left = -1;
+        if(isDraining_) {
+            left = static_cast<int>(chrono::duration_cast<MS>(drainDeadline_ - Clock::now()).count());
+            if(HttpConn::userCount <= 0 || left <= 0) break;
+        }
+        if(acceptPaused_) ResumeAccept();
+        if(timeoutMS_ > 0 || isDraining_ || sessions_ || memBudget_ > 0) timeMS = timer_->GetNextTick();
+        if(isDraining_ && (timeMS < 0 || timeMS > left)) timeMS = left;
+        // workers close conns without waking us up
+        if(acceptPaused_ && (timeMS < 0 || timeMS > ACCEPT_RETRY_MS)) timeMS = ACCEPT_RETRY_MS;
+
+        int eventCnt = epoller_->Wait(timeMS);
+        for(int i = 0; i < eventCnt; i++) {
+            int fd = epoller_->GetEventFd(i);
+            uint32_t events = epoller_->GetEvents(i);
+            if(fd == listenFd_) {
+                DealListen();
+            } else if(fd == signalFd_) {
+                DealSignal();
+            } else if(HttpConn* owner = UpstreamOwner(fd)) {
+                // upstream fds are looked up first, a client fd number may be stale in users_
+                ExtentTime(owner);
+                Dispatch(owner, &WebServer::OnProxy);
+            } else if(events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+                assert(users_.count(fd) > 0);
+                CloseConn(&users_[fd]);
+            } else if(events & EPOLLIN) {
+                assert(users_.count(fd) > 0);
+                DealRead(&users_[fd]);
+            } else if(events & EPOLLOUT) {
+                assert(users_.count(fd) > 0);
+                DealWrite(&users_[fd]);
+            } else {
+                LOG_ERROR("Unexpected event");
+            }
+        }
+    }
+    Stop();
+}
+
+void WebServer::Stop()
+{
+    StopListen();
+    if(!threadpool_->Shutdown(MS(SHUTDOWN_TIMEOUT_MS))) {
+        LOG_WARN("thread pool still busy after %d ms", SHUTDOWN_TIMEOUT_MS);
+    }
+    if(images_) {
+        ImageVariants::Stats stats = images_->GetStats();
+        LOG_INFO("image variants %llu encoded, %llu memory hits, %llu disk hits, %llu coalesced, %llu failed",
+                 (unsigned long long)stats.encodes, (unsigned long long)stats.memHits,
+                 (unsigned long long)stats.diskHits, (unsigned long long)stats.coalesced,
+                 (unsigned long long)stats.failed);
+        HttpConn::images = nullptr;
+        images_.reset(); // encodes in flight finish and wake their conns
+    }
+    if(coLoop_) coLoop_->Stop(); // pending handlers unwind and close their conns
+    ThreadPool::Stats stats = threadpool_->GetStats();
+    LOG_INFO("ThreadPool %llu tasks, queue delay %.0fus, run time %.0fus, %llu spare workers started",
+             (unsigned long long)stats.completed, stats.queueDelayUs, stats.runTimeUs,
+             (unsigned long long)stats.spawned);
+    LOG_INFO("queue delay urgent %.0fus, light %.0fus, heavy %.0fus, %llu tasks expired",
+             stats.classDelayUs[ThreadPool::URGENT], stats.classDelayUs[ThreadPool::LIGHT],
+             stats.classDelayUs[ThreadPool::HEAVY], (unsigned long long)stats.expired);
+    for(auto& user : users_) {
+        if(user.second.GetFd() > 0) CloseConn(&user.second);
+    }
+    timer_->Clear();
+    if(sessions_ && !sessionFile_.empty() && !handedOver_ && !sessions_->Save(sessionFile_)) {
+        LOG_WARN("can't save sessions to %s", sessionFile_.c_str());
+    }
+    if(AccessLog::Instance().IsOpen()) {
+        uint64_t dropped = AccessLog::Instance().Dropped();
+        AccessLog::Instance().Close();
+        if(dropped > 0) LOG_WARN("access log dropped %llu records", (unsigned long long)dropped);
+    }
+    LOG_INFO("memory: buffers %lld bytes, image cache %lld bytes", (long long)MemStats::Get(MemStats::BUFFERS),
+             (long long)MemStats::Get(MemStats::IMAGE_CACHE));
+    LOG_INFO("========== Server stop ==========");
+    Log::Instance().close();
+}
+
+void WebServer::SendError(int fd, const char* info)
+{
+    assert(fd > 0);
+    int ret = send(fd, info, strlen(info), MSG_NOSIGNAL);
+    if(ret < 0) {
+        LOG_WARN("send error to client[%d] error!", fd);
+    }
+    close(fd);
+}
+
+void WebServer::CloseConn(HttpConn* client)
+{
+    assert(client);
+    LOG_INFO("Client[%d] quit!", client->GetFd());
+    epoller_->DelFd(client->GetFd());
+    if(client->IsProxying()) DetachUpstream(client);
+    if(client->close() && client->IsConnCounted()) limiter_.ReleaseConn(client->GetAddr().sin_addr.s_addr);
+}
+
+void WebServer::AddClient(int fd, sockaddr_in addr, bool connCounted)
+{
+    assert(fd > 0);
+    users_[fd].init(fd, addr, connCounted);
+    if(cpuAware_) {
+        if(connCpu_.size() <= static_cast<size_t>(fd)) connCpu_.resize(fd + 1, -1);
+        connCpu_[fd] = CpuAffinity::IncomingCpu(fd);
+    }
+    if(timeoutMS_ > 0 || isDraining_) {
+        timer_->Add(fd, isDraining_ ? DRAIN_IDLE_MS : timeoutMS_.load(),
+                    std::bind(&WebServer::OnTimeout, this, &users_[fd]));
+    }
+    epoller_->AddFd(fd, EPOLLIN | connEvent_);
+    LOG_INFO("Client[%d] in!", users_[fd].GetFd());
+}
+
+void WebServer::DealListen()
+{
+    sockaddr_in addr;
+    do {
+        socklen_t len = sizeof(addr);
+        int fd = accept4(listenFd_, reinterpret_cast<sockaddr*>(&addr), &len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if(fd <= 0) return;
+        if(HttpConn::userCount >= maxConn_) {
+            // shed this one, the rest waits in the accept queue until conns are freed
+            SendError(fd, HttpResponse::Prerendered(503).c_str());
+            LOG_WARN("Clients is full!");
+            PauseAccept();
+            return;
+        }
+        bool counted;
+        if(!limiter_.AcquireConn(addr.sin_addr.s_addr, maxConnPerIP_, counted)) {
+            SendError(fd, HttpResponse::Prerendered(429).c_str());
+            LOG_WARN("Client %s has too many conns", inet_ntoa(addr.sin_addr));
+            continue;
+        }
+        AddClient(fd, addr, counted);
+    } while(listenEvent_ & EPOLLET);
+}
+
+void WebServer::DealRead(HttpConn* client)
+{
+    assert(client);
+    ExtentTime(client);
+    if(client->IsProxying()) {
+        Dispatch(client, &WebServer::OnProxy);
+        return;
+    }
+    if(WebSocket* ws = client->GetWebSocket()) {
+        // a broadcast may have armed the fd while a worker still owns the conn
+        if(ws->BeginTask()) {
+            Dispatch(client, &WebServer::OnWebSocket);
+        }
+        return;
+    }
+    Dispatch(client, &WebServer::OnRead);
+}
+
+void WebServer::DealWrite(HttpConn* client)
+{
+    assert(client);
+    ExtentTime(client);
+    if(client->IsProxying()) {
+        Dispatch(client, &WebServer::OnProxy);
+        return;
+    }
+    if(WebSocket* ws = client->GetWebSocket()) {
+        // a broadcast may have armed the fd while a worker still owns the conn
+        if(ws->BeginTask()) {
+            Dispatch(client, &WebServer::OnWebSocket);
+        }
+        return;
+    }
+    Dispatch(client, &WebServer::OnWrite);
+}
+
+void WebServer::Dispatch(HttpConn* client, void (WebServer::*task)(HttpConn*))
+{
+    ThreadPool::TaskClass cls = client->IsUrgent() ? ThreadPool::URGENT :
+                                client->IsHeavy() ? ThreadPool::HEAVY : ThreadPool::LIGHT;
+    int cpu = ConnCpu(client->GetFd());
+    client->Trace().Begin(RequestTrace::QUEUE);
+    auto run = [this, client, task]() {
+        client->Trace().End(RequestTrace::QUEUE);
+        (this->*task)(client);
+    };
+    if(timeoutMS_ <= 0) {
+        threadpool_->addTask(std::move(run), cls, cpu);
+        return;
+    }
+    threadpool_->addTask(std::move(run), cls, ThreadPool::Clock::now() + MS(timeoutMS_),
+                         std::bind(&WebServer::OnExpired, this, client), cpu);
+}
+
+void WebServer::OnExpired(HttpConn* client)
+{
+    // waited in the queue for as long as the client waits for anything, it is most likely gone
+    LOG_WARN("Client[%d] task expired in queue after %d ms", client->GetFd(), timeoutMS_.load());
+    CloseConn(client);
+}
+
+int WebServer::ConnCpu(int fd) const
+{
+    if(!cpuAware_ || fd < 0 || static_cast<size_t>(fd) >= connCpu_.size()) return -1;
+    return connCpu_[fd];
+}
+
+void WebServer::ExtentTime(HttpConn* client)
+{
+    assert(client);
+    if(timeoutMS_ > 0 || isDraining_) {
+        timer_->Adjust(client->GetFd(), isDraining_ ? DRAIN_IDLE_MS : timeoutMS_.load());
+    }
+}
+
+void WebServer::OnRead(HttpConn* client)
+{
+    assert(client);
+    int readErrno = 0;
+    client->Trace().Begin(RequestTrace::READ);
+    ssize_t ret = client->read(&readErrno);
+    client->Trace().End(RequestTrace::READ);
+    if(ret <= 0 && readErrno != EAGAIN) {
+        CloseConn(client);
+        return;
+    }
+    OnProcess(client);
+}
+
+void WebServer::OnProcess(HttpConn* client)
+{
+    RequestTrace::active = &client->Trace();
+    client->Trace().Begin(RequestTrace::PROCESS);
+    bool ready = client->process();
+    client->Trace().End(RequestTrace::PROCESS);
+    RequestTrace::active = nullptr;
+    if(ready) {
+        if(client->GetWebSocket()) {
+            FlushWebSocket(client);
+            return;
+        }
+        if(client->IsProxying()) {
+            OnProxy(client);
+            return;
+        }
+        if(client->IsCoPending()) {
+            coLoop_->Spawn(ServeCo(client));
+            return;
+        }
+        epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLOUT);
+    } else {
+        client->TrimBuffers(); // idle until the next request
+        epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLIN);
+    }
+}
+
+void WebServer::OnWrite(HttpConn* client)
+{
+    assert(client);
+    int writeErrno = 0;
+    client->Trace().Begin(RequestTrace::WRITE);
+    ssize_t ret = client->write(&writeErrno);
+    client->Trace().End(RequestTrace::WRITE);
+    if(client->ToWriteBytes() == 0) {
+        if(client->HandshakeWritten()) {
+            // TLS is up and nothing was answered, a request the client sent behind its Finished is read now
+            OnRead(client);
+            return;
+        }
+        // transfer finished
+        client->FinishTrace();
+        if(client->IsKeepAlive()) {
+            OnProcess(client);
+            return;
+        }
+    } else if(ret >= 0 || writeErrno == EAGAIN) {
+        // continue when socket is writable again
+        epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLOUT);
+        return;
+    }
+    CloseConn(client);
+}
+
+void WebServer::OnWebSocket(HttpConn* client)
+{
+    assert(client);
+    int readErrno = 0;
+    ssize_t ret = client->read(&readErrno);
+    if(ret == 0 || (ret < 0 && readErrno != EAGAIN)) {
+        CloseConn(client);
+        return;
+    }
+    client->process();
+    FlushWebSocket(client);
+}
+
+void WebServer::FlushWebSocket(HttpConn* client)
+{
+    WebSocket* ws = client->GetWebSocket();
+    int writeErrno = 0;
+    if(ws->HasPending() && client->write(&writeErrno) < 0 && writeErrno != EAGAIN) {
+        CloseConn(client);
+        return;
+    }
+    if(ws->IsFinished()) {
+        CloseConn(client);
+        return;
+    }
+    ws->EndTask();
+}
+
+void WebServer::OnTimeout(HttpConn* client)
+{
+    if(client->IsCoPending()) {
+        // the coroutine bounds its own waits, closing the fd under it would leave it waiting forever
+        timer_->Add(client->GetFd(), isDraining_ ? DRAIN_IDLE_MS : timeoutMS_.load(),
+                    std::bind(&WebServer::OnTimeout, this, client));
+        return;
+    }
+    WebSocket* ws = client->GetWebSocket();
+    if(ws && (isDraining_ ? ws->GoAway() : ws->Ping())) {
+        // answer has to come within another period
+        timer_->Add(client->GetFd(), isDraining_ ? DRAIN_IDLE_MS : timeoutMS_.load(),
+                    std::bind(&WebServer::OnTimeout, this, client));
+        return;
+    }
+    CloseConn(client);
+}
+
+Task<void> WebServer::ServeCo(HttpConn* client)
+{
+    int writeErrno = 0;
+    ssize_t ret = co_await client->ServeAsync(&writeErrno, timeoutMS_ > 0 ? timeoutMS_.load() : -1);
+    if(ret >= 0) client->FinishTrace();
+    if(ret < 0 || !client->IsKeepAlive()) {
+        CloseConn(client);
+        co_return;
+    }
+    // next request may already be buffered, it goes the usual way
+    Dispatch(client, &WebServer::OnProcess);
+}
+
+void WebServer::OnProxy(HttpConn* client)
+{
+    assert(client);
+    ProxyConn* proxy = client->Proxy();
+    ProxyConn::STEP step = proxy->Advance();
+    int stale = proxy->TakeStaleFd();
+    if(stale >= 0) DropUpstream(stale, client);
+
+    // only one side is armed at a time, so a single worker drives the request
+    switch(step) {
+    case ProxyConn::UPSTREAM_WRITE:
+        ArmUpstream(client, EPOLLOUT);
+        break;
+    case ProxyConn::UPSTREAM_READ:
+        ArmUpstream(client, EPOLLIN);
+        break;
+    case ProxyConn::CLIENT_WRITE:
+        epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLOUT);
+        break;
+    case ProxyConn::DONE:
+        DetachUpstream(client);
+        if(client->FinishProxy()) {
+            OnProcess(client); // pipelined request may be waiting already
+        } else {
+            CloseConn(client);
+        }
+        break;
+    case ProxyConn::FAILED:
+        DetachUpstream(client);
+        client->ProxyFailed();
+        if(client->ToWriteBytes() > 0) {
+            epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLOUT);
+        } else {
+            CloseConn(client);
+        }
+        break;
+    }
+}
+
+HttpConn* WebServer::UpstreamOwner(int fd)
+{
+    std::lock_guard<std::mutex> locker(upstreamMtx_);
+    auto it = upstreamOwner_.find(fd);
+    return it == upstreamOwner_.end() ? nullptr : it->second;
+}
+
+void WebServer::ArmUpstream(HttpConn* client, uint32_t events)
+{
+    ProxyConn* proxy = client->Proxy();
+    int fd = proxy->UpstreamFd();
+    if(proxy->RegisteredFd() == fd) {
+        epoller_->ModFd(fd, EPOLLONESHOT | events);
+        return;
+    }
+    // owner is known before the first event can arrive
+    {
+        std::lock_guard<std::mutex> locker(upstreamMtx_);
+        upstreamOwner_[fd] = client;
+    }
+    proxy->SetRegisteredFd(fd);
+    epoller_->AddFd(fd, EPOLLONESHOT | events);
+}
+
+void WebServer::DetachUpstream(HttpConn* client)
+{
+    ProxyConn* proxy = client->Proxy();
+    int fd = proxy->RegisteredFd();
+    if(fd < 0) return;
+    epoller_->DelFd(fd);
+    DropUpstream(fd, client);
+    proxy->SetRegisteredFd(-1);
+}
+
+void WebServer::DropUpstream(int fd, HttpConn* client)
+{
+    std::lock_guard<std::mutex> locker(upstreamMtx_);
+    auto it = upstreamOwner_.find(fd);
+    if(it != upstreamOwner_.end() && it->second == client) upstreamOwner_.erase(it);
+}
+
+bool WebServer::InitSignal()
+{
+    signal(SIGPIPE, SIG_IGN);
+
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGUSR2);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGHUP);
+    sigaddset(&mask, SIGUSR1);
+    if(pthread_sigmask(SIG_BLOCK, &mask, nullptr) != 0) return false;
+
+    signalFd_ = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if(signalFd_ < 0) {
+        LOG_ERROR("signalfd error: %s", strerror(errno));
+        return false;
+    }
+    return epoller_->AddFd(signalFd_, EPOLLIN);
+}
+
+void WebServer::DealSignal()
+{
+    signalfd_siginfo info;
+    while(read(signalFd_, &info, sizeof(info)) == sizeof(info)) {
+        switch(info.ssi_signo) {
+        case SIGUSR2:
+            Upgrade();
+            break;
+        case SIGHUP:
+            ReloadConfig();
+            break;
+        case SIGUSR1:
+            if(flightFile_.empty()) {
+                LOG_WARN("SIGUSR1 without a flight recorder, ignored");
+            } else if(FlightRecorder::Dump(flightFile_.c_str(), SIGUSR1)) {
+                LOG_INFO("flight recorder dumped to %s", flightFile_.c_str());
+            } else {
+                LOG_ERROR("flight recorder: dump to %s failed", flightFile_.c_str());
+            }
+            break;
+        case SIGTERM:
+        case SIGINT:
+            if(isDraining_) {
+                isClose_ = true;
+            } else {
+                LOG_INFO("got signal %d, draining", info.ssi_signo);
+                StartDrain();
+            }
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+void WebServer::Upgrade()
+{
+    if(isDraining_ || listenFd_ < 0) return;
+    if(!argv_ || !argv_[0]) {
+        LOG_ERROR("upgrade error: argv not set");
+        return;
+    }
+
+    int handoffFd, childFd;
+    if(!ListenerHandoff::Pair(handoffFd, childFd)) return;
+
+    // the new process loads the snapshot while it starts, logins since the last sweep must be in it.
+    // ones made while this process drains are not
+    if(sessions_ && !sessionFile_.empty()) {
+        savedChanges_ = sessions_->Changes();
+        if(!sessions_->Save(sessionFile_)) LOG_WARN("can't save sessions to %s", sessionFile_.c_str());
+    }
+
+    // build env before fork, child may only call async-signal-safe functions
+    string handoffEnv = string(ListenerHandoff::ENV_FD) + "=" + to_string(childFd);
+    vector<char*> envp;
+    for(char** env = environ; *env; env++) envp.push_back(*env);
+    envp.push_back(&handoffEnv[0]);
+    envp.push_back(nullptr);
+    sigset_t mask;
+    sigemptyset(&mask);
+
+    pid_t pid = fork();
+    if(pid == 0) {
+        pthread_sigmask(SIG_SETMASK, &mask, nullptr);
+        fcntl(childFd, F_SETFD, 0); // the only fd of ours kept over exec
+        execvpe(argv_[0], argv_, envp.data());
+        _exit(127);
+    }
+
+    close(childFd);
+    // a child that dies before Ready closes its end, WaitReady sees that at once
+    bool ok = pid > 0 && ListenerHandoff::Send(handoffFd, {listenFd_}) &&
+              ListenerHandoff::WaitReady(handoffFd, HANDOFF_TIMEOUT_MS);
+    close(handoffFd);
+
+    if(!ok) {
+        LOG_ERROR("upgrade error: new process %d did not take over", pid);
+        if(pid > 0) {
+            kill(pid, SIGKILL);
+            waitpid(pid, nullptr, 0);
+        }
+        return;
+    }
+    LOG_INFO("upgrade: listen socket handed to %d", pid);
+    handedOver_ = true;
+    StartDrain();
+}
+
+void WebServer::StopListen()
+{
+    if(listenFd_ < 0) return;
+    epoller_->DelFd(listenFd_);
+    close(listenFd_);
+    listenFd_ = -1;
+}
+
+void WebServer::PauseAccept()
+{
+    if(acceptPaused_ || listenFd_ < 0) return;
+    epoller_->DelFd(listenFd_);
+    acceptPaused_ = true;
+}
+
+void WebServer::ResumeAccept()
+{
+    if(listenFd_ < 0) {
+        acceptPaused_ = false;
+        return;
+    }
+    // some headroom so that accepting doesn't flap at the cap
+    if(HttpConn::userCount >= maxConn_ - maxConn_ / 10) return;
+    if(epoller_->AddFd(listenFd_, listenEvent_ | EPOLLIN)) acceptPaused_ = false;
+}
+
+void WebServer::StartDrain()
+{
+    if(isDraining_) return;
+    StopListen();
+    isDraining_ = true;
+    HttpConn::isDraining = true;
+    drainDeadline_ = Clock::now() + MS(DRAIN_TIMEOUT_MS);
+    for(auto& user : users_) {
+        if(user.second.GetFd() <= 0) continue;
+        if(timeoutMS_ > 0) {
+            timer_->Adjust(user.first, DRAIN_IDLE_MS);
+        } else {
+            timer_->Add(user.first, DRAIN_IDLE_MS, std::bind(&WebServer::OnTimeout, this, &user.second));
+        }
+    }
+    LOG_INFO("draining %d conns", (int)HttpConn::userCount);
+}
+
+bool WebServer::InheritSocket(const char* handoff)
+{
+    vector<int> fds;
+    handoffFd_ = ListenerHandoff::Adopt(handoff);
+    if(handoffFd_ < 0 || !ListenerHandoff::Receive(handoffFd_, fds, HANDOFF_TIMEOUT_MS)) {
+        LOG_ERROR("handoff on fd %s error", handoff);
+        if(handoffFd_ >= 0) close(handoffFd_);
+        handoffFd_ = -1;
+        return false;
+    }
+    listenFd_ = fds[0];
+    for(size_t i = 1; i < fds.size(); i++) close(fds[i]);
+    LOG_INFO("listen socket inherited from old process");
+    return true;
+}
+
+bool WebServer::InitSocket()
+{
+    // started by Upgrade of an older server
+    const char* handoff = getenv(ListenerHandoff::ENV_FD);
+    if(handoff) {
+        string handoffFd = handoff;
+        unsetenv(ListenerHandoff::ENV_FD);
+        if(InheritSocket(handoffFd.c_str())) {
+            SetFdNonblock(listenFd_);
+            if(epoller_->AddFd(listenFd_, listenEvent_ | EPOLLIN)) return true;
+            close(listenFd_);
+            listenFd_ = -1;
+            return false;
+        }
+    }
+
+    int ret;
+    sockaddr_in addr = {0};
+    if(port_ > 65535 || port_ < 1024) {
+        LOG_ERROR("Port:%d error!", port_);
+        return false;
+    }
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port_);
+    linger optLinger = {0};
+    if(openLinger_) {
+        // close gracefully, wait until remaining data is sent or timeout
+        optLinger.l_onoff = 1;
+        optLinger.l_linger = 1;
+    }
+
+    listenFd_ = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(listenFd_ < 0) {
+        LOG_ERROR("Create socket error!");
+        return false;
+    }
+
+    ret = setsockopt(listenFd_, SOL_SOCKET, SO_LINGER, &optLinger, sizeof(optLinger));
+    if(ret < 0) {
+        close(listenFd_);
+        listenFd_ = -1;
+        LOG_ERROR("Init linger error!");
+        return false;
+    }
+
+    int optval = 1;
+    ret = setsockopt(listenFd_, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(int));
+    if(ret == -1) {
+        LOG_ERROR("set socket setsockopt error !");
+        close(listenFd_);
+        listenFd_ = -1;
+        return false;
+    }
+
+    ret = bind(listenFd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+    if(ret < 0) {
+        LOG_ERROR("Bind Port:%d error!", port_);
+        close(listenFd_);
+        listenFd_ = -1;
+        return false;
+    }
+
+    ret = listen(listenFd_, SOMAXCONN);
+    if(ret < 0) {
+        LOG_ERROR("Listen port:%d error!", port_);
+        close(listenFd_);
+        listenFd_ = -1;
+        return false;
+    }
+
+    if(!epoller_->AddFd(listenFd_, listenEvent_ | EPOLLIN)) {
+        LOG_ERROR("Add listen error!");
+        close(listenFd_);
+        listenFd_ = -1;
+        return false;
+    }
+    SetFdNonblock(listenFd_);
+    LOG_INFO("Server port:%d", port_);
+    return true;
+}
+
+int WebServer::SetFdNonblock(int fd)
+{
+    assert(fd > 0);
+    return fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+}
@@ -0,0 +1,220 @@
+/*
+ * @author: Zimo Li
+ * @date: 2026-10-19
+*/
+
+#ifndef WEBSERVER_HPP
+#define WEBSERVER_HPP
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <netinet/in.h>
+#include "epoller.hpp"
+#include "ratelimiter.hpp"
+#include "config.hpp"
+#include "../timer/heaptimer.hpp"
+#include "../pool/threadpool.hpp"
+#include "../http/httpconn.hpp"
+#include "../http/upstream.hpp"
+#include "../coro/scheduler.hpp"
+
+// SIGUSR2: exec the binary again and hand the listening socket over, then drain and exit
+// SIGTERM/SIGINT: stop accepting and drain, a second one exits at once
+// SIGHUP: read the config file again and apply it
+// SIGUSR1: dump the flight recorder
+class WebServer {
+private:
+    static const int MAX_FD = 65536;
+    static const int DRAIN_TIMEOUT_MS = 30000; // in-flight requests get this long to finish
+    static const int DRAIN_IDLE_MS = 1000; // idle keep-alive conns are closed after this while draining
+    static const int HANDOFF_TIMEOUT_MS = 5000; // new process has to take over within this time
+    static const int SHUTDOWN_TIMEOUT_MS = 3000; // for thread pool tasks still running at exit
+    static const int ACCEPT_RETRY_MS = 100; // how often a paused listener checks the conn count
+    static const int SESSION_SWEEP_MS = 60000; // expired sessions nobody asked for are dropped this often
+    static const int MEM_CHECK_MS = 1000; // how often the memory budget is checked
+    static const int SESSION_TIMER_ID = MAX_FD; // above every fd
+    static const int MEM_TIMER_ID = MAX_FD + 1;
+
+    static char** argv_; // command line to exec on upgrade
+
+    int port_;
+    bool openLinger_;
+    std::atomic<int> timeoutMS_; // idle timeout of a conn, 0 means never
+    bool isClose_;
+    bool isDraining_;
+    TimeStamp drainDeadline_;
+
+    int listenFd_;
+    int signalFd_;
+    int handoffFd_; // conn to the old process when listen socket was inherited
+    bool acceptPaused_; // listener left epoll at the conn cap, new clients wait in the accept queue
+    std::string srcDir_;
+
+    uint32_t listenEvent_;
+    uint32_t connEvent_;
+
+    std::unique_ptr<HeapTimer> timer_;
+    std::unique_ptr<ThreadPool> threadpool_;
+    std::unique_ptr<Epoller> epoller_;
+    std::vector<std::unique_ptr<Upstream>> upstreams_; // outlives users_, conns return to its pools
+    std::unordered_map<int, HttpConn> users_;
+    std::unordered_map<int, HttpConn*> upstreamOwner_; // upstream fd in epoll -> client it serves
+    std::mutex upstreamMtx_;
+    std::unique_ptr<CoScheduler> coLoop_; // declared after users_ so that it stops first
+    std::unique_ptr<SessionStore> sessions_;
+    std::string sessionFile_; // snapshot, empty for none
+    std::atomic<uint64_t> savedChanges_; // store changes the snapshot has seen
+    bool handedOver_; // an upgrade took over, the snapshot is the new process's to write
+    std::string configFile_;
+    std::unique_ptr<Config> configBase_; // settings made in code, keys missing from the file keep these
+    std::unique_ptr<ImageVariants> images_; // its encodes wake coroutines on coLoop_
+    std::string flightFile_; // flight recorder dump, empty when it is off
+
+    int threadNum_;
+    int threadMax_; // spare workers are added up to this while tasks queue up
+    unsigned lightWeight_, heavyWeight_; // worker share of light and heavy conn tasks
+    std::vector<int> workerCpus_;
+    bool cpuAware_; // workers are pinned, tasks follow the incoming cpu of their socket
+    std::vector<int> connCpu_; // fd -> SO_INCOMING_CPU read at accept
+
+    int maxConn_; // over this a new client gets a 503 and accepting pauses
+    std::atomic<int> maxConnPerIP_; // 0 means no limit
+    std::size_t memBudget_; // MemStats total that turns memory pressure on, 0 means no budget
+    RateLimiter limiter_;
+    std::unique_ptr<TlsContext> tls_;
+    std::unique_ptr<AssetBundle> bundle_;
+
+    bool InitSocket();
+    bool InheritSocket(const char* handoff); // take listen socket from the old process, handoff is ENV_FD
+    bool InitSignal();
+    void InitEventMode(int trigMode);
+    void AddClient(int fd, sockaddr_in addr, bool connCounted);
+
+    void DealListen();
+    void DealWrite(HttpConn* client);
+    void DealRead(HttpConn* client);
+    void DealSignal();
+
+    void SendError(int fd, const char* info);
+    void ExtentTime(HttpConn* client);
+    int ConnCpu(int fd) const; // -1 lets any worker run the task
+    void CloseConn(HttpConn* client);
+    void ResetPool(); // replace the pool before anything was queued, after a setting changed
+    // queue task for client in the class its last request falls in, it fails fast once the client timed out
+    void Dispatch(HttpConn* client, void (WebServer::*task)(HttpConn*));
+    void OnExpired(HttpConn* client);
+
+    void OnRead(HttpConn* client);
+    void OnWrite(HttpConn* client);
+    void OnProcess(HttpConn* client);
+    void OnProxy(HttpConn* client); // event on either side of a proxied request
+    void OnWebSocket(HttpConn* client); // read, answer and write queued frames in one task
+    void FlushWebSocket(HttpConn* client);
+    void OnTimeout(HttpConn* client); // idle websocket gets a ping before it is dropped
+    Task<void> ServeCo(HttpConn* client); // coroutine route, conn comes back to the pool afterwards
+
+    HttpConn* UpstreamOwner(int fd);
+    void ArmUpstream(HttpConn* client, uint32_t events);
+    void DetachUpstream(HttpConn* client); // take upstream fd out of epoll before it is pooled or closed
+    void DropUpstream(int fd, HttpConn* client); // fd was closed by proxy, forget it
+
+    void Upgrade(); // start new binary and pass listen socket to it
+    void StopListen();
+    void PauseAccept();
+    void ResumeAccept(); // once conn count is back under the cap
+    void StartDrain();
+    void Stop(); // wait for workers, close conns and flush log
+    bool StartCoLoop();
+    void SweepSessions(); // timer callback, rearms itself
+    void CheckMemory(); // same
+    Config CurrentConfig() const; // what is in effect now, as a snapshot
+    void ApplyConfig(const Config& config); // on the loop thread
+    void ReloadConfig();
+
+    static int SetFdNonblock(int fd);
+
+public:
+    WebServer(int port, int trigMode, int timeoutMS, bool optLinger, int threadNum,
+              bool openLog, int logLevel, int logQueSize);
+    ~WebServer();
+
+    static void SetArgs(char** argv); // keep argv of main for upgrade
+
+    // pin workers to cpus and the log writer to logCpu (-1 leaves it), call before Start
+    void SetAffinity(const std::vector<int>& workerCpus, int logCpu);
+
+    // let the pool grow to maxThreads workers when tasks wait behind blocked ones, call before Start
+    void SetPoolLimit(int maxThreads);
+
+    // urgent paths (health checks) are served before anything else, light and heavy conn tasks
+    // (big uploads, responses and proxying) share the workers lightWeight:heavyWeight. call before Start
+    void SetScheduling(const std::vector<std::string>& urgentPaths, unsigned lightWeight, unsigned heavyWeight);
+
+    // log requests taking longer than ms from first byte to last, with time per phase. 0 turns it off
+    void SetSlowLog(int ms);
+
+    // binary access log appended to path, one in sampleRate requests is kept (all with 5xx).
+    // tools/accesslog_dump turns it into text or JSON
+    bool SetAccessLog(const std::string& path, int sampleRate);
+
+    // serve static files from a bundle made by tools/bundle_pack instead of srcDir, call before Start.
+    // populate maps every page now, hugePages asks for transparent huge pages
+    bool SetBundle(const std::string& file, bool populate, bool hugePages);
+
+    // "prefix/a.jpg?w=320&q=60" is answered with a smaller JPEG made by threads encoders of its own.
+    // variants are cached in memBytes of memory and diskBytes under cacheDir (empty for none). call before Start
+    bool SetImageVariants(const std::string& prefix, const std::string& cacheDir, std::size_t memBytes,
+                          std::size_t diskBytes, int threads);
+
+    // keep LOG_ lines from level up that the log file doesn't take in memory, per thread, and write
+    // them to file on a crash (fatal signal, failed assert) or SIGUSR1. tools/flightrec_dump reads it
+    bool SetFlightRecorder(int level, const std::string& file);
+
+    // settings from file (see Config) override the ones made in code and are read again on SIGHUP.
+    // call after the other setters, before Start. false if the file can't be read or has an error
+    bool SetConfigFile(const std::string& file);
+
+    // advertise HTTP/3 on UDP h3Port for maxAgeS seconds. there is no QUIC stack in this server, the
+    // port belongs to a terminator in front of it. browsers only take it from responses over TLS. call before Start
+    void SetAltSvc(int h3Port, int maxAgeS);
+
+    // terminate TLS on the listen port, call before Start. ticketKeyFile may be empty
+    bool SetTls(const std::string& certFile, const std::string& keyFile, const std::string& ticketKeyFile);
+
+    // cookie sessions: a POST to /login.html is checked once by loginCheck on the coroutine loop, against
+    // the user table through SqlConnPool (SqlConnPool::VerifyUserAsync) when loginCheck is empty. then
+    // the session cookie stands in for it. paths in sessionPaths show the login page to anyone without
+    // a session. idle sessions end after ttlSec. with snapshotFile they are saved every sweep and at stop,
+    // and loaded here, so a restart keeps users logged in. call before Start
+    bool EnableSessions(int ttlSec, const std::vector<std::string>& sessionPaths, HttpConn::LoginCheck loginCheck,
+                        const std::string& snapshotFile);
+
+    // latency over throughput, call before Start. conns get TCP_NODELAY. busyPollUs > 0 busy polls
+    // the NIC for conn reads (SO_BUSY_POLL) and in the event loop, which then burns its core: keep
+    // workers off it with SetAffinity and start the server pinned there (taskset). deferAcceptS > 0
+    // wakes accept only once the request arrived, fastOpenQueue > 0 takes data in the SYN (TFO),
+    // cork sends header and body in full segments and pushes the tail as soon as the response is done
+    void SetLowLatency(int busyPollUs, int deferAcceptS, int fastOpenQueue, bool cork);
+
+    // keep the memory counted by MemStats (buffers, image cache) under bytes: over it the image cache
+    // is trimmed, conns cut their buffers back to the first size when they go idle and freed pages go
+    // back to the kernel, until it is 10% under again. call before Start
+    void SetMemoryBudget(std::size_t bytes);
+
+    // admission control, call before Start. reqPerSec == 0 disables per client rate limiting
+    void SetLimits(int maxConn, int maxConnPerIP, int reqPerSec, int burst);
+
+    // forward requests under prefix to backends given as "ip:port", call before Start
+    bool AddProxyRoute(const std::string& prefix, const std::vector<std::string>& backends,
+                       Upstream::BALANCE balance = Upstream::ROUND_ROBIN);
+
+    // serve path by a coroutine on one shared scheduler thread, call before Start
+    bool AddCoRoute(const std::string& path, HttpConn::CoHandler handler);
+
+    void Start();
+};
+
+#endif // WEBSERVER_HPP
@@ -0,0 +1,123 @@
+/*
+ * @author: Zimo Li
+ * @date: 2026-10-19
+*/
+
+#include "heaptimer.hpp"
+#include <cassert>
+
+void HeapTimer::SiftUp(std::size_t i)
+{
+    assert(i < heap_.size());
+    while(i > 0) {
+        std::size_t parent = (i - 1) / 2;
+        if(!(heap_[i] < heap_[parent])) break;
+        SwapNode(i, parent);
+        i = parent;
+    }
+}
+
+bool HeapTimer::SiftDown(std::size_t i, std::size_t n)
+{
+    assert(i < heap_.size() && n <= heap_.size());
+    std::size_t start = i;
+    std::size_t child = i * 2 + 1;
+    while(child < n) {
+        if(child + 1 < n && heap_[child + 1] < heap_[child]) child++;
+        if(!(heap_[child] < heap_[i])) break;
+        SwapNode(i, child);
+        i = child;
+        child = i * 2 + 1;
+    }
+    return i > start;
+}
+
+void HeapTimer::SwapNode(std::size_t i, std::size_t j)
+{
+    assert(i < heap_.size() && j < heap_.size());
+    std::swap(heap_[i], heap_[j]);
+    ref_[heap_[i].id] = i;
+    ref_[heap_[j].id] = j;
+}
+
+void HeapTimer::Del(std::size_t i)
+{
+    assert(!heap_.empty() && i < heap_.size());
+    // move node to the tail, then fix the one that took its place
+    std::size_t n = heap_.size() - 1;
+    if(i < n) {
+        SwapNode(i, n);
+        if(!SiftDown(i, n)) SiftUp(i);
+    }
+    ref_.erase(heap_.back().id);
+    heap_.pop_back();
+}
+
+void HeapTimer::Add(int id, int timeoutMS, const TimeoutCallBack& cb)
+{
+    assert(id >= 0);
+    if(ref_.count(id) == 0) {
+        std::size_t i = heap_.size();
+        ref_[id] = i;
+        heap_.push_back({id, Clock::now() + MS(timeoutMS), cb});
+        SiftUp(i);
+    } else {
+        std::size_t i = ref_[id];
+        heap_[i].expires = Clock::now() + MS(timeoutMS);
+        heap_[i].cb = cb;
+        if(!SiftDown(i, heap_.size())) SiftUp(i);
+    }
+}
+
+void HeapTimer::Adjust(int id, int timeoutMS)
+{
+    if(ref_.count(id) == 0) return;
+    std::size_t i = ref_[id];
+    heap_[i].expires = Clock::now() + MS(timeoutMS);
+    if(!SiftDown(i, heap_.size())) SiftUp(i);
+}
+
+void HeapTimer::Remove(int id)
+{
+    if(ref_.count(id) == 0) return;
+    Del(ref_[id]);
+}
+
+void HeapTimer::DoWork(int id)
+{
+    if(ref_.count(id) == 0) return;
+    std::size_t i = ref_[id];
+    TimeoutCallBack cb = heap_[i].cb;
+    Del(i);
+    if(cb) cb();
+}
+
+void HeapTimer::Clear()
+{
+    ref_.clear();
+    heap_.clear();
+}
+
+void HeapTimer::Tick()
+{
+    while(!heap_.empty()) {
+        TimerNode node = heap_.front();
+        if(std::chrono::duration_cast<MS>(node.expires - Clock::now()).count() > 0) break;
+        Pop();
+        if(node.cb) node.cb();
+    }
+}
+
+void HeapTimer::Pop()
+{
+    assert(!heap_.empty());
+    Del(0);
+}
+
+int HeapTimer::GetNextTick()
+{
+    Tick();
+    if(heap_.empty()) return -1;
+    auto res = std::chrono::duration_cast<MS>(heap_.front().expires - Clock::now()).count();
+    return res < 0 ? 0 : static_cast<int>(res);
+}
@@ -0,0 +1,52 @@
+/*
+ * @author: Zimo Li
+ * @date: 2026-10-19
+*/
+
+#ifndef HEAPTIMER_HPP
+#define HEAPTIMER_HPP
+
+#include <vector>
+#include <chrono>
+#include <functional>
+#include <unordered_map>
+
+typedef std::function<void()> TimeoutCallBack;
+typedef std::chrono::steady_clock Clock;
+typedef std::chrono::milliseconds MS;
+typedef Clock::time_point TimeStamp;
+
+struct TimerNode {
+    int id;
+    TimeStamp expires;
+    TimeoutCallBack cb;
+    bool operator<(const TimerNode& t) const { return expires < t.expires; }
+};
+
+// min heap of timers, id(fd) -> heap index kept in ref_ for O(log n) adjust
+class HeapTimer {
+private:
+    std::vector<TimerNode> heap_;
+    std::unordered_map<int, std::size_t> ref_;
+
+    void Del(std::size_t i); // delete node at index i
+    void SiftUp(std::size_t i);
+    bool SiftDown(std::size_t i, std::size_t n); // return false if node didn't move
+    void SwapNode(std::size_t i, std::size_t j);
+
+public:
+    HeapTimer() { heap_.reserve(64); };
+    ~HeapTimer() { Clear(); };
+
+    void Add(int id, int timeoutMS, const TimeoutCallBack& cb); // add a timer or renew it
+    void Adjust(int id, int timeoutMS); // set new expire time from now
+    void Remove(int id); // drop timer without calling it
+    void DoWork(int id); // call the callback now and drop the timer
+    void Clear();
+
+    void Tick(); // call all expired timers
+    void Pop();
+    int GetNextTick(); // ms until next timer expires, -1 if none
+};
+
+#endif // HEAPTIMER_HPP
@@ -0,0 +1,260 @@
+/*
+ * @author: Zimo Li
+ * @date: 2026-10-19
+*/
+
+// HttpRequest::parse against a slow reference parser built on std::regex and plain strings,
+// every field both agree on is compared, the first difference aborts with both results
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+// gcc 12 at -O1 with sanitizers warns inside the std::function members of the regex NFA
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#include <regex>
+#pragma GCC diagnostic pop
+#include <set>
+#include "../../src/buffer/buffer.hpp"
+#include "../../src/http/httprequest.hpp"
+using namespace std;
+
+namespace {
+
+// std::regex recurses per character, longer inputs would only measure the stack
+const size_t MAX_INPUT_LEN = 4096;
+
+struct Reference {
+    string method, target, version, body;
+    vector<pair<string, string>> fields; // as sent, lowercase names
+    size_t consumed;
+};
+
+const set<string> KNOWN = {
+    "host", "connection", "keep-alive", "proxy-connection", "content-length", "content-type",
+    "transfer-encoding", "te", "trailer", "expect", "upgrade", "http2-settings",
+    "sec-websocket-key", "sec-websocket-version", "origin", "accept", "accept-encoding",
+    "accept-language", "user-agent", "referer", "cookie", "authorization", "cache-control",
+    "if-modified-since", "if-none-match", "range", "x-forwarded-for",
+};
+
+string Lower(string str)
+{
+    for(char& ch : str) {
+        if(ch >= 'A' && ch <= 'Z') ch = ch - 'A' + 'a';
+    }
+    return str;
+}
+
+string Escape(const string& str)
+{
+    string res;
+    char hex[8];
+    for(unsigned char ch : str) {
+        if(ch == '\\') {
+            res += "\\\\";
+        } else if(ch >= 0x20 && ch < 0x7f) {
+            res += ch;
+        } else {
+            snprintf(hex, sizeof(hex), "\\x%02x", ch);
+            res += hex;
+        }
+    }
+    return res;
+}
+
+// a known name is answered with its non-empty values joined, any other with the first one
+string RefHeader(const Reference& ref, const string& name)
+{
+    vector<string> values;
+    for(auto& field : ref.fields) {
+        if(field.first != name) continue;
+        if(KNOWN.count(name) == 0) return field.second;
+        if(!field.second.empty()) values.push_back(field.second);
+    }
+    string res;
+    for(size_t i = 0; i < values.size(); i++) res += (i ? ", " : "") + values[i];
+    return res;
+}
+
+enum RefResult { REF_BAD, REF_MORE, REF_DONE };
+
+// one request from in[start]: CRLF ended request line and fields, then Content-Length bytes of body
+RefResult RefParse(const string& in, size_t start, Reference& ref)
+{
+    static const regex REQUEST_LINE("^([^ ]*) ([^ ]*) HTTP/([^ ]*)$");
+    static const regex FIELD("^([^:]+):[ \\t]*([\\s\\S]*?)[ \\t]*$");
+    const size_t MAX_BODY = 16 * 1024 * 1024;
+
+    size_t pos = start;
+    bool requestLine = false;
+    while(true) {
+        size_t end = in.find("\r\n", pos);
+        if(end == string::npos) return REF_MORE;
+        string line = in.substr(pos, end - pos);
+        pos = end + 2;
+        smatch match;
+        if(!requestLine) {
+            if(line.empty()) continue; // empty lines before a request are skipped
+            if(!regex_match(line, match, REQUEST_LINE)) return REF_BAD;
+            ref.method = match[1];
+            ref.target = match[2];
+            ref.version = match[3];
+            requestLine = true;
+        } else if(line.empty()) {
+            break;
+        } else if(regex_match(line, match, FIELD)) {
+            ref.fields.emplace_back(Lower(match[1]), match[2]);
+        } else {
+            return REF_BAD;
+        }
+    }
+
+    bool hasLength = false;
+    for(auto& field : ref.fields) {
+        if(field.first == "transfer-encoding") return REF_BAD;
+        if(field.first == "content-length") hasLength = true;
+    }
+    string length = RefHeader(ref, "content-length");
+    if(hasLength && length.empty()) return REF_BAD;
+    if(length.find_first_not_of("0123456789") != string::npos) return REF_BAD;
+    length.erase(0, min(length.find_first_not_of('0'), length.size()));
+    if(length.size() > 9 || (!length.empty() && stoul(length) > MAX_BODY)) return REF_BAD;
+    size_t len = length.empty() ? 0 : stoul(length);
+    if(in.size() - pos < len) return REF_MORE;
+    ref.body = in.substr(pos, len);
+    ref.consumed = pos + len - start;
+    return REF_DONE;
+}
+
+bool RefHasToken(const string& value, const string& token)
+{
+    size_t pos = 0;
+    while(pos <= value.size()) {
+        size_t end = value.find(',', pos);
+        if(end == string::npos) end = value.size();
+        string item = value.substr(pos, end - pos);
+        item.erase(0, item.find_first_not_of(" \t"));
+        item.erase(item.find_last_not_of(" \t") + 1);
+        if(Lower(item) == token) return true;
+        pos = end + 1;
+    }
+    return false;
+}
+
+string RefDecode(const string& raw)
+{
+    string res;
+    for(size_t i = 0; i < raw.size(); i++) {
+        if(raw[i] == '+') {
+            res += ' ';
+        } else if(raw[i] == '%' && i + 2 < raw.size() && isxdigit(static_cast<unsigned char>(raw[i + 1])) &&
+                  isxdigit(static_cast<unsigned char>(raw[i + 2]))) {
+            res += static_cast<char>(stoi(raw.substr(i + 1, 2), nullptr, 16));
+            i += 2;
+        } else {
+            res += raw[i];
+        }
+    }
+    return res;
+}
+
+vector<pair<string, string>> RefForm(const string& body)
+{
+    vector<pair<string, string>> res;
+    size_t pos = 0;
+    while(pos <= body.size()) {
+        size_t end = body.find('&', pos);
+        if(end == string::npos) end = body.size();
+        string pair = body.substr(pos, end - pos);
+        size_t eq = pair.find('=');
+        if(eq != string::npos) {
+            res.emplace_back(RefDecode(pair.substr(0, eq)), RefDecode(pair.substr(eq + 1)));
+        } else if(!pair.empty()) {
+            res.emplace_back(RefDecode(pair), "");
+        }
+        pos = end + 1;
+    }
+    return res;
+}
+
+[[noreturn]] void Mismatch(const string& input, const char* what, const string& expected, const string& actual)
+{
+    fprintf(stderr, "mismatch in %s\n  reference: \"%s\"\n  parse:     \"%s\"\n  input:     \"%s\"\n", what,
+            Escape(expected).c_str(), Escape(actual).c_str(), Escape(input).c_str());
+    abort();
+}
+
+void Expect(const string& input, const char* what, const string& expected, const string& actual)
+{
+    if(expected != actual) Mismatch(input, what, expected, actual);
+}
+
+void Compare(const string& input, const Reference& ref, const HttpRequest& request, size_t consumed)
+{
+    Expect(input, "method", ref.method, request.method());
+    Expect(input, "target", ref.target, request.target());
+    Expect(input, "version", ref.version, request.version());
+    Expect(input, "body", ref.body, request.body());
+    Expect(input, "consumed", to_string(ref.consumed), to_string(consumed));
+
+    set<string> names;
+    size_t expectedSize = 0;
+    for(auto& field : ref.fields) {
+        if(KNOWN.count(field.first) == 0 || names.count(field.first) == 0) expectedSize++;
+        names.insert(field.first);
+    }
+    Expect(input, "field count", to_string(expectedSize), to_string(request.headers().Size()));
+    for(auto& name : names) {
+        Expect(input, ("field " + name).c_str(), RefHeader(ref, name), request.GetHeader(name));
+    }
+
+    bool keepAlive = ref.version == "1.1" && names.count("connection") == 1 &&
+                     RefHasToken(RefHeader(ref, "connection"), "keep-alive");
+    Expect(input, "keep-alive", to_string(keepAlive), to_string(request.IsKeepAlive()));
+
+    string type = Lower(RefHeader(ref, "content-type"));
+    if(ref.method == "POST" && type.substr(0, type.find(';')) == "application/x-www-form-urlencoded") {
+        auto form = RefForm(ref.body);
+        for(auto& field : form) {
+            string first;
+            for(auto& other : form) {
+                if(other.first == field.first) {
+                    first = other.second;
+                    break;
+                }
+            }
+            Expect(input, ("post " + field.first).c_str(), first, string(request.PostView(field.first)));
+        }
+    }
+}
+
+} // namespace
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+    if(size > MAX_INPUT_LEN) return 0;
+    string input(reinterpret_cast<const char*>(data), size);
+    Buffer buff;
+    buff.Append(input);
+
+    HttpRequest request;
+    size_t offset = 0;
+    for(int i = 0; i < 64 && offset < input.size(); i++) {
+        Reference ref;
+        RefResult expected = RefParse(input, offset, ref);
+        size_t before = buff.ReadableBytes();
+        bool actual = request.parse(buff);
+        Expect(input, "accepted", to_string(expected != REF_BAD), to_string(actual));
+        if(!actual) break;
+        Expect(input, "complete", to_string(expected == REF_DONE), to_string(request.IsComplete()));
+        if(expected == REF_MORE) break; // both wait for the next read
+
+        Compare(input, ref, request, before - buff.ReadableBytes());
+        request.Init();
+        offset += ref.consumed;
+    }
+    return 0;
+}
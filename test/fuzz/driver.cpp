@@ -0,0 +1,160 @@
+/*
+ * @author: Zimo Li
+ * @date: 2026-10-19
+*/
+
+// stand-in for libFuzzer's main when the targets are built with gcc or afl-g++:
+// every file or directory given is replayed, -runs=N adds N random mutations of them
+// and a crashing input is saved to ./crash-input before the process dies
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <csignal>
+#include <string>
+#include <vector>
+#include <random>
+#include <fstream>
+#include <sstream>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#if defined(__SANITIZE_ADDRESS__) && __has_include(<sanitizer/common_interface_defs.h>)
+#include <sanitizer/common_interface_defs.h>
+#define HAS_DEATH_CALLBACK 1
+#endif
+using namespace std;
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size);
+
+static const char* CRASH_FILE = "crash-input";
+static const string* current = nullptr; // input being run, dumped if it kills us
+
+static void SaveCurrent()
+{
+    if(!current) return;
+    int fd = open(CRASH_FILE, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0) return;
+    ssize_t ret = write(fd, current->data(), current->size());
+    (void)ret;
+    close(fd);
+    current = nullptr;
+}
+
+static void OnFatalSignal(int sig)
+{
+    SaveCurrent(); // only open/write/close, safe in a handler
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+static void Run(const string& input)
+{
+    current = &input;
+    LLVMFuzzerTestOneInput(reinterpret_cast<const uint8_t*>(input.data()), input.size());
+    current = nullptr;
+}
+
+static void Collect(const string& path, vector<string>& inputs)
+{
+    struct stat st;
+    if(stat(path.c_str(), &st) < 0) {
+        fprintf(stderr, "skip %s: %s\n", path.c_str(), strerror(errno));
+        return;
+    }
+    if(S_ISDIR(st.st_mode)) {
+        DIR* dir = opendir(path.c_str());
+        if(!dir) return;
+        vector<string> names;
+        while(dirent* entry = readdir(dir)) {
+            if(entry->d_name[0] != '.') names.push_back(path + "/" + entry->d_name);
+        }
+        closedir(dir);
+        for(auto& name : names) Collect(name, inputs);
+        return;
+    }
+    ifstream file(path, ios::binary);
+    stringstream content;
+    content << file.rdbuf();
+    inputs.push_back(content.str());
+}
+
+static void Mutate(string& input, const vector<string>& inputs, mt19937& rng, size_t maxLen)
+{
+    // tokens the parsers split on, a blind byte flip rarely hits them
+    static const char* TOKENS[] = { "\r\n", "\r\n\r\n", ":", " ", "%", "%4", "&", "=", "+", ";", ",", "\t", "\n" };
+    int rounds = 1 + rng() % 4;
+    for(int r = 0; r < rounds; r++) {
+        size_t pos = input.empty() ? 0 : rng() % (input.size() + 1);
+        switch(rng() % 6) {
+        case 0:
+            if(!input.empty() && pos < input.size()) input[pos] ^= 1 << (rng() % 8);
+            break;
+        case 1:
+            input.insert(pos, 1, static_cast<char>(rng()));
+            break;
+        case 2:
+            input.insert(pos, TOKENS[rng() % (sizeof(TOKENS) / sizeof(TOKENS[0]))]);
+            break;
+        case 3:
+            if(pos < input.size()) input.erase(pos, 1 + rng() % min<size_t>(16, input.size() - pos));
+            break;
+        case 4:
+            if(pos < input.size()) input.insert(pos, input.substr(pos, 1 + rng() % min<size_t>(64, input.size() - pos)));
+            break;
+        default: {
+            const string& other = inputs[rng() % inputs.size()];
+            size_t from = other.empty() ? 0 : rng() % other.size();
+            input = input.substr(0, pos) + other.substr(from);
+            break;
+        }
+        }
+    }
+    if(input.size() > maxLen) input.resize(maxLen);
+}
+
+int main(int argc, char* argv[])
+{
+    long runs = 0;
+    unsigned seed = 1;
+    size_t maxLen = 8192;
+    vector<string> inputs;
+    for(int i = 1; i < argc; i++) {
+        if(strncmp(argv[i], "-runs=", 6) == 0) {
+            runs = atol(argv[i] + 6);
+        } else if(strncmp(argv[i], "-seed=", 6) == 0) {
+            seed = strtoul(argv[i] + 6, nullptr, 10);
+        } else if(strncmp(argv[i], "-max_len=", 9) == 0) {
+            maxLen = strtoul(argv[i] + 9, nullptr, 10);
+        } else if(argv[i][0] == '-') {
+            fprintf(stderr, "ignored flag %s\n", argv[i]); // libFuzzer flags make no sense here
+        } else {
+            Collect(argv[i], inputs);
+        }
+    }
+
+    signal(SIGABRT, OnFatalSignal);
+    signal(SIGSEGV, OnFatalSignal);
+    signal(SIGFPE, OnFatalSignal);
+    signal(SIGBUS, OnFatalSignal);
+#ifdef HAS_DEATH_CALLBACK
+    __sanitizer_set_death_callback(SaveCurrent);
+#endif
+
+    for(auto& input : inputs) Run(input);
+    fprintf(stderr, "replayed %zu inputs\n", inputs.size());
+    if(runs == 0) return 0;
+
+    if(inputs.empty()) inputs.push_back("");
+    mt19937 rng(seed);
+    for(long i = 0; i < runs; i++) {
+        string input = inputs[rng() % inputs.size()];
+        Mutate(input, inputs, rng, maxLen);
+        Run(input);
+    }
+    fprintf(stderr, "ran %ld mutations, seed %u\n", runs, seed);
+    return 0;
+}
@@ -0,0 +1,121 @@
+/*
+ * @author: Zimo Li
+ * @date: 2026-10-19
+*/
+
+// Buffer against a plain string model, input is a list of operations
+
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <fcntl.h>
+#include <unistd.h>
+#include "../../src/buffer/buffer.hpp"
+
+enum OP {
+    APPEND,
+    RETRIEVE,
+    RETRIEVE_UNTIL,
+    RETRIEVE_ALL,
+    RETRIEVE_ALL_TO_STR,
+    APPEND_BUFFER,
+    READ_FD,
+    WRITE_FD,
+    SHRINK,
+    OP_COUNT,
+};
+
+static int pipeFd[2] = { -1, -1 };
+
+static void OpenPipe()
+{
+    if(pipeFd[0] >= 0) return;
+    int ret = pipe2(pipeFd, O_NONBLOCK | O_CLOEXEC);
+    assert(ret == 0);
+    (void)ret;
+}
+
+static void Check(const Buffer& buff, const std::string& model)
+{
+    assert(buff.ReadableBytes() == model.size());
+    assert(memcmp(buff.ReadPosition(), model.data(), model.size()) == 0);
+    assert(buff.ReadPosition() + buff.ReadableBytes() == buff.WritePositionConst());
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+    OpenPipe();
+    Buffer buff(size > 0 ? data[0] % 64 + 1 : 1); // small start so growth and compaction both happen
+    std::string model;
+
+    size_t pos = 1;
+    while(pos + 2 <= size) {
+        int op = data[pos] % OP_COUNT;
+        size_t len = data[pos + 1];
+        pos += 2;
+        switch(op) {
+        case APPEND:
+        case APPEND_BUFFER: {
+            len = std::min(len, size - pos);
+            std::string piece(reinterpret_cast<const char*>(data) + pos, len);
+            pos += len;
+            if(op == APPEND) {
+                buff.Append(piece);
+            } else {
+                Buffer other;
+                other.Append(piece);
+                buff.Append(other);
+            }
+            model += piece;
+            break;
+        }
+        case RETRIEVE:
+            len = std::min(len, model.size());
+            buff.Retrieve(len);
+            model.erase(0, len);
+            break;
+        case RETRIEVE_UNTIL:
+            len = std::min(len, model.size());
+            buff.RetrieveUntil(buff.ReadPosition() + len);
+            model.erase(0, len);
+            break;
+        case RETRIEVE_ALL:
+            buff.RetrieveAll();
+            model.clear();
+            break;
+        case RETRIEVE_ALL_TO_STR:
+            assert(buff.RetrieveAllToStr() == model);
+            model.clear();
+            break;
+        case READ_FD: {
+            // pipe holds far more than 255 bytes, so the write never blocks
+            std::string piece(len, static_cast<char>(pos));
+            ssize_t n = write(pipeFd[1], piece.data(), piece.size());
+            assert(n == static_cast<ssize_t>(len));
+            int err = 0;
+            n = len > 0 ? buff.ReadFromFd(pipeFd[0], &err) : 0;
+            assert(n == static_cast<ssize_t>(len));
+            model += piece;
+            break;
+        }
+        case WRITE_FD: {
+            int err = 0;
+            ssize_t n = model.empty() ? 0 : buff.WriteIntoFd(pipeFd[1], &err);
+            assert(n == static_cast<ssize_t>(model.size()));
+            std::string out(model.size(), '\0');
+            ssize_t got = model.empty() ? 0 : read(pipeFd[0], &out[0], out.size());
+            assert(got == n && out == model);
+            model.clear();
+            break;
+        }
+        case SHRINK:
+            buff.Shrink(len); // keeps what is readable
+            assert(buff.Capacity() >= model.size());
+            break;
+        default: break;
+        }
+        Check(buff, model);
+    }
+    return 0;
+}
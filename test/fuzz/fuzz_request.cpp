@@ -0,0 +1,54 @@
+/*
+ * @author: Zimo Li
+ * @date: 2026-10-19
+*/
+
+// HttpRequest::parse on raw bytes, the way HttpConn feeds it a read buffer
+
+#include <cassert>
+#include <cstdint>
+#include "../../src/buffer/buffer.hpp"
+#include "../../src/http/httprequest.hpp"
+
+static void CheckRequest(const HttpRequest& request)
+{
+    assert(request.method().find(' ') == std::string::npos);
+    assert(request.target().find(' ') == std::string::npos);
+    assert(request.version().find(' ') == std::string::npos);
+
+    const HttpHeaders& headers = request.headers();
+    for(size_t i = 0; i < headers.Size(); i++) {
+        std::string_view name = headers.Name(i), value = headers.Value(i);
+        assert(name.find(':') == std::string_view::npos);
+        assert(value.empty() || (value.front() != ' ' && value.front() != '\t' &&
+                                 value.back() != ' ' && value.back() != '\t'));
+        assert(HttpHeaders::Lookup(name) == headers.Id(i));
+        if(headers.Id(i) != HttpHeaders::UNKNOWN) {
+            assert(headers.Get(headers.Id(i)) == value); // a known name has one joined field
+        }
+    }
+    request.IsKeepAlive();
+    request.IsH2cUpgrade();
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+    Buffer buff;
+    buff.Append(reinterpret_cast<const char*>(data), size);
+
+    // pipelined requests are parsed out of the same buffer until it runs dry
+    HttpRequest request;
+    for(int i = 0; i < 64 && buff.ReadableBytes() > 0; i++) {
+        size_t before = buff.ReadableBytes();
+        if(!request.parse(buff)) break;
+        CheckRequest(request);
+        if(!request.IsComplete()) break; // the rest would come with the next read
+
+        HttpRequest copy = request; // post views must point into the copy, not the original
+        std::string user = request.GetPost("username");
+        request.Init();
+        assert(copy.GetPost("username") == user);
+        if(buff.ReadableBytes() >= before) break; // nothing consumed, a conn would wait for more
+    }
+    return 0;
+}
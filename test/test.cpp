@@ -4,9 +4,53 @@
  * @copyleft Apache 2.0
  */ 
 #include "../src/log/log.hpp"
+#include "../src/log/reqtrace.hpp"
+#include "../src/log/accesslog.hpp"
+#include "../src/log/flightrecorder.hpp"
 #include "../src/pool/threadpool.hpp"
+#include "../src/pool/affinity.hpp"
+#include "../src/pool/sqlconnpool.hpp"
+#include "../src/buffer/memstats.hpp"
+#include "../src/http/hpack.hpp"
+#include "../src/http/http2session.hpp"
+#include "../src/http/httpconn.hpp"
+#include "../src/http/imagevariants.hpp"
+#include "../src/http/httpheaders.hpp"
+#include "../src/http/httprequest.hpp"
+#include "../src/http/httpresponse.hpp"
+#include "../src/http/sessionstore.hpp"
+#include "../src/http/urlcodec.hpp"
+#include "../src/http/upstream.hpp"
+#include "../src/http/websocket.hpp"
+#include "../src/server/config.hpp"
+#include "../src/server/epoller.hpp"
+#include "../src/server/listenerhandoff.hpp"
+#include "../src/server/ratelimiter.hpp"
+#include "../src/server/webserver.hpp"
+#include "../src/coro/scheduler.hpp"
+#include <cassert>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <climits>
+#include <cstring>
+#include <tuple>
+#include <sched.h>
 #include <features.h>
+#include <jpeglib.h>
+#include <openssl/pem.h>
+#include <openssl/rand.h>
+#include <openssl/x509.h>
+#include <csignal>
+#include <fcntl.h>
 #include <unistd.h>
+#include <sys/socket.h>
+#include <sys/prctl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
 // #include <sys/types.h>
 
 // #if __GLIBC__ == 2 && __GLIBC_MINOR__ < 30
@@ -52,7 +96,1814 @@ void TestThreadPool() {
     getchar();
 }
 
+void TestAdaptivePool() {
+    ThreadPool pool(1, {}, 3);
+    std::mutex mtx;
+    std::condition_variable cond;
+    bool started = false, release = false;
+    std::atomic<int> done(0);
+    // the only core worker is stuck as if waiting on a db conn, until it is let go below
+    pool.addTask([&]() {
+        std::unique_lock<std::mutex> locker(mtx);
+        started = true;
+        cond.notify_all();
+        cond.wait(locker, [&]() { return release; });
+    });
+    {
+        std::unique_lock<std::mutex> locker(mtx);
+        cond.wait(locker, [&]() { return started; });
+    }
+    // an addTask that finds the oldest task waiting over GROW_DELAY_US starts a spare worker
+    for(int i = 0; i < 8; i++) {
+        pool.addTask([&]() { done++; });
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    for(int i = 0; i < 500 && done < 8; i++) std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    assert(done == 8); // a spare worker took the short tasks, the core one is still held
+
+    ThreadPool::Stats stats = pool.GetStats();
+    assert(stats.spawned >= 1 && stats.workers <= 3 && stats.completed >= 1);
+    assert(stats.maxQueueDelayUs >= 2000 && stats.runTimeUs >= 0);
+    {
+        std::lock_guard<std::mutex> locker(mtx);
+        release = true;
+    }
+    cond.notify_all();
+    bool shut = pool.Shutdown(std::chrono::milliseconds(2000));
+    assert(shut);
+}
+
+void TestCoroutine() {
+    CoScheduler sched;
+    bool started = sched.Start();
+    assert(started);
+    int fds[2];
+    int made = socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds);
+    assert(made == 0);
+    std::atomic<int> step(0);
+    // one coroutine waits for data the other writes after a sleep, both on the same thread
+    sched.Spawn([](CoScheduler* co, int fd, std::atomic<int>* step) -> Task<void> {
+        bool ready = co_await co->WaitFd(fd, EPOLLIN, 10);
+        assert(!ready); // nothing yet, times out
+        ready = co_await co->WaitFd(fd, EPOLLIN, 1000);
+        assert(ready);
+        char ch;
+        ssize_t n = read(fd, &ch, 1);
+        assert(n == 1 && ch == 'x');
+        (*step)++;
+        ready = co_await co->WaitFd(fd, EPOLLIN);
+        assert(!ready); // cancelled by Stop
+        (*step)++;
+    }(&sched, fds[0], &step));
+    sched.Spawn([](CoScheduler* co, int fd) -> Task<void> {
+        bool slept = co_await co->SleepFor(30);
+        assert(slept);
+        ssize_t n = write(fd, "x", 1);
+        assert(n == 1);
+    }(&sched, fds[1]));
+    for(int i = 0; i < 100 && step == 0; i++) std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    assert(step == 1);
+    sched.Stop();
+    assert(step == 2);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+void TestSqlLogin() {
+    // VerifyUserAsync on a pool of one stand-in conn: the second check waits for the conn the first
+    // hands back, and the lookup answers after a while like a query would
+    SqlConnPool& pool = SqlConnPool::Instance();
+    pool.init({mysql_init(nullptr)});
+    SqlConnPool::passwordLookup = [](MYSQL* sql, const std::string& user) -> Task<std::optional<std::string>> {
+        assert(sql);
+        co_await CoScheduler::Current()->SleepFor(20);
+        co_return user == "bob" ? std::optional<std::string>("pw") : std::nullopt;
+    };
+    CoScheduler sched;
+    bool started = sched.Start();
+    assert(started);
+    std::atomic<int> done(0), passed(0);
+    auto check = [](std::string user, std::string password, std::atomic<int>* done,
+                    std::atomic<int>* passed) -> Task<void> {
+        if(co_await SqlConnPool::VerifyUserAsync(user, password)) (*passed)++;
+        (*done)++;
+    };
+    sched.Spawn(check("bob", "pw", &done, &passed));
+    sched.Spawn(check("bob", "wrong", &done, &passed));
+    sched.Spawn(check("eve", "pw", &done, &passed));
+    for(int i = 0; i < 200 && done < 3; i++) std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    assert(done == 3 && passed == 1 && pool.GetAvailConnCount() == 1);
+    sched.Stop();
+    pool.ClosePool();
+    SqlConnPool::passwordLookup = SqlConnPool::PasswordOf;
+}
+
+void TestTaskClasses() {
+    ThreadPool pool(1);
+    std::atomic<bool> release(false);
+    std::vector<int> order;
+    pool.addTask([&]() {
+        while(!release) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20)); // worker holds the blocking task
+    for(int i = 0; i < 8; i++) pool.addTask([&]() { order.push_back(ThreadPool::HEAVY); }, ThreadPool::HEAVY);
+    for(int i = 0; i < 8; i++) pool.addTask([&]() { order.push_back(ThreadPool::LIGHT); }, ThreadPool::LIGHT);
+    pool.addTask([&]() { order.push_back(ThreadPool::URGENT); }, ThreadPool::URGENT);
+    std::atomic<int> expired(0);
+    pool.addTask([&]() { assert(false); }, ThreadPool::LIGHT,
+                 ThreadPool::Clock::now() + std::chrono::milliseconds(10), [&]() { expired++; });
+    std::this_thread::sleep_for(std::chrono::milliseconds(30));
+    release = true;
+    bool shut = pool.Shutdown(std::chrono::milliseconds(2000));
+    assert(shut);
+
+    // urgent first, then light and heavy 4:1 though all heavy ones came earlier
+    assert(order.size() == 17 && order[0] == ThreadPool::URGENT);
+    assert(std::count(order.begin() + 1, order.begin() + 11, ThreadPool::LIGHT) == 8);
+    ThreadPool::Stats stats = pool.GetStats();
+    assert(expired == 1 && stats.expired == 1 && stats.completed == 18);
+}
+
+void TestBlockDeque() {
+    BlockDeque<std::unique_ptr<int>> deque(4);
+    for(int i = 0; i < 4; i++) deque.push_back(std::make_unique<int>(i));
+    auto item = std::make_unique<int>(4);
+    bool pushed = deque.try_push(std::move(item), Overflow::DROP_NEWEST);
+    assert(!pushed && item && deque.dropped() == 1);
+    pushed = deque.try_push(std::move(item), Overflow::DROP_OLDEST);
+    assert(pushed && !item && deque.dropped() == 2);
+    std::vector<std::unique_ptr<int>> items;
+    size_t popped = deque.pop_all(items, 3);
+    assert(popped == 3 && *items.front() == 1 && *items.back() == 3);
+    popped = deque.pop_all(items);
+    assert(popped == 1 && *items.back() == 4);
+
+    // producers block on a small deque while one consumer drains it in batches
+    BlockDeque<int> ints(8);
+    std::atomic<long> sum(0);
+    std::thread consumer([&]() {
+        std::vector<int> batch;
+        while(ints.pop_all(batch) > 0) {
+            for(int value : batch) sum += value;
+            batch.clear();
+        }
+    });
+    std::vector<std::thread> producers;
+    for(int t = 0; t < 4; t++) {
+        producers.emplace_back([&]() {
+            for(int i = 1; i <= 10000; i++) {
+                int value = i;
+                bool pushed = ints.try_push(std::move(value), Overflow::BLOCK);
+                assert(pushed);
+            }
+        });
+    }
+    for(auto& producer : producers) producer.join();
+    for(int i = 0; i < 1000 && sum != 4 * 50005000L; i++) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    assert(sum == 4 * 50005000L && ints.dropped() == 0);
+    ints.close();
+    consumer.join();
+}
+
+void TestRequestTrace() {
+    RequestTrace trace;
+    trace.Reset(7);
+    trace.End(RequestTrace::WRITE); // never begun, ignored
+    trace.Begin(RequestTrace::QUEUE);
+    uint64_t begin = RequestTrace::Now();
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    uint64_t ticks = RequestTrace::Now() - begin;
+    trace.End(RequestTrace::QUEUE);
+    double us = RequestTrace::ToUs(ticks);
+    assert(us > 15000 && us < 200000);
+    trace.Add(RequestTrace::DB, ticks);
+    trace.Finish("GET", "/"); // slow log is off, just resets
+    trace.End(RequestTrace::QUEUE);
+}
+
+void TestAccessLog() {
+    const char* file = "./testaccess.bin";
+    remove(file);
+    bool opened = AccessLog::Instance().Open(file, 2);
+    assert(opened);
+    std::vector<std::thread> threads;
+    for(int t = 0; t < 2; t++) {
+        threads.emplace_back([t] {
+            for(int i = 0; i < 5000; i++) {
+                AccessLog::Instance().Add(htonl(0x7f000001), "GET", "/p" + std::to_string(i % 10),
+                                          i % 100 == 0 ? 503 : 200, 100 + t, i);
+            }
+        });
+    }
+    for(auto& t : threads) t.join();
+    AccessLog::Instance().Close();
+    assert(AccessLog::Instance().Dropped() == 0);
+
+    // every 2nd of the 4950 ok requests of each thread, and all 50 of its 5xx
+    FILE* fp = fopen(file, "rb");
+    assert(fp);
+    AccessBlockHeader header;
+    int requests = 0, errors = 0;
+    while(fread(&header, sizeof(header), 1, fp) == 1) {
+        assert(header.magic == ACCESS_MAGIC && header.version == ACCESS_VERSION);
+        std::vector<char> block(header.bytes);
+        size_t got = fread(block.data(), 1, block.size(), fp);
+        assert(got == block.size());
+        std::vector<uint32_t> paths;
+        uint32_t records = 0;
+        for(size_t pos = 0; pos < block.size(); ) {
+            AccessRecord record;
+            memcpy(&record, block.data() + pos, sizeof(record));
+            pos += sizeof(record);
+            if(record.type == AccessRecord::PATH) {
+                assert(std::string(block.data() + pos, record.bytes).substr(0, 2) == "/p");
+                assert(AccessLog::PathId(std::string(block.data() + pos, record.bytes)) == record.pathId);
+                paths.push_back(record.pathId);
+                pos += (record.bytes + 7) / 8 * 8;
+            } else {
+                assert(record.type == AccessRecord::REQUEST && record.method == AccessRecord::GET);
+                assert(std::find(paths.begin(), paths.end(), record.pathId) != paths.end());
+                assert(record.status == 503 ? record.sample == 1 : record.sample == 2);
+                errors += record.status == 503;
+                records++;
+            }
+        }
+        assert(records == header.records);
+        requests += records;
+    }
+    fclose(fp);
+    remove(file);
+    assert(errors == 2 * 50 && requests == 2 * (2475 + 50));
+}
+
+// records of a flight recorder dump as (tid, format, args)
+std::vector<std::tuple<int, std::string, std::string>> ReadFlightDump(const char* file, int& signo) {
+    std::vector<std::tuple<int, std::string, std::string>> records;
+    FILE* fp = fopen(file, "rb");
+    assert(fp);
+    FlightHeader header;
+    size_t got = fread(&header, sizeof(header), 1, fp);
+    assert(got == 1 && header.magic == FLIGHT_MAGIC && header.version == FLIGHT_VERSION);
+    signo = header.signo;
+    FlightRecord record;
+    while(fread(&record, sizeof(record), 1, fp) == 1) {
+        std::string format(record.formatLen, '\0'), args(record.argBytes, '\0');
+        got = fread(format.data(), 1, format.size(), fp);
+        assert(got == format.size());
+        got = fread(args.data(), 1, args.size(), fp);
+        assert(got == args.size());
+        records.emplace_back(record.tid, format, args);
+    }
+    fclose(fp);
+    return records;
+}
+
+void TestFlightRecorder() {
+    const char* file = "./testflight.bin";
+    assert(!FlightRecorder::IsOn(3));
+    bool enabled = FlightRecorder::Enable(0, file);
+    assert(enabled);
+    assert(FlightRecorder::IsOn(0));
+
+    // args are kept raw: tag, then 8 bytes or a length and the text
+    FlightRecorder::Record(0, "fr %d %s %.1f", -5, "abc", 2.5);
+    std::string longText(200, 'x');
+    FlightRecorder::Record(1, "fr long %s %d", longText.c_str(), 7);
+    int otherTid = 0;
+    std::thread([&otherTid] {
+        otherTid = gettid();
+        for(int i = 0; i < FlightRecorder::SLOTS + 10; i++) FlightRecorder::Record(0, "fr wrap %d", i);
+    }).join();
+    // LOG_ lines go to the recorder only when the log file doesn't take them
+    bool macro = !Log::Instance().IsOpen() || Log::Instance().GetLevel() > 0;
+    LOG_DEBUG("fr macro %u", 9u);
+
+    int signo;
+    bool dumped = FlightRecorder::Dump(file, SIGUSR1);
+    assert(dumped);
+    auto records = ReadFlightDump(file, signo);
+    assert(signo == SIGUSR1);
+    int wraps = 0, last = -1;
+    bool plain = false, cut = false, fromMacro = false;
+    for(auto& [tid, format, args] : records) {
+        if(format == "fr %d %s %.1f") {
+            assert(tid == gettid() && args.size() == 9 + 5 + 9);
+            int64_t i;
+            memcpy(&i, args.data() + 1, 8);
+            double d;
+            memcpy(&d, args.data() + 15, 8);
+            assert(args[0] == ARG_INT && i == -5 && args[9] == ARG_STR && args.substr(10, 4) == "\3abc");
+            assert(args[14] == ARG_DOUBLE && d == 2.5);
+            plain = true;
+        } else if(format == "fr long %s %d") {
+            // the string is cut to the arg space, the int after it doesn't fit anymore
+            assert(args.size() == FlightRecorder::ARG_BYTES && args[0] == ARG_STR);
+            assert((uint8_t)args[1] == FlightRecorder::ARG_BYTES - 2);
+            cut = true;
+        } else if(format == "fr macro %u") {
+            assert(args[0] == ARG_UINT && args[1] == 9);
+            fromMacro = true;
+        } else if(format == "fr wrap %d") {
+            // the ring of the exited thread still holds its newest records
+            assert(tid == otherTid);
+            int64_t i;
+            memcpy(&i, args.data() + 1, 8);
+            last = std::max<int>(last, i);
+            wraps++;
+        }
+    }
+    assert(plain && cut && fromMacro == macro && wraps == FlightRecorder::SLOTS && last == FlightRecorder::SLOTS + 9);
+
+    // a failed assert ends in SIGABRT, the handler dumps and the process still dies of it
+    remove(file);
+    pid_t pid = fork();
+    if(pid == 0) {
+        FlightRecorder::Record(2, "fr before abort %d", 42);
+        abort();
+    }
+    int status;
+    pid_t waited = waitpid(pid, &status, 0);
+    assert(waited == pid && WIFSIGNALED(status) && WTERMSIG(status) == SIGABRT);
+    records = ReadFlightDump(file, signo);
+    assert(signo == SIGABRT);
+    assert(std::any_of(records.begin(), records.end(),
+                       [](auto& r) { return std::get<1>(r) == "fr before abort %d"; }));
+    remove(file);
+
+    FlightRecorder::Disable();
+    assert(!FlightRecorder::IsOn(3));
+}
+
+void TestMemStats() {
+    int64_t base = MemStats::Get(MemStats::BUFFERS);
+    {
+        Buffer buff(1024);
+        assert(MemStats::Get(MemStats::BUFFERS) == base + (int64_t)buff.Capacity());
+        std::string big(100 * 1024, 'b');
+        buff.Append(big);
+        assert(buff.Capacity() > big.size() && MemStats::Get(MemStats::BUFFERS) == base + (int64_t)buff.Capacity());
+        bool shrunk = buff.Shrink(0);
+        assert(!shrunk); // all of it still to be read
+        buff.Retrieve(big.size() - 10);
+        shrunk = buff.Shrink(buff.Capacity());
+        assert(!shrunk); // not over the limit
+        shrunk = buff.Shrink(64 * 1024);
+        assert(shrunk && buff.Capacity() == 1024);
+        std::string rest = buff.RetrieveAllToStr();
+        assert(rest == std::string(10, 'b'));
+        assert(MemStats::Get(MemStats::BUFFERS) == base + 1024);
+        buff.Append("abc", 3);
+        buff.RetrieveAll();
+        assert(buff.ReadableBytes() == 0 && buff.WritableBytes() == 1024);
+    }
+    assert(MemStats::Get(MemStats::BUFFERS) == base);
+    assert(MemStats::Total() >= base && std::string(MemStats::Name(MemStats::IMAGE_CACHE)) == "image cache");
+    assert(!MemStats::UnderPressure());
+    MemStats::SetPressure(true);
+    assert(MemStats::UnderPressure());
+    MemStats::SetPressure(false);
+}
+
+void TestAssetBundle() {
+    const char* file = "./testbundle.bin";
+    std::vector<AssetBundle::Input> inputs;
+    for(int i = 0; i < 300; i++) {
+        AssetBundle::Input in;
+        in.path = "/dir" + std::to_string(i % 7) + "/file" + std::to_string(i) + ".html";
+        in.type = "text/html";
+        in.data = std::string(i, 'a' + i % 26);
+        if(i % 3 == 0) in.gzip = "gz" + std::to_string(i);
+        inputs.push_back(in);
+    }
+    inputs.push_back(inputs[5]);
+    bool written = AssetBundle::Write(file, inputs);
+    assert(!written); // duplicate path
+    inputs.pop_back();
+    written = AssetBundle::Write(file, inputs);
+    assert(written);
+
+    AssetBundle bundle;
+    bool opened = bundle.Open(file, true, false);
+    assert(opened && bundle.Count() == inputs.size());
+    AssetBundle::Asset asset;
+    for(auto& in : inputs) {
+        bool found = bundle.Find(in.path, asset);
+        assert(found);
+        assert(asset.path == in.path && asset.type == in.type);
+        assert(std::string(asset.data, asset.dataLen) == in.data);
+        assert(in.gzip.empty() ? asset.gzip == nullptr : std::string(asset.gzip, asset.gzipLen) == in.gzip);
+        assert(asset.etag.size() == 18 && asset.etag.front() == '"' && asset.etag != asset.gzipEtag);
+    }
+    assert(!bundle.Find("/dir0/file1.html", asset) && !bundle.Find("/", asset) && !bundle.Find("", asset));
+    bundle.Close();
+    assert(!bundle.IsOpen());
+
+    written = AssetBundle::Write(file, {});
+    opened = bundle.Open(file);
+    assert(written && opened && bundle.Count() == 0 && !bundle.Find("/index.html", asset));
+    bundle.Close();
+    remove(file);
+
+    assert(HttpResponse::AcceptsGzip("gzip, deflate, br") && HttpResponse::AcceptsGzip("br;q=1, gzip;q=0.5"));
+    assert(HttpResponse::AcceptsGzip("*") && !HttpResponse::AcceptsGzip("gzip;q=0, br"));
+    assert(!HttpResponse::AcceptsGzip("deflate") && !HttpResponse::AcceptsGzip("gzip;q=0.000"));
+}
+
+void TestSessionStore() {
+    const char* file = "./testsessions.txt";
+    SessionStore store(60);
+    std::vector<std::string> ids;
+    for(int i = 0; i < 200; i++) {
+        std::string id = store.Create(i % 2 ? "user " + std::to_string(i) : "u" + std::to_string(i));
+        assert(id.size() == 32);
+        ids.push_back(id);
+    }
+    assert(store.Size() == 200 && store.Changes() == 200);
+    std::string user;
+    bool found = store.Find(ids[7], user);
+    assert(found && user == "user 7");
+    assert(!store.Find("0123456789abcdef0123456789abcdef", user));
+    assert(!store.Find("not an id", user));
+    store.Erase(ids[0]);
+    found = store.Find(ids[0], user);
+    assert(!found && store.Changes() == 201);
+
+    assert(SessionStore::FromCookie("a=1; sid=" + ids[3] + "; b=2") == ids[3]);
+    assert(SessionStore::FromCookie("sid=" + ids[3]) == ids[3]);
+    assert(SessionStore::FromCookie("xsid=1; sidx=2").empty());
+
+    // a stale tmp readable by others doesn't leak ids either
+    FILE* stale = fopen((std::string(file) + ".tmp").c_str(), "w");
+    fclose(stale);
+    chmod((std::string(file) + ".tmp").c_str(), 0644);
+    bool saved = store.Save(file);
+    struct stat st;
+    int statted = stat(file, &st);
+    assert(saved && statted == 0 && (st.st_mode & 0777) == 0600);
+    SessionStore restored(60);
+    size_t loaded = restored.Load(file);
+    assert(loaded == 199);
+    found = restored.Find(ids[9], user);
+    assert(found && user == "user 9");
+    found = restored.Find(ids[10], user);
+    assert(found && user == "u10");
+
+    // expired sessions are skipped on load, lazily dropped on lookup and by Sweep
+    FILE* fp = fopen(file, "w");
+    fprintf(fp, "%s old 1\n%s new %lld\n", ids[1].c_str(), ids[2].c_str(), (long long)time(nullptr) + 60);
+    fclose(fp);
+    SessionStore reloaded(60);
+    loaded = reloaded.Load(file);
+    found = reloaded.Find(ids[1], user);
+    assert(loaded == 1 && !found);
+    SessionStore shortLived(1);
+    shortLived.Create("a");
+    std::string id = shortLived.Create("b");
+    sleep(2);
+    found = shortLived.Find(id, user); // dropped on the way
+    assert(!found && shortLived.Size() == 1);
+    size_t swept = shortLived.Sweep();
+    assert(swept == 1 && shortLived.Size() == 0);
+    remove(file);
+}
+
+std::string MakeJpeg(int width, int height) {
+    // gradient, smooth enough for the encoder to shrink it a lot
+    jpeg_compress_struct cinfo;
+    jpeg_error_mgr err;
+    cinfo.err = jpeg_std_error(&err);
+    jpeg_create_compress(&cinfo);
+    unsigned char* buf = nullptr;
+    unsigned long len = 0;
+    jpeg_mem_dest(&cinfo, &buf, &len);
+    cinfo.image_width = width;
+    cinfo.image_height = height;
+    cinfo.input_components = 3;
+    cinfo.in_color_space = JCS_RGB;
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, 95, TRUE);
+    jpeg_start_compress(&cinfo, TRUE);
+    std::vector<unsigned char> row(width * 3);
+    while(cinfo.next_scanline < cinfo.image_height) {
+        for(int x = 0; x < width; x++) {
+            row[x * 3] = x * 255 / width;
+            row[x * 3 + 1] = cinfo.next_scanline * 255 / height;
+            row[x * 3 + 2] = (x + cinfo.next_scanline) % 256;
+        }
+        JSAMPROW ptr = row.data();
+        jpeg_write_scanlines(&cinfo, &ptr, 1);
+    }
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+    std::string res(reinterpret_cast<char*>(buf), len);
+    free(buf);
+    return res;
+}
+
+void TestImageVariants() {
+    std::string jpeg = MakeJpeg(1000, 600), out;
+    int w = 0, h = 0;
+    assert(ImageVariants::Dimensions(jpeg, w, h) && w == 1000 && h == 600);
+    bool resized = ImageVariants::Resize(jpeg, 320, 60, out);
+    assert(resized);
+    assert(ImageVariants::Dimensions(out, w, h) && w == 320 && h == 192 && out.size() < jpeg.size() / 4);
+    resized = ImageVariants::Resize(jpeg, 4000, 75, out);
+    assert(resized); // never scaled up
+    assert(ImageVariants::Dimensions(out, w, h) && w == 1000 && h == 600);
+    resized = ImageVariants::Resize("not a jpeg", 320, 60, out);
+    assert(!resized);
+    resized = ImageVariants::Resize(jpeg.substr(0, 100), 320, 60, out);
+    assert(!resized);
+
+    system("rm -rf ./testimages ./testvariants && mkdir -p ./testimages/images");
+    FILE* fp = fopen("./testimages/images/a.jpg", "wb");
+    fwrite(jpeg.data(), 1, jpeg.size(), fp);
+    fclose(fp);
+    ImageVariants::Spec spec;
+    {
+        ImageVariants images("./testimages", "/images/", "./testvariants", 1 << 20, 1 << 20, 2);
+        std::string path = "/images/a.jpg?w=300&q=64";
+        bool parsed = images.Parse(path, spec);
+        assert(parsed && path == "/images/a.jpg");
+        assert(spec.path == path && spec.width == 320 && spec.quality == 60);
+        path = "/images/a.jpg?v=3";
+        parsed = images.Parse(path, spec);
+        assert(!parsed && path == "/images/a.jpg"); // served as it is
+        path = "/images/a.png?w=100";
+        parsed = images.Parse(path, spec);
+        assert(!parsed && path == "/images/a.png");
+        path = "/other/a.jpg?w=100";
+        parsed = images.Parse(path, spec);
+        assert(!parsed && path == "/other/a.jpg?w=100");
+        path = "/images/a.jpg?w=5000";
+        parsed = images.Parse(path, spec);
+        assert(parsed && spec.width == ImageVariants::WIDTHS[ImageVariants::WIDTH_STEPS - 1]);
+        path = "/images/a.jpg?w=480";
+        parsed = images.Parse(path, spec);
+        assert(parsed && spec.width == 480 && spec.quality == ImageVariants::DEFAULT_QUALITY);
+
+        // a herd asking for the same new variant gets one encode
+        CoScheduler sched;
+        bool started = sched.Start();
+        assert(started);
+        const int herd = 20;
+        std::atomic<int> done(0);
+        std::vector<ImageVariants::Image> results(herd + 1);
+        for(int i = 0; i < herd; i++) {
+            sched.Spawn([](ImageVariants* images, ImageVariants::Spec spec, ImageVariants::Image* res,
+                           std::atomic<int>* done) -> Task<void> {
+                *res = co_await images->Get(spec);
+                (*done)++;
+            }(&images, spec, &results[i], &done));
+        }
+        ImageVariants::Spec missing = {"/images/none.jpg", 320, 60};
+        sched.Spawn([](ImageVariants* images, ImageVariants::Spec spec, ImageVariants::Image* res,
+                       std::atomic<int>* done) -> Task<void> {
+            *res = co_await images->Get(spec);
+            (*done)++;
+        }(&images, missing, &results[herd], &done));
+        for(int i = 0; i < 500 && done < herd + 1; i++) std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        assert(done == herd + 1 && !results[herd]);
+        for(int i = 0; i < herd; i++) assert(results[i] && results[i] == results[0]);
+        assert(ImageVariants::Dimensions(*results[0], w, h) && w == 480 && h == 288);
+        ImageVariants::Stats stats = images.GetStats();
+        assert(stats.encodes == 1 && stats.coalesced + stats.memHits == herd - 1 && stats.failed == 1);
+        assert(images.MemBytes() == results[0]->size() && images.DiskBytes() == results[0]->size());
+        // memory pressure empties the memory cache, the disk keeps the variant
+        int64_t counted = MemStats::Get(MemStats::IMAGE_CACHE);
+        assert(counted >= (int64_t)images.MemBytes());
+        size_t trimmed = images.Trim(0);
+        assert(trimmed == results[0]->size() && images.MemBytes() == 0);
+        assert(MemStats::Get(MemStats::IMAGE_CACHE) == counted - (int64_t)results[0]->size());
+        sched.Stop();
+    }
+    // a restart finds the variant on disk
+    ImageVariants images("./testimages", "/images/", "./testvariants", 1 << 20, 1 << 20, 1);
+    assert(images.DiskBytes() > 0);
+    CoScheduler sched;
+    bool started = sched.Start();
+    assert(started);
+    std::atomic<int> done(0);
+    ImageVariants::Image res;
+    sched.Spawn([](ImageVariants* images, ImageVariants::Spec spec, ImageVariants::Image* res,
+                   std::atomic<int>* done) -> Task<void> {
+        *res = co_await images->Get(spec);
+        (*done)++;
+    }(&images, spec, &res, &done));
+    for(int i = 0; i < 500 && done == 0; i++) std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    assert(done == 1 && res);
+    assert(images.GetStats().diskHits == 1 && images.GetStats().encodes == 0);
+    sched.Stop();
+    system("rm -rf ./testimages ./testvariants");
+}
+
+void TestAltSvc() {
+    system("mkdir -p ./testaltsvc && echo hi > ./testaltsvc/a.html");
+    std::string path = "/a.html";
+    HttpResponse response;
+    Buffer buffer;
+    HttpResponse::altSvc = "h3=\":8443\"; ma=600";
+    response.init("./testaltsvc", path, true, 200);
+    response.MakeResponse(buffer);
+    std::string header = buffer.RetrieveAllToStr();
+    assert(header.find("\r\nAlt-Svc: h3=\":8443\"; ma=600\r\n") != std::string::npos);
+    HttpResponse::altSvc.clear();
+    response.init("./testaltsvc", path, true, 200);
+    response.MakeResponse(buffer);
+    header = buffer.RetrieveAllToStr();
+    assert(header.find("Alt-Svc") == std::string::npos);
+    response.UnmapFIle();
+    system("rm -rf ./testaltsvc");
+}
+
+void TestConfig() {
+    Config base;
+    base.threads = 4;
+    Config config;
+    std::string error;
+    bool parsed = Config::Parse("# tuned\n\nlog_level = 2\nthreads=6 # more\n"
+                                "pages = /a /b\r\nurgent_paths =\n", base, config, error);
+    assert(parsed);
+    assert(config.logLevel == 2 && config.threads == 6 && config.timeoutMS == base.timeoutMS);
+    assert(config.pages.size() == 2 && config.pages.count("/b") == 1 && config.urgentPaths.empty());
+    parsed = Config::Parse("threads = 6\nthread = 2\n", base, config, error);
+    assert(!parsed && error.find("line 2") == 0);
+    assert(config.threads == 6); // untouched by the failed parse
+    for(const char* text : {"log_level = 9\n", "timeout_ms = 10s\n", "pages = index\n", "threads\n"}) {
+        parsed = Config::Parse(text, base, config, error);
+        assert(!parsed);
+    }
+    parsed = Config::Load("./no/such/config", base, config, error);
+    assert(!parsed);
+
+    // readers see a published snapshot, requests are routed by its pages
+    config.pages = {"/hello"};
+    Config::Publish(std::unique_ptr<const Config>(new Config(config)));
+    assert(Config::Current().pages.count("/hello") == 1 && Config::Current().logLevel == 2);
+    HttpRequest request;
+    Buffer buff;
+    buff.Append("GET /hello HTTP/1.1\r\n\r\n");
+    parsed = request.parse(buff);
+    assert(parsed && request.path() == "/hello.html");
+    request.Init();
+    buff.Append("GET /index HTTP/1.1\r\n\r\n");
+    parsed = request.parse(buff);
+    assert(parsed && request.path() == "/index");
+    Config::Publish(std::unique_ptr<const Config>(new Config()));
+    request.Init();
+    buff.Append("GET /index HTTP/1.1\r\n\r\n");
+    parsed = request.parse(buff);
+    assert(parsed && request.path() == "/index.html");
+
+    // pool grows at once within its limit, shrinking leaves tasks running
+    ThreadPool pool(1, {}, 4);
+    pool.Resize(3, 4);
+    assert(pool.GetStats().workers == 3);
+    pool.Resize(8);
+    assert(pool.GetStats().workers == 4); // capped by the limit it was made with
+    pool.Resize(1);
+    std::atomic<int> done(0);
+    for(int i = 0; i < 100; i++) pool.addTask([&]() { done++; }, i % 4);
+    bool shut = pool.Shutdown(std::chrono::milliseconds(2000));
+    assert(shut && done == 100);
+}
+
+void TestHpack() {
+    // RFC 7541 C.4, requests with huffman coding sharing one dynamic table
+    const uint8_t req1[] = {0x82, 0x86, 0x84, 0x41, 0x8c, 0xf1, 0xe3, 0xc2, 0xe5, 0xf2, 0x3a,
+                            0x6b, 0xa0, 0xab, 0x90, 0xf4, 0xff};
+    const uint8_t req2[] = {0x82, 0x86, 0x84, 0xbe, 0x58, 0x86, 0xa8, 0xeb, 0x10, 0x64, 0x9c, 0xbf};
+    HpackDecoder decoder;
+    std::vector<HpackTable::Field> headers;
+    bool decoded = decoder.Decode(req1, sizeof(req1), headers);
+    assert(decoded && headers.size() == 4 && headers[3].second == "www.example.com");
+    headers.clear();
+    decoded = decoder.Decode(req2, sizeof(req2), headers);
+    assert(decoded && headers.size() == 5 && headers[3].second == "www.example.com" && headers[4].second == "no-cache");
+
+    HpackEncoder encoder;
+    HpackDecoder peer;
+    for(int i = 0; i < 3; i++) {
+        std::string block;
+        encoder.Encode({{":status", "200"}, {"content-type", "text/css"}, {"content-length", "1234"}}, block);
+        headers.clear();
+        decoded = peer.Decode(reinterpret_cast<const uint8_t*>(block.data()), block.size(), headers);
+        assert(decoded && headers.size() == 3 && headers[1].second == "text/css" && headers[2].second == "1234");
+    }
+}
+
+void TestHandoff() {
+    // listening socket passed over a unix socket is the same socket on the other side
+    int listenFd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int bound = bind(listenFd, (sockaddr*)&addr, sizeof(addr));
+    int listening = listen(listenFd, 8);
+    assert(bound == 0 && listening == 0);
+
+    int pair[2];
+    bool made = ListenerHandoff::Pair(pair[0], pair[1]);
+    assert(made && (fcntl(pair[1], F_GETFD) & FD_CLOEXEC));
+    bool sent = ListenerHandoff::Send(pair[0], {listenFd});
+    assert(sent);
+    std::vector<int> fds;
+    bool received = ListenerHandoff::Receive(pair[1], fds, 1000);
+    assert(received && fds.size() == 1 && fds[0] != listenFd);
+    bool ready = ListenerHandoff::Ready(pair[1]) && ListenerHandoff::WaitReady(pair[0], 1000);
+    assert(ready);
+
+    sockaddr_in a1, a2;
+    socklen_t len1 = sizeof(a1), len2 = sizeof(a2);
+    getsockname(listenFd, (sockaddr*)&a1, &len1);
+    getsockname(fds[0], (sockaddr*)&a2, &len2);
+    assert(a1.sin_port == a2.sin_port);
+    close(fds[0]);
+    close(listenFd);
+
+    // the env names an fd, taken only when it's a unix socket the parent made
+    int pipeFds[2];
+    int piped = pipe(pipeFds);
+    assert(piped == 0);
+    std::string pipeFd = std::to_string(pipeFds[0]), ownFd = std::to_string(pair[1]);
+    assert(ListenerHandoff::Adopt(nullptr) < 0 && ListenerHandoff::Adopt("") < 0);
+    assert(ListenerHandoff::Adopt("7x") < 0 && ListenerHandoff::Adopt("1") < 0);
+    assert(ListenerHandoff::Adopt(pipeFd.c_str()) < 0);
+    assert(ListenerHandoff::Adopt(ownFd.c_str()) < 0); // made by this process, not by its parent
+    pid_t pid = fork();
+    if(pid == 0) _exit(ListenerHandoff::Adopt(ownFd.c_str()) == pair[1] ? 0 : 1);
+    int status = 0;
+    pid_t waited = waitpid(pid, &status, 0);
+    assert(waited == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    close(pipeFds[0]);
+    close(pipeFds[1]);
+    close(pair[0]);
+    close(pair[1]);
+}
+
+void TestLowLatency() {
+    // SetLowLatency sets TCP_NODELAY on the listener only, accepted sockets must inherit it
+    int listenFd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int on = 1;
+    int set = setsockopt(listenFd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    int bound = bind(listenFd, (sockaddr*)&addr, sizeof(addr));
+    int listening = listen(listenFd, 8);
+    assert(set == 0 && bound == 0 && listening == 0);
+    socklen_t len = sizeof(addr);
+    getsockname(listenFd, (sockaddr*)&addr, &len);
+    int client = socket(AF_INET, SOCK_STREAM, 0);
+    int connected = connect(client, (sockaddr*)&addr, sizeof(addr));
+    assert(connected == 0);
+    int fd = accept(listenFd, nullptr, nullptr);
+    int val = 0;
+    len = sizeof(val);
+    int got = getsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &val, &len);
+    assert(fd >= 0 && got == 0 && val != 0);
+
+    // busy polling Wait still sleeps for its timeout and still sees events
+    Epoller epoller;
+    epoller.SetBusyPoll(100);
+    bool added = epoller.AddFd(fd, EPOLLIN);
+    assert(added);
+    auto start = std::chrono::steady_clock::now();
+    int events = epoller.Wait(20);
+    assert(events == 0 && std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(20));
+    ssize_t sent = send(client, "x", 1, 0);
+    events = epoller.Wait(1000);
+    assert(sent == 1 && events == 1 && epoller.GetEventFd(0) == fd);
+    epoller.SetBusyPoll(0);
+    close(fd);
+    close(client);
+    close(listenFd);
+}
+
+// serve request from a conn whose socket fills after 4KB, return all it wrote
+std::string StreamResponse(const std::string& request) {
+    int fds[2];
+    int made = socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds);
+    assert(made == 0);
+    int sndBuf = 4096;
+    int set = setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &sndBuf, sizeof(sndBuf));
+    assert(set == 0);
+    ssize_t sent = send(fds[1], request.data(), request.size(), 0);
+    assert(sent == (ssize_t)request.size());
+    sockaddr_in addr = {0};
+    HttpConn conn;
+    conn.init(fds[0], addr);
+    int err = 0;
+    ssize_t bytes = conn.read(&err);
+    bool ready = conn.process();
+    assert(bytes > 0 && ready);
+
+    // like OnWrite: a full socket leaves bytes to write, they go once the peer has read
+    std::string got;
+    char buf[64 * 1024];
+    ssize_t n;
+    bool blocked = false;
+    while(true) {
+        ssize_t ret = conn.write(&err);
+        if(conn.ToWriteBytes() == 0) break;
+        assert(ret >= 0 || err == EAGAIN);
+        blocked |= ret < 0;
+        while((n = recv(fds[1], buf, sizeof(buf), 0)) > 0) got.append(buf, n);
+    }
+    while((n = recv(fds[1], buf, sizeof(buf), 0)) > 0) got.append(buf, n);
+    assert(blocked && !conn.IsKeepAlive());
+    conn.close();
+    close(fds[1]);
+    return got;
+}
+
+void TestChunkedStream() {
+    // empty pieces in between must neither end the body early nor show up as a 0 chunk
+    HttpConn::srcDir = ".";
+    HttpConn::streamRoutes["/stream"] = [](const HttpRequest&) {
+        auto calls = std::make_shared<int>(0);
+        return [calls](Buffer& buffer, size_t maxLen) {
+            int i = (*calls)++;
+            if(i % 3 == 1) return true; // nothing this time
+            buffer.Append(std::string(std::min<size_t>(maxLen, 1000 + i * 700), 'a' + i % 26));
+            return i < 60;
+        };
+    };
+    std::string expected;
+    size_t chunkSize = HttpResponse::CHUNK_SIZE;
+    for(int i = 0; i <= 60; i++) {
+        if(i % 3 != 1) expected.append(std::min<size_t>(chunkSize, 1000 + i * 700), 'a' + i % 26);
+    }
+
+    std::string got = StreamResponse("GET /stream HTTP/1.1\r\nHost: test\r\nConnection: close\r\n\r\n");
+    size_t pos = got.find("\r\n\r\n");
+    assert(got.compare(0, 12, "HTTP/1.1 200") == 0 && pos != std::string::npos);
+    assert(got.find("Transfer-Encoding: chunked") < pos);
+    pos += 4;
+    std::string body;
+    while(true) {
+        size_t eol = got.find("\r\n", pos);
+        assert(eol != std::string::npos);
+        size_t len = std::stoul(got.substr(pos, eol - pos), nullptr, 16);
+        pos = eol + 2;
+        if(len == 0) break;
+        assert(len <= chunkSize && got.compare(pos + len, 2, "\r\n") == 0);
+        body.append(got, pos, len);
+        pos += len + 2;
+    }
+    assert(got.compare(pos, std::string::npos, "\r\n") == 0); // last chunk is the end of the response
+    assert(body == expected);
+
+    // HTTP/1.0 has no chunked coding, the body goes as it is and the close ends it
+    got = StreamResponse("GET /stream HTTP/1.0\r\nHost: test\r\nConnection: keep-alive\r\n\r\n");
+    pos = got.find("\r\n\r\n");
+    assert(pos != std::string::npos && got.find("Transfer-Encoding") == std::string::npos);
+    assert(got.find("Connection: close") < pos && got.compare(pos + 4, std::string::npos, expected) == 0);
+    HttpConn::streamRoutes.erase("/stream");
+}
+
+void TestRateLimiter() {
+    RateLimiter limiter(1024);
+    uint32_t ip = inet_addr("10.0.0.1");
+    bool allow = limiter.Allow(ip);
+    assert(allow); // disabled by default
+    limiter.SetRate(1, 3);
+    int allowed = 0;
+    for(int i = 0; i < 10; i++) allowed += limiter.Allow(ip);
+    assert(allowed == 3); // burst, refill is 1 per second
+    allow = limiter.Allow(inet_addr("10.0.0.2"));
+    assert(allow);
+
+    bool counted;
+    bool acquired = limiter.AcquireConn(ip, 2, counted);
+    assert(acquired && counted);
+    acquired = limiter.AcquireConn(ip, 2, counted);
+    assert(acquired);
+    acquired = limiter.AcquireConn(ip, 2, counted);
+    assert(!acquired);
+    limiter.ReleaseConn(ip);
+    acquired = limiter.AcquireConn(ip, 2, counted);
+    assert(acquired && counted);
+    acquired = limiter.AcquireConn(ip, 0, counted);
+    assert(acquired && !counted); // no limit, nothing to release
+
+    // a full table lets clients in uncounted, only the counted ones are released
+    RateLimiter small(16);
+    std::vector<uint32_t> countedIps;
+    int uncounted = 0;
+    for(uint32_t i = 1; i <= 100; i++) {
+        uint32_t client = htonl(0x0a010000 + i);
+        acquired = small.AcquireConn(client, 1, counted);
+        assert(acquired);
+        if(counted) countedIps.push_back(client);
+        else uncounted++;
+    }
+    assert(countedIps.size() <= 16 && uncounted > 0);
+    for(uint32_t client : countedIps) {
+        acquired = small.AcquireConn(client, 1, counted);
+        assert(!acquired);
+        small.ReleaseConn(client);
+        acquired = small.AcquireConn(client, 1, counted);
+        assert(acquired && counted);
+    }
+
+    // clients fighting over few slots: a slot is never taken over while it counts a conn,
+    // so afterwards no count is left behind
+    RateLimiter contended(16);
+    std::vector<std::thread> threads;
+    for(int t = 0; t < 4; t++) {
+        threads.emplace_back([&contended, t] {
+            for(int i = 0; i < 20000; i++) {
+                uint32_t client = htonl(0x0a020000 + (i * 7 + t) % 64 + 1);
+                bool mine;
+                contended.AcquireConn(client, 1000, mine);
+                if(mine) contended.ReleaseConn(client);
+            }
+        });
+    }
+    for(auto& thread : threads) thread.join();
+    for(uint32_t i = 1; i <= 64; i++) {
+        acquired = contended.AcquireConn(htonl(0x0a020000 + i), 1, counted);
+        assert(acquired);
+    }
+}
+
+void TestAffinity() {
+    std::vector<int> cpus = CpuAffinity::Parse("0-2,5,x,7-6,9");
+    assert((cpus == std::vector<int>{0, 1, 2, 5, 9}));
+
+    // a task hinted with the pinned cpu runs on that cpu
+    ThreadPool pool(2, {0});
+    std::atomic<int> ranOn(-2);
+    pool.addTask([&ranOn]() { ranOn = sched_getcpu(); }, 0);
+    bool shut = pool.Shutdown(std::chrono::milliseconds(1000));
+    assert(shut && ranOn == 0);
+}
+
+void TestUpstream() {
+    int listenFd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    socklen_t len = sizeof(addr);
+    int bound = bind(listenFd, (sockaddr*)&addr, len);
+    int listening = listen(listenFd, 8);
+    assert(bound == 0 && listening == 0);
+    getsockname(listenFd, (sockaddr*)&addr, &len);
+
+    Upstream upstream(Upstream::LEAST_CONN);
+    bool added = upstream.AddBackend("not an ip", 80);
+    assert(!added);
+    added = upstream.AddBackend("127.0.0.1", ntohs(addr.sin_port));
+    assert(added);
+    size_t backend;
+    bool reused;
+    int fd = upstream.Acquire(backend, reused);
+    assert(fd >= 0 && !reused);
+    int peer = accept(listenFd, nullptr, nullptr);
+
+    // kept conn is handed out again while backend keeps it open
+    upstream.Release(backend, fd, true);
+    int again = upstream.Acquire(backend, reused);
+    assert(again == fd && reused);
+    upstream.Release(backend, fd, true);
+    close(peer);
+    usleep(10000);
+    fd = upstream.Acquire(backend, reused);
+    assert(fd >= 0 && !reused);
+    upstream.Release(backend, fd, false);
+    close(listenFd);
+}
+
+void TestWebSocket() {
+    // examples of RFC 6455
+    assert(WebSocket::AcceptKey("dGhlIHNhbXBsZSBub25jZQ==") == "s3pPLMBiTxaQ9kYGzzhZRbK+xOo=");
+    assert(*WebSocket::MakeFrame(WebSocket::TEXT, "Hello", 5) == std::string("\x81\x05Hello"));
+    assert(WebSocket::MakeFrame(WebSocket::BINARY, std::string(256, 'x').data(), 256)->substr(0, 4) ==
+           std::string("\x82\x7e\x01\x00", 4));
+
+    std::string received;
+    WebSocket::Handler handler;
+    handler.onMessage = [&received](const std::shared_ptr<WebSocket>&, WebSocket::OPCODE, const std::string& msg) {
+        received += msg;
+    };
+    auto ws = std::make_shared<WebSocket>(100, handler);
+    Buffer in;
+    const char masked[] = "\x81\x85\x37\xfa\x21\x3d\x7f\x9f\x4d\x51\x58";
+    in.Append(masked, 5); // frame split across reads
+    ws->OnRead(in);
+    assert(received.empty() && in.ReadableBytes() == 5);
+    in.Append(masked + 5, 6);
+    ws->OnRead(in);
+    assert(received == "Hello" && in.ReadableBytes() == 0);
+
+    assert(!ws->HasPending());
+    bool pinged = ws->Ping();
+    assert(pinged && ws->HasPending());
+    pinged = ws->Ping();
+    assert(!pinged); // one is pending already
+    in.Append("\x88\x80\x00\x00\x00\x00", 6); // close without payload
+    ws->OnRead(in);
+    ws->Close();
+    bool sent = ws->Send(WebSocket::TEXT, "late");
+    assert(ws->IsFinished() && !sent);
+}
+
+void TestUrlCodec() {
+    std::string out;
+    UrlCodec::Decode("a%41%2fb+c%zz%4", out);
+    assert(out == "aA/b c%zz%4");
+
+    // vector paths against the scalar one, every offset and tail length of a block
+    std::string text(UrlCodec::BLOCK, 'x');
+    assert(UrlCodec::SpecialMask(text.data(), text.size()) == 0);
+    for(size_t i = 0; i < text.size(); i++) {
+        std::string probe = text;
+        probe[i] = "&=%+"[i % 4];
+        probe[(i * 7) % text.size()] = "+%=&"[i % 4];
+        for(size_t len : {i + 1, text.size()}) {
+            assert(UrlCodec::SpecialMask(probe.data(), len) == UrlCodec::SpecialMaskScalar(probe.data(), len));
+        }
+    }
+    out.clear();
+    UrlCodec::Decode(std::string(70, 'y') + "%41+" + std::string(60, 'z'), out); // escapes across blocks
+    assert(out == std::string(70, 'y') + "A " + std::string(60, 'z'));
+
+    HttpRequest request;
+    Buffer buff;
+    std::string form = "username=%E5%BC%A0+san&password=p%3Da%26ss&empty=&flag&long=" + std::string(100, 'v');
+    buff.Append("POST /login HTTP/1.1\r\nContent-Type: application/x-www-form-urlencoded\r\nContent-Length: " +
+                std::to_string(form.size()) + "\r\n\r\n" + form);
+    bool parsed = request.parse(buff);
+    assert(parsed);
+    assert(request.GetPost("username") == "\xE5\xBC\xA0 san");
+    assert(request.GetPost("password") == "p=a&ss");
+    assert(request.GetPost("empty") == "" && request.GetPost("long") == std::string(100, 'v'));
+    HttpRequest copy = request;
+    request.Init();
+    assert(copy.GetPost("password") == "p=a&ss");
+}
+
+void TestHttpHeaders() {
+    assert(HttpHeaders::Lookup("content-LENGTH") == HttpHeaders::CONTENT_LENGTH);
+    assert(HttpHeaders::Lookup("X-Custom") == HttpHeaders::UNKNOWN);
+    assert(HttpHeaders::HasToken("Upgrade , Keep-Alive", "keep-alive") && !HttpHeaders::HasToken("keep-alived", "keep-alive"));
+
+    HttpRequest request;
+    Buffer buff;
+    buff.Append("POST /login HTTP/1.1\r\nhost: a\r\nconnection:  Keep-Alive \r\nAccept: text/html\r\n"
+                "X-Custom: 1\r\naccept: */*\r\nx-custom: 2\r\n"
+                "content-type: Application/X-WWW-Form-Urlencoded; charset=utf-8\r\nContent-Length: 7\r\n\r\nuser=li");
+    bool parsed = request.parse(buff);
+    assert(parsed);
+    assert(request.IsKeepAlive() && request.GetPost("user") == "li" && buff.ReadableBytes() == 0);
+    assert(request.Header(HttpHeaders::HOST) == "a" && request.GetHeader("HOST") == "a");
+    assert(request.Header(HttpHeaders::ACCEPT) == "text/html, */*"); // joined, one field
+    assert(request.GetHeader("X-CUSTOM") == "1" && request.headers().Size() == 7);
+
+    buff.Append("GET /bad HTTP/1.1 extra\r\n\r\n");
+    request.Init();
+    parsed = request.parse(buff);
+    assert(!parsed && request.headers().Size() == 0);
+}
+
+void TestPartialRequest() {
+    // fed a byte at a time, like reads that each bring one: nothing is answered before the body is in
+    std::string login = "POST /login.html HTTP/1.1\r\nHost: a\r\nContent-Type: application/x-www-form-urlencoded\r\n"
+                        "Content-Length: 24\r\n\r\nusername=bob&password=pw";
+    std::string next = "GET /next HTTP/1.1\r\nHost: a\r\n\r\n";
+    HttpRequest request;
+    Buffer buff;
+    for(size_t i = 0; i < login.size(); i++) {
+        buff.Append(login.substr(i, 1));
+        bool parsed = request.parse(buff);
+        assert(parsed && request.IsComplete() == (i + 1 == login.size()));
+        assert(request.IsPartial() == (i + 1 < login.size() && i >= login.find("\r\n") + 1));
+    }
+    assert(request.GetPost("password") == "pw" && buff.ReadableBytes() == 0);
+
+    // pipelined: the bytes behind a request are the next one, not its body
+    request.Init();
+    buff.Append("GET /first HTTP/1.1\r\nHost: a\r\n\r\n" + next + "GET /th");
+    bool parsed = request.parse(buff);
+    assert(parsed && request.IsComplete() && request.path() == "/first" && request.body().empty());
+    request.Init();
+    parsed = request.parse(buff);
+    assert(parsed && request.IsComplete() && request.path() == "/next");
+    request.Init();
+    parsed = request.parse(buff);
+    assert(parsed && !request.IsComplete() && buff.ReadableBytes() == 7); // a cut request line waits
+    buff.Append("ird HTTP/1.1\r\n\r\n");
+    parsed = request.parse(buff);
+    assert(parsed && request.IsComplete() && request.path() == "/third" && buff.ReadableBytes() == 0);
+
+    // framing the parser can't be sure of is refused
+    const char* bad[] = {"POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n",
+                         "POST / HTTP/1.1\r\nContent-Length: 5, 6\r\n\r\n",
+                         "POST / HTTP/1.1\r\nContent-Length: -1\r\n\r\n",
+                         "POST / HTTP/1.1\r\nContent-Length: 99999999999999999999\r\n\r\n",
+                         "GET / HTTP/1.1\r\nno colon\r\n\r\n"};
+    for(const char* req : bad) {
+        buff.RetrieveAll();
+        buff.Append(req);
+        request.Init();
+        parsed = request.parse(buff);
+        assert(!parsed);
+    }
+    buff.RetrieveAll();
+    buff.Append("GET / HTTP/1.1\r\nX: " + std::string(70000, 'x'));
+    request.Init();
+    parsed = request.parse(buff);
+    assert(!parsed); // header over the limit before its line ends
+}
+
+void TestRequestPath() {
+    // one spelling of a path under srcDir, whatever the client sent
+    const char* paths[][2] = {{"/../../../../etc/passwd", "/etc/passwd"}, {"//secret.html", "/secret.html"},
+                              {"/a/./b/../c.html?x=/../y", "/a/c.html?x=/../y"}, {"/..", "/index.html"},
+                              {"/a//b/", "/a/b/"}, {"/a/..", "/index.html"}, {"/.%2e/x", "/.%2e/x"}};
+    HttpRequest request;
+    Buffer buff;
+    for(auto& path : paths) {
+        buff.Append(std::string("GET ") + path[0] + " HTTP/1.1\r\nHost: a\r\n\r\n");
+        request.Init();
+        bool parsed = request.parse(buff);
+        assert(parsed && request.path() == path[1] && request.target() == path[0]);
+        request.ParseFields("GET", path[0], {}, "");
+        assert(request.path() == path[1]);
+    }
+}
+
+// TestServer and TestTls run this in a child, and the test binary runs it again when the child execs
+// it on SIGUSR2. cwd is the server dir, the port, proxy backend and TLS come from the environment
+int RunTestServer() {
+    static char exe[PATH_MAX];
+    static char* args[] = {exe, nullptr};
+    if(!realpath("/proc/self/exe", exe)) return 1;
+    WebServer::SetArgs(args);
+    WebServer server(atoi(getenv("TESTSERVER_PORT")), 3, 60000, false, 2, false, 0, 1024);
+    server.SetLimits(1024, 3, 0, 0);
+    server.SetLowLatency(0, 1, 16, true);
+    server.SetMemoryBudget(1); // always under pressure, idle conns cut their buffers back
+    server.SetFlightRecorder(0, "flight.bin");
+    server.SetImageVariants("/images/", "variants", 1 << 20, 1 << 20, 1);
+    // logins take the default check through SqlConnPool, a stand-in conn answers for the user table
+    SqlConnPool::Instance().init({mysql_init(nullptr)});
+    SqlConnPool::passwordLookup = [](MYSQL*, const std::string& user) -> Task<std::optional<std::string>> {
+        co_return user == "bob" ? std::optional<std::string>("pw") : std::nullopt;
+    };
+    server.EnableSessions(600, {"/secret.html"}, nullptr, "sessions.txt");
+    if(getenv("TESTSERVER_BACKEND")) {
+        server.AddProxyRoute("/api/", {std::string("127.0.0.1:") + getenv("TESTSERVER_BACKEND")});
+    }
+    if(getenv("TESTSERVER_TLS") && !server.SetTls("cert.pem", "key.pem", "ticket.key")) return 1;
+    HttpConn::streamRoutes["/pid"] = [](const HttpRequest&) {
+        return [](Buffer& buffer, size_t) {
+            buffer.Append("pid " + std::to_string(getpid()));
+            return false;
+        };
+    };
+    WebSocket::Handler echo;
+    echo.onMessage = [](const std::shared_ptr<WebSocket>& ws, WebSocket::OPCODE op, const std::string& msg) {
+        ws->Send(op, msg);
+    };
+    HttpConn::wsRoutes["/ws"] = echo;
+    server.SetConfigFile("server.conf");
+    server.Start();
+    return 0;
+}
+
+// blocking conn to the test server from a loopback address of its own, reads give up after 5s
+int ConnectTo(int port, const char* fromIp = "127.0.0.1") {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = inet_addr(fromIp);
+    timeval tv = {5, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    if(bind(fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    addr.sin_port = htons(port);
+    if(connect(fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// append to got until it holds len bytes or the marker, false if the peer stops first
+bool RecvUntil(int fd, std::string& got, size_t len, const char* marker = nullptr) {
+    char buf[4096];
+    while(got.size() < len && !(marker && got.find(marker) != std::string::npos)) {
+        ssize_t n = recv(fd, buf, sizeof(buf), 0);
+        if(n <= 0) return false;
+        got.append(buf, n);
+    }
+    return true;
+}
+
+// one response, one without a length ends with the conn
+std::string ReadResponse(int fd) {
+    std::string res;
+    if(!RecvUntil(fd, res, SIZE_MAX, "\r\n\r\n")) return res;
+    size_t end = res.find("\r\n\r\n") + 4;
+    std::string head = res.substr(0, end);
+    std::transform(head.begin(), head.end(), head.begin(), ::tolower);
+    size_t pos = head.find("\r\ncontent-length:");
+    RecvUntil(fd, res, pos == std::string::npos ? SIZE_MAX : end + atol(head.c_str() + pos + 17));
+    return res;
+}
+
+// "" if nobody listens
+std::string Fetch(int port, const std::string& request) {
+    int fd = ConnectTo(port);
+    if(fd < 0) return "";
+    send(fd, request.data(), request.size(), MSG_NOSIGNAL);
+    std::string res = ReadResponse(fd);
+    close(fd);
+    return res;
+}
+
+std::string Get(int port, const std::string& path, const std::string& cookie = "") {
+    return Fetch(port, "GET " + path + " HTTP/1.1\r\nHost: test\r\nConnection: close\r\n" +
+                       (cookie.empty() ? "" : "Cookie: " + cookie + "\r\n") + "\r\n");
+}
+
+std::string Body(const std::string& res) {
+    size_t pos = res.find("\r\n\r\n");
+    return pos == std::string::npos ? "" : res.substr(pos + 4);
+}
+
+// client preface, empty SETTINGS and one request on stream 1
+std::string H2Hello(const std::string& method, const std::string& path, const std::string& cookie) {
+    auto frame = [](uint8_t type, uint8_t flags, const std::string& payload) {
+        char head[9] = {char(payload.size() >> 16), char(payload.size() >> 8), char(payload.size()),
+                        char(type), char(flags), 0, 0, 0, char(type == 0x4 ? 0 : 1)};
+        return std::string(head, sizeof(head)) + payload;
+    };
+    std::vector<HpackTable::Field> fields = {{":method", method}, {":scheme", "http"}, {":path", path},
+                                             {":authority", "test"}};
+    if(!cookie.empty()) fields.emplace_back("cookie", cookie);
+    std::string block;
+    HpackEncoder().Encode(fields, block);
+    return std::string(Http2Session::PREFACE, Http2Session::PREFACE_LEN) + frame(0x4, 0, "") +
+           frame(0x1, 0x5, block); // END_STREAM | END_HEADERS on stream 1
+}
+
+// takes the whole frames off got, true once stream 1 is over. status is :status, "RST n" when the
+// stream is reset with error n
+bool H2Answer(HpackDecoder& decoder, std::string& got, std::string& status, std::string& body) {
+    while(got.size() >= 9) {
+        size_t len = (uint8_t(got[0]) << 16) | (uint8_t(got[1]) << 8) | uint8_t(got[2]);
+        if(got.size() < 9 + len) break;
+        uint8_t type = got[3], flags = got[4];
+        bool onStream = (got[5] | got[6] | got[7]) == 0 && got[8] == 1;
+        std::string payload = got.substr(9, len);
+        got.erase(0, 9 + len);
+        if(!onStream) continue;
+        if(type == 0x1) {
+            std::vector<HpackTable::Field> headers;
+            decoder.Decode(reinterpret_cast<const uint8_t*>(payload.data()), payload.size(), headers);
+            for(auto& field : headers) {
+                if(field.first == ":status") status = field.second;
+            }
+        } else if(type == 0x0) {
+            body += payload;
+        } else if(type == 0x3 && len == 4) {
+            status = "RST " + std::to_string(uint8_t(payload[3]));
+            return true;
+        }
+        if((type == 0x0 || type == 0x1) && (flags & 0x1)) return true;
+    }
+    return false;
+}
+
+// one request on a new prior knowledge h2c conn, returns as H2Answer and fills body
+std::string H2Request(int port, const std::string& method, const std::string& path, const std::string& cookie,
+                      std::string& body) {
+    body.clear();
+    int fd = ConnectTo(port);
+    if(fd < 0) return "";
+    std::string req = H2Hello(method, path, cookie);
+    send(fd, req.data(), req.size(), MSG_NOSIGNAL);
+
+    HpackDecoder decoder;
+    std::string got, status;
+    char buf[4096];
+    while(!H2Answer(decoder, got, status, body)) {
+        ssize_t n = recv(fd, buf, sizeof(buf), 0);
+        if(n <= 0) break;
+        got.append(buf, n);
+    }
+    close(fd);
+    return status;
+}
+
+void TestHttp2Routes() {
+    // h2 streams are admitted and routed like HTTP/1.x requests, on a session driven through buffers
+    sockaddr_in addr = {0};
+    auto answer = [&addr](const std::string& path, std::string& body) {
+        Http2Session session("./", addr);
+        Buffer in, out;
+        in.Append(H2Hello("GET", path, ""));
+        session.Start(out);
+        session.OnRead(in, out);
+        session.Flush(out, SIZE_MAX);
+        HpackDecoder decoder;
+        std::string got(out.ReadPosition(), out.ReadableBytes()), status;
+        body.clear();
+        bool done = H2Answer(decoder, got, status, body);
+        return done ? status : "";
+    };
+    std::string body, status;
+
+    HttpConn::requestFilter = [](const sockaddr_in&) { return false; };
+    status = answer("/index.html", body);
+    assert(status == "429" && body == "429 : Too Many Requests\n");
+    HttpConn::requestFilter = nullptr;
+
+    // proxied and coroutine routes answer later, the client has to ask again over HTTP/1.1
+    Upstream upstream(Upstream::LEAST_CONN);
+    HttpConn::proxyRoutes["/api/"] = &upstream;
+    status = answer("/api/x", body);
+    assert(status == "RST 13");
+    HttpConn::proxyRoutes.clear();
+    HttpConn::coRoutes["/co"] = [](HttpRequest&) -> Task<void> { co_return; };
+    status = answer("/co", body);
+    assert(status == "RST 13");
+    HttpConn::coRoutes.clear();
+    status = answer("/nothing.html", body);
+    assert(status == "404");
+}
+
+int ServedBy(int port) {
+    // chunked: size, then "pid N"
+    std::string body = Body(Get(port, "/pid"));
+    size_t pos = body.find("pid ");
+    return pos == std::string::npos ? -1 : atoi(body.c_str() + pos + 4);
+}
+
+bool WaitExit(pid_t pid, int timeoutMS) {
+    int status;
+    for(int i = 0; i < timeoutMS / 10; i++) {
+        if(waitpid(pid, &status, WNOHANG) == pid) return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return false;
+}
+
+// pages, an image and a config file under ./testserver
+void MakeServerDir() {
+    system("rm -rf ./testserver && mkdir -p ./testserver/resources/images");
+    const char* pages[][2] = {{"index", "index page"}, {"hello", "hello page"}, {"login", "login page"},
+                              {"welcome", "welcome page"}, {"secret", "secret page"}, {"error", "error page"}};
+    FILE* fp;
+    for(auto& page : pages) {
+        fp = fopen((std::string("./testserver/resources/") + page[0] + ".html").c_str(), "w");
+        fputs(page[1], fp);
+        fclose(fp);
+    }
+    std::string jpeg = MakeJpeg(800, 480);
+    fp = fopen("./testserver/resources/images/a.jpg", "wb");
+    fwrite(jpeg.data(), 1, jpeg.size(), fp);
+    fclose(fp);
+    fp = fopen("./testserver/server.conf", "w");
+    fputs("slow_log_ms = 0\n", fp);
+    fclose(fp);
+}
+
+int FreePort() {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    socklen_t len = sizeof(addr);
+    int bound = bind(fd, (sockaddr*)&addr, len);
+    assert(bound == 0);
+    getsockname(fd, (sockaddr*)&addr, &len);
+    close(fd);
+    return ntohs(addr.sin_port);
+}
+
+// RunTestServer in ./testserver of a child, backendPort 0 for no proxy route
+pid_t StartTestServer(int port, int backendPort, bool tls) {
+    setenv("TESTSERVER_PORT", std::to_string(port).c_str(), 1);
+    if(backendPort > 0) setenv("TESTSERVER_BACKEND", std::to_string(backendPort).c_str(), 1);
+    if(tls) setenv("TESTSERVER_TLS", "1", 1);
+    pid_t pid = fork();
+    if(pid == 0) {
+        prctl(PR_SET_PDEATHSIG, SIGKILL); // a failed assert here must not leave a server behind
+        _exit(chdir("./testserver") == 0 ? RunTestServer() : 1);
+    }
+    unsetenv("TESTSERVER_PORT");
+    unsetenv("TESTSERVER_BACKEND");
+    unsetenv("TESTSERVER_TLS");
+    return pid;
+}
+
+void TestServer() {
+    // a WebServer on loopback in a child process, its signals and statics stay out of this one
+    MakeServerDir();
+    int backendFd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    socklen_t len = sizeof(addr);
+    int bound = bind(backendFd, (sockaddr*)&addr, len);
+    int listening = listen(backendFd, 8);
+    assert(bound == 0 && listening == 0);
+    getsockname(backendFd, (sockaddr*)&addr, &len);
+    int port = FreePort();
+    // the process started on SIGUSR2 outlives its parent, it becomes ours to wait for
+    int reaper = prctl(PR_SET_CHILD_SUBREAPER, 1);
+    assert(reaper == 0);
+    pid_t pid = StartTestServer(port, ntohs(addr.sin_port), false);
+
+    std::string res;
+    for(int i = 0; i < 500 && res.empty(); i++) {
+        res = Get(port, "/index.html");
+        if(res.empty()) std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    assert(res.compare(0, 12, "HTTP/1.1 200") == 0 && Body(res) == "index page");
+    res = Get(port, "/hello");
+    assert(res.compare(0, 12, "HTTP/1.1 404") == 0);
+    res = Get(port, "/../server.conf"); // next to resources
+    assert(res.compare(0, 12, "HTTP/1.1 404") == 0);
+    pid_t servedBy = ServedBy(port);
+    assert(servedBy == pid);
+
+    // proxy route, the backend answers one request
+    std::thread backend([backendFd]() {
+        int fd = accept(backendFd, nullptr, nullptr);
+        std::string req;
+        RecvUntil(fd, req, SIZE_MAX, "\r\n\r\n");
+        std::string res = "HTTP/1.1 200 OK\r\nContent-Length: 12\r\nConnection: close\r\n\r\nfrom backend";
+        send(fd, res.data(), res.size(), MSG_NOSIGNAL);
+        close(fd);
+    });
+    res = Get(port, "/api/x");
+    backend.join();
+    assert(res.compare(0, 12, "HTTP/1.1 200") == 0 && Body(res) == "from backend");
+
+    // websocket echo
+    int ws = ConnectTo(port);
+    std::string upgrade = "GET /ws HTTP/1.1\r\nHost: test\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+                          "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: 13\r\n\r\n";
+    send(ws, upgrade.data(), upgrade.size(), MSG_NOSIGNAL);
+    res.clear();
+    bool got = RecvUntil(ws, res, SIZE_MAX, "\r\n\r\n");
+    assert(got && res.compare(0, 12, "HTTP/1.1 101") == 0);
+    assert(res.find("s3pPLMBiTxaQ9kYGzzhZRbK+xOo=") != std::string::npos);
+    send(ws, "\x81\x85\x37\xfa\x21\x3d\x7f\x9f\x4d\x51\x58", 11, MSG_NOSIGNAL);
+    std::string frame = res.substr(res.find("\r\n\r\n") + 4);
+    got = RecvUntil(ws, frame, 7);
+    assert(got && frame == std::string("\x81\x05Hello"));
+    close(ws);
+
+    // sessions: login page until a login, then the cookie is enough
+    res = Get(port, "/secret.html");
+    assert(Body(res) == "login page");
+    std::string form = "username=bob&password=pw";
+    res = Fetch(port, "POST /login.html HTTP/1.1\r\nHost: test\r\nConnection: close\r\n"
+                      "Content-Type: application/x-www-form-urlencoded\r\nContent-Length: " +
+                      std::to_string(form.size()) + "\r\n\r\n" + form);
+    size_t pos = res.find("Set-Cookie: ");
+    assert(pos != std::string::npos && Body(res) == "welcome page");
+    std::string cookie = res.substr(pos + 12, res.find(';', pos) - pos - 12);
+    res = Get(port, "/secret.html", cookie);
+    assert(Body(res) == "secret page");
+
+    // a login whose body comes in a second segment, then two requests sent at once
+    int fd = ConnectTo(port);
+    std::string head = "POST /login.html HTTP/1.1\r\nHost: test\r\nConnection: keep-alive\r\n"
+                       "Content-Type: application/x-www-form-urlencoded\r\nContent-Length: " +
+                       std::to_string(form.size()) + "\r\n\r\n";
+    send(fd, head.data(), head.size(), MSG_NOSIGNAL);
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    send(fd, form.data(), form.size(), MSG_NOSIGNAL);
+    res = ReadResponse(fd);
+    assert(Body(res) == "welcome page");
+    std::string pipelined = "GET /index.html HTTP/1.1\r\nHost: test\r\nConnection: keep-alive\r\n\r\n"
+                            "GET /login.html HTTP/1.1\r\nHost: test\r\nConnection: close\r\n\r\n";
+    send(fd, pipelined.data(), pipelined.size(), MSG_NOSIGNAL);
+    res.clear();
+    RecvUntil(fd, res, SIZE_MAX); // till the second one closes the conn
+    pos = res.find("index page");
+    assert(res.compare(0, 12, "HTTP/1.1 200") == 0 && pos != std::string::npos);
+    assert(res.compare(pos + 10, 12, "HTTP/1.1 200") == 0 && Body(res.substr(pos + 10)) == "login page");
+    close(fd);
+    res = Get(port, "//secret.html");
+    assert(Body(res) == "login page");
+
+    // h2c streams follow the same session rules, a login is sent again over HTTP/1.1
+    std::string body;
+    res = H2Request(port, "GET", "/secret.html", "", body);
+    assert(res == "200" && body == "login page");
+    res = H2Request(port, "GET", "/./secret.html", "", body);
+    assert(res == "200" && body == "login page");
+    res = H2Request(port, "GET", "/secret.html", cookie, body);
+    assert(res == "200" && body == "secret page");
+    res = H2Request(port, "POST", "/login.html", "", body);
+    assert(res == "RST 13");
+    res = H2Request(port, "GET", "/../server.conf", "", body);
+    assert(res == "404");
+    res = H2Request(port, "GET", "/api/x", "", body);
+    assert(res == "RST 13");
+    res = H2Request(port, "GET", "/images/a.jpg?w=320", "", body);
+    assert(res == "RST 13");
+
+    // image variant
+    res = Get(port, "/images/a.jpg?w=320");
+    int w = 0, h = 0;
+    assert(res.compare(0, 12, "HTTP/1.1 200") == 0);
+    assert(ImageVariants::Dimensions(Body(res), w, h) && w == 320 && h == 192);
+
+    // 3 conns per IP, counted from an address nothing else used
+    std::vector<int> conns;
+    for(int i = 0; i < 4; i++) {
+        int fd = ConnectTo(port, "127.0.0.2");
+        assert(fd >= 0);
+        std::string req = "GET /index.html HTTP/1.1\r\nHost: test\r\nConnection: keep-alive\r\n\r\n";
+        send(fd, req.data(), req.size(), MSG_NOSIGNAL);
+        res = ReadResponse(fd);
+        assert(res.compare(0, 12, i < 3 ? "HTTP/1.1 200" : "HTTP/1.1 429") == 0);
+        conns.push_back(fd);
+    }
+    for(int fd : conns) close(fd);
+
+    // SIGHUP reads the config file again
+    FILE* fp = fopen("./testserver/server.conf", "w");
+    fputs("pages = /hello\n", fp);
+    fclose(fp);
+    int killed = kill(pid, SIGHUP);
+    assert(killed == 0);
+    res.clear();
+    for(int i = 0; i < 500 && Body(res) != "hello page"; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        res = Get(port, "/hello");
+    }
+    assert(Body(res) == "hello page");
+
+    // SIGUSR1 dumps the flight recorder
+    killed = kill(pid, SIGUSR1);
+    assert(killed == 0);
+    FlightHeader header = {0};
+    for(int i = 0; i < 500 && header.signo != SIGUSR1; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        fp = fopen("./testserver/flight.bin", "rb");
+        if(fp && fread(&header, sizeof(header), 1, fp) != 1) header.signo = 0;
+        if(fp) fclose(fp);
+    }
+    assert(header.magic == FLIGHT_MAGIC && header.pid == pid && header.signo == SIGUSR1);
+
+    // SIGUSR2 starts the binary again on the same socket, the old process drains and exits
+    int idle = ConnectTo(port);
+    std::string req = "GET /index.html HTTP/1.1\r\nHost: test\r\nConnection: keep-alive\r\n\r\n";
+    send(idle, req.data(), req.size(), MSG_NOSIGNAL);
+    res = ReadResponse(idle);
+    assert(Body(res) == "index page");
+    killed = kill(pid, SIGUSR2);
+    bool exited = WaitExit(pid, 10000);
+    assert(killed == 0 && exited);
+    char c;
+    ssize_t n = recv(idle, &c, 1, 0);
+    assert(n == 0); // idle keep-alive conn closed by the drain
+    close(idle);
+    pid_t next = ServedBy(port);
+    assert(next > 0 && next != pid);
+    res = Get(port, "/secret.html", cookie);
+    assert(Body(res) == "secret page"); // sessions came along
+
+    // SIGTERM drains, sessions are saved for the next start
+    killed = kill(next, SIGTERM);
+    exited = WaitExit(next, 10000);
+    assert(killed == 0 && exited);
+    fd = ConnectTo(port);
+    assert(fd < 0);
+    struct stat st;
+    int statted = stat("./testserver/sessions.txt", &st);
+    assert(statted == 0 && (st.st_mode & 0777) == 0600);
+    fp = fopen("./testserver/sessions.txt", "r");
+    char line[256] = {0};
+    bool gotLine = fgets(line, sizeof(line), fp) != nullptr;
+    assert(gotLine && std::string(line).find(" bob ") != std::string::npos);
+    fclose(fp);
+    prctl(PR_SET_CHILD_SUBREAPER, 0);
+    close(backendFd);
+    system("rm -rf ./testserver");
+}
+
+// self-signed P-256 cert for localhost
+void MakeCert(const char* certFile, const char* keyFile) {
+    EVP_PKEY* key = EVP_EC_gen("P-256");
+    X509* cert = X509_new();
+    assert(key && cert);
+    X509_set_version(cert, 2);
+    ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+    X509_gmtime_adj(X509_getm_notBefore(cert), 0);
+    X509_gmtime_adj(X509_getm_notAfter(cert), 3600);
+    X509_set_pubkey(cert, key);
+    X509_NAME* name = X509_get_subject_name(cert);
+    X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (const unsigned char*)"localhost", -1, -1, 0);
+    X509_set_issuer_name(cert, name);
+    int signedBytes = X509_sign(cert, key, EVP_sha256());
+    assert(signedBytes > 0);
+    FILE* fp = fopen(certFile, "w");
+    PEM_write_X509(fp, cert);
+    fclose(fp);
+    fp = fopen(keyFile, "w");
+    PEM_write_PrivateKey(fp, key, nullptr, nullptr, 0, nullptr, nullptr);
+    fclose(fp);
+    X509_free(cert);
+    EVP_PKEY_free(key);
+}
+
+// request on a new TLS conn, resuming session if there is one. session is replaced by the one of this
+// conn, "" if the handshake fails
+std::string TlsFetch(SSL_CTX* ctx, int port, const std::string& request, SSL_SESSION*& session, bool& reused) {
+    int fd = ConnectTo(port);
+    if(fd < 0) return "";
+    SSL* ssl = SSL_new(ctx);
+    SSL_set_fd(ssl, fd);
+    SSL_set_tlsext_host_name(ssl, "localhost");
+    SSL_set1_host(ssl, "localhost");
+    if(session) SSL_set_session(ssl, session);
+    std::string res;
+    if(SSL_connect(ssl) == 1 && SSL_write(ssl, request.data(), request.size()) == (int)request.size()) {
+        char buf[16 * 1024];
+        int n;
+        while((n = SSL_read(ssl, buf, sizeof(buf))) > 0) res.append(buf, n);
+        reused = SSL_session_reused(ssl) == 1;
+        if(session) SSL_SESSION_free(session);
+        session = SSL_get1_session(ssl); // has the ticket sent after the handshake by now
+        SSL_shutdown(ssl); // SSL_free without it marks the session not resumable
+    }
+    SSL_free(ssl);
+    close(fd);
+    return res;
+}
+
+void TestTls() {
+    // handshake and file responses over TLS, tickets resume on the server and on a new process sharing the key
+    MakeServerDir();
+    MakeCert("./testserver/cert.pem", "./testserver/key.pem");
+    unsigned char keys[80];
+    int random = RAND_bytes(keys, sizeof(keys));
+    assert(random == 1);
+    FILE* fp = fopen("./testserver/ticket.key", "wb");
+    fwrite(keys, 1, sizeof(keys), fp);
+    fclose(fp);
+    std::string big(1 << 20, 'x'); // takes many records and writes that block
+    for(size_t i = 0; i < big.size(); i += 7) big[i] = 'a' + i % 26;
+    fp = fopen("./testserver/resources/big.html", "w");
+    fwrite(big.data(), 1, big.size(), fp);
+    fclose(fp);
+
+    SSL_CTX* ctx = SSL_CTX_new(TLS_client_method());
+    int loaded = SSL_CTX_load_verify_locations(ctx, "./testserver/cert.pem", nullptr);
+    assert(loaded == 1);
+    SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER, nullptr);
+    std::string getBig = "GET /big.html HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n";
+    std::string getIndex = "GET /index.html HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n";
+    SSL_SESSION* session = nullptr;
+    bool reused = true;
+    int port = FreePort();
+    pid_t pid = StartTestServer(port, 0, true);
+    std::string res;
+    for(int i = 0; i < 500 && res.empty(); i++) {
+        res = TlsFetch(ctx, port, getBig, session, reused);
+        if(res.empty()) std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    assert(res.compare(0, 12, "HTTP/1.1 200") == 0 && Body(res) == big && !reused && session);
+    res = TlsFetch(ctx, port, getIndex, session, reused);
+    assert(Body(res) == "index page" && reused);
+    res = Get(port, "/index.html");
+    assert(res.find("index page") == std::string::npos); // no plaintext
+    int killed = kill(pid, SIGTERM);
+    bool exited = WaitExit(pid, 10000);
+    assert(killed == 0 && exited);
+
+    pid = StartTestServer(port, 0, true);
+    res.clear();
+    for(int i = 0; i < 500 && res.empty(); i++) {
+        res = TlsFetch(ctx, port, getBig, session, reused);
+        if(res.empty()) std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    assert(Body(res) == big && reused);
+    killed = kill(pid, SIGTERM);
+    exited = WaitExit(pid, 10000);
+    assert(killed == 0 && exited);
+    SSL_SESSION_free(session);
+    SSL_CTX_free(ctx);
+    system("rm -rf ./testserver");
+}
+
+void TestTlsHandshakeOnWrite() {
+    // the last flight of the server (TLS 1.3 tickets) blocks, the handshake ends on the write path and
+    // the conn goes on reading the request instead of looking finished
+    MakeServerDir();
+    MakeCert("./testserver/cert.pem", "./testserver/key.pem");
+    TlsContext tls;
+    bool inited = tls.Init("./testserver/cert.pem", "./testserver/key.pem");
+    assert(inited);
+    int pair[2];
+    int made = socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, pair);
+    assert(made == 0);
+    int sndbuf = 1;
+    setsockopt(pair[0], SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+
+    HttpConn::tlsContext = &tls;
+    HttpConn::srcDir = "./testserver/resources";
+    HttpConn conn;
+    conn.init(pair[0], sockaddr_in{}, false);
+    SSL_CTX* ctx = SSL_CTX_new(TLS_client_method());
+    SSL_CTX_set_min_proto_version(ctx, TLS1_3_VERSION);
+    SSL* ssl = SSL_new(ctx);
+    SSL_set_fd(ssl, pair[1]);
+    SSL_set_connect_state(ssl);
+    int err = 0, connected = 0;
+    for(int i = 0; i < 10 && connected != 1; i++) {
+        connected = SSL_do_handshake(ssl); // a 1.3 client is done once its Finished is sent
+        if(connected != 1) conn.read(&err);
+    }
+    assert(connected == 1);
+
+    // the socket of the server is full when its Finished arrives, the request comes right behind it
+    char junk[4096] = {0};
+    size_t filled = 0;
+    ssize_t n;
+    while((n = send(pair[0], junk, sizeof(junk), MSG_NOSIGNAL)) > 0) filled += n;
+    std::string req = "GET /index.html HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n";
+    int sent = SSL_write(ssl, req.data(), req.size());
+    assert(sent == (int)req.size());
+    n = conn.read(&err);
+    bool wantWrite = conn.process();
+    assert(n < 0 && err == EAGAIN && wantWrite);
+    for(size_t left = filled; left > 0; left -= n) {
+        n = recv(pair[1], junk, std::min(left, sizeof(junk)), 0);
+        assert(n > 0);
+    }
+
+    n = conn.write(&err);
+    assert(n == 0 && conn.ToWriteBytes() == 0 && conn.HandshakeWritten());
+    n = conn.read(&err);
+    bool ready = conn.process();
+    assert(n > 0 && ready);
+    while(conn.ToWriteBytes() > 0 && conn.write(&err) > 0) {}
+    assert(conn.ToWriteBytes() == 0 && !conn.HandshakeWritten());
+    std::string res;
+    char buf[4096];
+    for(int i = 0; i < 100 && res.find("index page") == std::string::npos; i++) {
+        int got = SSL_read(ssl, buf, sizeof(buf));
+        if(got > 0) res.append(buf, got);
+        else std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    assert(res.compare(0, 12, "HTTP/1.1 200") == 0 && Body(res) == "index page");
+
+    SSL_free(ssl);
+    SSL_CTX_free(ctx);
+    conn.close();
+    close(pair[1]);
+    HttpConn::tlsContext = nullptr;
+    system("rm -rf ./testserver");
+}
+
 int main() {
+    // exec by the server of TestServer on SIGUSR2, serve in place of it
+    if(getenv(ListenerHandoff::ENV_FD)) return RunTestServer();
+    TestHpack();
+    TestAssetBundle();
+    TestSessionStore();
+    TestImageVariants();
+    TestAltSvc();
+    TestConfig();
+    TestHttpHeaders();
+    TestRequestPath();
+    TestPartialRequest();
+    TestUrlCodec();
+    TestHandoff();
+    TestLowLatency();
+    TestChunkedStream();
+    TestRateLimiter();
+    TestUpstream();
+    TestWebSocket();
+    TestHttp2Routes();
+    TestServer();
+    TestTls();
+    TestTlsHandshakeOnWrite();
+    TestAffinity();
+    TestAdaptivePool();
+    TestTaskClasses();
+    TestCoroutine();
+    TestSqlLogin();
+    TestBlockDeque();
+    TestRequestTrace();
+    TestAccessLog();
+    TestFlightRecorder();
+    TestMemStats();
     TestLog();
     TestThreadPool();
 }
\ No newline at end of file
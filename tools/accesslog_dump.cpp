@@ -0,0 +1,109 @@
+/*
+ * @author: Zimo Li
+ * @date: 2026-10-19
+*/
+
+// prints a binary access log (WebServer::SetAccessLog) as text or JSON lines
+//   accesslog_dump [--json] access.bin
+#include <arpa/inet.h>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "../src/log/accesslog.hpp"
+using namespace std;
+
+static void PrintJsonString(const string& s)
+{
+    putchar('"');
+    for(unsigned char c : s) {
+        if(c == '"' || c == '\\') printf("\\%c", c);
+        else if(c < 0x20) printf("\\u%04x", c);
+        else putchar(c);
+    }
+    putchar('"');
+}
+
+static void Print(const AccessRecord& record, const string& path, bool json)
+{
+    char ip[INET_ADDRSTRLEN];
+    in_addr addr;
+    addr.s_addr = record.ip;
+    inet_ntop(AF_INET, &addr, ip, sizeof(ip));
+
+    time_t sec = record.timeUs / 1000000;
+    tm t;
+    gmtime_r(&sec, &t);
+    char when[32];
+    strftime(when, sizeof(when), "%Y-%m-%dT%H:%M:%S", &t);
+
+    if(json) {
+        printf("{\"time\":\"%s.%06uZ\",\"ip\":\"%s\",\"method\":\"%s\",\"path\":", when,
+               (unsigned)(record.timeUs % 1000000), ip, AccessLog::MethodName(record.method));
+        PrintJsonString(path);
+        printf(",\"status\":%u,\"bytes\":%u,\"latency_us\":%u,\"sample\":%u}\n", record.status,
+               record.bytes, record.latencyUs, record.sample);
+    } else {
+        // common log format, latency and sample rate appended
+        printf("%s - - [%s.%06uZ] \"%s %s\" %u %u %uus 1/%u\n", ip, when,
+               (unsigned)(record.timeUs % 1000000), AccessLog::MethodName(record.method), path.c_str(),
+               record.status, record.bytes, record.latencyUs, record.sample);
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    bool json = false;
+    const char* file = nullptr;
+    for(int i = 1; i < argc; i++) {
+        if(strcmp(argv[i], "--json") == 0) json = true;
+        else file = argv[i];
+    }
+    if(!file) {
+        fprintf(stderr, "usage: %s [--json] access.bin\n", argv[0]);
+        return 2;
+    }
+    FILE* fp = fopen(file, "rb");
+    if(!fp) {
+        perror(file);
+        return 1;
+    }
+
+    AccessBlockHeader header;
+    vector<char> block;
+    long offset = 0;
+    while(fread(&header, sizeof(header), 1, fp) == 1) {
+        if(header.magic != ACCESS_MAGIC || header.version != ACCESS_VERSION) {
+            fprintf(stderr, "%s: bad block header at offset %ld\n", file, offset);
+            fclose(fp);
+            return 1;
+        }
+        block.resize(header.bytes);
+        if(fread(block.data(), 1, block.size(), fp) != block.size()) {
+            fprintf(stderr, "%s: truncated block at offset %ld\n", file, offset);
+            break;
+        }
+        offset += sizeof(header) + header.bytes;
+
+        // path dictionary is per block
+        unordered_map<uint32_t, string> paths;
+        size_t pos = 0;
+        while(pos + sizeof(AccessRecord) <= block.size()) {
+            AccessRecord record;
+            memcpy(&record, block.data() + pos, sizeof(record));
+            pos += sizeof(record);
+            if(record.type == AccessRecord::PATH) {
+                if(pos + record.bytes > block.size()) break;
+                paths[record.pathId].assign(block.data() + pos, record.bytes);
+                pos += (record.bytes + 7) / 8 * 8;
+            } else if(record.type == AccessRecord::REQUEST) {
+                auto it = paths.find(record.pathId);
+                Print(record, it == paths.end() ? "-" : it->second, json);
+            }
+        }
+    }
+    fclose(fp);
+    return 0;
+}
@@ -0,0 +1,81 @@
+/*
+ * @author: Zimo Li
+ * @date: 2026-10-19
+*/
+
+// packs a resource tree into one bundle for WebServer::SetBundle
+//   bundle_pack resources resources.bundle
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <zlib.h>
+#include "../src/http/assetbundle.hpp"
+#include "../src/http/httpresponse.hpp"
+using namespace std;
+
+// gzip at the best level, done once here so the server never compresses
+static bool Gzip(const string& data, string& out)
+{
+    z_stream zs = {};
+    if(deflateInit2(&zs, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 9, Z_DEFAULT_STRATEGY) != Z_OK) return false;
+    out.resize(deflateBound(&zs, data.size()));
+    zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+    zs.avail_in = data.size();
+    zs.next_out = reinterpret_cast<Bytef*>(out.data());
+    zs.avail_out = out.size();
+    int ret = deflate(&zs, Z_FINISH);
+    out.resize(zs.total_out);
+    deflateEnd(&zs);
+    return ret == Z_STREAM_END;
+}
+
+static bool Compressible(const string& type)
+{
+    return type.compare(0, 5, "text/") == 0 || type == "application/xhtml+xml" || type == "application/rtf";
+}
+
+int main(int argc, char* argv[])
+{
+    if(argc != 3) {
+        fprintf(stderr, "usage: %s srcDir out.bundle\n", argv[0]);
+        return 2;
+    }
+    filesystem::path root(argv[1]);
+    vector<AssetBundle::Input> inputs;
+    size_t plain = 0, packed = 0;
+    error_code ec;
+    for(auto it = filesystem::recursive_directory_iterator(root, ec); !ec && it != filesystem::end(it); it.increment(ec)) {
+        if(!it->is_regular_file()) continue;
+        AssetBundle::Input in;
+        in.path = "/" + it->path().lexically_relative(root).generic_string();
+        in.type = HttpResponse::MimeType(in.path);
+        ifstream file(it->path(), ios::binary);
+        ostringstream data;
+        data << file.rdbuf();
+        if(!file) {
+            fprintf(stderr, "can't read %s\n", it->path().c_str());
+            return 1;
+        }
+        in.data = data.str();
+        // keep the variant only if it saves at least a tenth
+        if(Compressible(in.type) && Gzip(in.data, in.gzip) && in.gzip.size() * 10 > in.data.size() * 9) {
+            in.gzip.clear();
+        }
+        plain += in.data.size();
+        packed += in.data.size() + in.gzip.size();
+        inputs.push_back(std::move(in));
+    }
+    if(ec) {
+        fprintf(stderr, "%s: %s\n", argv[1], ec.message().c_str());
+        return 1;
+    }
+    if(!AssetBundle::Write(argv[2], inputs)) {
+        fprintf(stderr, "can't write %s\n", argv[2]);
+        return 1;
+    }
+    printf("%zu files, %zu bytes, %zu with gzip variants\n", inputs.size(), plain, packed);
+    return 0;
+}
@@ -0,0 +1,164 @@
+/*
+ * @author: Zimo Li
+ * @date: 2026-10-19
+*/
+
+// prints a flight recorder dump (WebServer::SetFlightRecorder) as log lines, oldest first
+//   flightrec_dump [--tid N] flight.bin
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <vector>
+#include "../src/log/flightrecorder.hpp"
+using namespace std;
+
+struct Entry {
+    FlightRecord record;
+    string format;
+    string args;
+};
+
+static const char* LevelName(int level)
+{
+    static const char* NAMES[] = {"[debug]: ", "[info] : ", "[warn] : ", "[error]: "};
+    return level >= 0 && level < 4 ? NAMES[level] : "[?]    : ";
+}
+
+// next arg as its tag and 8 byte value or string, false when the recorder had no room left for it
+static bool NextArg(const string& args, size_t& pos, uint8_t& tag, uint64_t& bits, string& text)
+{
+    if(pos >= args.size()) return false;
+    tag = args[pos];
+    if(tag == ARG_STR) {
+        if(pos + 2 > args.size()) return false;
+        size_t len = static_cast<uint8_t>(args[pos + 1]);
+        if(pos + 2 + len > args.size()) return false;
+        text = args.substr(pos + 2, len);
+        pos += 2 + len;
+        return true;
+    }
+    if(pos + 9 > args.size()) return false;
+    memcpy(&bits, args.data() + pos + 1, sizeof(bits));
+    pos += 9;
+    return true;
+}
+
+// printf again, one conversion at a time: length modifiers are replaced by what the arg was stored as
+static string Format(const Entry& entry)
+{
+    const string& format = entry.format;
+    string out;
+    size_t pos = 0;
+    char buf[512];
+    for(size_t i = 0; i < format.size(); i++) {
+        if(format[i] != '%') {
+            out += format[i];
+            continue;
+        }
+        size_t start = i++;
+        while(i < format.size() && strchr("-+ #0", format[i])) i++;
+        while(i < format.size() && (isdigit(static_cast<unsigned char>(format[i])) || format[i] == '.')) i++;
+        string spec = format.substr(start, i - start);
+        while(i < format.size() && strchr("hlLqjzt", format[i])) i++;
+        if(i >= format.size()) break;
+        char conv = format[i];
+        if(conv == '%') {
+            out += '%';
+            continue;
+        }
+        uint8_t tag;
+        uint64_t bits = 0;
+        string text;
+        if(!NextArg(entry.args, pos, tag, bits, text)) {
+            out += "?";
+            continue;
+        }
+        if(tag == ARG_STR) {
+            snprintf(buf, sizeof(buf), (spec + 's').c_str(), text.c_str());
+        } else if(tag == ARG_DOUBLE) {
+            double d;
+            memcpy(&d, &bits, sizeof(d));
+            if(strchr("fFeEgGaA", conv)) snprintf(buf, sizeof(buf), (spec + conv).c_str(), d);
+            else snprintf(buf, sizeof(buf), "%g", d);
+        } else if(conv == 's') {
+            snprintf(buf, sizeof(buf), "?");
+        } else if(conv == 'p') {
+            snprintf(buf, sizeof(buf), "0x%llx", static_cast<unsigned long long>(bits));
+        } else if(conv == 'c') {
+            snprintf(buf, sizeof(buf), (spec + 'c').c_str(), static_cast<int>(bits));
+        } else if(strchr("di", conv)) {
+            snprintf(buf, sizeof(buf), (spec + "lld").c_str(), static_cast<long long>(bits));
+        } else if(strchr("uxXo", conv)) {
+            snprintf(buf, sizeof(buf), (spec + "ll" + conv).c_str(), static_cast<unsigned long long>(bits));
+        } else {
+            snprintf(buf, sizeof(buf), "?");
+        }
+        out += buf;
+    }
+    return out;
+}
+
+int main(int argc, char* argv[])
+{
+    const char* file = nullptr;
+    int tid = 0;
+    for(int i = 1; i < argc; i++) {
+        if(strcmp(argv[i], "--tid") == 0 && i + 1 < argc) tid = atoi(argv[++i]);
+        else file = argv[i];
+    }
+    if(!file) {
+        fprintf(stderr, "usage: %s [--tid N] flight.bin\n", argv[0]);
+        return 2;
+    }
+    FILE* fp = fopen(file, "rb");
+    if(!fp) {
+        perror(file);
+        return 1;
+    }
+
+    FlightHeader header;
+    if(fread(&header, sizeof(header), 1, fp) != 1 || header.magic != FLIGHT_MAGIC ||
+       header.version != FLIGHT_VERSION) {
+        fprintf(stderr, "%s: not a flight recorder dump\n", file);
+        fclose(fp);
+        return 1;
+    }
+
+    vector<Entry> entries;
+    Entry entry;
+    while(fread(&entry.record, sizeof(entry.record), 1, fp) == 1) {
+        entry.format.resize(entry.record.formatLen);
+        entry.args.resize(entry.record.argBytes);
+        if(fread(entry.format.data(), 1, entry.format.size(), fp) != entry.format.size() ||
+           fread(entry.args.data(), 1, entry.args.size(), fp) != entry.args.size()) {
+            fprintf(stderr, "%s: truncated record\n", file);
+            break;
+        }
+        if(tid == 0 || entry.record.tid == tid) entries.push_back(entry);
+    }
+    fclose(fp);
+
+    // rings are dumped one after another and wrap, time puts the threads back together
+    stable_sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+        return a.record.timeUs < b.record.timeUs;
+    });
+
+    time_t sec = header.timeUs / 1000000;
+    tm t;
+    localtime_r(&sec, &t);
+    char when[32];
+    strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", &t);
+    printf("# pid %d, signal %d, dumped %s, %zu records\n", header.pid, header.signo, when, entries.size());
+    for(const Entry& e : entries) {
+        sec = e.record.timeUs / 1000000;
+        localtime_r(&sec, &t);
+        strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", &t);
+        printf("%s.%06u %d %s%s\n", when, static_cast<unsigned>(e.record.timeUs % 1000000), e.record.tid,
+               LevelName(e.record.level), Format(e).c_str());
+    }
+    return 0;
+}